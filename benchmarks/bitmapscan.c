@@ -0,0 +1,187 @@
+/* Block bitmap search benchmark
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Times the search ext2fs does in a block group's bitmap when allocating
+   a block away from its goal (a run of eight free bits, else any free bit),
+   on bitmaps that are more and more full.  The byte and bit scanning the
+   allocator used to do is compared with the word-at-a-time search from
+   ext2fs/bitmap.c, using each of its word skipping routines.  */
+
+#include <error.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../ext2fs/bitmap.c"
+
+#define BITMAP_BYTES 4096
+#define BITMAP_BITS (BITMAP_BYTES * 8)
+
+/* The search as it was done before.  */
+
+static inline void *
+old_memscan (void *buf, unsigned char ch, size_t len)
+{
+  return memchr (buf, ch, len) ?: buf + len;
+}
+
+static unsigned long
+old_find_next_zero_bit (void *addr, unsigned long size, unsigned long offset)
+{
+  uint32_t *p = ((uint32_t *) addr) + (offset >> 5);
+  unsigned long result = offset & ~31UL;
+  uint32_t tmp;
+
+  if (offset >= size)
+    return size;
+  size -= result;
+  offset &= 31UL;
+  if (offset)
+    {
+      tmp = *(p++);
+      tmp |= ~0U >> (32-offset);
+      if (size < 32)
+	goto found_first;
+      if (~tmp)
+	goto found_middle;
+      size -= 32;
+      result += 32;
+    }
+  while (size & ~31UL)
+    {
+      if (~(tmp = *(p++)))
+	goto found_middle;
+      result += 32;
+      size -= 32;
+    }
+  if (!size)
+    return result;
+  tmp = *p;
+
+found_first:
+  tmp |= ~0U << size;
+  if (!~tmp)
+    return result + size;
+found_middle:
+  return result + ffs (~tmp) - 1;
+}
+
+static unsigned long
+old_search (unsigned char *bh)
+{
+  unsigned char *r = old_memscan (bh, 0, BITMAP_BITS >> 3);
+  unsigned long j = (r - bh) << 3;
+  if (j < BITMAP_BITS)
+    return j;
+  return old_find_next_zero_bit (bh, BITMAP_BITS, 0);
+}
+
+static unsigned long
+new_search (unsigned char *bh)
+{
+  unsigned long j = find_next_zero_run (bh, BITMAP_BITS, 0, 8);
+  if (j < BITMAP_BITS)
+    return j;
+  return find_first_zero_bit (bh, BITMAP_BITS);
+}
+
+/* Fill BH so that only a fraction FREE of its bits, scattered at random,
+   are zero.  If FREE is 0, leave only the very last bit free.  */
+static void
+fill_bitmap (unsigned char *bh, double free)
+{
+  int i;
+
+  memset (bh, 0xff, BITMAP_BYTES);
+  if (free == 0)
+    bh[BITMAP_BYTES - 1] = 0x7f;
+  else
+    for (i = 0; i < BITMAP_BITS; i++)
+      if (drand48 () < free)
+	bh[i >> 3] &= ~(1 << (i & 7));
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+run (const char *name, unsigned long (*search) (unsigned char *),
+     unsigned char *bh, int iterations, unsigned long expect)
+{
+  double start = now (), elapsed;
+  int i;
+
+  for (i = 0; i < iterations; i++)
+    if ((*search) (bh) != expect)
+      error (1, 0, "%s: wrong result", name);
+  elapsed = now () - start;
+
+  printf ("  %-8s %8.1f ns/search\n", name, elapsed * 1e9 / iterations);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const double free_fractions[] = { 0.01, 0.001, 0.0001, 0 };
+  unsigned long *words;
+  unsigned char *bh;
+  int iterations = argc > 1 ? atoi (argv[1]) : 100000;
+  int f;
+
+  words = malloc (BITMAP_BYTES);
+  if (! words)
+    error (1, 0, "Out of memory");
+  bh = (unsigned char *) words;
+  __builtin_cpu_init ();
+
+  for (f = 0; f < sizeof free_fractions / sizeof *free_fractions; f++)
+    {
+      unsigned long expect;
+
+      fill_bitmap (bh, free_fractions[f]);
+      expect = old_search (bh);
+      printf ("%.2f%% free, first free bit %lu:\n",
+	      free_fractions[f] * 100, expect);
+
+      run ("old", old_search, bh, iterations, expect);
+
+      scan_words = scan_words_generic;
+      run ("generic", new_search, bh, iterations, expect);
+#ifdef BITMAP_SCAN_SIMD
+      if (__builtin_cpu_supports ("sse2"))
+	{
+	  scan_words = scan_words_sse2;
+	  run ("sse2", new_search, bh, iterations, expect);
+	}
+      if (__builtin_cpu_supports ("avx2"))
+	{
+	  scan_words = scan_words_avx2;
+	  run ("avx2", new_search, bh, iterations, expect);
+	}
+#endif
+    }
+
+  return 0;
+}
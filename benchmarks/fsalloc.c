@@ -0,0 +1,171 @@
+/* Concurrent file creation and append benchmark
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Each of N threads creates files in its own directory below DIR and
+   appends to them, so that the filesystem has to allocate inodes and
+   blocks from several threads at once.  The aggregate rate of file
+   creation and of data written is printed at the end.  */
+
+#include <argp.h>
+#include <error.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static int nthreads = 4;
+static int nfiles = 1000;
+static size_t append_size = 4096;
+static int nappends = 4;
+static int keep;
+static char *target = ".";
+
+static const struct argp_option options[] =
+{
+  {"threads", 't', "N", 0, "Number of threads (default 4)"},
+  {"files", 'f', "N", 0, "Files created by each thread (default 1000)"},
+  {"size", 's', "BYTES", 0, "Size of each append (default 4096)"},
+  {"appends", 'a', "N", 0, "Appends to each file (default 4)"},
+  {"keep", 'k', 0, 0, "Don't remove the files afterwards"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 't': nthreads = atoi (arg); break;
+    case 'f': nfiles = atoi (arg); break;
+    case 's': append_size = strtoul (arg, 0, 0); break;
+    case 'a': nappends = atoi (arg); break;
+    case 'k': keep = 1; break;
+    case ARGP_KEY_ARG:
+      if (state->arg_num > 0)
+	argp_usage (state);
+      target = arg;
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+static const struct argp argp =
+{ options, parse_opt, "[DIR]",
+  "Create and append to files from several threads at once." };
+
+/* Barrier so that all threads start hammering at the same time.  */
+static pthread_barrier_t start;
+
+static void *
+worker (void *arg)
+{
+  int id = (int) (long) arg;
+  char dir[strlen (target) + 32];
+  char name[sizeof dir + 32];
+  char *buf;
+  int i, j;
+
+  buf = malloc (append_size);
+  if (! buf)
+    error (1, errno, "malloc");
+  memset (buf, 'a' + id % 26, append_size);
+
+  sprintf (dir, "%s/fsalloc.%d.%d", target, getpid (), id);
+  if (mkdir (dir, 0755) < 0)
+    error (1, errno, "%s", dir);
+
+  pthread_barrier_wait (&start);
+
+  for (i = 0; i < nfiles; i++)
+    {
+      int fd;
+
+      sprintf (name, "%s/%d", dir, i);
+      fd = open (name, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+      if (fd < 0)
+	error (1, errno, "%s", name);
+      for (j = 0; j < nappends; j++)
+	if (write (fd, buf, append_size) != append_size)
+	  error (1, errno, "%s", name);
+      close (fd);
+    }
+
+  pthread_barrier_wait (&start);
+
+  if (! keep)
+    {
+      for (i = 0; i < nfiles; i++)
+	{
+	  sprintf (name, "%s/%d", dir, i);
+	  unlink (name);
+	}
+      rmdir (dir);
+    }
+
+  free (buf);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  pthread_t *threads;
+  struct timeval t0, t1;
+  double secs, bytes;
+  int i, err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+  if (nthreads < 1 || nfiles < 1 || nappends < 0)
+    error (1, 0, "Bad arguments");
+
+  threads = calloc (nthreads, sizeof *threads);
+  if (! threads)
+    error (1, errno, "calloc");
+
+  /* The main thread takes part so it can time the run.  */
+  pthread_barrier_init (&start, 0, nthreads + 1);
+  for (i = 0; i < nthreads; i++)
+    {
+      err = pthread_create (&threads[i], 0, worker, (void *) (long) i);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+
+  pthread_barrier_wait (&start);
+  gettimeofday (&t0, 0);
+  pthread_barrier_wait (&start);
+  gettimeofday (&t1, 0);
+
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], 0);
+
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+  bytes = (double) nthreads * nfiles * nappends * append_size;
+  printf ("%d threads, %d files: %.3f s, %.1f files/s, %.2f MB/s\n",
+	  nthreads, nthreads * nfiles, secs,
+	  nthreads * nfiles / secs, bytes / secs / (1024 * 1024));
+
+  return 0;
+}
@@ -0,0 +1,206 @@
+/* Integer hash table benchmark
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* For a number of load factors, fill a struct hurd_ihash of a given
+   size up to exactly that load, and time insertions, lookups of keys
+   that are there and of keys that are not, and a steady stream of
+   removals and insertions as a server sees when ports or nodes come
+   and go.  The last one shows how much the table suffers from removed
+   elements; the size of the table is printed after it, as getting rid
+   of them may have enlarged it.  The keys are consecutive, like port
+   names and inode numbers, unless --random is given.  */
+
+#include <argp.h>
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <hurd/ihash.h>
+
+static int size_bits = 16;
+static long operations = 4000000;
+static int random_keys;
+static const unsigned int default_loads[] = { 32, 64, 96, 112, 120 };
+
+static const struct argp_option options[] =
+{
+  {"size", 's', "BITS", 0, "Size of the table is 2^BITS (default 16)"},
+  {"operations", 'n', "N", 0, "Lookups and changes per test (default 4000000)"},
+  {"random", 'r', 0, 0, "Use random keys instead of consecutive ones"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 's': size_bits = atoi (arg); break;
+    case 'n': operations = atol (arg); break;
+    case 'r': random_keys = 1; break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+static const struct argp argp =
+{ options, parse_opt, "[LOAD...]",
+  "Time hurd_ihash operations at several load factors, given in binary "
+  "percent (128 is a full table).  The default is 32 64 96 112 120." };
+
+/* The values stored in the table.  */
+struct elem
+{
+  hurd_ihash_locp_t locp;
+  hurd_ihash_key_t key;
+};
+
+static struct timeval t0;
+
+static void
+start (void)
+{
+  gettimeofday (&t0, 0);
+}
+
+/* Return millions of operations per second for N operations since
+   start was called.  */
+static double
+rate (long n)
+{
+  struct timeval t1;
+  gettimeofday (&t1, 0);
+  return n / ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_usec - t0.tv_usec));
+}
+
+/* A cheap generator, so that it does not dominate the lookups.  */
+static unsigned long
+next (unsigned long *state)
+{
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state >> 17;
+}
+
+static void
+run (unsigned int load)
+{
+  size_t size = (size_t) 1 << size_bits;
+  size_t n = size * load / 128;
+  /* Twice as many keys as fit, so that half of them are misses.  */
+  hurd_ihash_key_t *keys;
+  struct elem *elems;
+  struct hurd_ihash ht =
+    HURD_IHASH_INITIALIZER (offsetof (struct elem, locp));
+  unsigned long state = 1;
+  double insert, hit, miss, churn;
+  volatile void *sink;
+  size_t i;
+  long k;
+
+  keys = malloc (2 * n * sizeof *keys);
+  elems = malloc (2 * n * sizeof *elems);
+  if (! keys || ! elems)
+    error (1, errno, "malloc");
+  for (i = 0; i < 2 * n; i++)
+    keys[i] = random_keys ? next (&state) << 1 | 1 : i + 1;
+  for (i = 0; i < 2 * n; i++)
+    elems[i].key = keys[i];
+
+  hurd_ihash_set_max_load (&ht, load);
+
+  start ();
+  for (i = 0; i < n; i++)
+    if (hurd_ihash_add (&ht, keys[i], &elems[i]))
+      error (1, ENOMEM, "hurd_ihash_add");
+  insert = rate (n);
+  if (ht.size != size)
+    error (1, 0, "table has %zu instead of %zu locations", ht.size, size);
+
+  start ();
+  for (k = 0; k < operations; k++)
+    sink = hurd_ihash_find (&ht, keys[next (&state) % n]);
+  hit = rate (operations);
+
+  start ();
+  for (k = 0; k < operations; k++)
+    sink = hurd_ihash_find (&ht, keys[n + next (&state) % n]);
+  miss = rate (operations);
+  (void) sink;
+
+  /* Remove a random element and add one that is not there, keeping
+     the load the same.  Element I is in the table iff its locp is
+     set.  */
+  for (i = n; i < 2 * n; i++)
+    elems[i].locp = NULL;
+  start ();
+  for (k = 0; k < operations / 2; k++)
+    {
+      struct elem *out, *in;
+      do
+	out = &elems[next (&state) % (2 * n)];
+      while (! out->locp);
+      do
+	in = &elems[next (&state) % (2 * n)];
+      while (in->locp);
+
+      hurd_ihash_locp_remove (&ht, out->locp);
+      out->locp = NULL;
+      if (hurd_ihash_add (&ht, in->key, in))
+	error (1, ENOMEM, "hurd_ihash_add");
+    }
+  churn = rate (operations);
+
+  printf ("%4u %7.1f%% %10.2f %10.2f %10.2f %10.2f %10zu\n",
+	  load, load / 1.28, insert, hit, miss, churn, ht.size);
+
+  hurd_ihash_destroy (&ht);
+  free (keys);
+  free (elems);
+}
+
+int
+main (int argc, char **argv)
+{
+  int first, i;
+
+  argp_parse (&argp, argc, argv, 0, &first, 0);
+  if (size_bits < 7 || size_bits > 28 || operations < 2)
+    error (1, 0, "Bad arguments");
+
+  printf ("%d locations, %s keys, millions of operations per second\n",
+	  1 << size_bits, random_keys ? "random" : "consecutive");
+  printf ("load        %%     insert     lookup       miss  rm+insert"
+	  "       size\n");
+
+  if (first < argc)
+    for (i = first; i < argc; i++)
+      {
+	int load = atoi (argv[i]);
+	if (load < 1 || load > 128)
+	  error (1, 0, "%s: load must be between 1 and 128", argv[i]);
+	run (load);
+      }
+  else
+    for (i = 0; i < sizeof default_loads / sizeof default_loads[0]; i++)
+      run (default_loads[i]);
+
+  return 0;
+}
@@ -0,0 +1,240 @@
+/* Interrupting a saturated libports server
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Serve a port with ports_manage_port_operations_multithread and
+   ports_max_threads set, as a server started with --max-threads does.
+   Client threads send it requests that wait until they are interrupted:
+   enough of them to take all the slots, and some more that the server
+   has to hold on to.  Then interrupt_operation is sent to the port, and
+   every request must come back interrupted, the held ones too.  The
+   time the interrupt took is printed, with the thread statistics of
+   the server.  */
+
+#include <argp.h>
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <hurd.h>
+#include <hurd/interrupt.h>
+#include <hurd/ports.h>
+
+#include "../libports/interrupt_S.h"
+
+/* The id of the requests that wait to be interrupted; they carry
+   nothing but a reply port.  */
+#define WAIT_ID 424200
+
+/* How long to wait for the server, in seconds, before deciding it is
+   deadlocked.  */
+#define DEADLINE 30
+
+static unsigned int max_threads = 4;
+static int extra = 8;
+
+static const struct argp_option options[] =
+{
+  {"max-threads", 't', "N", 0, "Serve at most N requests at once"
+   " (default 4)"},
+  {"extra", 'e', "N", 0, "Requests to send beyond that (default 8)"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 't': max_threads = atoi (arg); break;
+    case 'e': extra = atoi (arg); break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+static const struct argp argp =
+{ options, parse_opt, 0,
+  "Check that a server with all its request slots busy can still be"
+  " interrupted." };
+
+static struct port_bucket *bucket;
+static mach_port_t server;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t never = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int waiting;
+
+/* Serve a WAIT_ID request: wait until interrupted.  */
+static error_t
+wait_for_interrupt (void)
+{
+  pthread_mutex_lock (&lock);
+  waiting++;
+  pthread_cond_broadcast (&changed);
+  while (! pthread_hurd_cond_wait_np (&never, &lock))
+    ;
+  waiting--;
+  pthread_mutex_unlock (&lock);
+  return EINTR;
+}
+
+static int
+demuxer (mach_msg_header_t *inp, mach_msg_header_t *outp)
+{
+  mig_routine_t routine;
+
+  if ((routine = ports_interrupt_server_routine (inp)))
+    {
+      (*routine) (inp, outp);
+      return TRUE;
+    }
+  if (inp->msgh_id == WAIT_ID)
+    {
+      ((mig_reply_header_t *) outp)->RetCode = wait_for_interrupt ();
+      return TRUE;
+    }
+  return FALSE;
+}
+
+static void *
+serve (void *arg)
+{
+  ports_manage_port_operations_multithread (bucket, demuxer, 0, 0, 0);
+  return 0;
+}
+
+/* Send a WAIT_ID request to SERVER and return the error it gets.  */
+static void *
+client (void *arg)
+{
+  mach_port_t reply_port = mach_reply_port ();
+  union
+  {
+    mach_msg_header_t request;
+    mig_reply_header_t reply;
+  } msg;
+  error_t err;
+
+  msg.request.msgh_bits = MACH_MSGH_BITS (MACH_MSG_TYPE_COPY_SEND,
+					  MACH_MSG_TYPE_MAKE_SEND_ONCE);
+  msg.request.msgh_size = sizeof msg.request;
+  msg.request.msgh_remote_port = server;
+  msg.request.msgh_local_port = reply_port;
+  msg.request.msgh_seqno = 0;
+  msg.request.msgh_id = WAIT_ID;
+
+  err = mach_msg (&msg.request, MACH_SEND_MSG | MACH_RCV_MSG,
+		  sizeof msg.request, sizeof msg, reply_port,
+		  MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+  if (! err)
+    err = msg.reply.RetCode;
+
+  mach_port_destroy (mach_task_self (), reply_port);
+  return (void *) (long) err;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct port_class *class;
+  struct port_info *pi;
+  struct ports_thread_stats before, stats;
+  pthread_t thread, *clients;
+  struct timeval t0, t1;
+  int i, nclients;
+  void *ret;
+  error_t err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+  if (max_threads < 1 || extra < 0)
+    error (1, 0, "Bad arguments");
+  nclients = max_threads + extra;
+
+  bucket = ports_create_bucket ();
+  class = ports_create_class (0, 0);
+  if (! bucket || ! class)
+    error (1, errno, "Creating a port");
+  err = ports_create_port (class, bucket, sizeof *pi, &pi);
+  if (err)
+    error (1, err, "Creating a port");
+  server = ports_get_send_right (pi);
+
+  ports_max_threads = max_threads;
+  ports_thread_stats (&before);
+  err = pthread_create (&thread, 0, serve, 0);
+  if (err)
+    error (1, err, "pthread_create");
+  pthread_detach (thread);
+
+  clients = calloc (nclients, sizeof *clients);
+  if (! clients)
+    error (1, errno, "calloc");
+  for (i = 0; i < nclients; i++)
+    {
+      err = pthread_create (&clients[i], 0, client, 0);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+
+  /* Wait for the slots to be taken and the other requests to be held.
+     Should the server deadlock, the alarm kills us.  */
+  alarm (DEADLINE);
+  pthread_mutex_lock (&lock);
+  while (waiting < max_threads)
+    pthread_cond_wait (&changed, &lock);
+  pthread_mutex_unlock (&lock);
+  do
+    {
+      usleep (10000);
+      ports_thread_stats (&stats);
+    }
+  while (stats.saturated - before.saturated < extra);
+  pthread_mutex_lock (&lock);
+  if (waiting != max_threads)
+    error (1, 0, "%d requests served at once, not %u", waiting, max_threads);
+  pthread_mutex_unlock (&lock);
+
+  gettimeofday (&t0, 0);
+  err = interrupt_operation (server, 0);
+  if (err)
+    error (1, err, "interrupt_operation");
+  gettimeofday (&t1, 0);
+
+  for (i = 0; i < nclients; i++)
+    {
+      pthread_join (clients[i], &ret);
+      if ((error_t) (long) ret != EINTR)
+	error (1, (error_t) (long) ret, "Request %d was not interrupted", i);
+    }
+  alarm (0);
+
+  ports_thread_stats (&stats);
+  printf ("%u slots, %d requests held: interrupted in %ld us;"
+	  " %u threads at most, %lu held\n",
+	  max_threads, extra,
+	  (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec),
+	  stats.peak, stats.saturated - before.saturated);
+
+  return 0;
+}
@@ -0,0 +1,207 @@
+/* Multithreaded slab allocation benchmark
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Each of N threads allocates a batch of objects from a shared slab
+   space and frees them again, over and over.  A batch of one is the
+   allocation and release of a port or node by a server thread handling
+   one request; larger batches make the threads go through the depot
+   and the slabs.  Some of the objects are freed by another thread
+   than the one that allocated them.  The aggregate rate of allocations
+   is printed at the end, and the slab space is checked to be empty.  */
+
+#include <argp.h>
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <hurd/slab.h>
+
+static int nthreads = 4;
+static long iterations = 1000000;
+static int batch = 1;
+static size_t object_size = 128;
+static int handoff;
+
+static const struct argp_option options[] =
+{
+  {"threads", 't', "N", 0, "Number of threads (default 4)"},
+  {"iterations", 'i', "N", 0, "Allocations by each thread (default 1000000)"},
+  {"batch", 'b', "N", 0, "Objects allocated before they are freed (default 1)"},
+  {"size", 's', "BYTES", 0, "Size of the objects (default 128)"},
+  {"handoff", 'h', 0, 0,
+   "Have each thread free half of its objects in the next thread"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 't': nthreads = atoi (arg); break;
+    case 'i': iterations = atol (arg); break;
+    case 'b': batch = atoi (arg); break;
+    case 's': object_size = strtoul (arg, 0, 0); break;
+    case 'h': handoff = 1; break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+static const struct argp argp =
+{ options, parse_opt, 0,
+  "Allocate and free slab objects from several threads at once." };
+
+static hurd_slab_space_t space;
+
+/* Barrier so that all threads start hammering at the same time.  */
+static pthread_barrier_t start;
+
+/* With --handoff, a thread leaves half of each batch here for the
+   next thread to free.  */
+struct mailbox
+{
+  pthread_mutex_t lock;
+  void **objs;
+  int count, size;
+};
+static struct mailbox *mailboxes;
+
+static void
+post (struct mailbox *mb, void *obj)
+{
+  pthread_mutex_lock (&mb->lock);
+  if (mb->count == mb->size)
+    {
+      mb->size = mb->size * 2 ?: 64;
+      mb->objs = realloc (mb->objs, mb->size * sizeof *mb->objs);
+      if (! mb->objs)
+	error (1, errno, "realloc");
+    }
+  mb->objs[mb->count++] = obj;
+  pthread_mutex_unlock (&mb->lock);
+}
+
+static void
+collect (struct mailbox *mb)
+{
+  pthread_mutex_lock (&mb->lock);
+  while (mb->count > 0)
+    hurd_slab_dealloc (space, mb->objs[--mb->count]);
+  pthread_mutex_unlock (&mb->lock);
+}
+
+static void *
+worker (void *arg)
+{
+  int id = (int) (long) arg;
+  void **objs = calloc (batch, sizeof *objs);
+  long n;
+  int i;
+
+  if (! objs)
+    error (1, errno, "calloc");
+
+  pthread_barrier_wait (&start);
+
+  for (n = 0; n < iterations; n += batch)
+    {
+      for (i = 0; i < batch; i++)
+	{
+	  error_t err = hurd_slab_alloc (space, &objs[i]);
+	  if (err)
+	    error (1, err, "hurd_slab_alloc");
+	  /* Touch the object, as a real user would.  */
+	  memset (objs[i], id, object_size);
+	}
+      for (i = 0; i < batch; i++)
+	if (handoff && i % 2)
+	  post (&mailboxes[(id + 1) % nthreads], objs[i]);
+	else
+	  hurd_slab_dealloc (space, objs[i]);
+      if (handoff)
+	collect (&mailboxes[id]);
+    }
+
+  pthread_barrier_wait (&start);
+  if (handoff)
+    collect (&mailboxes[id]);
+
+  free (objs);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  pthread_t *threads;
+  struct timeval t0, t1;
+  double secs;
+  int i, err;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+  if (nthreads < 1 || iterations < 1 || batch < 1 || object_size < 1)
+    error (1, 0, "Bad arguments");
+
+  err = hurd_slab_create (object_size, 0, NULL, NULL, NULL, NULL, NULL,
+			  &space);
+  if (err)
+    error (1, err, "hurd_slab_create");
+
+  threads = calloc (nthreads, sizeof *threads);
+  mailboxes = calloc (nthreads, sizeof *mailboxes);
+  if (! threads || ! mailboxes)
+    error (1, errno, "calloc");
+  for (i = 0; i < nthreads; i++)
+    pthread_mutex_init (&mailboxes[i].lock, 0);
+
+  /* The main thread takes part so it can time the run.  */
+  pthread_barrier_init (&start, 0, nthreads + 1);
+  for (i = 0; i < nthreads; i++)
+    {
+      err = pthread_create (&threads[i], 0, worker, (void *) (long) i);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+
+  pthread_barrier_wait (&start);
+  gettimeofday (&t0, 0);
+  pthread_barrier_wait (&start);
+  gettimeofday (&t1, 0);
+
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], 0);
+
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+  printf ("%d threads, batch %d: %.3f s, %.2f M allocations/s\n",
+	  nthreads, batch, secs, nthreads * iterations / secs / 1e6);
+
+  err = hurd_slab_reclaim (space);
+  if (err)
+    error (1, err, "hurd_slab_reclaim");
+  err = hurd_slab_free (space);
+  if (err)
+    error (1, err, "hurd_slab_free");
+
+  return 0;
+}
@@ -0,0 +1,242 @@
+/* pfinet timer benchmark
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Simulate the timers of a number of busy TCP connections, as pfinet's
+   timer emulation sees them: each connection has a retransmit and a
+   delayed-ACK timer, and every packet rearms both of them.  Packets
+   arrive at a steady rate over simulated jiffies, and the timers that
+   expire are run at each jiffy; an expiring retransmit timer backs off
+   and rearms itself.  This is timed for the timing wheel pfinet uses,
+   and for the sorted list it used before if --list is given.  */
+
+#include <argp.h>
+#include <error.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "timer-wheel.h"
+
+static long connections = 50000;
+static long packets = 2000000;
+static long per_jiffy = 1000;
+static int use_list;
+
+static const struct argp_option options[] =
+{
+  {"connections", 'c', "N", 0, "Number of connections (default 50000)"},
+  {"packets", 'n', "N", 0, "Number of packets (default 2000000)"},
+  {"rate", 'r', "N", 0, "Packets per jiffy (default 1000)"},
+  {"list", 'l', 0, 0, "Use a sorted list instead of the timing wheel"},
+  {0}
+};
+
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+    {
+    case 'c': connections = atol (arg); break;
+    case 'n': packets = atol (arg); break;
+    case 'r': per_jiffy = atol (arg); break;
+    case 'l': use_list = 1; break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+static const struct argp argp =
+{ options, parse_opt, 0,
+  "Time rearming and running the timers of many TCP connections." };
+
+/* The sorted list of timers that pfinet used before, for comparison.  */
+
+static struct timer_list *timers;
+
+static void
+list_add_timer (struct timer_list *timer)
+{
+  struct timer_list **tp;
+
+  for (tp = &timers; *tp; tp = &(*tp)->next)
+    if ((*tp)->expires > timer->expires)
+      break;
+
+  timer->next = *tp;
+  if (timer->next)
+    timer->next->prev = &timer->next;
+  timer->prev = tp;
+  *tp = timer;
+}
+
+static void
+list_run (unsigned long now)
+{
+  while (timers && timers->expires <= now)
+    {
+      struct timer_list *tp = timers;
+
+      timers = tp->next;
+      if (timers)
+	timers->prev = &timers;
+      tp->next = 0;
+      tp->prev = 0;
+
+      (*tp->function) (tp->data);
+    }
+}
+
+static void
+list_del_timer (struct timer_list *timer)
+{
+  if (timer->prev)
+    {
+      *timer->prev = timer->next;
+      if (timer->next)
+	timer->next->prev = timer->prev;
+      timer->next = 0;
+      timer->prev = 0;
+    }
+}
+
+static void
+arm (struct timer_list *timer)
+{
+  if (use_list)
+    list_add_timer (timer);
+  else
+    timer_wheel_add (timer);
+}
+
+static void
+rearm (struct timer_list *timer, unsigned long expires)
+{
+  if (use_list)
+    list_del_timer (timer);
+  else
+    timer_wheel_del (timer);
+  timer->expires = expires;
+  arm (timer);
+}
+
+struct conn
+{
+  struct timer_list retransmit;
+  struct timer_list delack;
+  unsigned int rto;
+};
+
+static unsigned long now;
+static long retransmits, delacks;
+
+static void
+retransmit_timer (unsigned long data)
+{
+  struct conn *conn = (struct conn *) data;
+
+  retransmits++;
+  if (conn->rto < 12000)
+    conn->rto *= 2;
+  rearm (&conn->retransmit, now + conn->rto);
+}
+
+static void
+delack_timer (unsigned long data)
+{
+  delacks++;
+}
+
+/* A cheap generator, so that it does not dominate the timers.  */
+static unsigned long
+next (unsigned long *state)
+{
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state >> 17;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct conn *conns;
+  struct timeval t0, t1;
+  unsigned long state = 1;
+  double secs;
+  long i;
+
+  argp_parse (&argp, argc, argv, 0, 0, 0);
+  if (connections < 1 || packets < 1 || per_jiffy < 1)
+    error (1, 0, "Bad arguments");
+
+  conns = calloc (connections, sizeof *conns);
+  if (! conns)
+    error (1, errno, "calloc");
+
+  /* Every connection has its retransmit timer armed between 2 and 3
+     seconds from now, and its delayed-ACK timer idle.  */
+  for (i = 0; i < connections; i++)
+    {
+      struct conn *conn = &conns[i];
+
+      conn->rto = 300;
+      conn->retransmit.function = retransmit_timer;
+      conn->retransmit.data = (unsigned long) conn;
+      conn->retransmit.expires = now + 200 + next (&state) % 100;
+      arm (&conn->retransmit);
+      conn->delack.function = delack_timer;
+      conn->delack.data = (unsigned long) conn;
+    }
+
+  gettimeofday (&t0, 0);
+  for (i = 0; i < packets; i++)
+    {
+      struct conn *conn = &conns[next (&state) % connections];
+
+      /* An ACK for new data: the retransmit timer starts over, and data
+	 that came with it is acknowledged after a while.  */
+      conn->rto = 20 + next (&state) % 280;
+      rearm (&conn->retransmit, now + conn->rto);
+      if (! conn->delack.prev)
+	{
+	  conn->delack.expires = now + 4 + next (&state) % 16;
+	  arm (&conn->delack);
+	}
+
+      if ((i + 1) % per_jiffy == 0)
+	{
+	  now++;
+	  if (use_list)
+	    list_run (now);
+	  else
+	    timer_wheel_run (now);
+	}
+    }
+  gettimeofday (&t1, 0);
+
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+  printf ("%s, %ld connections, %ld packets over %lu jiffies\n",
+	  use_list ? "sorted list" : "timing wheel", connections, packets, now);
+  printf ("%ld retransmits, %ld delayed ACKs\n", retransmits, delacks);
+  printf ("%.3f seconds, %.2f million packets per second\n",
+	  secs, packets / secs / 1e6);
+
+  free (conns);
+  return 0;
+}
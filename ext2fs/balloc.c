@@ -44,14 +44,6 @@
 #include "ext2fs.h"
 #include "bitmap.c"
 
-/* Returns a pointer to the first occurrence of CH in the buffer BUF of len
-   LEN, or BUF + LEN if CH doesn't occur.  */
-static inline void *
-memscan (void *buf, unsigned char ch, size_t len)
-{
-  return memchr (buf, ch, len) ?: buf + len;
-}
-
 #define in_range(b, first, len) ((b) >= (first) && (b) <= (first) + (len) - 1)
 
 void
@@ -60,17 +52,14 @@ ext2_free_blocks (block_t block, unsigned long count)
   unsigned char *bh;
   unsigned long block_group;
   unsigned long bit;
-  unsigned long i;
+  unsigned long i, freed;
   struct ext2_group_desc *gdp;
 
-  pthread_spin_lock (&global_lock);
-
   if (block < sblock->s_first_data_block ||
       (block + count) > sblock->s_blocks_count)
     {
       ext2_error ("freeing blocks not in datazone - "
 		  "block = %u, count = %lu", block, count);
-      pthread_spin_unlock (&global_lock);
       return;
     }
 
@@ -92,6 +81,7 @@ ext2_free_blocks (block_t block, unsigned long count)
 		      block, count);
 	}
       gdp = group_desc (block_group);
+      pthread_spin_lock (group_lock (block_group));
       bh = disk_cache_block_ref (gdp->bg_block_bitmap);
 
       if (in_range (gdp->bg_block_bitmap, block, gcount) ||
@@ -102,29 +92,31 @@ ext2_free_blocks (block_t block, unsigned long count)
 		    "block = %u, count = %lu",
 		    block, count);
 
+      freed = 0;
       for (i = 0; i < gcount; i++)
 	{
 	  if (!clear_bit (bit + i, bh))
 	    ext2_warning ("bit already cleared for block %lu", block + i);
 	  else
-	    {
-	      gdp->bg_free_blocks_count++;
-	      sblock->s_free_blocks_count++;
-	    }
+	    freed++;
 	}
+      gdp->bg_free_blocks_count += freed;
 
       record_global_poke (bh);
       disk_cache_block_ref_ptr (gdp);
       record_global_poke (gdp);
 
+      pthread_spin_unlock (group_lock (block_group));
+
+      __atomic_add_fetch (&sblock->s_free_blocks_count, freed,
+			  __ATOMIC_RELAXED);
+
       block += gcount;
       count -= gcount;
     } while (count > 0);
 
   sblock_dirty = 1;
 
-  pthread_spin_unlock (&global_lock);
-
   alloc_sync (0);
 }
 
@@ -132,36 +124,52 @@ ext2_free_blocks (block_t block, unsigned long count)
  * ext2_new_block uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within
- * each block group the search first looks for an entire free byte in the block
- * bitmap, and then for any free bit if that fails.
+ * each block group the search first looks for a run of free blocks as long
+ * as the preallocation wanted (but at least eight), then for a run of eight,
+ * and then for any free bit if that fails.
+ *
+ * Only the lock of the block group being searched is held, so allocations
+ * in different groups proceed in parallel.  The free block counts of the
+ * other groups are only used as hints when choosing where to look.
+ *
+ * Unless USE_RESERVE is set, the blocks kept back for delayed allocation
+ * (see ext2_delalloc_reserve) are left alone, so that the write-back of
+ * data already accepted into the page cache can't run out of space.
  */
 block_t
 ext2_new_block (block_t goal,
 		block_t prealloc_goal,
-		block_t *prealloc_count, block_t *prealloc_block)
+		block_t *prealloc_count, block_t *prealloc_block,
+		int use_reserve)
 {
   unsigned char *bh = NULL;
-  unsigned char *p, *r;
   int i, j, k, tmp;
-  unsigned long lmap;
+  block_t run = prealloc_goal > 8 ? prealloc_goal : 8;
   struct ext2_group_desc *gdp;
 
 #ifdef EXT2FS_DEBUG
   static int goal_hits = 0, goal_attempts = 0;
 #endif
 
-  pthread_spin_lock (&global_lock);
-
 #ifdef XXX /* Auth check to use reserved blocks  */
   if (sblock->s_free_blocks_count <= sblock->s_r_blocks_count &&
       (!fsuser () && (sb->u.ext2_sb.s_resuid != current->fsuid) &&
        (sb->u.ext2_sb.s_resgid == 0 ||
 	!in_group_p (sb->u.ext2_sb.s_resgid))))
+    return 0;
+#endif
+
+  if (! use_reserve)
     {
-      pthread_spin_unlock (&global_lock);
-      return 0;
+      block_t free = __atomic_load_n (&sblock->s_free_blocks_count,
+				      __ATOMIC_RELAXED);
+      block_t reserve = ext2_delalloc_reserve ();
+
+      if (free <= reserve)
+	return 0;
+      if (prealloc_goal > free - reserve - 1)
+	prealloc_goal = free - reserve - 1;
     }
-#endif
 
   ext2_debug ("goal=%u", goal);
 
@@ -174,6 +182,7 @@ repeat:
     goal = sblock->s_first_data_block;
   i = (goal - sblock->s_first_data_block) / sblock->s_blocks_per_group;
   gdp = group_desc (i);
+  pthread_spin_lock (group_lock (i));
   if (gdp->bg_free_blocks_count > 0)
     {
       j = ((goal - sblock->s_first_data_block) % sblock->s_blocks_per_group);
@@ -199,24 +208,13 @@ repeat:
 	     * The goal was occupied; search forward for a free
 	     * block within the next 32 blocks
 	   */
-	  if ((j & 31) == 31)
-	    lmap = 0;
-	  else
-	    lmap = ((((unsigned long *) bh)[j >> 5]) >>
-		    ((j & 31) + 1));
-	  if (j < sblock->s_blocks_per_group - 32)
-	    lmap |= (((unsigned long *) bh)[(j >> 5) + 1]) <<
-	      (31 - (j & 31));
-	  else
-	    lmap |= 0xffffffff << (31 - (j & 31));
-	  if (lmap != 0xffffffffl)
+	  tmp = j + 33 < sblock->s_blocks_per_group
+	    ? j + 33 : sblock->s_blocks_per_group;
+	  k = find_next_zero_bit (bh, tmp, j + 1);
+	  if (k < tmp)
 	    {
-	      k = ffz (lmap) + 1;
-	      if ((j + k) < sblock->s_blocks_per_group)
-		{
-		  j += k;
-		  goto got_block;
-		}
+	      j = k;
+	      goto got_block;
 	    }
 	}
 
@@ -225,23 +223,21 @@ repeat:
       /*
        * There has been no free block found in the near vicinity
        * of the goal: do a search forward through the block groups,
-       * searching in each group first for an entire free byte in
-       * the bitmap and then for any free bit.
+       * searching in each group first for a run of RUN free bits
+       * in the bitmap and then for any free bit.
        *
        * Search first in the remainder of the current group; then,
        * cyclicly search through the rest of the groups.
        */
-      p = bh + (j >> 3);
-      r = memscan (p, 0, (sblock->s_blocks_per_group - j + 7) >> 3);
-      k = (r - bh) << 3;
+      k = find_next_zero_run (bh, sblock->s_blocks_per_group, j, run);
+      if (k >= sblock->s_blocks_per_group && run > 8)
+	k = find_next_zero_run (bh, sblock->s_blocks_per_group, j, 8);
       if (k < sblock->s_blocks_per_group)
 	{
 	  j = k;
 	  goto search_back;
 	}
-      k = find_next_zero_bit ((unsigned long *) bh,
-			      sblock->s_blocks_per_group,
-			      j);
+      k = find_next_zero_bit (bh, sblock->s_blocks_per_group, j);
       if (k < sblock->s_blocks_per_group)
 	{
 	  j = k;
@@ -251,6 +247,7 @@ repeat:
       disk_cache_block_deref (bh);
       bh = NULL;
     }
+  pthread_spin_unlock (group_lock (i));
 
   ext2_debug ("bit not found in block group %d", i);
 
@@ -264,36 +261,37 @@ repeat:
       if (i >= groups_count)
 	i = 0;
       gdp = group_desc (i);
+      if (gdp->bg_free_blocks_count == 0)
+	continue;
+      pthread_spin_lock (group_lock (i));
       if (gdp->bg_free_blocks_count > 0)
 	break;
+      pthread_spin_unlock (group_lock (i));
     }
   if (k >= groups_count)
-    {
-      pthread_spin_unlock (&global_lock);
-      return 0;
-    }
+    return 0;
   assert (bh == NULL);
   bh = disk_cache_block_ref (gdp->bg_block_bitmap);
-  r = memscan (bh, 0, sblock->s_blocks_per_group >> 3);
-  j = (r - bh) << 3;
+  j = find_next_zero_run (bh, sblock->s_blocks_per_group, 0, run);
+  if (j >= sblock->s_blocks_per_group && run > 8)
+    j = find_next_zero_run (bh, sblock->s_blocks_per_group, 0, 8);
   if (j < sblock->s_blocks_per_group)
     goto search_back;
   else
-    j = find_first_zero_bit ((unsigned long *) bh,
-			     sblock->s_blocks_per_group);
+    j = find_first_zero_bit (bh, sblock->s_blocks_per_group);
   if (j >= sblock->s_blocks_per_group)
     {
       disk_cache_block_deref (bh);
       bh = NULL;
       ext2_error ("free blocks count corrupted for block group %d", i);
-      pthread_spin_unlock (&global_lock);
+      pthread_spin_unlock (group_lock (i));
       return 0;
     }
 
 search_back:
   assert (bh != NULL);
   /*
-     * We have succeeded in finding a free byte in the block
+     * We have succeeded in finding a run of free bits in the block
      * bitmap.  Now search backwards up to 7 bits to find the
      * start of this group of free blocks.
    */
@@ -316,6 +314,7 @@ got_block:
       ext2_warning ("bit already set for block %d", j);
       disk_cache_block_deref (bh);
       bh = NULL;
+      pthread_spin_unlock (group_lock (i));
       goto repeat;
     }
 
@@ -337,14 +336,15 @@ got_block:
 #ifdef EXT2_PREALLOCATE
   if (prealloc_goal)
     {
-      *prealloc_count = 0;
+      /* Take as many of the free blocks following J as wanted.  */
+      k = j + prealloc_goal < sblock->s_blocks_per_group
+	? j + prealloc_goal : sblock->s_blocks_per_group;
+      k = find_next_set_bit (bh, k, j + 1);
+      *prealloc_count = k - (j + 1);
       *prealloc_block = tmp + 1;
-      for (k = 1;
-	   k < prealloc_goal && (j + k) < sblock->s_blocks_per_group; k++)
+      for (k = 1; k <= *prealloc_count; k++)
 	{
-	  if (set_bit (j + k, bh))
-	    break;
-	  (*prealloc_count)++;
+	  set_bit (j + k, bh);
 
 	  /* (See comment before the clear_bit above) */
 	  if (modified_global_blocks)
@@ -355,7 +355,8 @@ got_block:
 	    }
 	}
       gdp->bg_free_blocks_count -= *prealloc_count;
-      sblock->s_free_blocks_count -= *prealloc_count;
+      __atomic_sub_fetch (&sblock->s_free_blocks_count, *prealloc_count,
+			  __ATOMIC_RELAXED);
       ext2_debug ("preallocated a further %u bits", *prealloc_count);
     }
 #endif
@@ -379,12 +380,12 @@ got_block:
   disk_cache_block_ref_ptr (gdp);
   record_global_poke (gdp);
 
-  sblock->s_free_blocks_count--;
+  __atomic_sub_fetch (&sblock->s_free_blocks_count, 1, __ATOMIC_RELAXED);
   sblock_dirty = 1;
 
  sync_out:
   assert (bh == NULL);
-  pthread_spin_unlock (&global_lock);
+  pthread_spin_unlock (group_lock (i));
   alloc_sync (0);
 
   return j;
@@ -398,8 +399,6 @@ ext2_count_free_blocks ()
   struct ext2_group_desc *gdp;
   int i;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -407,17 +406,18 @@ ext2_count_free_blocks ()
     {
       void *bh;
       gdp = group_desc (i);
+      pthread_spin_lock (group_lock (i));
       desc_count += gdp->bg_free_blocks_count;
       bh = disk_cache_block_ref (gdp->bg_block_bitmap);
       x = count_free (bh, block_size);
       disk_cache_block_deref (bh);
+      pthread_spin_unlock (group_lock (i));
       printf ("group %d: stored = %d, counted = %lu",
 	      i, gdp->bg_free_blocks_count, x);
       bitmap_count += x;
     }
   printf ("ext2_count_free_blocks: stored = %u, computed = %lu, %lu",
 	  sblock->s_free_blocks_count, desc_count, bitmap_count);
-  pthread_spin_unlock (&global_lock);
   return bitmap_count;
 #else
   return sblock->s_free_blocks_count;
@@ -440,8 +440,6 @@ ext2_check_blocks_bitmap ()
   struct ext2_group_desc *gdp;
   int i, j;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -470,6 +468,7 @@ ext2_check_blocks_bitmap ()
 	}
 
       gdp = group_desc (i);
+      pthread_spin_lock (group_lock (i));
       desc_count += gdp->bg_free_blocks_count;
       bh = disk_cache_block_ref (gdp->bg_block_bitmap);
 
@@ -502,11 +501,13 @@ ext2_check_blocks_bitmap ()
 	ext2_error ("wrong free blocks count for group %d,"
 		    " stored = %d, counted = %lu",
 		    i, gdp->bg_free_blocks_count, x);
+      pthread_spin_unlock (group_lock (i));
       bitmap_count += x;
     }
+  /* Without a global lock, this is only meaningful if nothing is being
+     allocated or freed concurrently.  */
   if (sblock->s_free_blocks_count != bitmap_count)
     ext2_error ("wrong free blocks count in super block,"
 		" stored = %lu, counted = %lu",
 		(unsigned long) sblock->s_free_blocks_count, bitmap_count);
-  pthread_spin_unlock (&global_lock);
 }
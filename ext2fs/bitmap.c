@@ -18,7 +18,13 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
-#define ffz(word)	(ffs (~(unsigned int) (word)) - 1)
+#include <stddef.h>
+#include <limits.h>
+
+#if defined (__i386__) || defined (__x86_64__)
+#include <immintrin.h>
+#define BITMAP_SCAN_SIMD 1
+#endif
 
 /*
  *  linux/fs/ext2/bitmap.c (&c)
@@ -29,80 +35,267 @@
  * Universite Pierre et Marie Curie (Paris VI)
  */
 
-static int nibblemap[] = {4, 3, 3, 2, 3, 2, 2, 1, 3, 2, 2, 1, 2, 1, 1, 0};
-
+/* Returns the number of zero bits in the first NUMCHARS bytes of MAP.  */
 static inline
 unsigned long count_free (unsigned char *map, unsigned int numchars)
 {
-	unsigned int i;
-	unsigned long sum = 0;
-
-	if (!map)
-		return (0);
-	for (i = 0; i < numchars; i++)
-		sum += nibblemap[map[i] & 0xf] +
-			nibblemap[(map[i] >> 4) & 0xf];
-	return (sum);
+  unsigned int i;
+  unsigned long used = 0;
+
+  if (!map)
+    return 0;
+  for (i = 0; i + sizeof (unsigned long) <= numchars; i += sizeof (unsigned long))
+    used += __builtin_popcountl (*(unsigned long *) (map + i));
+  for (; i < numchars; i++)
+    used += __builtin_popcount (map[i]);
+  return numchars * CHAR_BIT - used;
 }
-
+
 /* ---------------------------------------------------------------- */
 
-/*
- * Copyright 1994, David S. Miller (davem@caip.rutgers.edu).
- */
+/* Bitmaps are searched a word at a time.  Long stretches of words that are
+   all ones (a full part of the disk) or all zeros (an empty one) are the
+   common case on nearly full and on fresh filesystems respectively, so the
+   skipping of such stretches is done by a separate routine, which uses
+   vector instructions when the processor has them.  */
 
-/* find_next_zero_bit() finds the first zero bit in a bit string of length
- * 'size' bits, starting the search at bit 'offset'. This is largely based
- * on Linus's ALPHA routines, which are pretty portable BTW.
- */
+#define BITS_PER_WORD (sizeof (unsigned long) * CHAR_BIT)
+
+/* A word with the top bit of each byte set.  */
+#define BYTE_TOP_BITS (~0UL / 0xff * 0x80)
+
+/* Returns the index of the first of the NWORDS words W at P for which
+   (W ^ FILL) & MASK is non-zero, or NWORDS if there is none.  FILL and
+   MASK must be the same in every byte.  */
+static size_t
+scan_words_generic (const unsigned long *p, size_t nwords,
+		    unsigned long fill, unsigned long mask)
+{
+  size_t i;
+  for (i = 0; i < nwords; i++)
+    if ((p[i] ^ fill) & mask)
+      break;
+  return i;
+}
+
+#ifdef BITMAP_SCAN_SIMD
+__attribute__ ((target ("sse2")))
+static size_t
+scan_words_sse2 (const unsigned long *p, size_t nwords,
+		 unsigned long fill, unsigned long mask)
+{
+  const size_t step = sizeof (__m128i) / sizeof *p;
+  const __m128i f = _mm_set1_epi8 ((char) fill);
+  const __m128i m = _mm_set1_epi8 ((char) mask);
+  const __m128i zero = _mm_setzero_si128 ();
+  size_t i;
+
+  /* Look at four vectors at a time while nothing is found.  */
+  for (i = 0; i + 4 * step <= nwords; i += 4 * step)
+    {
+      __m128i v0 = _mm_loadu_si128 ((const __m128i *) (p + i));
+      __m128i v1 = _mm_loadu_si128 ((const __m128i *) (p + i + step));
+      __m128i v2 = _mm_loadu_si128 ((const __m128i *) (p + i + 2 * step));
+      __m128i v3 = _mm_loadu_si128 ((const __m128i *) (p + i + 3 * step));
+      __m128i v = _mm_or_si128 (_mm_or_si128 (_mm_xor_si128 (v0, f),
+					       _mm_xor_si128 (v1, f)),
+			       _mm_or_si128 (_mm_xor_si128 (v2, f),
+					       _mm_xor_si128 (v3, f)));
+      v = _mm_and_si128 (v, m);
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero)) != 0xffff)
+	break;
+    }
+  for (; i + step <= nwords; i += step)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (p + i));
+      v = _mm_and_si128 (_mm_xor_si128 (v, f), m);
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero)) != 0xffff)
+	break;
+    }
+  return i + scan_words_generic (p + i, nwords - i, fill, mask);
+}
+
+__attribute__ ((target ("avx2")))
+static size_t
+scan_words_avx2 (const unsigned long *p, size_t nwords,
+		 unsigned long fill, unsigned long mask)
+{
+  const size_t step = sizeof (__m256i) / sizeof *p;
+  const __m256i f = _mm256_set1_epi8 ((char) fill);
+  const __m256i m = _mm256_set1_epi8 ((char) mask);
+  const __m256i zero = _mm256_setzero_si256 ();
+  size_t i;
+
+  /* Look at four vectors at a time while nothing is found.  */
+  for (i = 0; i + 4 * step <= nwords; i += 4 * step)
+    {
+      __m256i v0 = _mm256_loadu_si256 ((const __m256i *) (p + i));
+      __m256i v1 = _mm256_loadu_si256 ((const __m256i *) (p + i + step));
+      __m256i v2 = _mm256_loadu_si256 ((const __m256i *) (p + i + 2 * step));
+      __m256i v3 = _mm256_loadu_si256 ((const __m256i *) (p + i + 3 * step));
+      __m256i v = _mm256_or_si256 (_mm256_or_si256 (_mm256_xor_si256 (v0, f),
+					       _mm256_xor_si256 (v1, f)),
+			       _mm256_or_si256 (_mm256_xor_si256 (v2, f),
+					       _mm256_xor_si256 (v3, f)));
+      v = _mm256_and_si256 (v, m);
+      if (_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, zero)) != -1)
+	break;
+    }
+  for (; i + step <= nwords; i += step)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (p + i));
+      v = _mm256_and_si256 (_mm256_xor_si256 (v, f), m);
+      if (_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, zero)) != -1)
+	break;
+    }
+  return i + scan_words_generic (p + i, nwords - i, fill, mask);
+}
+#endif
+
+static size_t scan_words_select (const unsigned long *p, size_t nwords,
+				 unsigned long fill, unsigned long mask);
+
+/* The word skipping routine in use; chosen on first use according to what
+   the processor supports.  */
+static size_t (*scan_words) (const unsigned long *p, size_t nwords,
+			     unsigned long fill, unsigned long mask)
+  = scan_words_select;
+
+static size_t
+scan_words_select (const unsigned long *p, size_t nwords,
+		   unsigned long fill, unsigned long mask)
+{
+  size_t (*fn) (const unsigned long *, size_t, unsigned long, unsigned long)
+    = scan_words_generic;
 
+#ifdef BITMAP_SCAN_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    fn = scan_words_avx2;
+  else if (__builtin_cpu_supports ("sse2"))
+    fn = scan_words_sse2;
+#endif
+
+  __atomic_store_n (&scan_words, fn, __ATOMIC_RELAXED);
+  return (*fn) (p, nwords, fill, mask);
+}
+
+/* Returns the first bit at or after OFFSET in the SIZE bits long bitmap
+   ADDR whose value differs from the bits in FILL (0 or ~0UL), or SIZE if
+   there is none.  */
 static inline unsigned long
-find_next_zero_bit(void *addr, unsigned long size, unsigned long offset)
+find_next_bit_other_than (void *addr, unsigned long size,
+			  unsigned long offset, unsigned long fill)
 {
-  unsigned long *p = ((unsigned long *) addr) + (offset >> 5);
-  unsigned long result = offset & ~31UL;
-  unsigned long tmp;
+  const unsigned long *p = addr;
+  unsigned long nwords = (size + BITS_PER_WORD - 1) / BITS_PER_WORD;
+  unsigned long i = offset / BITS_PER_WORD;
+  unsigned long w;
 
   if (offset >= size)
     return size;
-  size -= result;
-  offset &= 31UL;
-  if (offset)
-    {
-      tmp = *(p++);
-      tmp |= ~0UL >> (32-offset);
-      if (size < 32)
-	goto found_first;
-      if (~tmp)
-	goto found_middle;
-      size -= 32;
-      result += 32;
-    }
-  while (size & ~31UL)
+
+  w = (p[i] ^ fill) & (~0UL << (offset % BITS_PER_WORD));
+  if (!w)
     {
-      if (~(tmp = *(p++)))
-	goto found_middle;
-      result += 32;
-      size -= 32;
+      i++;
+      i += (*scan_words) (p + i, nwords - i, fill, ~0UL);
+      if (i >= nwords)
+	return size;
+      w = p[i] ^ fill;
     }
-  if (!size)
-    return result;
-  tmp = *p;
-
-found_first:
-  tmp |= ~0UL << size;
-  if (!~tmp)
-    return result + size;
-found_middle:
-  return result + ffz(tmp);
+
+  offset = i * BITS_PER_WORD + __builtin_ctzl (w);
+  return offset < size ? offset : size;
 }
 
-/* Linus sez that gcc can optimize the following correctly, we'll see if this
- * holds on the Sparc as it does for the ALPHA.
- */
+/* Returns the first zero bit at or after OFFSET in the SIZE bits long
+   bitmap ADDR, or SIZE if there is none.  */
+static inline unsigned long
+find_next_zero_bit (void *addr, unsigned long size, unsigned long offset)
+{
+  return find_next_bit_other_than (addr, size, offset, ~0UL);
+}
+
+/* Returns the first set bit at or after OFFSET in the SIZE bits long
+   bitmap ADDR, or SIZE if there is none.  */
+static inline unsigned long
+find_next_set_bit (void *addr, unsigned long size, unsigned long offset)
+{
+  return find_next_bit_other_than (addr, size, offset, 0);
+}
 
 static inline int
-find_first_zero_bit(void *buf, unsigned len)
+find_first_zero_bit (void *buf, unsigned len)
 {
-  return find_next_zero_bit(buf, len, 0);
+  return find_next_zero_bit (buf, len, 0);
+}
+
+/* Returns the start of the first run of at least LEN zero bits at or after
+   OFFSET in the SIZE bits long bitmap ADDR, or SIZE if there is none.  */
+static inline unsigned long
+find_next_zero_run (void *addr, unsigned long size, unsigned long offset,
+		    unsigned long len)
+{
+  const unsigned long *p = addr;
+  unsigned long nwords = (size + BITS_PER_WORD - 1) / BITS_PER_WORD;
+  unsigned long i = offset / BITS_PER_WORD;
+  unsigned long carry = 0;	/* Free bits at the top of the last word.  */
+  unsigned long free, run, k, step;
+
+  if (offset >= size || len <= 1)
+    return find_next_zero_bit (addr, size, offset);
+
+  if (len > BITS_PER_WORD)
+    {
+      while ((offset = find_next_zero_bit (addr, size, offset)) < size)
+	{
+	  unsigned long limit = size - offset > len ? offset + len : size;
+	  unsigned long end = find_next_set_bit (addr, limit, offset);
+	  if (end - offset >= len)
+	    return offset;
+	  if (end == size)
+	    break;
+	  offset = end;
+	}
+      return size;
+    }
+
+  free = ~p[i] & (~0UL << (offset % BITS_PER_WORD));
+  for (;;)
+    {
+      if (i == nwords - 1 && size % BITS_PER_WORD)
+	free &= ~0UL >> (BITS_PER_WORD - size % BITS_PER_WORD);
+
+      /* A run continuing from the previous word.  */
+      if (carry
+	  && carry + (~free ? __builtin_ctzl (~free) : BITS_PER_WORD) >= len)
+	return i * BITS_PER_WORD - carry;
+
+      /* After this, bit N of RUN is set if K bits from N on are free.  */
+      run = free;
+      for (k = 1; k < len && run; k += step)
+	{
+	  step = k < len - k ? k : len - k;
+	  run &= run >> step;
+	}
+      if (run)
+	return i * BITS_PER_WORD + __builtin_ctzl (run);
+
+      carry = ~free ? __builtin_clzl (~free) : carry + BITS_PER_WORD;
+
+      if (++i >= nwords)
+	return size;
+      if (! carry)
+	{
+	  /* Any run of at least eight bits includes the top bit of some
+	     byte, so skip words where those are all in use; otherwise
+	     just skip full words.  */
+	  i += (*scan_words) (p + i, nwords - i, ~0UL,
+			      len >= CHAR_BIT ? BYTE_TOP_BITS : ~0UL);
+	  if (i >= nwords)
+	    return size;
+	}
+      free = ~p[i];
+    }
 }
@@ -86,6 +86,10 @@ struct dirstat
   /* For stat COMPRESS, this is the number of bytes needed to be copied
      in order to undertake the compression. */
   size_t nbytes;
+
+  /* For type CREATE, true if the new entry goes into the leaf block
+     where the directory index expects it, so the index stays valid.  */
+  int dx_valid;
 };
 
 const size_t diskfs_dirstat_size = sizeof (struct dirstat);
@@ -102,6 +106,18 @@ dirscanblock (vm_address_t blockoff, struct node *dp, int idx,
 	      const char *name, size_t namelen, enum lookup_type type,
 	      struct dirstat *ds, ino_t *inum);
 
+static error_t
+dx_lookup (vm_address_t buf, struct node *dp,
+	   const char *name, size_t namelen, enum lookup_type type,
+	   struct dirstat *ds, ino_t *inum);
+
+/* True if the hashed index of directory DP may be used for lookups.
+   A modification that would invalidate the index clears EXT2_BTREE_FL,
+   after which the directory is scanned linearly again.  */
+#define dx_usable(dp)							\
+  (EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_DIR_INDEX)	\
+   && (diskfs_node_disknode (dp)->info.i_flags & EXT2_BTREE_FL))
+
 
 #if 0				/* XXX unused for now */
 static const unsigned char ext2_file_type[EXT2_FT_MAX] =
@@ -149,6 +165,8 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
   vm_address_t blockaddr;
   int idx, lastidx;
   int looped;
+  int indexed;
+  int dots;
 
   if ((type == REMOVE) || (type == RENAME))
     assert (npp);
@@ -174,6 +192,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
       ds->type = LOOKUP;
       ds->mapbuf = 0;
       ds->mapextent = 0;
+      ds->dx_valid = 0;
     }
   if (buf)
     {
@@ -202,8 +221,40 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 
   diskfs_set_node_atime (dp);
 
+  /* "." and ".." are only in the first block, which is the root of
+     the hashed index and is not covered by any of its leaves.  */
+  dots = (name[0] == '.'
+	  && (namelen == 1 || (namelen == 2 && name[1] == '.')));
+
+  /* Use the hashed index, if there is one.  If the index turns out to
+     be unusable, or we are looking for room for a new entry and the
+     leaf the index points to is full, fall back to the linear scan.  */
+  indexed = 0;
+  if (!dots && dx_usable (dp))
+    {
+      err = dx_lookup (buf, dp, name, namelen, type, ds, &inum);
+      if (err && err != ENOENT && err != EAGAIN)
+	{
+	  munmap ((caddr_t) buf, buflen);
+	  return err;
+	}
+
+      if (err == EAGAIN)
+	;
+      else if (ds && (type == CREATE || type == RENAME) && !inum)
+	{
+	  if (ds->stat != LOOKING)
+	    {
+	      indexed = 1;
+	      ds->dx_valid = 1;
+	    }
+	}
+      else
+	indexed = 1;
+    }
+
   /* Start the lookup at diskfs_node_disknode (DP)->dir_idx.  */
-  idx = diskfs_node_disknode (dp)->dir_idx;
+  idx = dots ? 0 : diskfs_node_disknode (dp)->dir_idx;
   if (idx * DIRBLKSIZ > dp->dn_stat.st_size)
     idx = 0;			/* just in case */
   blockaddr = buf + idx * DIRBLKSIZ;
@@ -212,7 +263,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
   if (lastidx == 0)
     lastidx = dp->dn_stat.st_size / DIRBLKSIZ;
 
-  while (!looped || idx < lastidx)
+  while (!indexed && (!looped || idx < lastidx))
     {
       err = dirscanblock (blockaddr, dp, idx, name, namelen, type, ds, &inum);
       if (!err)
@@ -516,6 +567,155 @@ dirscanblock (vm_address_t blockaddr, struct node *dp, int idx,
   return 0;
 }
 
+/* One level of the path from the root of a directory index to a leaf
+   block.  */
+struct dx_frame
+{
+  struct dx_entry *entries;	/* the entries of this index block */
+  struct dx_entry *at;		/* the entry we followed */
+  unsigned count;		/* number of entries in use */
+};
+
+/* Indexes deeper than this are not supported.  */
+#define DX_MAX_LEVELS 3
+
+/* Check that the index block whose entries start at ENTRIES has room
+   for exactly LIMIT entries, and fill in FRAME with the entry that
+   covers HASH.  Return EAGAIN if the block looks corrupt.  */
+static error_t
+dx_probe_block (struct dx_entry *entries, unsigned limit, uint32_t hash,
+		struct dx_frame *frame)
+{
+  struct dx_countlimit *cl = (struct dx_countlimit *) entries;
+  struct dx_entry *p, *q, *m;
+
+  if (cl->limit != limit || cl->count == 0 || cl->count > limit)
+    return EAGAIN;
+
+  /* The first entry covers everything below the second entry's hash;
+     its hash field holds the count and limit.  Find the last entry
+     whose hash is not greater than HASH.  */
+  p = entries + 1;
+  q = entries + cl->count - 1;
+  while (p <= q)
+    {
+      m = p + (q - p) / 2;
+      if (m->hash > hash)
+	q = m - 1;
+      else
+	p = m + 1;
+    }
+
+  frame->entries = entries;
+  frame->count = cl->count;
+  frame->at = p - 1;
+  return 0;
+}
+
+/* Look up NAME (of length NAMELEN) in the directory DP, which is
+   mapped at BUF, using its hashed index.  Args TYPE, DS and INUM are
+   as for dirscanblock.  Return ENOENT if the name is not in the
+   directory, and EAGAIN if the index cannot be used, in which case
+   the caller should scan the directory linearly.  */
+static error_t
+dx_lookup (vm_address_t buf, struct node *dp,
+	   const char *name, size_t namelen, enum lookup_type type,
+	   struct dirstat *ds, ino_t *inum)
+{
+  error_t err;
+  struct dx_root *root = (struct dx_root *) buf;
+  struct dx_frame frames[DX_MAX_LEVELS];
+  struct dx_entry *entries;
+  block_t nblocks = dp->dn_stat.st_size / DIRBLKSIZ;
+  block_t blk = 0;
+  uint32_t hash;
+  unsigned limit;
+  int levels, level, version;
+
+  if (nblocks < 2
+      || root->info.reserved_zero != 0
+      || root->info.info_length != sizeof root->info
+      || root->info.indirect_levels >= DX_MAX_LEVELS)
+    goto bad_index;
+
+  levels = root->info.indirect_levels;
+  version = root->info.hash_version;
+  if (version <= DX_HASH_TEA
+      && (sblock->s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+    version += DX_HASH_LEGACY_UNSIGNED;
+
+  err = ext2_dirhash (name, namelen, version, sblock->s_hash_seed,
+		      &hash, NULL);
+  if (err)
+    goto bad_index;
+
+  /* Walk down from the root to the leaf covering HASH.  */
+  entries = (struct dx_entry *) ((char *) &root->info
+				 + root->info.info_length);
+  limit = (DIRBLKSIZ - ((char *) entries - (char *) root))
+    / sizeof (struct dx_entry);
+  for (level = 0; ; level++)
+    {
+      if (dx_probe_block (entries, limit, hash, &frames[level]))
+	goto bad_index;
+
+      blk = frames[level].at->block & DX_BLOCK_MASK;
+      if (blk == 0 || blk >= nblocks)
+	goto bad_index;
+      if (level == levels)
+	break;
+
+      entries = (struct dx_entry *) (buf + blk * DIRBLKSIZ
+				     + sizeof (struct dx_node));
+      limit = (DIRBLKSIZ - sizeof (struct dx_node))
+	/ sizeof (struct dx_entry);
+    }
+
+  for (;;)
+    {
+      err = dirscanblock (buf + blk * DIRBLKSIZ, dp, blk,
+			  name, namelen, type, ds, inum);
+      if (err != ENOENT)
+	return err;
+
+      /* Names with the same hash may spill over into the next leaf,
+	 in which case the lowest bit of the next leaf's hash is set.
+	 Find the next leaf, going up as far as needed.  */
+      for (level = levels; level >= 0; level--)
+	if (++frames[level].at < frames[level].entries + frames[level].count)
+	  break;
+      if (level < 0)
+	return ENOENT;
+      if ((frames[level].at->hash & ~1) != hash
+	  || !(frames[level].at->hash & 1))
+	return ENOENT;
+
+      blk = frames[level].at->block & DX_BLOCK_MASK;
+      if (blk == 0 || blk >= nblocks)
+	goto bad_index;
+      while (level < levels)
+	{
+	  entries = (struct dx_entry *) (buf + blk * DIRBLKSIZ
+					 + sizeof (struct dx_node));
+	  limit = (DIRBLKSIZ - sizeof (struct dx_node))
+	    / sizeof (struct dx_entry);
+	  level++;
+	  if (dx_probe_block (entries, limit, 0, &frames[level]))
+	    goto bad_index;
+	  /* Take the very first entry of the block.  */
+	  frames[level].at = entries;
+	  blk = entries->block & DX_BLOCK_MASK;
+	  if (blk == 0 || blk >= nblocks)
+	    goto bad_index;
+	}
+    }
+
+ bad_index:
+  ext2_warning ("unusable directory index, scanning linearly: inode: %Ld",
+		dp->cache_id);
+  return EAGAIN;
+}
+
 /* Following a lookup call for CREATE, this adds a node to a directory.
    DP is the directory to be modified; NAME is the name to be entered;
    NP is the node being linked in; DS is the cached information returned
@@ -652,8 +852,11 @@ diskfs_direnter_hard (struct node *dp, const char *name, struct node *np,
   new->name_len = namelen;
   memcpy (new->name, name, namelen);
 
-  /* Mark the directory inode has having been written.  */
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
+  /* If the entry is not where the directory index would look for it,
+     the index is no longer valid.  Mark the directory as not indexed,
+     so that it is scanned linearly from now on.  */
+  if (! ds->dx_valid)
+    diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
   dp->dn_set_mtime = 1;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
@@ -720,8 +923,9 @@ diskfs_dirremove_hard (struct node *dp, struct dirstat *ds)
       ds->preventry->rec_len += ds->entry->rec_len;
     }
 
+  /* Removing an entry from its block does not affect the directory
+     index, if any.  */
   dp->dn_set_mtime = 1;
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
@@ -751,9 +955,10 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np, struct dirstat *ds)
 
   assert (!diskfs_readonly);
 
+  /* The name does not change, so neither does its place in the
+     directory index, if any.  */
   ds->entry->inode = np->cache_id;
   dp->dn_set_mtime = 1;
-  diskfs_node_disknode (dp)->info.i_flags &= ~EXT2_BTREE_FL;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
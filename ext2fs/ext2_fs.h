@@ -198,6 +198,7 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
 #define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
@@ -418,9 +419,36 @@ struct ext2_super_block {
 	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
 	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
 	__u16	s_padding1;
-	__u32	s_reserved[204];	/* Padding to the end of the block */
+	/*
+	 * Journaling support, unused by this implementation.
+	 */
+	__u8	s_journal_uuid[16];	/* uuid of journal superblock */
+	__u32	s_journal_inum;		/* inode number of journal file */
+	__u32	s_journal_dev;		/* device number of journal file */
+	__u32	s_last_orphan;		/* start of list of inodes to delete */
+	__u32	s_hash_seed[4];		/* HTREE hash seed */
+	__u8	s_def_hash_version;	/* Default hash version to use */
+	__u8	s_reserved_char_pad;
+	__u16	s_desc_size;		/* size of group descriptor */
+	__u32	s_default_mount_opts;
+	__u32	s_first_meta_bg;	/* First metablock block group */
+	__u32	s_mkfs_time;		/* When the filesystem was created */
+	__u32	s_jnl_blocks[17];	/* Backup of the journal inode */
+	__u32	s_blocks_count_hi;	/* Blocks count, high 32 bits */
+	__u32	s_r_blocks_count_hi;	/* Reserved blocks count, high 32 bits */
+	__u32	s_free_blocks_hi;	/* Free blocks count, high 32 bits */
+	__u16	s_min_extra_isize;	/* All inodes have at least # bytes */
+	__u16	s_want_extra_isize;	/* New inodes should reserve # bytes */
+	__u32	s_flags;		/* Miscellaneous flags */
+	__u32	s_reserved[167];	/* Padding to the end of the block */
 };
 
+/*
+ * Superblock flags (s_flags)
+ */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001	/* Signed dirhash in use */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002	/* Unsigned dirhash in use */
+
 #ifdef __KERNEL__
 #define EXT2_SB(sb)	(&((sb)->u.ext2_sb))
 #else
@@ -463,6 +491,7 @@ struct ext2_super_block {
 
 #define EXT2_FEATURE_COMPAT_DIR_PREALLOC	0x0001
 #define EXT2_FEATURE_COMPAT_EXT_ATTR		0x0008
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
 
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -470,9 +499,11 @@ struct ext2_super_block {
 
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
+#define EXT2_FEATURE_INCOMPAT_EXTENTS		0x0040
 
 #define EXT2_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_EXT_ATTR
-#define EXT2_FEATURE_INCOMPAT_SUPP	EXT2_FEATURE_INCOMPAT_FILETYPE
+#define EXT2_FEATURE_INCOMPAT_SUPP	(EXT2_FEATURE_INCOMPAT_FILETYPE| \
+					 EXT2_FEATURE_INCOMPAT_EXTENTS)
 #define EXT2_FEATURE_RO_COMPAT_SUPP	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT2_FEATURE_RO_COMPAT_LARGE_FILE| \
 					 EXT2_FEATURE_RO_COMPAT_BTREE_DIR)
@@ -524,6 +555,103 @@ struct ext2_dir_entry_2 {
 
 #define EXT2_FT_MAX		8
 
+/*
+ * Hashed directory index (htree).  The first block of an indexed
+ * directory starts with "." and "..", the latter spanning the rest of
+ * the block, followed by struct dx_root_info and the root index
+ * entries.  Interior index blocks consist of one empty directory entry
+ * spanning the whole block, followed by the index entries.  To readers
+ * unaware of the index, all these blocks look like ordinary directory
+ * blocks; the leaf blocks are ordinary directory blocks.
+ */
+#define DX_HASH_LEGACY			0
+#define DX_HASH_HALF_MD4		1
+#define DX_HASH_TEA			2
+#define DX_HASH_LEGACY_UNSIGNED		3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+
+struct dx_fake_dirent {
+	__u32	inode;
+	__u16	rec_len;
+	__u8	name_len;
+	__u8	file_type;
+};
+
+struct dx_root_info {
+	__u32	reserved_zero;
+	__u8	hash_version;
+	__u8	info_length;		/* 8 */
+	__u8	indirect_levels;
+	__u8	unused_flags;
+};
+
+struct dx_root {
+	struct dx_fake_dirent dot;
+	char	dot_name[4];
+	struct dx_fake_dirent dotdot;
+	char	dotdot_name[4];
+	struct dx_root_info info;
+};
+
+struct dx_node {
+	struct dx_fake_dirent fake;
+};
+
+/* The HASH field of the first entry of each index block holds the
+   number of used and available entries of the block instead.  */
+struct dx_entry {
+	__u32	hash;
+	__u32	block;
+};
+
+struct dx_countlimit {
+	__u16	limit;
+	__u16	count;
+};
+
+/* Only the low 28 bits of dx_entry.block are the block number.  */
+#define DX_BLOCK_MASK			0x0fffffff
+
+/*
+ * Structure of an extent tree
+ *
+ * The i_block array of an inode with EXT2_EXTENTS_FL set holds the
+ * root node of a tree mapping runs of file blocks to runs of disk
+ * blocks.  Each node starts with a header, followed by index entries
+ * (interior nodes) or extents (leaves), sorted by logical block.
+ * Nodes other than the root occupy a whole block.
+ */
+#define EXT2_EXT_MAGIC			0xf30a
+
+struct ext2_extent_header {
+	__u16	eh_magic;		/* EXT2_EXT_MAGIC */
+	__u16	eh_entries;		/* Number of valid entries */
+	__u16	eh_max;			/* Capacity of the node */
+	__u16	eh_depth;		/* Zero for a leaf */
+	__u32	eh_generation;
+};
+
+struct ext2_extent {
+	__u32	ee_block;		/* First logical block */
+	__u16	ee_len;			/* Number of blocks */
+	__u16	ee_start_hi;		/* High 16 bits of the first disk block */
+	__u32	ee_start_lo;		/* Low 32 bits of the first disk block */
+};
+
+struct ext2_extent_idx {
+	__u32	ei_block;		/* First logical block of the subtree */
+	__u32	ei_leaf_lo;		/* Low 32 bits of the node's disk block */
+	__u16	ei_leaf_hi;		/* High 16 bits of the node's disk block */
+	__u16	ei_unused;
+};
+
+/* An extent longer than EXT2_EXT_INIT_MAX_LEN is allocated but not
+   initialized, and reads as zeros; its length is ee_len minus
+   EXT2_EXT_INIT_MAX_LEN.  */
+#define EXT2_EXT_INIT_MAX_LEN		(1 << 15)
+#define EXT2_EXT_MAX_DEPTH		5
+
 /*
  * EXT2_DIR_PAD defines the directory entries boundaries
  *
@@ -60,6 +60,9 @@ char *diskfs_disk_name;
 int ext2_debug_flag;
 #endif
 
+#define OPT_DELAYED_ALLOCATION	600
+#define OPT_NO_DELAYED_ALLOCATION	601
+
 /* Ext2fs-specific options.  */
 static const struct argp_option
 options[] =
@@ -71,6 +74,14 @@ options[] =
   },
   {"sblock", 'S', "BLOCKNO", 0,
    "Use alternate superblock location (1kb blocks)"},
+  {"paging-workers", 'W', "NUM", 0,
+   "Use at most NUM threads per pager to service paging requests"
+   " (0 picks a default based on the number of processors)"},
+  {"delayed-allocation", OPT_DELAYED_ALLOCATION, 0, 0,
+   "Only reserve space when file pages are made writable, and allocate"
+   " the blocks when the pages are written back"},
+  {"no-delayed-allocation", OPT_NO_DELAYED_ALLOCATION, 0, 0,
+   "Allocate blocks as soon as file pages are made writable (default)"},
   {0}
 };
 
@@ -84,6 +95,8 @@ parse_opt (int key, char *arg, struct argp_state *state)
   {
     int debug_flag;
     unsigned int sb_block;
+    int paging_workers;
+    int delayed_allocation;
   } *values = state->hook;
 
   switch (key)
@@ -99,6 +112,20 @@ parse_opt (int key, char *arg, struct argp_state *state)
 	  return EINVAL;
 	}
       break;
+    case 'W':
+      values->paging_workers = strtol (arg, &arg, 0);
+      if (!arg || *arg != '\0' || values->paging_workers < 0)
+	{
+	  argp_error (state, "invalid number for --paging-workers");
+	  return EINVAL;
+	}
+      break;
+    case OPT_DELAYED_ALLOCATION:
+      values->delayed_allocation = 1;
+      break;
+    case OPT_NO_DELAYED_ALLOCATION:
+      values->delayed_allocation = 0;
+      break;
 
     case ARGP_KEY_INIT:
       state->child_inputs[0] = state->input;
@@ -108,6 +135,8 @@ parse_opt (int key, char *arg, struct argp_state *state)
       state->hook = values;
       memset (values, 0, sizeof *values);
       values->sb_block = SBLOCK_BLOCK;
+      values->paging_workers = -1;
+      values->delayed_allocation = delayed_allocation;
       break;
 
     case ARGP_KEY_SUCCESS:
@@ -122,6 +151,18 @@ parse_opt (int key, char *arg, struct argp_state *state)
 #endif
 	}
 
+      if (values->paging_workers >= 0)
+	{
+	  error_t err = set_paging_workers (values->paging_workers);
+	  if (err)
+	    {
+	      argp_failure (state, 2, err, "cannot set paging workers");
+	      return err;
+	    }
+	}
+
+      delayed_allocation = values->delayed_allocation;
+
       break;
 
     default:
@@ -143,6 +184,14 @@ diskfs_append_args (char **argz, size_t *argz_len)
   if (!err && ext2_debug_flag)
     err = argz_add (argz, argz_len, "--debug");
 #endif
+  if (!err && paging_workers)
+    {
+      char buf[40];
+      snprintf (buf, sizeof buf, "--paging-workers=%d", paging_workers);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && delayed_allocation)
+    err = argz_add (argz, argz_len, "--delayed-allocation");
   if (! err)
     err = store_parsed_append_args (store_parsed, argz, argz_len);
 
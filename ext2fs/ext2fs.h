@@ -180,6 +180,28 @@ struct disknode
      partially allocated.  */
   int last_page_partially_writable;
 
+  /* Sequential access detection for the file pager.  READ_AHEAD_NEXT is
+     the offset of the page we expect the next sequential fault at, and
+     READ_AHEAD_PAGES the number of pages to read ahead when it
+     happens.  Only touched while servicing paging requests, which are
+     serialized per pager.  */
+  vm_offset_t read_ahead_next;
+  int read_ahead_pages;
+
+  /* With delayed allocation, the file blocks (keys) that have been made
+     writable but have no disk block yet; DELALLOC_BLOCKS is their number.
+     Both are protected by ALLOC_LOCK.  */
+  struct hurd_ihash delalloc;
+  block_t delalloc_blocks;
+
+  /* True while ext2_alloc_run is handing out the blocks it preallocated,
+     so that ext2_alloc_block uses them whatever the goal.  */
+  int alloc_run;
+
+  /* True while blocks reserved for delayed allocation are allocated, so
+     that ext2_alloc_block may take them from the reserve.  */
+  int delalloc_run;
+
   /* Index to start a directory lookup at.  */
   int dir_idx;
 };
@@ -200,11 +222,43 @@ struct user_pager_info
 
 #define DISK_CACHE_BLOCKS	65536
 
+/* The read-ahead window of the file pager starts at
+   READ_AHEAD_MIN_PAGES pages once sequential access is detected, and
+   doubles on each further sequential fault up to READ_AHEAD_MAX_PAGES.  */
+#define READ_AHEAD_MIN_PAGES	4
+#define READ_AHEAD_MAX_PAGES	32
+
 #include <hurd/diskfs-pager.h>
 
+/* The maximum number of threads servicing paging requests for each of
+   the disk and file pagers, or zero for libpager's default.  */
+extern int paging_workers;
+
+/* If true, making a file page writable only reserves space for its
+   blocks; disk blocks are assigned when the page is written back, a whole
+   run at a time.  */
+extern int delayed_allocation;
+
+/* The number of blocks reserved for delayed allocation in all files.  */
+extern block_t delalloc_reserved;
+
+/* Return the number of free blocks that must be kept back for the blocks
+   reserved for delayed allocation, including an estimate of the indirect
+   blocks they will need.  */
+block_t ext2_delalloc_reserve (void);
+
+/* Release the delayed allocation reservations of NODE for its blocks
+   starting with block END.  NODE's ALLOC_LOCK must be held for
+   writing.  */
+void ext2_delalloc_release (struct node *node, block_t end);
+
 /* Set up the disk pager.  */
 void create_disk_pager (void);
 
+/* Set PAGING_WORKERS to MAX_WORKERS, and apply it to the pagers if they
+   are already running.  */
+error_t set_paging_workers (int max_workers);
+
 /* Inhibit the disk pager.  */
 error_t inhibit_ext2_pager (void);
 
@@ -409,7 +463,9 @@ dino_ref (ino_t inum)
   struct ext2_group_desc *bg = group_desc (bg_num);
   block_t block = bg->bg_inode_table + (group_inum / inodes_per_block);
   struct ext2_inode *inode = disk_cache_block_ref (block);
-  inode += group_inum % inodes_per_block;
+  inode = (struct ext2_inode *) ((char *) inode
+				 + ((group_inum % inodes_per_block)
+				    * EXT2_INODE_SIZE (sblock)));
   ext2_debug ("(%llu) = %p", inum, inode);
   return inode;
 }
@@ -430,9 +486,10 @@ void write_all_disknodes ();
 
 /* ---------------------------------------------------------------- */
 
-/* What to lock if changing global data data (e.g., the superblock or block
-   group descriptors or bitmaps).  */
-pthread_spinlock_t global_lock;
+/* What to lock if changing the descriptor or bitmaps of block group NUM.
+   The free counts in the superblock are updated atomically instead.  */
+pthread_spinlock_t *group_locks;
+#define group_lock(num) (&group_locks[num])
 
 /* Where to record such changes.  */
 struct pokel global_pokel;
@@ -533,6 +590,17 @@ alloc_sync (struct node *np)
 }
 #endif /* Use extern inlines.  */
 
+/* ---------------------------------------------------------------- */
+/* htree.c */
+
+/* Compute the directory index hash of the LEN bytes long NAME using
+   hash algorithm VERSION (one of the DX_HASH_* values) and the hash
+   seed SEED.  Return the hash in *HASH, and the minor hash in
+   *MINOR_HASH if MINOR_HASH is not NULL.  */
+error_t ext2_dirhash (const char *name, size_t len, int version,
+		      const uint32_t seed[4],
+		      uint32_t *hash, uint32_t *minor_hash);
+
 /* ---------------------------------------------------------------- */
 /* getblk.c */
 
@@ -543,12 +611,45 @@ void ext2_discard_prealloc (struct node *node);
    otherwise EINVAL is returned.  */
 error_t ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block);
 
+/* Returns in DISK_BLOCK the disk block corresponding to BLOCK in NODE, and
+   in COUNT the number of blocks, at most MAX, starting at BLOCK that are
+   mapped to consecutive disk blocks.  If BLOCK is not allocated, EINVAL is
+   returned, and COUNT is set to a number of unallocated blocks starting at
+   BLOCK.  */
+error_t ext2_getblk_run (struct node *node, block_t block, block_t max,
+			 block_t *disk_block, block_t *count);
+
+/* Allocate a new block for the file NODE, as close to block GOAL as
+   possible, and return it, or 0 if none could be had.  If ZERO is true, then
+   zero the block (and add it to NODE's list of modified indirect blocks).  */
+block_t ext2_alloc_block (struct node *node, block_t goal, int zero);
+
+/* Allocate disk blocks for the COUNT unallocated blocks of NODE starting
+   with BLOCK, trying to place them in one contiguous run.  */
+error_t ext2_alloc_run (struct node *node, block_t block, block_t count);
+
 block_t ext2_new_block (block_t goal,
 			block_t prealloc_goal,
-			block_t *prealloc_count, block_t *prealloc_block);
+			block_t *prealloc_count, block_t *prealloc_block,
+			int use_reserve);
 
 void ext2_free_blocks (block_t block, unsigned long count);
 
+/* ---------------------------------------------------------------- */
+/* extents.c */
+
+/* Like ext2_getblk_run and ext2_getblk, for extent-mapped files.  */
+error_t ext2_extent_map (struct node *node, block_t block, block_t max,
+			 block_t *disk_block, block_t *count);
+error_t ext2_extent_getblk (struct node *node, block_t block, int create,
+			    block_t *disk_block);
+
+/* Free all blocks in the extent-mapped NODE starting with block END.  */
+error_t ext2_extent_truncate (struct node *node, block_t end);
+
+/* Make the freshly allocated NODE extent-mapped, with an empty tree.  */
+void ext2_extent_init (struct node *node);
+
 /* ---------------------------------------------------------------- */
 
 /* Write disk block ADDR with DATA of LEN bytes, waiting for completion.  */
@@ -0,0 +1,872 @@
+/* Extent tree block mapping
+
+   Copyright (C) 2016 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Files with EXT2_EXTENTS_FL set map their blocks through a tree of
+   extents rooted in the inode's i_block array, as created by Linux and
+   recent versions of mke2fs.  Only block numbers that fit in 32 bits
+   are supported.  All modifications happen with the node's ALLOC_LOCK
+   held for writing.  */
+
+#include <string.h>
+#include "ext2fs.h"
+
+/* Both index entries and extents are this long, and start with the
+   first logical block they cover.  */
+#define EXT_ENTRY_SIZE		sizeof (struct ext2_extent)
+
+/* The number of entries that fit into the root node, in the inode.  */
+#define EXT_ROOT_MAX							\
+  ((sizeof (((struct ext2_inode_info *) 0)->i_data)			\
+    - sizeof (struct ext2_extent_header)) / EXT_ENTRY_SIZE)
+
+/* The number of entries that fit into a node occupying a block.  */
+#define EXT_BLOCK_MAX							\
+  ((block_size - sizeof (struct ext2_extent_header)) / EXT_ENTRY_SIZE)
+
+#define EXT_FIRST_EXTENT(eh)	((struct ext2_extent *) ((eh) + 1))
+#define EXT_FIRST_INDEX(eh)	((struct ext2_extent_idx *) ((eh) + 1))
+#define EXT_ENTRY(eh, i)	((char *) ((eh) + 1) + (i) * EXT_ENTRY_SIZE)
+#define EXT_KEY(entry)		(*(const __u32 *) (entry))
+
+/* One level of the path from the root of an extent tree to a leaf.  */
+struct ext_path
+{
+  struct ext2_extent_header *header; /* the node */
+  block_t block;		/* its disk block, or 0 for the root */
+  int index;			/* the entry followed or found, or -1 */
+  int dirty;			/* true if the node was modified */
+};
+
+static inline struct ext2_extent_header *
+ext_root (struct node *node)
+{
+  return (struct ext2_extent_header *) diskfs_node_disknode (node)->info.i_data;
+}
+
+static inline block_t
+ext_len (struct ext2_extent *ex)
+{
+  return (ex->ee_len > EXT2_EXT_INIT_MAX_LEN
+	  ? ex->ee_len - EXT2_EXT_INIT_MAX_LEN : ex->ee_len);
+}
+
+static inline int
+ext_uninit (struct ext2_extent *ex)
+{
+  return ex->ee_len > EXT2_EXT_INIT_MAX_LEN;
+}
+
+/* Return EIO, complaining, if EH is not a sane node of NODE's extent
+   tree at depth DEPTH (or any depth, if DEPTH is negative) with room
+   for at most MAX entries.  */
+static error_t
+ext_check (struct node *node, struct ext2_extent_header *eh,
+	   int depth, unsigned max)
+{
+  if (eh->eh_magic != EXT2_EXT_MAGIC
+      || eh->eh_max > max
+      || eh->eh_entries > eh->eh_max
+      || eh->eh_depth > EXT2_EXT_MAX_DEPTH
+      || (depth >= 0 && eh->eh_depth != depth))
+    {
+      ext2_warning ("corrupt extent tree: inode: %Ld", node->cache_id);
+      return EIO;
+    }
+  return 0;
+}
+
+/* Return the disk block of the node index entry IX points to, or 0 if
+   it is not valid.  */
+static block_t
+ext_child (struct ext2_extent_idx *ix)
+{
+  if (ix->ei_leaf_hi != 0
+      || ix->ei_leaf_lo < sblock->s_first_data_block
+      || ix->ei_leaf_lo >= sblock->s_blocks_count)
+    return 0;
+  return ix->ei_leaf_lo;
+}
+
+/* Write out the modified extent tree node EH of NODE, consuming the
+   disk cache reference on it.  */
+static void
+ext_poke (struct node *node, struct ext2_extent_header *eh)
+{
+  if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
+    sync_global_ptr (eh, 1);
+  else
+    record_indir_poke (node, eh);
+}
+
+/* Release the nodes on PATH, which leads to a leaf at depth DEPTH,
+   writing out those that were modified.  */
+static void
+ext_path_release (struct node *node, struct ext_path *path, int depth)
+{
+  int level;
+
+  for (level = 1; level <= depth; level++)
+    if (path[level].dirty)
+      ext_poke (node, path[level].header);
+    else
+      disk_cache_block_deref (path[level].header);
+
+  if (path[0].dirty)
+    {
+      node->dn_stat_dirty = 1;
+      if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
+	diskfs_node_update (node, 1);
+    }
+}
+
+/* Walk down NODE's extent tree towards the leaf that covers BLOCK,
+   filling in PATH, which must have room for EXT2_EXT_MAX_DEPTH + 1
+   levels, and returning the depth of the tree in *DEPTH.  On success,
+   the caller must call ext_path_release.  */
+static error_t
+ext_find (struct node *node, block_t block, struct ext_path *path, int *depth)
+{
+  error_t err;
+  struct ext2_extent_header *eh = ext_root (node);
+  int level;
+
+  err = ext_check (node, eh, -1, EXT_ROOT_MAX);
+  if (err)
+    return err;
+
+  *depth = eh->eh_depth;
+  path[0].header = eh;
+  path[0].block = 0;
+  path[0].dirty = 0;
+
+  for (level = 0; ; level++)
+    {
+      int lo = 0, hi = eh->eh_entries - 1;
+
+      /* Find the last entry starting at or before BLOCK.  */
+      while (lo <= hi)
+	{
+	  int mid = (lo + hi) / 2;
+	  if (EXT_KEY (EXT_ENTRY (eh, mid)) > block)
+	    hi = mid - 1;
+	  else
+	    lo = mid + 1;
+	}
+      path[level].index = hi;
+
+      if (level == *depth)
+	break;
+
+      if (eh->eh_entries == 0)
+	{
+	  ext2_warning ("corrupt extent tree: inode: %Ld", node->cache_id);
+	  err = EIO;
+	}
+      else
+	{
+	  block_t child;
+
+	  /* Blocks before the first index entry are still looked for
+	     in the first subtree.  */
+	  if (path[level].index < 0)
+	    path[level].index = 0;
+
+	  child = ext_child (&EXT_FIRST_INDEX (eh)[path[level].index]);
+	  if (! child)
+	    {
+	      ext2_warning ("corrupt extent tree: inode: %Ld",
+			    node->cache_id);
+	      err = EIO;
+	    }
+	  else
+	    {
+	      eh = disk_cache_block_ref (child);
+	      err = ext_check (node, eh, *depth - level - 1, EXT_BLOCK_MAX);
+	      if (err)
+		disk_cache_block_deref (eh);
+	      else
+		{
+		  path[level + 1].header = eh;
+		  path[level + 1].block = child;
+		  path[level + 1].dirty = 0;
+		}
+	    }
+	}
+
+      if (err)
+	{
+	  ext_path_release (node, path, level);
+	  return err;
+	}
+    }
+
+  return 0;
+}
+
+/* Return the first logical block after the leaf entry PATH leads to
+   that is covered by the tree, or ~0 if there is none.  */
+static block_t
+ext_next_key (struct ext_path *path, int depth)
+{
+  int level;
+
+  for (level = depth; level >= 0; level--)
+    if (path[level].index + 1 < path[level].header->eh_entries)
+      return EXT_KEY (EXT_ENTRY (path[level].header, path[level].index + 1));
+
+  return ~(block_t) 0;
+}
+
+/* Free the COUNT data blocks starting at BLOCK, which belonged to
+   NODE.  */
+static void
+ext_free_blocks (struct node *node, block_t block, block_t count)
+{
+  ext2_free_blocks (block, count);
+  node->dn_stat.st_blocks -= count << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+}
+
+/* Allocate a new block near GOAL for a tree node at depth DEPTH of
+   NODE, and return it, with a reference to its empty node in *EH, or
+   0 if there is no space left.  */
+static block_t
+ext_alloc_node (struct node *node, block_t goal, int depth,
+		struct ext2_extent_header **eh)
+{
+  block_t block = ext2_alloc_block (node, goal, 0);
+
+  if (! block)
+    return 0;
+
+  *eh = disk_cache_block_ref (block);
+  memset (*eh, 0, block_size);
+  (*eh)->eh_magic = EXT2_EXT_MAGIC;
+  (*eh)->eh_max = EXT_BLOCK_MAX;
+  (*eh)->eh_depth = depth;
+
+  node->dn_stat.st_blocks += 1 << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+
+  return block;
+}
+
+/* Free the tree node EH of NODE, at disk block BLOCK, consuming the
+   disk cache reference on it.  */
+static void
+ext_free_node (struct node *node, block_t block,
+	       struct ext2_extent_header *eh)
+{
+  /* Make sure no stale contents of the node get written over whoever
+     gets the block next.  */
+  pager_flush_some (diskfs_disk_pager,
+		    bptr_index (eh) << log2_block_size, block_size, 1);
+  disk_cache_block_deref (eh);
+  ext_free_blocks (node, block, 1);
+}
+
+/* Set the key of the node at level LEVEL of PATH, which has changed to
+   KEY, in its ancestors.  */
+static void
+ext_update_keys (struct ext_path *path, int level, block_t key)
+{
+  for (; level > 0; level--)
+    {
+      struct ext_path *parent = &path[level - 1];
+
+      EXT_FIRST_INDEX (parent->header)[parent->index].ei_block = key;
+      parent->dirty = 1;
+      if (parent->index != 0)
+	break;
+    }
+}
+
+/* Inserting into the ancestors of the node at level LEVEL of PATH may
+   have split them, moving its index entry into a new sibling.  Walk down
+   the tree again to make the levels above LEVEL lead to it.  */
+static void
+ext_repath (struct node *node, struct ext_path *path, int level)
+{
+  block_t key = EXT_KEY (EXT_ENTRY (path[level].header, 0));
+  int l;
+
+  for (l = 1; l < level; l++)
+    if (path[l].dirty)
+      ext_poke (node, path[l].header);
+    else
+      disk_cache_block_deref (path[l].header);
+
+  for (l = 0; l < level; l++)
+    {
+      struct ext2_extent_header *eh = path[l].header;
+      int lo = 0, hi = eh->eh_entries - 1;
+
+      while (lo <= hi)
+	{
+	  int mid = (lo + hi) / 2;
+	  if (EXT_KEY (EXT_ENTRY (eh, mid)) > key)
+	    hi = mid - 1;
+	  else
+	    lo = mid + 1;
+	}
+      path[l].index = hi < 0 ? 0 : hi;
+
+      if (l + 1 < level)
+	{
+	  block_t child = ext_child (&EXT_FIRST_INDEX (eh)[path[l].index]);
+
+	  assert (child);
+	  path[l + 1].header = disk_cache_block_ref (child);
+	  path[l + 1].block = child;
+	  path[l + 1].dirty = 0;
+	}
+    }
+
+  assert (ext_child (&EXT_FIRST_INDEX (path[level - 1].header)
+		     [path[level - 1].index]) == path[level].block);
+}
+
+/* The root of NODE's tree, at level 0 of PATH, is full.  Move its
+   entries into a new block, and make the root an index node with just
+   one entry pointing there, making the tree one level deeper.  */
+static error_t
+ext_grow (struct node *node, struct ext_path *path, int *depth)
+{
+  struct ext2_extent_header *root = path[0].header, *eh;
+  struct ext2_extent_idx *ix;
+  block_t goal, block;
+
+  if (*depth >= EXT2_EXT_MAX_DEPTH)
+    return EFBIG;
+
+  goal = (diskfs_node_disknode (node)->info.i_block_group
+	  * EXT2_BLOCKS_PER_GROUP (sblock)) + sblock->s_first_data_block;
+  block = ext_alloc_node (node, goal, root->eh_depth, &eh);
+  if (! block)
+    return ENOSPC;
+
+  memcpy (eh + 1, root + 1, root->eh_entries * EXT_ENTRY_SIZE);
+  eh->eh_entries = root->eh_entries;
+
+  ix = EXT_FIRST_INDEX (root);
+  ix->ei_block = EXT_KEY (EXT_ENTRY (eh, 0));
+  ix->ei_leaf_lo = block;
+  ix->ei_leaf_hi = 0;
+  ix->ei_unused = 0;
+  root->eh_entries = 1;
+  root->eh_depth++;
+
+  memmove (&path[1], &path[0], (*depth + 1) * sizeof path[0]);
+  path[1].header = eh;
+  path[1].block = block;
+  path[1].dirty = 1;
+  path[0].header = root;
+  path[0].block = 0;
+  path[0].index = 0;
+  path[0].dirty = 1;
+  (*depth)++;
+
+  return 0;
+}
+
+/* Insert ENTRY as entry POS of the node at level LEVEL of PATH, which
+   leads to a leaf at depth *DEPTH, splitting nodes and making the tree
+   deeper as necessary.  On failure, the blocks the tree maps are left
+   unchanged.  */
+static error_t
+ext_insert (struct node *node, struct ext_path *path, int *depth,
+	    int level, int pos, const void *entry)
+{
+  error_t err;
+  struct ext2_extent_header *eh = path[level].header, *new, *into;
+  struct ext2_extent_idx ix;
+  block_t block, goal;
+  int n = eh->eh_entries, split, old_depth;
+
+  if (n < eh->eh_max)
+    {
+      memmove (EXT_ENTRY (eh, pos + 1), EXT_ENTRY (eh, pos),
+	       (n - pos) * EXT_ENTRY_SIZE);
+      memcpy (EXT_ENTRY (eh, pos), entry, EXT_ENTRY_SIZE);
+      eh->eh_entries++;
+      path[level].dirty = 1;
+      if (pos == 0)
+	ext_update_keys (path, level, EXT_KEY (entry));
+      return 0;
+    }
+
+  if (level == 0)
+    {
+      err = ext_grow (node, path, depth);
+      if (err)
+	return err;
+      return ext_insert (node, path, depth, 1, pos, entry);
+    }
+
+  /* The node is full, so split it.  When appending, which is by far
+     the most common case, start a new node; otherwise, split it in
+     half.  */
+  split = pos == n ? n : n / 2;
+
+  goal = path[level].block;
+  block = ext_alloc_node (node, goal, eh->eh_depth, &new);
+  if (! block)
+    return ENOSPC;
+
+  /* Enter the new node into the parent first, so that nothing has
+     changed yet if that fails.  This may make the tree deeper, moving
+     our node one level down.  */
+  ix.ei_block = split == n ? EXT_KEY (entry) : EXT_KEY (EXT_ENTRY (eh, split));
+  ix.ei_leaf_lo = block;
+  ix.ei_leaf_hi = 0;
+  ix.ei_unused = 0;
+  old_depth = *depth;
+  err = ext_insert (node, path, depth, level - 1, path[level - 1].index + 1,
+		    &ix);
+  if (err)
+    {
+      ext_free_node (node, block, new);
+      return err;
+    }
+  level += *depth - old_depth;
+  ext_repath (node, path, level);
+
+  memcpy (new + 1, EXT_ENTRY (eh, split), (n - split) * EXT_ENTRY_SIZE);
+  new->eh_entries = n - split;
+  eh->eh_entries = split;
+
+  if (pos <= split && split < n)
+    {
+      into = eh;
+      if (pos == 0)
+	ext_update_keys (path, level, EXT_KEY (entry));
+    }
+  else
+    {
+      into = new;
+      pos -= split;
+    }
+  memmove (EXT_ENTRY (into, pos + 1), EXT_ENTRY (into, pos),
+	   (into->eh_entries - pos) * EXT_ENTRY_SIZE);
+  memcpy (EXT_ENTRY (into, pos), entry, EXT_ENTRY_SIZE);
+  into->eh_entries++;
+
+  path[level].dirty = 1;
+  ext_poke (node, new);
+
+  return 0;
+}
+
+/* Split the uninitialized extent PATH leads to, in a tree of depth
+   *DEPTH, in two at the logical block AT, which must be inside it but
+   not its first block.  On failure, the tree is left unchanged.  */
+static error_t
+ext_split_uninit (struct node *node, struct ext_path *path, int *depth,
+		  block_t at)
+{
+  struct ext2_extent *ex =
+    &EXT_FIRST_EXTENT (path[*depth].header)[path[*depth].index];
+  struct ext2_extent tail;
+  block_t head = at - ex->ee_block;
+  __u16 len = ex->ee_len;
+  error_t err;
+
+  tail.ee_block = at;
+  tail.ee_len = len - head;
+  tail.ee_start_hi = 0;
+  tail.ee_start_lo = ex->ee_start_lo + head;
+  ex->ee_len = head + EXT2_EXT_INIT_MAX_LEN;
+
+  err = ext_insert (node, path, depth, *depth, path[*depth].index + 1, &tail);
+  if (err)
+    /* ext_insert failed before touching the leaf, but it may have made
+       the tree deeper, moving the leaf out of the root.  */
+    EXT_FIRST_EXTENT (path[*depth].header)[path[*depth].index].ee_len = len;
+  return err;
+}
+
+/* Write zeros over the disk block BLOCK.  */
+static error_t
+ext_zero_block (block_t block)
+{
+  error_t err;
+  size_t written;
+  void *zeros;
+
+  zeros = mmap (0, block_size, PROT_READ, MAP_ANON, 0, 0);
+  if (zeros == MAP_FAILED)
+    return ENOMEM;
+
+  err = store_write (store,
+		     (store_offset_t) block << log2_dev_blocks_per_fs_block,
+		     zeros, block_size, &written);
+  if (!err && written != block_size)
+    err = EIO;
+
+  munmap (zeros, block_size);
+  return err;
+}
+
+/* BLOCK of NODE is in an uninitialized extent: zero it on disk, mark it
+   alone as initialized, splitting the extent around it as needed, and
+   return its disk block in *DISK_BLOCK.  When the block follows an
+   initialized extent on disk, as when a preallocated file is written
+   sequentially, it is moved over to that extent instead.  */
+static error_t
+ext_initialize_block (struct node *node, block_t block, block_t *disk_block)
+{
+  error_t err;
+  struct ext_path path[EXT2_EXT_MAX_DEPTH + 1];
+  struct ext2_extent_header *leaf;
+  struct ext2_extent *ex, *prev;
+  int depth, i, merge;
+
+  for (;;)
+    {
+      err = ext_find (node, block, path, &depth);
+      if (err)
+	return err;
+
+      leaf = path[depth].header;
+      i = path[depth].index;
+      assert (i >= 0);
+      ex = &EXT_FIRST_EXTENT (leaf)[i];
+      assert (ext_uninit (ex) && block < ex->ee_block + ext_len (ex));
+
+      prev = i > 0 ? ex - 1 : NULL;
+      merge = (prev && !ext_uninit (prev) && prev->ee_start_hi == 0
+	       && prev->ee_block + prev->ee_len == block
+	       && prev->ee_start_lo + prev->ee_len == ex->ee_start_lo
+	       && prev->ee_len < EXT2_EXT_INIT_MAX_LEN);
+
+      if (block > ex->ee_block)
+	err = ext_split_uninit (node, path, &depth, block);
+      else if (ext_len (ex) > 1 && ! merge)
+	err = ext_split_uninit (node, path, &depth, block + 1);
+      else
+	break;
+
+      /* Look BLOCK up again, as splitting may have moved its extent.  */
+      ext_path_release (node, path, depth);
+      if (err)
+	return err;
+    }
+
+  /* EX now starts at BLOCK, and is either just that block, or can give
+     it to PREV.  */
+  *disk_block = ex->ee_start_lo;
+  err = ext_zero_block (*disk_block);
+  if (err)
+    {
+      ext_path_release (node, path, depth);
+      return err;
+    }
+
+  if (! merge)
+    ex->ee_len = 1;
+  else
+    {
+      prev->ee_len++;
+      if (ext_len (ex) > 1)
+	{
+	  /* EX isn't the first entry of LEAF, so no key changes.  */
+	  ex->ee_block++;
+	  ex->ee_start_lo++;
+	  ex->ee_len--;
+	}
+      else
+	{
+	  memmove (ex, ex + 1, (leaf->eh_entries - i - 1) * EXT_ENTRY_SIZE);
+	  leaf->eh_entries--;
+	}
+    }
+  path[depth].dirty = 1;
+
+  ext_path_release (node, path, depth);
+  return 0;
+}
+
+/* Return in *DISK_BLOCK the disk block corresponding to BLOCK in the
+   extent-mapped NODE, and in *COUNT the number of blocks, at most MAX,
+   starting at BLOCK that are mapped to consecutive disk blocks.  If
+   BLOCK is not allocated, EINVAL is returned, *DISK_BLOCK is set to 0
+   and *COUNT to the number of unallocated blocks, at most MAX, starting
+   at BLOCK.  */
+error_t
+ext2_extent_map (struct node *node, block_t block, block_t max,
+		 block_t *disk_block, block_t *count)
+{
+  error_t err;
+  struct ext_path path[EXT2_EXT_MAX_DEPTH + 1];
+  struct ext2_extent *ex = NULL;
+  block_t n;
+  int depth;
+
+  err = ext_find (node, block, path, &depth);
+  if (err)
+    return err;
+
+  if (path[depth].index >= 0)
+    ex = &EXT_FIRST_EXTENT (path[depth].header)[path[depth].index];
+
+  if (ex && block < ex->ee_block + ext_len (ex))
+    {
+      n = ex->ee_block + ext_len (ex) - block;
+      if (ext_uninit (ex))
+	{
+	  *disk_block = 0;
+	  err = EINVAL;
+	}
+      else if (ex->ee_start_hi != 0)
+	{
+	  ext2_warning ("block beyond 2^32: inode: %Ld", node->cache_id);
+	  err = EIO;
+	}
+      else
+	*disk_block = ex->ee_start_lo + (block - ex->ee_block);
+    }
+  else
+    {
+      block_t next = ext_next_key (path, depth);
+      n = next > block ? next - block : 1;
+      *disk_block = 0;
+      err = EINVAL;
+    }
+
+  *count = n < max ? n : max;
+
+  ext_path_release (node, path, depth);
+  return err;
+}
+
+/* Returns in DISK_BLOCK the disk block corresponding to BLOCK in the
+   extent-mapped NODE.  If there is no such block yet, but CREATE is
+   true, then it is created, otherwise EINVAL is returned.  */
+error_t
+ext2_extent_getblk (struct node *node, block_t block, int create,
+		    block_t *disk_block)
+{
+  error_t err;
+  struct ext_path path[EXT2_EXT_MAX_DEPTH + 1];
+  struct ext2_extent *ex = NULL, new;
+  struct ext2_extent_header *leaf;
+  block_t goal, result;
+  int depth;
+
+  err = ext_find (node, block, path, &depth);
+  if (err)
+    return err;
+
+  leaf = path[depth].header;
+  if (path[depth].index >= 0)
+    ex = &EXT_FIRST_EXTENT (leaf)[path[depth].index];
+
+  if (ex && block < ex->ee_block + ext_len (ex))
+    {
+      if (ex->ee_start_hi != 0)
+	{
+	  ext2_warning ("block beyond 2^32: inode: %Ld", node->cache_id);
+	  err = EIO;
+	}
+      else if (ext_uninit (ex))
+	{
+	  ext_path_release (node, path, depth);
+	  if (! create)
+	    return EINVAL;
+	  return ext_initialize_block (node, block, disk_block);
+	}
+      if (! err)
+	*disk_block = ex->ee_start_lo + (block - ex->ee_block);
+      ext_path_release (node, path, depth);
+      return err;
+    }
+
+  if (! create)
+    {
+      ext_path_release (node, path, depth);
+      return EINVAL;
+    }
+
+  /* Try to put the block right after the disk blocks of the preceding
+     extent, so that it can simply be made longer.  */
+  if (ex && ex->ee_start_hi == 0)
+    goal = ex->ee_start_lo + (block - ex->ee_block);
+  else
+    goal = (diskfs_node_disknode (node)->info.i_block_group
+	    * EXT2_BLOCKS_PER_GROUP (sblock)) + sblock->s_first_data_block;
+
+  result = ext2_alloc_block (node, goal, 0);
+  if (! result)
+    {
+      ext_path_release (node, path, depth);
+      return ENOSPC;
+    }
+
+  if (ex && !ext_uninit (ex) && ex->ee_start_hi == 0
+      && ex->ee_block + ex->ee_len == block
+      && ex->ee_start_lo + ex->ee_len == result
+      && ex->ee_len < EXT2_EXT_INIT_MAX_LEN)
+    {
+      ex->ee_len++;
+      path[depth].dirty = 1;
+    }
+  else
+    {
+      new.ee_block = block;
+      new.ee_len = 1;
+      new.ee_start_hi = 0;
+      new.ee_start_lo = result;
+      err = ext_insert (node, path, &depth, depth, path[depth].index + 1,
+			&new);
+      if (err)
+	{
+	  ext2_free_blocks (result, 1);
+	  ext_path_release (node, path, depth);
+	  return err;
+	}
+    }
+
+  ext_path_release (node, path, depth);
+
+  *disk_block = result;
+  node->dn_set_ctime = node->dn_set_mtime = 1;
+  node->dn_stat.st_blocks += 1 << log2_stat_blocks_per_fs_block;
+  node->dn_stat_dirty = 1;
+
+  if (diskfs_synchronous || diskfs_node_disknode (node)->info.i_osync)
+    diskfs_node_update (node, 1);
+
+  return 0;
+}
+
+/* Free the blocks at or after END in the subtree of NODE rooted at
+   EH.  Return true if EH was modified.  */
+static int
+ext_truncate_node (struct node *node, struct ext2_extent_header *eh,
+		   block_t end)
+{
+  int modified = 0;
+
+  if (eh->eh_depth == 0)
+    while (eh->eh_entries > 0)
+      {
+	struct ext2_extent *ex = &EXT_FIRST_EXTENT (eh)[eh->eh_entries - 1];
+	block_t len = ext_len (ex);
+
+	if (ex->ee_start_hi != 0)
+	  {
+	    ext2_warning ("block beyond 2^32: inode: %Ld", node->cache_id);
+	    break;
+	  }
+
+	if (ex->ee_block >= end)
+	  {
+	    ext_free_blocks (node, ex->ee_start_lo, len);
+	    eh->eh_entries--;
+	    modified = 1;
+	    continue;
+	  }
+
+	if (ex->ee_block + len > end)
+	  {
+	    block_t keep = end - ex->ee_block;
+	    ext_free_blocks (node, ex->ee_start_lo + keep, len - keep);
+	    ex->ee_len = keep + (ext_uninit (ex) ? EXT2_EXT_INIT_MAX_LEN : 0);
+	    modified = 1;
+	  }
+	break;
+      }
+  else
+    while (eh->eh_entries > 0)
+      {
+	struct ext2_extent_idx *ix = &EXT_FIRST_INDEX (eh)[eh->eh_entries - 1];
+	struct ext2_extent_header *child;
+	block_t block = ext_child (ix);
+
+	if (! block)
+	  {
+	    ext2_warning ("corrupt extent tree: inode: %Ld", node->cache_id);
+	    break;
+	  }
+
+	child = disk_cache_block_ref (block);
+	if (ext_check (node, child, eh->eh_depth - 1, EXT_BLOCK_MAX))
+	  {
+	    disk_cache_block_deref (child);
+	    break;
+	  }
+
+	if (! ext_truncate_node (node, child, end))
+	  {
+	    disk_cache_block_deref (child);
+	    break;
+	  }
+
+	if (child->eh_entries > 0)
+	  {
+	    /* Something before END is left in this subtree, and thus
+	       in all the ones before it.  */
+	    ext_poke (node, child);
+	    break;
+	  }
+
+	ext_free_node (node, block, child);
+	eh->eh_entries--;
+	modified = 1;
+      }
+
+  return modified;
+}
+
+/* Free all blocks in the extent-mapped NODE starting with block END.  */
+error_t
+ext2_extent_truncate (struct node *node, block_t end)
+{
+  error_t err;
+  struct ext2_extent_header *root = ext_root (node);
+
+  err = ext_check (node, root, -1, EXT_ROOT_MAX);
+  if (err)
+    return err;
+
+  if (ext_truncate_node (node, root, end))
+    {
+      if (root->eh_entries == 0)
+	{
+	  root->eh_depth = 0;
+	  root->eh_max = EXT_ROOT_MAX;
+	}
+      node->dn_stat_dirty = 1;
+    }
+
+  return 0;
+}
+
+/* Make the freshly allocated NODE extent-mapped, with an empty tree.  */
+void
+ext2_extent_init (struct node *node)
+{
+  struct ext2_extent_header *root = ext_root (node);
+
+  memset (diskfs_node_disknode (node)->info.i_data, 0,
+	  sizeof diskfs_node_disknode (node)->info.i_data);
+  root->eh_magic = EXT2_EXT_MAGIC;
+  root->eh_max = EXT_ROOT_MAX;
+  diskfs_node_disknode (node)->info.i_flags |= EXT2_EXTENTS_FL;
+  node->dn_stat_dirty = 1;
+}
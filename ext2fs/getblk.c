@@ -63,7 +63,7 @@ ext2_discard_prealloc (struct node *node)
 /* Allocate a new block for the file NODE, as close to block GOAL as
    possible, and return it, or 0 if none could be had.  If ZERO is true, then
    zero the block (and add it to NODE's list of modified indirect blocks).  */
-static block_t
+block_t
 ext2_alloc_block (struct node *node, block_t goal, int zero)
 {
 #ifdef EXT2FS_DEBUG
@@ -73,7 +73,8 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
 
 #ifdef EXT2_PREALLOCATE
   if (diskfs_node_disknode (node)->info.i_prealloc_count &&
-      (goal == diskfs_node_disknode (node)->info.i_prealloc_block ||
+      (diskfs_node_disknode (node)->alloc_run ||
+       goal == diskfs_node_disknode (node)->info.i_prealloc_block ||
        goal + 1 == diskfs_node_disknode (node)->info.i_prealloc_block))
     {
       result = diskfs_node_disknode (node)->info.i_prealloc_block++;
@@ -96,10 +97,12 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
 	 ? sblock->s_prealloc_dir_blocks
 	 : 0,
 	 &diskfs_node_disknode (node)->info.i_prealloc_count,
-	 &diskfs_node_disknode (node)->info.i_prealloc_block);
+	 &diskfs_node_disknode (node)->info.i_prealloc_block,
+	 diskfs_node_disknode (node)->delalloc_run);
     }
 #else
-  result = ext2_new_block (goal, 0, 0);
+  result = ext2_new_block (goal, 0, 0, 0,
+			   diskfs_node_disknode (node)->delalloc_run);
 #endif
 
   if (result && zero)
@@ -112,6 +115,55 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
   return result;
 }
 
+/* Allocate disk blocks for the COUNT unallocated blocks of NODE starting
+   with BLOCK, trying to place them in one contiguous run.  This is done by
+   preallocating the whole run up front, and then letting ext2_getblk take
+   the blocks for the data, and for any indirect blocks needed on the way,
+   from the preallocation in order.  */
+error_t
+ext2_alloc_run (struct node *node, block_t block, block_t count)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  error_t err = 0;
+  block_t disk_block;
+  block_t i;
+
+#ifdef EXT2_PREALLOCATE
+  if (count > 1)
+    {
+      block_t goal, first, n;
+
+      /* Continue right after the preceding block if it's allocated.  */
+      if (block > 0 && ext2_getblk_run (node, block - 1, 1, &goal, &n) == 0)
+	goal++;
+      else
+	goal = (dn->info.i_block_group * EXT2_BLOCKS_PER_GROUP (sblock)
+		+ sblock->s_first_data_block);
+
+      ext2_discard_prealloc (node);
+      first = ext2_new_block (goal, count + count / addr_per_block + 1,
+			      &dn->info.i_prealloc_count,
+			      &dn->info.i_prealloc_block, dn->delalloc_run);
+      if (! first)
+	return ENOSPC;
+
+      ext2_debug ("allocating run of %u blocks for inode %llu at %u[%u]",
+		  count, node->cache_id, first, dn->info.i_prealloc_count + 1);
+
+      /* Put FIRST back in front of the blocks preallocated after it.  */
+      dn->info.i_prealloc_block = first;
+      dn->info.i_prealloc_count++;
+      dn->alloc_run = 1;
+    }
+#endif
+
+  for (i = 0; !err && i < count; i++)
+    err = ext2_getblk (node, block + i, 1, &disk_block);
+
+  dn->alloc_run = 0;
+  return err;
+}
+
 static error_t
 inode_getblk (struct node *node, int nr, int create, int zero,
 	      block_t new_block, block_t *result)
@@ -247,6 +299,9 @@ ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
   block_t indir, b;
   unsigned long addr_per_block = EXT2_ADDR_PER_BLOCK (sblock);
 
+  if (diskfs_node_disknode (node)->info.i_flags & EXT2_EXTENTS_FL)
+    return ext2_extent_getblk (node, block, create, disk_block);
+
   if (block > EXT2_NDIR_BLOCKS + addr_per_block +
       addr_per_block * addr_per_block +
       addr_per_block * addr_per_block * addr_per_block)
@@ -313,3 +368,87 @@ ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
 
   return err;
 }
+
+/* Returns in DISK_BLOCK the disk block corresponding to BLOCK in NODE, and
+   in COUNT the number of blocks, at most MAX, starting at BLOCK that are
+   mapped to consecutive disk blocks.  If BLOCK is not allocated, EINVAL is
+   returned, and COUNT is set to a number of unallocated blocks starting at
+   BLOCK.  Only one lookup is needed for a whole run of an extent-mapped
+   file, or of the part of a run mapped by one indirect block.  */
+error_t
+ext2_getblk_run (struct node *node, block_t block, block_t max,
+		 block_t *disk_block, block_t *count)
+{
+  error_t err;
+  block_t *bptrs, first, b;
+  unsigned long index, limit;
+  unsigned long addr_per_block = EXT2_ADDR_PER_BLOCK (sblock);
+
+  if (diskfs_node_disknode (node)->info.i_flags & EXT2_EXTENTS_FL)
+    return ext2_extent_map (node, block, max, disk_block, count);
+
+  /* Find the array of block pointers that BLOCK's pointer is in.  */
+  if (block < EXT2_NDIR_BLOCKS)
+    {
+      bptrs = diskfs_node_disknode (node)->info.i_data;
+      index = block;
+      limit = EXT2_NDIR_BLOCKS;
+    }
+  else
+    {
+      block_t indir;
+
+      b = block - EXT2_NDIR_BLOCKS;
+      if (b < addr_per_block)
+	err = inode_getblk (node, EXT2_IND_BLOCK, 0, 0, 0, &indir);
+      else
+	{
+	  b -= addr_per_block;
+	  if (b < addr_per_block * addr_per_block)
+	    err = inode_getblk (node, EXT2_DIND_BLOCK, 0, 0, 0, &indir);
+	  else
+	    {
+	      b -= addr_per_block * addr_per_block;
+	      if (b >= addr_per_block * addr_per_block * addr_per_block)
+		{
+		  ext2_warning ("block > big: %u", block);
+		  return EIO;
+		}
+	      err = inode_getblk (node, EXT2_TIND_BLOCK, 0, 0, 0, &indir);
+	      if (!err)
+		err = block_getblk (node, indir,
+				    b / (addr_per_block * addr_per_block),
+				    0, 0, 0, &indir);
+	    }
+	  if (!err)
+	    err = block_getblk (node, indir,
+				(b / addr_per_block) & (addr_per_block - 1),
+				0, 0, 0, &indir);
+	}
+      if (err)
+	{
+	  /* The hole includes a whole indirect block, so at least the rest
+	     of the blocks it would map.  */
+	  b = addr_per_block - (b & (addr_per_block - 1));
+	  *disk_block = 0;
+	  *count = b < max ? b : max;
+	  return err;
+	}
+
+      bptrs = (block_t *) disk_cache_block_ref (indir);
+      index = b & (addr_per_block - 1);
+      limit = addr_per_block;
+    }
+
+  first = bptrs[index];
+  for (b = 1; b < max && index + b < limit; b++)
+    if (first ? bptrs[index + b] != first + b : bptrs[index + b] != 0)
+      break;
+
+  if (bptrs != diskfs_node_disknode (node)->info.i_data)
+    disk_cache_block_deref (bptrs);
+
+  *disk_block = first;
+  *count = b;
+  return first ? 0 : EINVAL;
+}
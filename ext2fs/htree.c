@@ -0,0 +1,255 @@
+/* Hash functions for indexed (htree) directories
+
+   Copyright (C) 2016 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* These must produce exactly the same values as the Linux
+   implementation, since the hashes are stored on disk.  */
+
+#include "ext2fs.h"
+
+#include <string.h>
+
+#define DELTA 0x9E3779B9
+
+static void
+tea_transform (uint32_t buf[4], const uint32_t in[4])
+{
+  uint32_t sum = 0;
+  uint32_t b0 = buf[0], b1 = buf[1];
+  uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+  int n = 16;
+
+  do
+    {
+      sum += DELTA;
+      b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+      b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+  while (--n);
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* F, G and H are basic MD4 functions: selection, majority, parity.  */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+#define ROUND(f, a, b, c, d, x, s) \
+  (a += f (b, c, d) + (x), a = ROL32 (a, s))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+/* Basic cut-down MD4 transform.  */
+static void
+half_md4_transform (uint32_t buf[4], const uint32_t in[8])
+{
+  uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  /* Round 1 */
+  ROUND (F, a, b, c, d, in[0] + K1,  3);
+  ROUND (F, d, a, b, c, in[1] + K1,  7);
+  ROUND (F, c, d, a, b, in[2] + K1, 11);
+  ROUND (F, b, c, d, a, in[3] + K1, 19);
+  ROUND (F, a, b, c, d, in[4] + K1,  3);
+  ROUND (F, d, a, b, c, in[5] + K1,  7);
+  ROUND (F, c, d, a, b, in[6] + K1, 11);
+  ROUND (F, b, c, d, a, in[7] + K1, 19);
+
+  /* Round 2 */
+  ROUND (G, a, b, c, d, in[1] + K2,  3);
+  ROUND (G, d, a, b, c, in[3] + K2,  5);
+  ROUND (G, c, d, a, b, in[5] + K2,  9);
+  ROUND (G, b, c, d, a, in[7] + K2, 13);
+  ROUND (G, a, b, c, d, in[0] + K2,  3);
+  ROUND (G, d, a, b, c, in[2] + K2,  5);
+  ROUND (G, c, d, a, b, in[4] + K2,  9);
+  ROUND (G, b, c, d, a, in[6] + K2, 13);
+
+  /* Round 3 */
+  ROUND (H, a, b, c, d, in[3] + K3,  3);
+  ROUND (H, d, a, b, c, in[7] + K3,  9);
+  ROUND (H, c, d, a, b, in[2] + K3, 11);
+  ROUND (H, b, c, d, a, in[6] + K3, 15);
+  ROUND (H, a, b, c, d, in[1] + K3,  3);
+  ROUND (H, d, a, b, c, in[5] + K3,  9);
+  ROUND (H, c, d, a, b, in[0] + K3, 11);
+  ROUND (H, b, c, d, a, in[4] + K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+#undef ROUND
+#undef F
+#undef G
+#undef H
+#undef K1
+#undef K2
+#undef K3
+
+/* The old legacy hash.  */
+static uint32_t
+dx_hack_hash (const char *name, size_t len, int unsigned_flag)
+{
+  uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  const unsigned char *ucp = (const unsigned char *) name;
+  const signed char *scp = (const signed char *) name;
+  int c;
+
+  while (len--)
+    {
+      if (unsigned_flag)
+	c = (int) *ucp++;
+      else
+	c = (int) *scp++;
+
+      hash = hash1 + (hash0 ^ (c * 7152373));
+
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+  return hash0 << 1;
+}
+
+/* Fill in the NUM words of BUF from the LEN bytes of MSG, padding
+   them with a value derived from LEN.  */
+static void
+str2hashbuf (const char *msg, size_t len, uint32_t *buf, int num,
+	     int unsigned_flag)
+{
+  uint32_t pad, val;
+  size_t i;
+  int c;
+  const unsigned char *ucp = (const unsigned char *) msg;
+  const signed char *scp = (const signed char *) msg;
+
+  pad = (uint32_t) len | ((uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      if (unsigned_flag)
+	c = (int) ucp[i];
+      else
+	c = (int) scp[i];
+
+      val = c + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+/* Compute the directory index hash of the LEN bytes long NAME using
+   hash algorithm VERSION (one of the DX_HASH_* values) and the hash
+   seed SEED, which may be all zeros.  Return the hash in *HASH, and
+   the minor hash in *MINOR_HASH if MINOR_HASH is not NULL.  Return
+   EINVAL if VERSION is not known.  */
+error_t
+ext2_dirhash (const char *name, size_t len, int version,
+	      const uint32_t seed[4],
+	      uint32_t *hash, uint32_t *minor_hash)
+{
+  uint32_t major = 0, minor = 0;
+  uint32_t in[8], buf[4];
+  const char *p;
+  int unsigned_flag = 0;
+  int i;
+
+  /* Initialize the default seed for the hash checksum functions.  */
+  buf[0] = 0x67452301;
+  buf[1] = 0xefcdab89;
+  buf[2] = 0x98badcfe;
+  buf[3] = 0x10325476;
+
+  /* Use the given seed, unless it is all zeros.  */
+  for (i = 0; i < 4; i++)
+    if (seed[i])
+      {
+	memcpy (buf, seed, sizeof buf);
+	break;
+      }
+
+  switch (version)
+    {
+    case DX_HASH_LEGACY_UNSIGNED:
+      unsigned_flag = 1;
+      /* Fall through.  */
+    case DX_HASH_LEGACY:
+      major = dx_hack_hash (name, len, unsigned_flag);
+      break;
+
+    case DX_HASH_HALF_MD4_UNSIGNED:
+      unsigned_flag = 1;
+      /* Fall through.  */
+    case DX_HASH_HALF_MD4:
+      for (p = name; len > 0; len -= len > 32 ? 32 : len, p += 32)
+	{
+	  str2hashbuf (p, len, in, 8, unsigned_flag);
+	  half_md4_transform (buf, in);
+	}
+      minor = buf[2];
+      major = buf[1];
+      break;
+
+    case DX_HASH_TEA_UNSIGNED:
+      unsigned_flag = 1;
+      /* Fall through.  */
+    case DX_HASH_TEA:
+      for (p = name; len > 0; len -= len > 16 ? 16 : len, p += 16)
+	{
+	  str2hashbuf (p, len, in, 4, unsigned_flag);
+	  tea_transform (buf, in);
+	}
+      major = buf[0];
+      minor = buf[1];
+      break;
+
+    default:
+      return EINVAL;
+    }
+
+  /* The lowest bit is used to mark hash collisions in the index, and
+     the largest value is reserved as an end of directory marker.  */
+  major &= ~1;
+  if (major == (0x7fffffffU << 1))
+    major = (0x7fffffffU - 1) << 1;
+
+  *hash = major;
+  if (minor_hash)
+    *minor_hash = minor;
+  return 0;
+}
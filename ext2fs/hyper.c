@@ -17,6 +17,7 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <error.h>
@@ -130,7 +131,11 @@ get_hypermetadata (void)
 			sblock->s_feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPP);
 	  diskfs_readonly = 1;
 	}
-      if (sblock->s_inode_size != EXT2_GOOD_OLD_INODE_SIZE)
+      /* Only the first EXT2_GOOD_OLD_INODE_SIZE bytes of larger inodes,
+	 as made by recent versions of mke2fs, are used.  */
+      if (sblock->s_inode_size < EXT2_GOOD_OLD_INODE_SIZE
+	  || sblock->s_inode_size > block_size
+	  || (sblock->s_inode_size & (sblock->s_inode_size - 1)))
 	ext2_panic ("inode size %d isn't supported", sblock->s_inode_size);
     }
 
@@ -144,6 +149,16 @@ get_hypermetadata (void)
   addr_per_block = block_size / sizeof (block_t);
   db_per_group = (groups_count + desc_per_block - 1) / desc_per_block;
 
+  if (! group_locks)
+    {
+      int i;
+      group_locks = malloc (groups_count * sizeof *group_locks);
+      if (! group_locks)
+	ext2_panic ("can't allocate block group locks");
+      for (i = 0; i < groups_count; i++)
+	pthread_spin_init (&group_locks[i], PTHREAD_PROCESS_PRIVATE);
+    }
+
   ext2fs_clean = sblock->s_state & EXT2_VALID_FS;
   if (! ext2fs_clean)
     {
@@ -64,12 +64,9 @@ diskfs_free_node (struct node *np, mode_t old_mode)
 
   ext2_free_xattr_block (np);
 
-  pthread_spin_lock (&global_lock);
-
   if (inum < EXT2_FIRST_INO (sblock) || inum > sblock->s_inodes_count)
     {
       ext2_error ("reserved inode or nonexistent inode: %Ld", inum);
-      pthread_spin_unlock (&global_lock);
       return;
     }
 
@@ -77,6 +74,7 @@ diskfs_free_node (struct node *np, mode_t old_mode)
   bit = (inum - 1) % sblock->s_inodes_per_group;
 
   gdp = group_desc (block_group);
+  pthread_spin_lock (group_lock (block_group));
   bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
 
   if (!clear_bit (bit, bh))
@@ -92,12 +90,12 @@ diskfs_free_node (struct node *np, mode_t old_mode)
       disk_cache_block_ref_ptr (gdp);
       record_global_poke (gdp);
 
-      sblock->s_free_inodes_count++;
+      __atomic_add_fetch (&sblock->s_free_inodes_count, 1, __ATOMIC_RELAXED);
     }
 
   disk_cache_block_deref (bh);
   sblock_dirty = 1;
-  pthread_spin_unlock (&global_lock);
+  pthread_spin_unlock (group_lock (block_group));
   alloc_sync(0);
 }
 
@@ -112,6 +110,9 @@ diskfs_free_node (struct node *np, mode_t old_mode)
  *
  * For other inodes, search forward from the parent directory\'s block
  * group to find a free inode.
+ *
+ * The free counts are read without locking to choose a group; only the
+ * lock of the chosen group is then taken, and the choice rechecked.
  */
 ino_t
 ext2_alloc_inode (ino_t dir_inum, mode_t mode)
@@ -122,8 +123,6 @@ ext2_alloc_inode (ino_t dir_inum, mode_t mode)
   struct ext2_group_desc *gdp;
   struct ext2_group_desc *tmp;
 
-  pthread_spin_lock (&global_lock);
-
 repeat:
   assert (bh == NULL);
   gdp = NULL;
@@ -131,7 +130,9 @@ repeat:
 
   if (S_ISDIR (mode))
     {
-      avefreei = sblock->s_free_inodes_count / groups_count;
+      avefreei = (__atomic_load_n (&sblock->s_free_inodes_count,
+				   __ATOMIC_RELAXED)
+		  / groups_count);
 
 /* I am not yet convinced that this next bit is necessary.
       i = inode_group_num(dir_inum);
@@ -215,9 +216,14 @@ repeat:
     }
 
   if (!gdp)
+    return 0;
+
+  pthread_spin_lock (group_lock (i));
+  if (gdp->bg_free_inodes_count == 0)
     {
-      pthread_spin_unlock (&global_lock);
-      return 0;
+      /* Someone else took the last one.  */
+      pthread_spin_unlock (group_lock (i));
+      goto repeat;
     }
 
   bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
@@ -230,6 +236,7 @@ repeat:
 	  ext2_warning ("bit already set for inode %llu", inum);
 	  disk_cache_block_deref (bh);
 	  bh = NULL;
+	  pthread_spin_unlock (group_lock (i));
 	  goto repeat;
 	}
       record_global_poke (bh);
@@ -239,13 +246,9 @@ repeat:
     {
       disk_cache_block_deref (bh);
       bh = NULL;
-      if (gdp->bg_free_inodes_count != 0)
-	{
-	  ext2_error ("free inodes count corrupted in group %d", i);
-	  inum = 0;
-	  goto sync_out;
-	}
-      goto repeat;
+      ext2_error ("free inodes count corrupted in group %d", i);
+      inum = 0;
+      goto sync_out;
     }
 
   inum += i * sblock->s_inodes_per_group + 1;
@@ -263,12 +266,12 @@ repeat:
   disk_cache_block_ref_ptr (gdp);
   record_global_poke (gdp);
 
-  sblock->s_free_inodes_count--;
+  __atomic_sub_fetch (&sblock->s_free_inodes_count, 1, __ATOMIC_RELAXED);
   sblock_dirty = 1;
 
  sync_out:
   assert (bh == NULL);
-  pthread_spin_unlock (&global_lock);
+  pthread_spin_unlock (group_lock (i));
   alloc_sync (0);
 
   /* Make sure the coming read_node won't complain about bad
@@ -341,6 +344,12 @@ diskfs_alloc_node (struct node *dir, mode_t mode, struct node **node)
     ext2_mask_flags(mode,
 	       diskfs_node_disknode (dir)->info.i_flags & EXT2_FL_INHERITED);
 
+  /* Map the blocks of new files and directories with extents, if the
+     filesystem allows that.  */
+  if (EXT2_HAS_INCOMPAT_FEATURE (sblock, EXT2_FEATURE_INCOMPAT_EXTENTS)
+      && (S_ISREG (mode) || S_ISDIR (mode)))
+    ext2_extent_init (np);
+
   st->st_flags = 0;
 
   /*
@@ -369,8 +378,6 @@ ext2_count_free_inodes ()
   struct ext2_group_desc *gdp;
   int i;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -378,17 +385,18 @@ ext2_count_free_inodes ()
     {
       void *bh;
       gdp = group_desc (i);
+      pthread_spin_lock (group_lock (i));
       desc_count += gdp->bg_free_inodes_count;
       bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
       x = count_free (bh, sblock->s_inodes_per_group / 8);
       disk_cache_block_deref (bh);
+      pthread_spin_unlock (group_lock (i));
       ext2_debug ("group %d: stored = %d, counted = %lu",
 		  i, gdp->bg_free_inodes_count, x);
       bitmap_count += x;
     }
   ext2_debug ("stored = %u, computed = %lu, %lu",
 	      sblock->s_free_inodes_count, desc_count, bitmap_count);
-  pthread_spin_unlock (&global_lock);
   return desc_count;
 #else
   return sblock->s_free_inodes_count;
@@ -404,8 +412,6 @@ ext2_check_inodes_bitmap ()
   struct ext2_group_desc *gdp;
   unsigned long desc_count, bitmap_count, x;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -413,6 +419,7 @@ ext2_check_inodes_bitmap ()
     {
       void *bh;
       gdp = group_desc (i);
+      pthread_spin_lock (group_lock (i));
       desc_count += gdp->bg_free_inodes_count;
       bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
       x = count_free (bh, sblock->s_inodes_per_group / 8);
@@ -421,12 +428,13 @@ ext2_check_inodes_bitmap ()
 	ext2_error ("wrong free inodes count in group %d, "
 		    "stored = %d, counted = %lu",
 		    i, gdp->bg_free_inodes_count, x);
+      pthread_spin_unlock (group_lock (i));
       bitmap_count += x;
     }
+  /* Without a global lock, this is only meaningful if nothing is being
+     allocated or freed concurrently.  */
   if (sblock->s_free_inodes_count != bitmap_count)
     ext2_error ("wrong free inodes count in super block, "
 		"stored = %lu, counted = %lu",
 		(unsigned long) sblock->s_free_inodes_count, bitmap_count);
-
-  pthread_spin_unlock (&global_lock);
 }
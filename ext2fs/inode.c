@@ -1,7 +1,7 @@
 /* Inode management routines
 
-   Copyright (C) 1994, 1995, 1996, 1997, 1998, 1999, 2000, 2001, 2002, 2007
-     Free Software Foundation, Inc.
+   Copyright (C) 1994, 1995, 1996, 1997, 1998, 1999, 2000, 2001, 2002, 2007,
+     2026 Free Software Foundation, Inc.
 
    Converted for ext2fs by Miles Bader <miles@gnu.org>
 
@@ -60,6 +60,12 @@ diskfs_user_make_node (struct node **npp, struct lookup_context *ctx)
   dn->dirents = 0;
   dn->dir_idx = 0;
   dn->pager = 0;
+  dn->read_ahead_next = 0;
+  dn->read_ahead_pages = 0;
+  hurd_ihash_init (&dn->delalloc, HURD_IHASH_NO_LOCP);
+  dn->delalloc_blocks = 0;
+  dn->alloc_run = 0;
+  dn->delalloc_run = 0;
   pthread_rwlock_init (&dn->alloc_lock, NULL);
   pokel_init (&dn->indir_pokel, diskfs_disk_pager, disk_cache);
 
@@ -76,6 +82,10 @@ diskfs_node_norefs (struct node *np)
     free (diskfs_node_disknode (np)->dirents);
   assert (!diskfs_node_disknode (np)->pager);
 
+  /* Any pages still only reserved are gone with the pager.  */
+  ext2_delalloc_release (np, 0);
+  hurd_ihash_destroy (&diskfs_node_disknode (np)->delalloc);
+
   /* Move any pending writes of indirect blocks.  */
   pokel_inherit (&global_pokel, &diskfs_node_disknode (np)->indir_pokel);
   pokel_finalize (&diskfs_node_disknode (np)->indir_pokel);
@@ -433,6 +443,12 @@ write_node (struct node *np)
 	info->i_flags |= EXT2_NODUMP_FL;
       if (st->st_flags & UF_IMMUTABLE)
 	info->i_flags |= EXT2_IMMUTABLE_FL;
+      /* New nodes are created as regular files, and may have been made
+	 extent-mapped before becoming a device, fifo or socket, which
+	 have no blocks and keep their own data in i_block.  */
+      if (st->st_mode && ! S_ISREG (st->st_mode) && ! S_ISDIR (st->st_mode)
+	  && ! S_ISLNK (st->st_mode))
+	info->i_flags &= ~EXT2_EXTENTS_FL;
       di->i_flags = info->i_flags;
 
       if (st->st_mode == 0)
@@ -535,6 +551,10 @@ diskfs_set_statfs (struct statfs *st)
   st->f_bsize = block_size;
   st->f_blocks = sblock->s_blocks_count;
   st->f_bfree = sblock->s_free_blocks_count;
+  if (st->f_bfree > delalloc_reserved)
+    st->f_bfree -= delalloc_reserved;
+  else
+    st->f_bfree = 0;
   st->f_bavail = st->f_bfree - sblock->s_r_blocks_count;
   if (st->f_bfree < sblock->s_r_blocks_count)
     st->f_bavail = 0;
@@ -640,7 +660,7 @@ diskfs_set_translator (struct node *np, const char *name, unsigned namelen,
 	    ext2_new_block ((diskfs_node_disknode (np)->info.i_block_group
 			    * EXT2_BLOCKS_PER_GROUP (sblock))
 			    + sblock->s_first_data_block,
-			    0, 0, 0);
+			    0, 0, 0, 0);
 	  if (blkno == 0)
 	    {
 	      dino_deref (di);
@@ -773,6 +793,11 @@ write_symlink (struct node *node, const char *target)
 
   assert (node->dn_stat.st_blocks == 0);
 
+  /* The target replaces the (empty) extent tree the node may have been
+     given when it was created as a regular file.  */
+  diskfs_node_disknode (node)->info.i_flags &= ~EXT2_EXTENTS_FL;
+  memset (diskfs_node_disknode (node)->info.i_data, 0,
+	  sizeof diskfs_node_disknode (node)->info.i_data);
   memcpy (diskfs_node_disknode (node)->info.i_data, target, len);
   node->dn_stat.st_size = len - 1;
   node->dn_set_ctime = 1;
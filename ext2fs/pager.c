@@ -38,6 +38,16 @@ struct port_bucket *file_pager_bucket;
    worker threads can be inhibited and resumed.  */
 struct pager_requests *file_pager_requests;
 
+/* The maximum number of paging threads per pager, zero meaning the
+   default.  */
+int paging_workers;
+
+/* Whether to delay the allocation of blocks until write-back.  */
+int delayed_allocation;
+
+/* The number of blocks reserved for delayed allocation in all files.  */
+block_t delalloc_reserved;
+
 pthread_spinlock_t node_to_page_lock = PTHREAD_SPINLOCK_INITIALIZER;
 
 
@@ -61,22 +71,30 @@ struct ext2fs_pager_stats
   unsigned long file_pagein_reads; /* Device reads done by file pagein */
   unsigned long file_pagein_freed_bufs;	/* Discarded pages */
   unsigned long file_pagein_alloced_bufs; /* Allocated pages */
+  unsigned long file_read_aheads; /* Clustered reads done by file pagein */
+  unsigned long file_read_ahead_pages; /* Pages offered by those reads */
 
   unsigned long file_pageouts;
 
   unsigned long file_page_unlocks;
   unsigned long file_grows;
+
+  unsigned long file_delalloc_runs; /* Runs allocated at write-back */
+  unsigned long file_delalloc_blocks; /* Blocks in those runs */
 };
 
 static struct ext2fs_pager_stats ext2s_pager_stats =
   { .lock = PTHREAD_SPINLOCK_INITIALIZER };
 
-#define STAT_INC(field)							      \
+#define STAT_ADD(field, n)						      \
 do { pthread_spin_lock (&ext2s_pager_stats.lock);			      \
-     ext2s_pager_stats.field++;						      \
+     ext2s_pager_stats.field += (n);					      \
      pthread_spin_unlock (&ext2s_pager_stats.lock); } while (0)
 
+#define STAT_INC(field) STAT_ADD (field, 1)
+
 #else /* !STATS */
+#define STAT_ADD(field, n) /* nop */0
 #define STAT_INC(field) /* nop */0
 #endif /* STATS */
 
@@ -132,15 +150,19 @@ free_page_buf (void *buf)
 }
 
 /* Find the location on disk of page OFFSET in NODE.  Return the disk block
-   in BLOCK (if unallocated, then return 0).  If *LOCK is 0, then a reader
-   lock is acquired on NODE's ALLOC_LOCK before doing anything, and left
-   locked after the return -- even if an error is returned.  0 is returned
-   on success otherwise an error code.  */
+   in BLOCK (if unallocated, then return 0).  If RUN is not NULL, return in
+   *RUN the number of blocks, starting with that one, that are mapped to
+   consecutive disk blocks (or are all unallocated), not counting any past
+   the end of NODE.  If *LOCK is 0, then a reader lock is acquired on NODE's
+   ALLOC_LOCK before doing anything, and left locked after the return -- even
+   if an error is returned.  0 is returned on success otherwise an error
+   code.  */
 static error_t
 find_block (struct node *node, vm_offset_t offset,
-	    block_t *block, pthread_rwlock_t **lock)
+	    block_t *block, block_t *run, pthread_rwlock_t **lock)
 {
   error_t err;
+  block_t count = 1;
 
   if (!*lock)
     {
@@ -151,7 +173,9 @@ find_block (struct node *node, vm_offset_t offset,
   if (offset + block_size > node->allocsize)
     return EIO;
 
-  err = ext2_getblk (node, offset >> log2_block_size, 0, block);
+  err = ext2_getblk_run (node, offset >> log2_block_size,
+			 (node->allocsize - offset) >> log2_block_size,
+			 block, &count);
   if (err == EINVAL)
     /* Don't barf yet if the node is unallocated.  */
     {
@@ -159,12 +183,104 @@ find_block (struct node *node, vm_offset_t offset,
       err = 0;
     }
 
+  if (run)
+    *run = count;
+
   return err;
 }
-
+
+/* Return the number of whole pages, at most MAX_PAGES, starting at
+   OFFSET in NODE that are backed by a single run of consecutive,
+   allocated disk blocks; the first block of the run is returned in
+   *BLOCK.  NODE's ALLOC_LOCK must be held.  */
+static int
+find_page_run (struct node *node, vm_offset_t offset, int max_pages,
+	       block_t *block)
+{
+  pthread_rwlock_t *lock = &diskfs_node_disknode (node)->alloc_lock;
+  block_t run;
+  int pages;
+
+  if (find_block (node, offset, block, &run, &lock) || *block == 0)
+    return 0;
+
+  pages = (run << log2_block_size) / vm_page_size;
+  return pages < max_pages ? pages : max_pages;
+}
+
+/* Try to read page PAGE of NODE together with up to AHEAD following
+   pages using one device read, and return the page at PAGE in *BUF.
+   The other pages are offered to the kernel; this is safe because no
+   write-back for NODE's pager can happen while we are servicing one of
+   its paging requests.  Return the number of pages read, or zero if
+   the pages are not contiguous on disk or the read failed, in which
+   case the caller should fall back to reading PAGE alone.  */
+static int
+file_pager_read_cluster (struct node *node, vm_offset_t page, int ahead,
+			 void **buf)
+{
+  error_t err;
+  struct disknode *dn = diskfs_node_disknode (node);
+  struct pager *pager;
+  block_t block;
+  int pages;
+  void *data = NULL;
+  size_t amount, len = 0;
+
+  pthread_rwlock_rdlock (&dn->alloc_lock);
+
+  pages = find_page_run (node, page, 1 + ahead, &block);
+  if (pages < 2)
+    {
+      pthread_rwlock_unlock (&dn->alloc_lock);
+      return 0;
+    }
+
+  amount = pages * vm_page_size;
+  err = store_read (store,
+		    (store_offset_t) block << log2_dev_blocks_per_fs_block,
+		    amount, &data, &len);
+
+  pthread_rwlock_unlock (&dn->alloc_lock);
+
+  if (err)
+    return 0;
+  if (len != amount)
+    {
+      munmap (data, len);
+      return 0;
+    }
+
+  ext2_debug ("read inode %llu pages %lu[%d] from block %u",
+	      node->cache_id, page, pages, block);
+
+  STAT_INC (file_read_aheads);
+  STAT_ADD (file_read_ahead_pages, pages - 1);
+
+  pthread_spin_lock (&node_to_page_lock);
+  pager = dn->pager;
+  if (pager)
+    ports_port_ref (pager);
+  pthread_spin_unlock (&node_to_page_lock);
+
+  if (pager)
+    {
+      pager_offer_pages (pager, 0, 0, page + vm_page_size,
+			 (vm_address_t) data + vm_page_size,
+			 amount - vm_page_size);
+      ports_port_deref (pager);
+    }
+  else
+    munmap (data + vm_page_size, amount - vm_page_size);
+
+  *buf = data;
+  return pages;
+}
+
 /* Read one page for the pager backing NODE at offset PAGE, into BUF.  This
    may need to read several filesystem blocks to satisfy one page, and tries
-   to consolidate the i/o if possible.  */
+   to consolidate the i/o if possible.  If NODE is being read sequentially,
+   following pages are read along with PAGE and offered to the kernel.  */
 static error_t
 file_pager_read_page (struct node *node, vm_offset_t page,
 		      void **buf, int *writelock)
@@ -176,10 +292,38 @@ file_pager_read_page (struct node *node, vm_offset_t page,
   int left = vm_page_size;
   block_t pending_blocks = 0;
   int num_pending_blocks = 0;
+  struct disknode *dn = diskfs_node_disknode (node);
 
   ext2_debug ("reading inode %llu page %lu[%u]",
 	      node->cache_id, page, vm_page_size);
 
+  /* A fault right after the pages we last read (ahead) means the file
+     is being read sequentially; open the read-ahead window, or widen
+     it.  Anything else closes it.  */
+  if (page == dn->read_ahead_next)
+    {
+      if (dn->read_ahead_pages == 0)
+	dn->read_ahead_pages = READ_AHEAD_MIN_PAGES;
+      else if (dn->read_ahead_pages < READ_AHEAD_MAX_PAGES)
+	dn->read_ahead_pages *= 2;
+    }
+  else
+    dn->read_ahead_pages = 0;
+  dn->read_ahead_next = page + vm_page_size;
+
+  if (dn->read_ahead_pages > 0)
+    {
+      int pages = file_pager_read_cluster (node, page,
+					   dn->read_ahead_pages, buf);
+      if (pages > 0)
+	{
+	  STAT_INC (file_pageins);
+	  dn->read_ahead_next = page + pages * vm_page_size;
+	  *writelock = 0;
+	  return 0;
+	}
+    }
+
   /* Read the NUM_PENDING_BLOCKS blocks in PENDING_BLOCKS, into the buffer
      pointed to by BUF (allocating it if necessary) at offset OFFS.  OFFS in
      adjusted by the amount read, and NUM_PENDING_BLOCKS is zeroed.  Any read
@@ -248,7 +392,7 @@ file_pager_read_page (struct node *node, vm_offset_t page,
     {
       block_t block;
 
-      err = find_block (node, page, &block, &lock);
+      err = find_block (node, page, &block, NULL, &lock);
       if (err)
 	break;
 
@@ -319,16 +463,31 @@ pending_blocks_write (struct pending_blocks *pb)
 
       ext2_debug ("writing block %u[%ld]", pb->block, pb->num);
 
-      if (pb->offs > 0)
+      if (pb->offs % vm_page_size)
 	/* Put what we're going to write into a page-aligned buffer.  */
 	{
-	  void *page_buf = get_page_buf ();
+	  void *page_buf;
+	  if (length <= vm_page_size)
+	    page_buf = get_page_buf ();
+	  else
+	    {
+	      page_buf = mmap (0, round_page (length), PROT_READ|PROT_WRITE,
+			       MAP_ANON, 0, 0);
+	      if (page_buf == MAP_FAILED)
+		page_buf = 0;
+	    }
+	  if (! page_buf)
+	    return ENOMEM;
 	  memcpy ((void *)page_buf, pb->buf + pb->offs, length);
 	  err = store_write (store, dev_block, page_buf, length, &amount);
-	  free_page_buf (page_buf);
+	  if (length <= vm_page_size)
+	    free_page_buf (page_buf);
+	  else
+	    munmap (page_buf, round_page (length));
 	}
       else
-	err = store_write (store, dev_block, pb->buf, length, &amount);
+	err = store_write (store, dev_block, pb->buf + pb->offs, length,
+			   &amount);
       if (err)
 	return err;
       else if (amount != length)
@@ -376,17 +535,142 @@ pending_blocks_add (struct pending_blocks *pb, block_t block)
   return 0;
 }
 
-/* Write one page for the pager backing NODE, at OFFSET, into BUF.  This
-   may need to write several filesystem blocks to satisfy one page, and tries
-   to consolidate the i/o if possible.  */
+/* Value stored in a disknode's DELALLOC table for each reserved block.  */
+#define DELALLOC_RESERVED ((hurd_ihash_value_t) 1)
+
+block_t
+ext2_delalloc_reserve (void)
+{
+  block_t reserved = __atomic_load_n (&delalloc_reserved, __ATOMIC_RELAXED);
+  return reserved ? reserved + reserved / addr_per_block + 3 : 0;
+}
+
+/* Reserve space for block BLOCK of NODE, which is to become writable,
+   unless it is allocated or reserved already.  NODE's ALLOC_LOCK must be
+   held for writing.  */
 static error_t
-file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
+delalloc_reserve (struct node *node, block_t block)
 {
-  error_t err = 0;
+  struct disknode *dn = diskfs_node_disknode (node);
+  block_t disk_block, count, free;
+  error_t err;
+
+  err = ext2_getblk_run (node, block, 1, &disk_block, &count);
+  if (err != EINVAL)
+    return err;
+  if (hurd_ihash_find (&dn->delalloc, block))
+    return 0;
+
+  /* Keep back an estimate of the indirect blocks that will be needed as
+     well when the reserved blocks get allocated.  */
+  __atomic_add_fetch (&delalloc_reserved, 1, __ATOMIC_RELAXED);
+  free = __atomic_load_n (&sblock->s_free_blocks_count, __ATOMIC_RELAXED);
+  if (ext2_delalloc_reserve () > free)
+    err = ENOSPC;
+  else
+    err = hurd_ihash_add (&dn->delalloc, block, DELALLOC_RESERVED);
+
+  if (err)
+    __atomic_sub_fetch (&delalloc_reserved, 1, __ATOMIC_RELAXED);
+  else
+    dn->delalloc_blocks++;
+
+  return err;
+}
+
+/* Drop the reservations of NODE for the COUNT blocks starting with BLOCK,
+   which have just been allocated.  NODE's ALLOC_LOCK must be held for
+   writing.  */
+static void
+delalloc_unreserve (struct node *node, block_t block, block_t count)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  block_t dropped = 0;
+
+  for (; count > 0 && dn->delalloc_blocks > dropped; block++, count--)
+    dropped += hurd_ihash_remove (&dn->delalloc, block);
+
+  dn->delalloc_blocks -= dropped;
+  __atomic_sub_fetch (&delalloc_reserved, dropped, __ATOMIC_RELAXED);
+}
+
+/* Release the delayed allocation reservations of NODE for its blocks
+   starting with block END.  NODE's ALLOC_LOCK must be held for
+   writing.  */
+void
+ext2_delalloc_release (struct node *node, block_t end)
+{
+  struct disknode *dn = diskfs_node_disknode (node);
+  block_t dropped = 0;
+
+  if (dn->delalloc_blocks == 0)
+    return;
+
+  HURD_IHASH_ITERATE_ITEMS (&dn->delalloc, item)
+    if (item->key >= end)
+      {
+	hurd_ihash_locp_remove (&dn->delalloc, &item->value);
+	dropped++;
+      }
+
+  dn->delalloc_blocks -= dropped;
+  __atomic_sub_fetch (&delalloc_reserved, dropped, __ATOMIC_RELAXED);
+}
+
+/* Give disk blocks to all unallocated blocks of NODE between OFFSET and
+   END, allocating each run of them at once, so that it is contiguous on
+   disk if possible.  NODE's ALLOC_LOCK must be held for writing.  */
+static error_t
+delalloc_allocate (struct node *node, vm_offset_t offset, vm_offset_t end)
+{
+  error_t err;
+  block_t block = offset >> log2_block_size;
+  block_t last;
+
+  if (end > node->allocsize)
+    end = node->allocsize;
+  last = end >> log2_block_size;
+
+  diskfs_node_disknode (node)->delalloc_run = 1;
+  err = diskfs_catch_exception ();
+  while (!err && block < last)
+    {
+      block_t disk_block, count;
+
+      err = ext2_getblk_run (node, block, last - block, &disk_block, &count);
+      if (err == EINVAL)
+	{
+	  err = ext2_alloc_run (node, block, count);
+	  if (! err)
+	    {
+	      delalloc_unreserve (node, block, count);
+	      STAT_INC (file_delalloc_runs);
+	      STAT_ADD (file_delalloc_blocks, count);
+	    }
+	}
+      block += count;
+    }
+  diskfs_end_catch_exception ();
+  diskfs_node_disknode (node)->delalloc_run = 0;
+
+  return err;
+}
+
+/* Write LENGTH bytes, a multiple of the page size, for the pager backing
+   NODE at OFFSET from BUF, storing the result for each page in ERRORS.
+   This may need to write several filesystem blocks per page, and
+   consolidates runs of consecutive blocks into one device write, even
+   across page boundaries.  */
+static void
+file_pager_write_pages (struct node *node, vm_offset_t offset, void *buf,
+			vm_size_t length, error_t *errors)
+{
+  error_t err = 0, alloc_err = 0;
   struct pending_blocks pb;
   pthread_rwlock_t *lock = &diskfs_node_disknode (node)->alloc_lock;
   block_t block;
-  int left = vm_page_size;
+  vm_offset_t end = offset + length;
+  vm_size_t page;
 
   pending_blocks_init (&pb, buf);
 
@@ -395,34 +679,66 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
      diskfs_grow and diskfs_truncate.  */
   pthread_rwlock_rdlock (&diskfs_node_disknode (node)->alloc_lock);
 
+  if (diskfs_node_disknode (node)->delalloc_blocks > 0)
+    {
+      /* Some blocks may only be reserved; allocate them now.  */
+      pthread_rwlock_unlock (lock);
+      pthread_rwlock_wrlock (lock);
+      alloc_err = delalloc_allocate (node, offset, end);
+      pthread_rwlock_unlock (lock);
+      pthread_rwlock_rdlock (lock);
+      if (alloc_err)
+	ext2_warning ("inode=%Ld, pages=0x%lx[%lu]: %s",
+		      node->cache_id, offset, length, strerror (alloc_err));
+    }
+
   if (offset >= node->allocsize)
-    left = 0;
-  else if (offset + left > node->allocsize)
-    left = node->allocsize - offset;
+    end = offset;
+  else if (end > node->allocsize)
+    end = node->allocsize;
 
-  ext2_debug ("writing inode %d page %d[%d]", node->cache_id, offset, left);
+  ext2_debug ("writing inode %d pages %d[%d]", node->cache_id, offset,
+	      end - offset);
 
-  STAT_INC (file_pageouts);
+  STAT_ADD (file_pageouts, length / vm_page_size);
 
-  while (left > 0)
+  while (!err && offset < end)
     {
-      err = find_block (node, offset, &block, &lock);
+      block_t run;
+
+      err = find_block (node, offset, &block, &run, &lock);
       if (err)
 	break;
-      assert (block);
-      pending_blocks_add (&pb, block);
-      offset += block_size;
-      left -= block_size;
+      if (! block)
+	{
+	  /* Only if delayed allocation failed above.  */
+	  assert (alloc_err);
+	  err = alloc_err;
+	  break;
+	}
+      for (; !err && run > 0 && offset < end; run--, offset += block_size)
+	err = pending_blocks_add (&pb, block++);
     }
 
   if (!err)
-    pending_blocks_write (&pb);
+    err = pending_blocks_write (&pb);
 
   pthread_rwlock_unlock (&diskfs_node_disknode (node)->alloc_lock);
 
+  /* Everything before PB.offs made it to disk.  */
+  for (page = 0; page < length / vm_page_size; page++)
+    errors[page] = ((page + 1) * vm_page_size <= pb.offs) ? 0 : err;
+}
+
+/* Write one page for the pager backing NODE, at OFFSET, into BUF.  */
+static error_t
+file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
+{
+  error_t err;
+  file_pager_write_pages (node, offset, buf, vm_page_size, &err);
   return err;
 }
-
+
 static error_t
 disk_pager_read_page (vm_offset_t page, void **buf, int *writelock)
 {
@@ -572,6 +888,24 @@ pager_write_page (struct user_pager_info *pager, vm_offset_t page,
     return file_pager_write_page (pager->node, page, (void *)buf);
 }
 
+/* Satisfy a multi-page pager write request for either the disk pager or
+   file pager PAGER, from the LENGTH bytes at offset OFFSET from BUF.  */
+void
+pager_write_pages (struct user_pager_info *pager, vm_offset_t offset,
+		   vm_address_t buf, vm_size_t length, error_t *errors)
+{
+  if (pager->type == DISK)
+    {
+      vm_size_t i;
+      for (i = 0; i < length / vm_page_size; i++)
+	errors[i] = disk_pager_write_page (offset + i * vm_page_size,
+					   (void *) buf + i * vm_page_size);
+    }
+  else
+    file_pager_write_pages (pager->node, offset, (void *) buf, length,
+			    errors);
+}
+
 void
 pager_notify_evict (struct user_pager_info *pager, vm_offset_t page)
 {
@@ -582,7 +916,8 @@ pager_notify_evict (struct user_pager_info *pager, vm_offset_t page)
 
 /* Make page PAGE writable, at least up to ALLOCSIZE.  This function and
    diskfs_grow are the only places that blocks are actually added to the
-   file.  */
+   file; with delayed allocation, they only reserve space for them, and
+   the blocks are allocated by file_pager_write_pages.  */
 error_t
 pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
 {
@@ -608,7 +943,10 @@ pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
 	  while (left > 0)
 	    {
 	      block_t disk_block;
-	      err = ext2_getblk (node, block++, 1, &disk_block);
+	      if (delayed_allocation)
+		err = delalloc_reserve (node, block++);
+	      else
+		err = ext2_getblk (node, block++, 1, &disk_block);
 	      if (err)
 		break;
 	      left -= block_size;
@@ -710,7 +1048,10 @@ diskfs_grow (struct node *node, off_t size, struct protid *cred)
 	      while (!err && end_block < writable_end)
 		{
 		  block_t disk_block;
-		  err = ext2_getblk (node, end_block++, 1, &disk_block);
+		  if (delayed_allocation)
+		    err = delalloc_reserve (node, end_block++);
+		  else
+		    err = ext2_getblk (node, end_block++, 1, &disk_block);
 		}
 	      diskfs_end_catch_exception ();
 
@@ -1243,17 +1584,35 @@ create_disk_pager (void)
   disk_cache_size = disk_cache_blocks << log2_block_size;
   diskfs_start_disk_pager (upi, disk_pager_bucket, MAY_CACHE, 1,
 			   disk_cache_size, &disk_cache);
+  if (paging_workers)
+    pager_set_max_workers (diskfs_disk_pager_requests, paging_workers);
   disk_cache_init ();
 
   /* The file pager.  */
   file_pager_bucket = ports_create_bucket ();
 
   /* Start libpagers worker threads.  */
-  err = pager_start_workers (file_pager_bucket, &file_pager_requests);
+  err = pager_start_workers_max (file_pager_bucket, paging_workers,
+				 &file_pager_requests);
   if (err)
     ext2_panic ("can't create libpager worker threads: %s", strerror (err));
 }
 
+error_t
+set_paging_workers (int max_workers)
+{
+  error_t err = 0;
+
+  if (diskfs_disk_pager_requests)
+    err = pager_set_max_workers (diskfs_disk_pager_requests, max_workers);
+  if (!err && file_pager_requests)
+    err = pager_set_max_workers (file_pager_requests, max_workers);
+  if (!err)
+    paging_workers = max_workers;
+
+  return err;
+}
+
 error_t
 inhibit_ext2_pager (void)
 {
@@ -291,7 +291,8 @@ diskfs_truncate (struct node *node, off_t length)
   if (length >= node->dn_stat.st_size)
     return 0;
 
-  if (! node->dn_stat.st_blocks)
+  if (! node->dn_stat.st_blocks
+      && ! diskfs_node_disknode (node)->delalloc_blocks)
     /* There aren't really any blocks allocated, so just frob the size.  This
        is true for fast symlinks, and also apparently for some device nodes
        in linux.  */
@@ -338,18 +339,30 @@ diskfs_truncate (struct node *node, off_t length)
       block_t *bptrs = diskfs_node_disknode (node)->info.i_data;
       struct free_block_run fbr;
 
-      free_block_run_init (&fbr, node);
+      if (diskfs_node_disknode (node)->info.i_flags & EXT2_EXTENTS_FL)
+	/* Extents are freed a whole run at a time.  */
+	err = ext2_extent_truncate (node, end);
+      else
+	{
+	  free_block_run_init (&fbr, node);
 
-      trunc_direct (node, end, &fbr);
+	  trunc_direct (node, end, &fbr);
 
-      offs = EXT2_NDIR_BLOCKS;
-      trunc_single_indirect (node, end, bptrs + EXT2_IND_BLOCK, offs, &fbr);
-      offs += addr_per_block;
-      trunc_double_indirect (node, end, bptrs + EXT2_DIND_BLOCK, offs, &fbr);
-      offs += addr_per_block * addr_per_block;
-      trunc_triple_indirect (node, end, bptrs + EXT2_TIND_BLOCK, offs, &fbr);
+	  offs = EXT2_NDIR_BLOCKS;
+	  trunc_single_indirect (node, end, bptrs + EXT2_IND_BLOCK, offs,
+				 &fbr);
+	  offs += addr_per_block;
+	  trunc_double_indirect (node, end, bptrs + EXT2_DIND_BLOCK, offs,
+				 &fbr);
+	  offs += addr_per_block * addr_per_block;
+	  trunc_triple_indirect (node, end, bptrs + EXT2_TIND_BLOCK, offs,
+				 &fbr);
+
+	  free_block_run_finish (&fbr);
+	}
 
-      free_block_run_finish (&fbr);
+      /* Pages past the end were flushed without being written back.  */
+      ext2_delalloc_release (node, end);
 
       node->allocsize = round_block (length);
 
@@ -695,7 +695,7 @@ ext2_set_xattr (struct node *np, const char *name, const char *value, int len,
 
       goal = sblock->s_first_data_block + np->dn->info.i_block_group *
 	EXT2_BLOCKS_PER_GROUP (sblock);
-      blkno = ext2_new_block (goal, 0, 0, 0);
+      blkno = ext2_new_block (goal, 0, 0, 0, 0);
       block = disk_cache_block_ref (blkno);
 
       if (blkno == 0)
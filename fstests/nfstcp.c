@@ -0,0 +1,266 @@
+/* Test NFS over TCP between nfs and nfsd on the loopback
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Run nfsd on this machine, and mount one of its directories, EXPORT,
+   on MOUNT with large transfers over TCP, e.g.:
+
+     settrans -a MOUNT /hurd/nfs --tcp --read-size=65536 \
+       --write-size=65536 localhost:EXPORT
+
+   Then `nfstcp MOUNT EXPORT' first talks to nfsd directly: it sends a
+   call split over several record fragments, then several calls in one
+   go, and checks the replies.  Then it writes files of various sizes,
+   most larger than what fits in a UDP call, through MOUNT, and checks
+   that they read back the same through both MOUNT and EXPORT.  */
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define NFS_PORT 2049
+#define NFS_PROGRAM 100003
+#define NFS_VERSION 2
+#define NFSPROC_NULL 0
+
+#define LAST_FRAGMENT 0x80000000
+
+/* The number of words in a call to NFSPROC_NULL and in its reply.  */
+#define CALL_WORDS 10
+#define REPLY_WORDS 6
+
+static const size_t sizes[] =
+  { 0, 1, 8191, 8192, 8193, 65535, 65536, 65537, 300000 };
+
+/* Fill CALL with a call to NFSPROC_NULL with XID.  */
+static void
+null_call (uint32_t *call, uint32_t xid)
+{
+  call[0] = htonl (xid);
+  call[1] = htonl (0);		/* CALL */
+  call[2] = htonl (2);		/* RPC version */
+  call[3] = htonl (NFS_PROGRAM);
+  call[4] = htonl (NFS_VERSION);
+  call[5] = htonl (NFSPROC_NULL);
+  call[6] = htonl (0);		/* AUTH_NULL credentials */
+  call[7] = htonl (0);
+  call[8] = htonl (0);		/* AUTH_NULL verifier */
+  call[9] = htonl (0);
+}
+
+static void
+write_fully (int fd, const void *buf, size_t len, const char *what)
+{
+  ssize_t cc;
+
+  while (len > 0)
+    {
+      cc = write (fd, buf, len);
+      if (cc < 0)
+	error (1, errno, "%s", what);
+      buf += cc;
+      len -= cc;
+    }
+}
+
+static void
+read_fully (int fd, void *buf, size_t len, const char *what)
+{
+  ssize_t cc;
+
+  while (len > 0)
+    {
+      cc = read (fd, buf, len);
+      if (cc < 0)
+	error (1, errno, "%s", what);
+      if (cc == 0)
+	error (1, 0, "%s: Connection closed", what);
+      buf += cc;
+      len -= cc;
+    }
+}
+
+/* Read the reply to a call to NFSPROC_NULL from FD, and return its
+   xid.  */
+static uint32_t
+null_reply (int fd)
+{
+  uint32_t marker, reply[REPLY_WORDS];
+
+  read_fully (fd, &marker, sizeof marker, "Reading a record marker");
+  marker = ntohl (marker);
+  if (marker != (LAST_FRAGMENT | sizeof reply))
+    error (1, 0, "Unexpected record marker %#x", marker);
+  read_fully (fd, reply, sizeof reply, "Reading a reply");
+
+  if (ntohl (reply[1]) != 1	/* REPLY */
+      || ntohl (reply[2]) != 0	/* MSG_ACCEPTED */
+      || ntohl (reply[5]) != 0)	/* SUCCESS */
+    error (1, 0, "Call %#x failed", ntohl (reply[0]));
+
+  return ntohl (reply[0]);
+}
+
+/* Check the record marking of nfsd on the loopback.  */
+static void
+test_records (void)
+{
+  struct sockaddr_in addr;
+  uint32_t call[CALL_WORDS], buf[3 * (CALL_WORDS + 1)], marker, xid;
+  int fd, i, seen;
+
+  fd = socket (PF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    error (1, errno, "socket");
+  memset (&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (NFS_PORT);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (connect (fd, (struct sockaddr *) &addr, sizeof addr) < 0)
+    error (1, errno, "Connecting to nfsd");
+
+  /* One call in three fragments, the middle one empty.  */
+  xid = getpid () << 8;
+  null_call (call, xid);
+  marker = htonl (4 * sizeof call[0]);
+  write_fully (fd, &marker, sizeof marker, "Sending a fragment");
+  write_fully (fd, call, 4 * sizeof call[0], "Sending a fragment");
+  marker = htonl (0);
+  write_fully (fd, &marker, sizeof marker, "Sending a fragment");
+  marker = htonl (LAST_FRAGMENT | (CALL_WORDS - 4) * sizeof call[0]);
+  write_fully (fd, &marker, sizeof marker, "Sending a fragment");
+  write_fully (fd, call + 4, (CALL_WORDS - 4) * sizeof call[0],
+	       "Sending a fragment");
+  if (null_reply (fd) != xid)
+    error (1, 0, "Reply to the wrong call");
+
+  /* Three calls at once; nfsd may answer them in any order.  */
+  for (i = 0; i < 3; i++)
+    {
+      buf[i * (CALL_WORDS + 1)] = htonl (LAST_FRAGMENT | sizeof call);
+      null_call (buf + i * (CALL_WORDS + 1) + 1, xid + 1 + i);
+    }
+  write_fully (fd, buf, sizeof buf, "Sending calls");
+  for (seen = 0, i = 0; i < 3; i++)
+    {
+      uint32_t r = null_reply (fd) - xid - 1;
+      if (r >= 3 || (seen & (1 << r)))
+	error (1, 0, "Unexpected reply");
+      seen |= 1 << r;
+    }
+
+  close (fd);
+}
+
+/* Fill BUF with LEN bytes of a pattern that depends on SEED.  */
+static void
+fill (char *buf, size_t len, unsigned seed)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    buf[i] = (i * 7 + seed) ^ (i >> 8);
+}
+
+/* Check that the file NAME holds the LEN bytes at DATA.  */
+static void
+check_file (const char *name, const char *data, size_t len)
+{
+  char *buf = malloc (len + 1);
+  int fd;
+  ssize_t cc;
+  size_t got = 0;
+
+  if (! buf)
+    error (1, errno, "malloc");
+
+  fd = open (name, O_RDONLY);
+  if (fd < 0)
+    error (1, errno, "%s", name);
+  while ((cc = read (fd, buf + got, len + 1 - got)) > 0)
+    got += cc;
+  if (cc < 0)
+    error (1, errno, "%s", name);
+  close (fd);
+
+  if (got != len)
+    error (1, 0, "%s: Read %zu bytes instead of %zu", name, got, len);
+  if (memcmp (buf, data, len))
+    error (1, 0, "%s: Read back wrong data", name);
+  free (buf);
+}
+
+/* Write files through MOUNT and read them back through MOUNT and
+   EXPORT.  */
+static void
+test_files (const char *mount, const char *export)
+{
+  char mname[1024], ename[1024], *data;
+  size_t i;
+  int fd;
+
+  for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+    {
+      snprintf (mname, sizeof mname, "%s/nfstcp.%zu", mount, sizes[i]);
+      snprintf (ename, sizeof ename, "%s/nfstcp.%zu", export, sizes[i]);
+
+      data = malloc (sizes[i] + 1);
+      if (! data)
+	error (1, errno, "malloc");
+      fill (data, sizes[i], i);
+
+      fd = open (mname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+	error (1, errno, "%s", mname);
+      write_fully (fd, data, sizes[i], mname);
+      if (fsync (fd) < 0 || close (fd) < 0)
+	error (1, errno, "%s", mname);
+
+      check_file (mname, data, sizes[i]);
+      check_file (ename, data, sizes[i]);
+
+      unlink (mname);
+      free (data);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc != 3)
+    {
+      fprintf (stderr, "Usage: %s MOUNT EXPORT\n", argv[0]);
+      exit (2);
+    }
+
+  test_records ();
+  printf ("nfsd: record marking ok\n");
+
+  test_files (argv[1], argv[2]);
+  printf ("%s: files read back ok\n", argv[1]);
+
+  return 0;
+}
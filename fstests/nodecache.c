@@ -0,0 +1,159 @@
+/* Test that shrinking the node cache keeps nodes that must stay
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* Bind a socket in DIRECTORY, which must be on a libdiskfs file system
+   we may control (e.g. one we started ourselves), shrink that file
+   system's node cache to almost nothing, and create enough files to
+   make it drop every node it can.  The socket's node has no users but
+   holds the socket address, so it must survive that: connecting to the
+   socket must still work afterwards, and the file system must still be
+   there.  */
+
+#include <hurd.h>
+#include <hurd/fsys.h>
+#include <argz.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define NFILES 512
+
+/* The node cache size libdiskfs uses when none is given.  */
+#define DEFAULT_NODE_CACHE_SIZE "16384"
+
+static char *dir;
+
+/* Set the node cache size of the file system with control port CTL to
+   SIZE.  */
+static void
+set_cache_size (fsys_t ctl, const char *size)
+{
+  char opt[64];
+  error_t err;
+
+  snprintf (opt, sizeof opt, "--node-cache-size=%s", size);
+  err = fsys_set_options (ctl, opt, strlen (opt) + 1, 0);
+  if (err)
+    error (1, err, "%s: Setting %s", dir, opt);
+}
+
+/* Return the node cache size the file system with control port CTL
+   uses now, as a string.  */
+static char *
+get_cache_size (fsys_t ctl)
+{
+  static const char prefix[] = "--node-cache-size=";
+  char *argz = 0, *opt = 0;
+  mach_msg_type_number_t argz_len = 0;
+  error_t err;
+
+  err = fsys_get_options (ctl, &argz, &argz_len);
+  if (err)
+    error (1, err, "%s: Getting options", dir);
+
+  while ((opt = argz_next (argz, argz_len, opt)))
+    if (! strncmp (opt, prefix, sizeof prefix - 1))
+      return strdup (opt + sizeof prefix - 1);
+  return strdup (DEFAULT_NODE_CACHE_SIZE);
+}
+
+static void
+name_socket (struct sockaddr_un *addr)
+{
+  memset (addr, 0, sizeof *addr);
+  addr->sun_family = AF_LOCAL;
+  snprintf (addr->sun_path, sizeof addr->sun_path, "%s/nodecache.sock", dir);
+}
+
+int
+main (int argc, char **argv)
+{
+  struct sockaddr_un addr;
+  char name[1024], *old_size;
+  file_t dirport;
+  fsys_t ctl;
+  error_t err;
+  int listener, s, fd, i;
+
+  if (argc != 2)
+    {
+      fprintf (stderr, "Usage: %s DIRECTORY\n", argv[0]);
+      exit (2);
+    }
+  dir = argv[1];
+
+  dirport = file_name_lookup (dir, O_READ, 0);
+  if (dirport == MACH_PORT_NULL)
+    error (1, errno, "%s", dir);
+  err = file_getcontrol (dirport, &ctl);
+  if (err)
+    error (1, err, "%s: Getting the control port", dir);
+
+  name_socket (&addr);
+  unlink (addr.sun_path);
+  listener = socket (PF_LOCAL, SOCK_STREAM, 0);
+  if (listener < 0)
+    error (1, errno, "socket");
+  if (bind (listener, (struct sockaddr *) &addr, sizeof addr) < 0)
+    error (1, errno, "%s", addr.sun_path);
+  if (listen (listener, 1) < 0)
+    error (1, errno, "listen");
+
+  old_size = get_cache_size (ctl);
+  set_cache_size (ctl, "1");
+
+  /* Each of these misses in the node cache, which then drops all the
+     unused nodes it may.  */
+  for (i = 0; i < NFILES; i++)
+    {
+      snprintf (name, sizeof name, "%s/nodecache.%d", dir, i);
+      fd = open (name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+	error (1, errno, "%s", name);
+      close (fd);
+    }
+
+  /* The socket node must still know its address.  */
+  s = socket (PF_LOCAL, SOCK_STREAM, 0);
+  if (s < 0)
+    error (1, errno, "socket");
+  if (connect (s, (struct sockaddr *) &addr, sizeof addr) < 0)
+    error (1, errno, "Connecting to %s after shrinking the cache",
+	   addr.sun_path);
+  close (s);
+
+  set_cache_size (ctl, old_size);
+
+  for (i = 0; i < NFILES; i++)
+    {
+      snprintf (name, sizeof name, "%s/nodecache.%d", dir, i);
+      unlink (name);
+    }
+  close (listener);
+  unlink (addr.sun_path);
+
+  printf ("%s: socket node survived shrinking the node cache\n", dir);
+  return 0;
+}
@@ -26,6 +26,61 @@
 #include "priv.h"
 #include "fs_S.h"
 
+/* Walk down the leading components of PATH, starting at *DNPP, for as
+   long as everything needed is in the name and node caches, without
+   locking any node.  Only directories without translators are passed
+   through; the last component, `..', and anything that is not cached
+   are left to the caller, which looks them up the slow way.  *DNPP
+   must carry a hard reference, which is moved along to the directory
+   reached.  Return the part of PATH that is left.  */
+static char *
+walk_cached (struct protid *dircred, struct node **dnpp, char *path)
+{
+  struct node *dnp = *dnpp, *np;
+  char *name = path, *end, *next;
+
+  for (;;)
+    {
+      end = strchrnul (name, '/');
+      if (*end == '\0')
+	break;			/* The last component.  */
+      for (next = end; *next == '/'; next++)
+	;
+      if (*next == '\0')
+	break;			/* The last component, with a trailing slash.  */
+
+      if (end - name == 2 && name[0] == '.' && name[1] == '.')
+	break;
+
+      if (!S_ISDIR (dnp->dn_stat.st_mode)
+	  || fshelp_access (&dnp->dn_stat, S_IEXEC, dircred->user))
+	break;
+
+      if (! (end - name == 1 && name[0] == '.'))
+	{
+	  np = _diskfs_check_lookup_cache_fast (dnp, name, end - name);
+	  if (! np)
+	    break;
+
+	  if (!S_ISDIR (np->dn_stat.st_mode)
+	      || (np->dn_stat.st_mode & S_IPTRANS)
+	      || fshelp_translated (&np->transbox))
+	    {
+	      diskfs_nrele (np);
+	      break;
+	    }
+
+	  diskfs_nrele (dnp);
+	  dnp = np;
+	}
+
+      name = next;
+    }
+
+  *dnpp = dnp;
+  return name;
+}
+
 /* Implement dir_lookup as described in <hurd/fs.defs>. */
 kern_return_t
 diskfs_S_dir_lookup (struct protid *dircred,
@@ -93,12 +148,14 @@ diskfs_S_dir_lookup (struct protid *dircred,
     }
 
   dnp = dircred->po->np;
+  diskfs_nref (dnp);		/* acquire a reference for later diskfs_nput */
+
+  /* Pass quickly through the directories we find in the caches.  */
+  path = walk_cached (dircred, &dnp, path);
 
   pthread_mutex_lock (&dnp->lock);
   np = 0;
 
-  diskfs_nref (dnp);		/* acquire a reference for later diskfs_nput */
-
   do
     {
       assert (!lastcomp);
@@ -84,6 +84,7 @@ diskfs_S_dir_rmdir (struct protid *dircred,
       np->dn_stat.st_nlink--;
       np->dn_set_ctime = 1;
       diskfs_clear_directory (np, dnp, dircred);
+      diskfs_purge_lookup_cache_dir (np);
       if (diskfs_synchronous)
 	diskfs_file_update (np, 1);
     }
@@ -84,6 +84,10 @@ struct node
   /* The slot we occupy in the node cache.  */
   hurd_ihash_locp_t slot;
 
+  /* Our place in the node cache's list of nodes without hard
+     references, most recently used first.  */
+  struct node *lru_next, *lru_prev;
+
   struct disknode *dn;
 
   io_statbuf_t dn_stat;
@@ -126,6 +130,11 @@ struct node
   loff_t allocsize;
 
   ino64_t cache_id;
+
+  /* Entries in the name cache for this directory are only valid if
+     they were made with this generation number, see
+     diskfs_purge_lookup_cache_dir.  */
+  unsigned long name_cache_gen;
 };
 
 struct diskfs_control
@@ -622,6 +631,56 @@ void diskfs_user_try_dropping_softrefs (struct node *np);
 /* Lookup node INUM (which must have a reference already) and return it
    without allocating any new references. */
 struct node *diskfs_cached_ifind (ino_t inum);
+
+/* The node cache keeps nodes that have links but no hard references
+   around in case they are looked up again.  When it holds more than
+   this many nodes, the least recently used of those are dropped.  Zero
+   means no limit.  The translator may set this before calling
+   diskfs_init_diskfs; it can also be changed with the --node-cache-size
+   option.  */
+extern size_t diskfs_node_cache_size;
+
+/* Change diskfs_node_cache_size to SIZE, dropping unused nodes from the
+   cache right away if it now holds too many.  */
+void diskfs_set_node_cache_size (size_t size);
+
+/* Statistics about the node cache, see diskfs_node_cache_stats.  */
+struct diskfs_node_cache_stats
+{
+  size_t entries;		/* nodes in the cache */
+  size_t unused;		/* of those, nodes without hard references */
+  size_t size;			/* diskfs_node_cache_size */
+  unsigned long long hits;	/* lookups that found the node cached */
+  unsigned long long misses;	/* lookups that had to read the node */
+  unsigned long long evictions;	/* nodes dropped to honor the limit */
+};
+
+/* Fill in *STATS with statistics about the node cache.  */
+void diskfs_node_cache_stats (struct diskfs_node_cache_stats *stats);
+
+/* The maximum number of entries in the cache of directory lookups,
+   zero to disable the cache.  The translator may set this before
+   calling diskfs_init_diskfs; it can also be changed with the
+   --name-cache-size option.  */
+extern size_t diskfs_name_cache_size;
+
+/* Change diskfs_name_cache_size to SIZE, dropping entries from the
+   cache right away if it now holds too many.  */
+void diskfs_set_name_cache_size (size_t size);
+
+/* Statistics about the name cache, see diskfs_name_cache_stats.  */
+struct diskfs_name_cache_stats
+{
+  size_t entries;		/* entries in the cache */
+  size_t size;			/* diskfs_name_cache_size */
+  unsigned long long hits;	/* lookups answered with a node */
+  unsigned long long negative_hits; /* lookups answered with ENOENT */
+  unsigned long long misses;	/* lookups the cache knew nothing about */
+  unsigned long long evictions;	/* entries dropped to honor the limit */
+};
+
+/* Fill in *STATS with statistics about the name cache.  */
+void diskfs_name_cache_stats (struct diskfs_name_cache_stats *stats);
 
 /* The library exports the following functions for general use */
 
@@ -1003,9 +1062,18 @@ void diskfs_enter_lookup_cache (struct node *dir, struct node *np,
 				const char *name);
 
 /* Purge all references in the cache to NP as a node inside
-   directory DP. */
+   directory DP.  This has to look at every entry in the cache;
+   diskfs_purge_lookup_cache_name is much cheaper if the name is
+   known.  */
 void diskfs_purge_lookup_cache (struct node *dp, struct node *np);
 
+/* Purge the cache entry for NAME inside directory DP, if any.  */
+void diskfs_purge_lookup_cache_name (struct node *dp, const char *name);
+
+/* Purge all entries for names inside directory DP, including
+   negative ones.  */
+void diskfs_purge_lookup_cache_dir (struct node *dp);
+
 /* Scan the cache looking for NAME inside DIR.  If we don't know
    anything entry at all, then return 0.  If the entry is confirmed to
    not exist, then return -1.  Otherwise, return NP for the entry, with
@@ -24,204 +24,356 @@
 #include <hurd/ihash.h>
 #include <string.h>
 
-/* The name cache is implemented using a hash table.
+/* The name cache is implemented using hash tables.  To keep lookups
+   in different directories, or of different names, from contending for
+   a single lock, the cache is split into NAME_SHARDS shards, each with
+   its own lock and hash table.  The shard an entry lives in is chosen
+   by the hash of the directory and the name.  A shard's hash table
+   grows with the number of entries in it.
+
+   Each shard holds at most its share of diskfs_name_cache_size
+   entries.  To make room for a new entry, one that has not been used
+   recently is dropped.  We approximate the least-recently used entry
+   using the clock algorithm, so that lookups only need to set a flag
+   in the entry and can share the shard lock.
+
+   Every node carries a generation number, and entries are only valid
+   if they were made with the current generation of their directory.
+   Changing the generation thus invalidates all entries of a directory
+   at once, and entries of a directory whose inode number gets reused
+   are never mistaken for entries of the new one.  */
+
+/* Number of shards.  The shard is chosen by the top bits of the hash,
+   the hash tables use the bottom ones.  */
+#define NAME_SHARD_BITS	6
+#define NAME_SHARDS	(1 << NAME_SHARD_BITS)
+
+/* Initial number of buckets of a shard's hash table.  Must be a power
+   of two.  */
+#define MIN_BUCKETS	64
+
+struct name_entry
+{
+  /* Next entry in the same hash bucket.  */
+  struct name_entry *next;
+
+  /* Neighbours on the clock.  */
+  struct name_entry *clock_next, *clock_prev;
 
-   We use buckets of a fixed size.  We approximate the
-   least-frequently used cache algorithm by counting the number of
-   lookups using saturating arithmetic in the two lowest bits of the
-   pointer to the name.  Using this strategy we achieve a constant
-   worst-case lookup and insertion time.  */
+  unsigned long key;
 
-/* Number of buckets.  Must be a power of two. */
-#define CACHE_SIZE	256
+  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  */
+  ino64_t dir_cache_id;
+
+  /* 0 for NODE_CACHE_ID means a `negative' entry -- recording that
+     there's definitely no node with this name.  */
+  ino64_t node_cache_id;
 
-/* Entries per bucket.  */
-#define BUCKET_SIZE	4
+  /* The generation of the directory this entry was made in.  */
+  unsigned long dir_gen;
 
-/* A mask for fast binary modulo.  */
-#define CACHE_MASK	(CACHE_SIZE - 1)
+  /* Set when the entry is used, cleared when the clock passes it.  */
+  int referenced;
 
-/* Cache bucket with BUCKET_SIZE entries.
+  char name[0];
+};
 
-   The layout of the bucket is chosen so that it will be straight
-   forward to use vector operations in the future.  */
-struct cache_bucket
+struct name_shard
 {
-  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  If
-     NULL, the entry is unused.  */
-  unsigned long name[BUCKET_SIZE];
+  pthread_rwlock_t lock;
 
-  /* The key.  */
-  unsigned long key[BUCKET_SIZE];
+  /* The hash table.  NBUCKETS is zero or a power of two.  */
+  struct name_entry **buckets;
+  size_t nbuckets;
+  size_t count;
 
-  /* Used to indentify nodes to the fs dependent code.  */
-  ino64_t dir_cache_id[BUCKET_SIZE];
+  /* The next entry the clock considers for replacement.  New entries
+     go right behind it.  */
+  struct name_entry *hand;
 
-  /* 0 for NODE_CACHE_ID means a `negative' entry -- recording that
-     there's definitely no node with this name.  */
-  ino64_t node_cache_id[BUCKET_SIZE];
+  unsigned long long hits, negative_hits, misses, evictions;
+} __attribute__ ((aligned (64)));	/* Keep shards off each other's
+					   cache lines.  */
+
+static struct name_shard name_cache[NAME_SHARDS] =
+{
+  [0 ... NAME_SHARDS - 1] = { .lock = PTHREAD_RWLOCK_INITIALIZER }
 };
 
-/* The cache.  */
-static struct cache_bucket name_cache[CACHE_SIZE];
+size_t diskfs_name_cache_size = DEFAULT_NAME_CACHE_SIZE;
 
-/* Protected by this lock.  */
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-/* Given VALUE, return the char pointer.  */
-static inline char *
-charp (unsigned long value)
+static unsigned long name_cache_gen;
+
+/* Return a name cache generation number that has never been used
+   before, for a new node or a directory whose entries are purged.  */
+unsigned long
+_diskfs_name_cache_new_gen (void)
 {
-  return (char *) (value & ~3L);
+  return __atomic_add_fetch (&name_cache_gen, 1, __ATOMIC_RELAXED);
 }
 
-/* Given VALUE, return the approximation of use frequency.  */
+/* Hash the directory cache_id and the name.  */
 static inline unsigned long
-frequ (unsigned long value)
+hash (ino64_t dir_cache_id, const char *name, size_t len)
 {
-  return value & 3;
+  unsigned long h;
+  h = hurd_ihash_hash32 (&dir_cache_id, sizeof dir_cache_id, 0);
+  h = hurd_ihash_hash32 (name, len, h);
+  return h;
 }
-
-/* Add an entry in the Ith slot of the given bucket.  If there is a
-   value there, remove it first.  */
-static inline void
-add_entry (struct cache_bucket *b, int i,
-	   const char *name, unsigned long key,
-	   ino64_t dir_cache_id, ino64_t node_cache_id)
-{
-  if (b->name[i])
-    free (charp (b->name[i]));
 
-  b->name[i] = (unsigned long) strdup (name);
-  assert ((b->name[i] & 3) == 0);
-  if (b->name[i] == 0)
-    return;
-
-  b->key[i] = key;
-  b->dir_cache_id[i] = dir_cache_id;
-  b->node_cache_id[i] = node_cache_id;
+static inline struct name_shard *
+shard_of (unsigned long key)
+{
+  return &name_cache[(key >> (32 - NAME_SHARD_BITS)) & (NAME_SHARDS - 1)];
 }
 
-/* Remove the entry in the Ith slot of the given bucket.  */
-static inline void
-remove_entry (struct cache_bucket *b, int i)
+/* The number of entries a single shard may hold.  */
+static inline size_t
+shard_limit (void)
 {
-  if (b->name[i])
-    free (charp (b->name[i]));
-  b->name[i] = 0;
+  return (diskfs_name_cache_size + NAME_SHARDS - 1) / NAME_SHARDS;
 }
 
-/* Check if the entry in the Ith slot of the given bucket is
-   valid.  */
-static inline int
-valid_entry (struct cache_bucket *b, int i)
+/* Find the entry for NAME, whose first LEN characters are used and
+   hash to KEY, in directory DIR_CACHE_ID, whatever its generation.  S->lock
+   must be held.  */
+static struct name_entry *
+find_entry (struct name_shard *s, ino64_t dir_cache_id,
+	    const char *name, size_t len, unsigned long key)
 {
-  return b->name[i] != 0;
+  struct name_entry *e;
+
+  if (s->nbuckets == 0)
+    return NULL;
+
+  for (e = s->buckets[key & (s->nbuckets - 1)]; e; e = e->next)
+    if (e->key == key
+	&& e->dir_cache_id == dir_cache_id
+	&& memcmp (e->name, name, len) == 0
+	&& e->name[len] == '\0')
+      return e;
+
+  return NULL;
 }
-
-/* If there is no best candidate to replace, pick any.  We approximate
-   any by picking the slot depicted by REPLACE, and increment REPLACE
-   then.  */
-static int replace;
-
-/* Lookup (DIR_CACHE_ID, NAME, KEY) in the cache.  If it is found,
-   return 1 and set BUCKET and INDEX to the item.  Otherwise, return 0
-   and set BUCKET and INDEX to the slot where the item should be
-   inserted.  */
-static inline int
-lookup (ino64_t dir_cache_id, const char *name, unsigned long key,
-	struct cache_bucket **bucket, int *index)
+
+/* Remove E from shard S and free it.  S->lock must be held for
+   writing.  */
+static void
+remove_entry (struct name_shard *s, struct name_entry *e)
 {
-  struct cache_bucket *b = *bucket = &name_cache[key & CACHE_MASK];
-  unsigned long best = 3;
-  int i;
+  struct name_entry **p;
+
+  for (p = &s->buckets[e->key & (s->nbuckets - 1)]; *p != e; p = &(*p)->next)
+    assert (*p);
+  *p = e->next;
 
-  for (i = 0; i < BUCKET_SIZE; i++)
+  if (e->clock_next == e)
+    s->hand = NULL;
+  else
     {
-      unsigned long f = frequ (b->name[i]);
+      e->clock_prev->clock_next = e->clock_next;
+      e->clock_next->clock_prev = e->clock_prev;
+      if (s->hand == e)
+	s->hand = e->clock_next;
+    }
 
-      if (valid_entry (b, i)
-	  && b->key[i] == key
-	  && b->dir_cache_id[i] == dir_cache_id
-	  && strcmp (charp (b->name[i]), name) == 0)
-	{
-	  if (f < 3)
-	    b->name[i] += 1;
+  s->count--;
+  free (e);
+}
 
-	  *index = i;
-	  return 1;
-	}
+/* Drop entries from shard S until it holds at most LIMIT of them.
+   S->lock must be held for writing.  */
+static void
+shrink_shard (struct name_shard *s, size_t limit)
+{
+  while (s->count > limit)
+    {
+      struct name_entry *e = s->hand;
 
-      /* Keep track of the replacement candidate.  */
-      if (f < best)
+      /* Give entries used since the clock last passed a second
+	 chance.  This terminates, since we clear the flags as we go.  */
+      while (e->referenced)
 	{
-	  best = f;
-	  *index = i;
+	  e->referenced = 0;
+	  e = e->clock_next;
 	}
-    }
 
-  /* If there was no entry with a lower use frequency, just replace
-     any entry.  */
-  if (best == 3)
-    {
-      *index = replace;
-      replace = (replace + 1) & (BUCKET_SIZE - 1);
+      s->hand = e;
+      remove_entry (s, e);
+      s->evictions++;
     }
-
-  return 0;
 }
 
-/* Hash the directory cache_id and the name.  */
-static inline unsigned long
-hash (ino64_t dir_cache_id, const char *name)
+/* Double the number of buckets of shard S, or allocate the initial
+   ones.  S->lock must be held for writing.  If memory is short, the
+   table is left alone.  */
+static void
+grow_shard (struct name_shard *s)
 {
-  unsigned long h;
-  h = hurd_ihash_hash32 (&dir_cache_id, sizeof dir_cache_id, 0);
-  h = hurd_ihash_hash32 (name, strlen (name), h);
-  return h;
+  size_t nbuckets = s->nbuckets ? s->nbuckets * 2 : MIN_BUCKETS;
+  struct name_entry **buckets, *e, *next;
+  size_t i;
+
+  buckets = calloc (nbuckets, sizeof *buckets);
+  if (buckets == NULL)
+    return;
+
+  for (i = 0; i < s->nbuckets; i++)
+    for (e = s->buckets[i]; e; e = next)
+      {
+	next = e->next;
+	e->next = buckets[e->key & (nbuckets - 1)];
+	buckets[e->key & (nbuckets - 1)] = e;
+      }
+
+  free (s->buckets);
+  s->buckets = buckets;
+  s->nbuckets = nbuckets;
 }
-
+
 /* Node NP has just been found in DIR with NAME.  If NP is null, that
    means that this name has been confirmed as absent in the directory. */
 void
 diskfs_enter_lookup_cache (struct node *dir, struct node *np, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
+  size_t len = strlen (name);
+  unsigned long key = hash (dir->cache_id, name, len);
+  struct name_shard *s = shard_of (key);
   ino64_t value = np ? np->cache_id : 0;
-  struct cache_bucket *bucket;
-  int i = 0, found;
+  size_t limit = shard_limit ();
+  struct name_entry *e;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (! found)
-    add_entry (bucket, i, name, key, dir->cache_id, value);
+  if (limit == 0)
+    return;
+
+  pthread_rwlock_wrlock (&s->lock);
+  e = find_entry (s, dir->cache_id, name, len, key);
+  if (e)
+    {
+      e->node_cache_id = value;
+      e->dir_gen = dir->name_cache_gen;
+      pthread_rwlock_unlock (&s->lock);
+      return;
+    }
+
+  shrink_shard (s, limit - 1);
+  if (s->count >= s->nbuckets)
+    grow_shard (s);
+
+  e = malloc (sizeof *e + len + 1);
+  if (e == NULL || s->nbuckets == 0)
+    {
+      free (e);
+      pthread_rwlock_unlock (&s->lock);
+      return;
+    }
+
+  e->key = key;
+  e->dir_cache_id = dir->cache_id;
+  e->node_cache_id = value;
+  e->dir_gen = dir->name_cache_gen;
+  e->referenced = 0;
+  memcpy (e->name, name, len + 1);
+
+  e->next = s->buckets[key & (s->nbuckets - 1)];
+  s->buckets[key & (s->nbuckets - 1)] = e;
+
+  if (s->hand == NULL)
+    s->hand = e->clock_next = e->clock_prev = e;
   else
-    if (bucket->node_cache_id[i] != value)
-      bucket->node_cache_id[i] = value;
+    {
+      e->clock_next = s->hand;
+      e->clock_prev = s->hand->clock_prev;
+      e->clock_prev->clock_next = e;
+      s->hand->clock_prev = e;
+    }
+  s->count++;
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_rwlock_unlock (&s->lock);
 }
-
+
 /* Purge all references in the cache to NP as a node inside
-   directory DP. */
+   directory DP.  This has to look at every entry in the cache;
+   diskfs_purge_lookup_cache_name is much cheaper if the name is
+   known.  */
 void
 diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 {
-  int i;
-  struct cache_bucket *b;
+  struct name_shard *s;
+  struct name_entry *e, *next;
+  size_t i;
 
-  pthread_mutex_lock (&cache_lock);
+  for (s = &name_cache[0]; s < &name_cache[NAME_SHARDS]; s++)
+    {
+      pthread_rwlock_wrlock (&s->lock);
+      for (i = 0; i < s->nbuckets; i++)
+	for (e = s->buckets[i]; e; e = next)
+	  {
+	    next = e->next;
+	    if (e->dir_cache_id == dp->cache_id
+		&& e->node_cache_id == np->cache_id)
+	      remove_entry (s, e);
+	  }
+      pthread_rwlock_unlock (&s->lock);
+    }
+}
 
-  for (b = &name_cache[0]; b < &name_cache[CACHE_SIZE]; b++)
-    for (i = 0; i < BUCKET_SIZE; i++)
-      if (valid_entry (b, i)
-	  && b->dir_cache_id[i] == dp->cache_id
-	  && b->node_cache_id[i] == np->cache_id)
-	remove_entry (b, i);
+/* Purge the cache entry for NAME inside directory DP, if any.  */
+void
+diskfs_purge_lookup_cache_name (struct node *dp, const char *name)
+{
+  size_t len = strlen (name);
+  unsigned long key = hash (dp->cache_id, name, len);
+  struct name_shard *s = shard_of (key);
+  struct name_entry *e;
+
+  pthread_rwlock_wrlock (&s->lock);
+  e = find_entry (s, dp->cache_id, name, len, key);
+  if (e)
+    remove_entry (s, e);
+  pthread_rwlock_unlock (&s->lock);
+}
 
-  pthread_mutex_unlock (&cache_lock);
+/* Purge all entries for names inside directory DP, including
+   negative ones.  */
+void
+diskfs_purge_lookup_cache_dir (struct node *dp)
+{
+  /* The entries are left where they are for the clock to find.  */
+  dp->name_cache_gen = _diskfs_name_cache_new_gen ();
 }
-
+
+/* Look up the first LEN characters of NAME in DIR.  Return 1 and set
+   *ID if it is found, return 0 if it is not.  */
+static int
+lookup (struct node *dir, const char *name, size_t len, ino64_t *id)
+{
+  unsigned long key = hash (dir->cache_id, name, len);
+  struct name_shard *s = shard_of (key);
+  struct name_entry *e;
+  int found = 0;
+
+  pthread_rwlock_rdlock (&s->lock);
+  e = find_entry (s, dir->cache_id, name, len, key);
+  if (e && e->dir_gen == dir->name_cache_gen)
+    {
+      *id = e->node_cache_id;
+      if (! e->referenced)
+	__atomic_store_n (&e->referenced, 1, __ATOMIC_RELAXED);
+      found = 1;
+    }
+  pthread_rwlock_unlock (&s->lock);
+
+  if (! found)
+    __atomic_add_fetch (&s->misses, 1, __ATOMIC_RELAXED);
+  else if (*id == 0)
+    __atomic_add_fetch (&s->negative_hits, 1, __ATOMIC_RELAXED);
+  else
+    __atomic_add_fetch (&s->hits, 1, __ATOMIC_RELAXED);
+  return found;
+}
+
 /* Scan the cache looking for NAME inside DIR.  If we don't know
    anything entry at all, then return 0.  If the entry is confirmed to
    not exist, then return -1.  Otherwise, return NP for the entry, with
@@ -229,65 +381,115 @@ diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 struct node *
 diskfs_check_lookup_cache (struct node *dir, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
   int lookup_parent = name[0] == '.' && name[1] == '.' && name[2] == '\0';
-  struct cache_bucket *bucket;
-  int i, found;
+  ino64_t id, id2;
 
   if (lookup_parent && dir == diskfs_root_node)
     /* This is outside our file system, return cache miss.  */
     return NULL;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (found)
+  if (! lookup (dir, name, strlen (name), &id))
+    return 0;
+
+  if (id == 0)
+    /* A negative cache entry.  */
+    return (struct node *) -1;
+  else if (id == dir->cache_id)
+    /* The cached node is the same as DIR.  */
     {
-      ino64_t id = bucket->node_cache_id[i];
-      pthread_mutex_unlock (&cache_lock);
-
-      if (id == 0)
-	/* A negative cache entry.  */
-	return (struct node *) -1;
-      else if (id == dir->cache_id)
-	/* The cached node is the same as DIR.  */
-	{
-	  diskfs_nref (dir);
-	  return dir;
-	}
-      else
-	/* Just a normal entry in DIR; get the actual node.  */
+      diskfs_nref (dir);
+      return dir;
+    }
+  else
+    /* Just a normal entry in DIR; get the actual node.  */
+    {
+      struct node *np;
+      error_t err;
+
+      if (lookup_parent)
 	{
-	  struct node *np;
-	  error_t err;
+	  pthread_mutex_unlock (&dir->lock);
+	  err = diskfs_cached_lookup (id, &np);
+	  pthread_mutex_lock (&dir->lock);
+
+	  if (err)
+	    return 0;
 
-	  if (lookup_parent)
+	  /* In the window where DP was unlocked, we might
+	     have lost.  So check the cache again, and see
+	     if it's still there; if so, then we win. */
+	  if (! lookup (dir, name, strlen (name), &id2) || id2 != id)
 	    {
-	      pthread_mutex_unlock (&dir->lock);
-	      err = diskfs_cached_lookup (id, &np);
-	      pthread_mutex_lock (&dir->lock);
-
-	      /* In the window where DP was unlocked, we might
-		 have lost.  So check the cache again, and see
-		 if it's still there; if so, then we win. */
-	      pthread_mutex_lock (&cache_lock);
-	      found = lookup (dir->cache_id, name, key, &bucket, &i);
-	      if (! found
-		  || bucket->node_cache_id[i] != id)
-		{
-		  pthread_mutex_unlock (&cache_lock);
-
-		  /* Lose */
-		  diskfs_nput (np);
-		  return 0;
-		}
-	      pthread_mutex_unlock (&cache_lock);
+	      /* Lose */
+	      diskfs_nput (np);
+	      return 0;
 	    }
-	  else
-	    err = diskfs_cached_lookup (id, &np);
-	  return err ? 0 : np;
 	}
+      else
+	err = diskfs_cached_lookup (id, &np);
+      return err ? 0 : np;
+    }
+}
+
+/* Like diskfs_check_lookup_cache, but only for names other than `..',
+   and without going to disk: return the node for the first LEN
+   characters of NAME inside DIR with a new hard reference, but
+   unlocked, if both the entry and the node are cached, and NULL
+   otherwise.  DIR need not be locked.  */
+struct node *
+_diskfs_check_lookup_cache_fast (struct node *dir, const char *name,
+				 size_t len)
+{
+  ino64_t id;
+
+  if (! lookup (dir, name, len, &id) || id == 0)
+    return NULL;
+
+  if (id == dir->cache_id)
+    {
+      diskfs_nref (dir);
+      return dir;
     }
 
-  pthread_mutex_unlock (&cache_lock);
-  return 0;
+  return _diskfs_cached_ref (id);
+}
+
+/* Change diskfs_name_cache_size to SIZE, dropping entries from the
+   cache right away if it now holds too many.  */
+void
+diskfs_set_name_cache_size (size_t size)
+{
+  struct name_shard *s;
+  size_t limit;
+
+  diskfs_name_cache_size = size;
+  limit = shard_limit ();
+  for (s = &name_cache[0]; s < &name_cache[NAME_SHARDS]; s++)
+    {
+      pthread_rwlock_wrlock (&s->lock);
+      shrink_shard (s, limit);
+      pthread_rwlock_unlock (&s->lock);
+    }
+}
+
+/* Fill in *STATS with statistics about the name cache.  */
+void
+diskfs_name_cache_stats (struct diskfs_name_cache_stats *stats)
+{
+  struct name_shard *s;
+
+  memset (stats, 0, sizeof *stats);
+  stats->size = diskfs_name_cache_size;
+  for (s = &name_cache[0]; s < &name_cache[NAME_SHARDS]; s++)
+    {
+      pthread_rwlock_rdlock (&s->lock);
+      stats->entries += s->count;
+      stats->evictions += s->evictions;
+      pthread_rwlock_unlock (&s->lock);
+
+      stats->hits += __atomic_load_n (&s->hits, __ATOMIC_RELAXED);
+      stats->negative_hits += __atomic_load_n (&s->negative_hits,
+					       __ATOMIC_RELAXED);
+      stats->misses += __atomic_load_n (&s->misses, __ATOMIC_RELAXED);
+    }
 }
@@ -1,6 +1,6 @@
 /* Inode cache.
 
-   Copyright (C) 1994-2015 Free Software Foundation, Inc.
+   Copyright (C) 1994-2015, 2026 Free Software Foundation, Inc.
 
    This file is part of the GNU Hurd.
 
@@ -18,16 +18,29 @@
    along with the GNU Hurd.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <hurd/ihash.h>
+#include <stdint.h>
 
 #include "priv.h"
 
-/* The node cache is implemented using a hash table.  Access to the
-   cache is protected by nodecache_lock.
+/* The node cache is implemented using hash tables.  To keep lookups
+   of different nodes from contending for a single lock, the cache is
+   split into NODECACHE_SHARDS shards, each with its own hash table and
+   lock.  The shard a node lives in is chosen by the hash of its inode
+   number.
 
    Every node in the cache carries a light reference.  When we are
    asked to give up that light reference, we reacquire our lock
    momentarily to check whether someone else reacquired a reference
-   through the cache.  */
+   through the cache.
+
+   Nodes that still have links keep that light reference after their
+   last hard reference is gone, so that looking them up again is
+   cheap.  Each shard keeps those nodes on a list, most recently used
+   first.  When a shard holds more than its share of
+   diskfs_node_cache_size nodes, the least recently used of them are
+   dropped before a new node is read.  Nodes holding state that is not
+   on disk -- a socket address, an active translator or notification
+   requests -- are never dropped.  */
 
 /* The size of ino_t is larger than hurd_ihash_key_t on 32 bit
    platforms.  We therefore have to use libihashs generalized key
@@ -40,13 +53,18 @@
         (h) *= 0x2127599bf4325c37ULL;   \
         (h) ^= (h) >> 47; })
 
+static inline uint64_t
+hash_inum (ino_t inum)
+{
+  uint64_t h = inum;
+  mix_fasthash (h);
+  return h;
+}
+
 static hurd_ihash_key_t
 hash (const void *key)
 {
-  ino_t i;
-  i = *(ino_t *) key;
-  mix_fasthash (i);
-  return (hurd_ihash_key_t) i;
+  return (hurd_ihash_key_t) hash_inum (*(ino_t *) key);
 }
 
 static int
@@ -55,10 +73,189 @@ compare (const void *a, const void *b)
   return *(ino_t *) a == *(ino_t *) b;
 }
 
-static struct hurd_ihash nodecache =
-  HURD_IHASH_INITIALIZER_GKI (offsetof (struct node, slot), NULL, NULL,
-                              hash, compare);
-static pthread_rwlock_t nodecache_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* The shard is chosen by the top bits of the hash, the hash tables
+   use the bottom ones.  */
+#define NODECACHE_SHARD_BITS	5
+#define NODECACHE_SHARDS	(1 << NODECACHE_SHARD_BITS)
+
+struct nodecache_shard
+{
+  pthread_rwlock_t lock;
+  struct hurd_ihash nodes;
+
+  /* The nodes in NODES without hard references, most recently used
+     first.  LRU_LOCK may be taken while holding LOCK or a node lock,
+     but nothing else may be locked while holding it.  */
+  pthread_spinlock_t lru_lock;
+  struct node *lru_head, *lru_tail;
+  size_t lru_count;
+
+  unsigned long long hits, misses, evictions;
+} __attribute__ ((aligned (64)));	/* Keep shards off each other's
+					   cache lines.  */
+
+static struct nodecache_shard nodecache[NODECACHE_SHARDS] =
+{
+  [0 ... NODECACHE_SHARDS - 1] =
+  {
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+    .nodes = HURD_IHASH_INITIALIZER_GKI (offsetof (struct node, slot),
+					 NULL, NULL, hash, compare),
+    .lru_lock = PTHREAD_SPINLOCK_INITIALIZER,
+  }
+};
+
+size_t diskfs_node_cache_size = DEFAULT_NODE_CACHE_SIZE;
+
+static inline struct nodecache_shard *
+shard_of (ino_t inum)
+{
+  return &nodecache[hash_inum (inum) >> (64 - NODECACHE_SHARD_BITS)];
+}
+
+/* Return nonzero if NP is on the unused list of shard S.  S->lru_lock
+   must be held.  */
+static inline int
+lru_linked (struct nodecache_shard *s, struct node *np)
+{
+  return np->lru_prev != NULL || s->lru_head == np;
+}
+
+/* Add NP at the front of the unused list of shard S.  S->lru_lock must
+   be held.  */
+static void
+lru_push (struct nodecache_shard *s, struct node *np)
+{
+  np->lru_prev = NULL;
+  np->lru_next = s->lru_head;
+  if (s->lru_head)
+    s->lru_head->lru_prev = np;
+  else
+    s->lru_tail = np;
+  s->lru_head = np;
+  s->lru_count++;
+}
+
+/* Remove NP from the unused list of shard S.  S->lru_lock must be
+   held.  */
+static void
+lru_unlink (struct nodecache_shard *s, struct node *np)
+{
+  if (np->lru_prev)
+    np->lru_prev->lru_next = np->lru_next;
+  else
+    s->lru_head = np->lru_next;
+  if (np->lru_next)
+    np->lru_next->lru_prev = np->lru_prev;
+  else
+    s->lru_tail = np->lru_prev;
+  np->lru_next = np->lru_prev = NULL;
+  s->lru_count--;
+}
+
+/* How many unused nodes we ask to give up their other light references
+   in one go, see shrink_shard.  */
+#define SHRINK_SOFTREFS_MAX	16
+
+/* Drop unused nodes from shard S until it holds no more than its share
+   of diskfs_node_cache_size, or until each unused node has been looked
+   at once.  Nothing may be locked by the caller.  */
+static void
+shrink_shard (struct nodecache_shard *s)
+{
+  struct node *victims = NULL, *softrefs[SHRINK_SOFTREFS_MAX];
+  struct node *np;
+  size_t limit, scan;
+  int nsoftrefs = 0, i;
+
+  if (diskfs_node_cache_size == 0)
+    return;
+  limit = (diskfs_node_cache_size + NODECACHE_SHARDS - 1) / NODECACHE_SHARDS;
+  if (s->nodes.nr_items <= limit)
+    return;
+
+  pthread_rwlock_wrlock (&s->lock);
+  pthread_spin_lock (&s->lru_lock);
+  for (scan = s->lru_count;
+       scan > 0 && s->nodes.nr_items > limit && s->lru_tail;
+       scan--)
+    {
+      struct references result;
+
+      np = s->lru_tail;
+      lru_unlink (s, np);
+
+      refcounts_references (&np->refcounts, &result);
+      if (result.hard > 0)
+	/* The node is in use again.  It is put back on the list when
+	   its last hard reference is released.  */
+	continue;
+
+      if (np->sockaddr != MACH_PORT_NULL
+	  || fshelp_translated (&np->transbox)
+	  || np->dirmod_reqs || np->filemod_reqs)
+	{
+	  /* Dropping NP would lose state that is not on disk.  These only
+	     change under a hard reference, and NP has none, so they can
+	     be looked at without its lock.  Leave NP for a later pass.  */
+	  lru_push (s, np);
+	  continue;
+	}
+
+      if (result.weak > 1)
+	{
+	  /* Someone besides us holds a light reference, e.g. a pager.
+	     Ask for it to be given up and have another look at NP
+	     later.  */
+	  lru_push (s, np);
+	  if (nsoftrefs < SHRINK_SOFTREFS_MAX)
+	    {
+	      refcounts_ref_weak (&np->refcounts, NULL);
+	      softrefs[nsoftrefs++] = np;
+	    }
+	  continue;
+	}
+
+      /* Ours is the only reference, so nobody can get at NP once it is
+	 out of the hash table.  */
+      hurd_ihash_locp_remove (&s->nodes, np->slot);
+      np->slot = NULL;
+      np->lru_next = victims;
+      victims = np;
+      s->evictions++;
+    }
+  pthread_spin_unlock (&s->lru_lock);
+  pthread_rwlock_unlock (&s->lock);
+
+  while (victims)
+    {
+      np = victims;
+      victims = np->lru_next;
+      np->lru_next = NULL;
+      diskfs_nrele_light (np);
+    }
+
+  for (i = 0; i < nsoftrefs; i++)
+    {
+      np = softrefs[i];
+      pthread_mutex_lock (&np->lock);
+      diskfs_user_try_dropping_softrefs (np);
+      pthread_mutex_unlock (&np->lock);
+      diskfs_nrele_light (np);
+    }
+}
+
+/* Gain a hard reference to NP, which was found in shard S.  S->lock
+   must be held.  */
+static inline void
+ref_cached (struct nodecache_shard *s, struct node *np)
+{
+  diskfs_nref (np);
+  pthread_spin_lock (&s->lru_lock);
+  if (lru_linked (s, np))
+    lru_unlink (s, np);
+  pthread_spin_unlock (&s->lru_lock);
+}
 
 /* Fetch inode INUM, set *NPP to the node structure;
    gain one user reference and lock the node.  */
@@ -76,13 +273,22 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
 {
   error_t err;
   struct node *np, *tmp;
+  struct nodecache_shard *s = shard_of (inum);
   hurd_ihash_locp_t slot;
 
-  pthread_rwlock_rdlock (&nodecache_lock);
-  np = hurd_ihash_locp_find (&nodecache, (hurd_ihash_key_t) &inum, &slot);
+  pthread_rwlock_rdlock (&s->lock);
+  np = hurd_ihash_locp_find (&s->nodes, (hurd_ihash_key_t) &inum, &slot);
   if (np)
-    goto gotit;
-  pthread_rwlock_unlock (&nodecache_lock);
+    {
+      __atomic_add_fetch (&s->hits, 1, __ATOMIC_RELAXED);
+      goto gotit;
+    }
+  pthread_rwlock_unlock (&s->lock);
+
+  __atomic_add_fetch (&s->misses, 1, __ATOMIC_RELAXED);
+
+  /* Make room for the new node first, while we hold no locks.  */
+  shrink_shard (s);
 
   err = diskfs_user_make_node (&np, ctx);
   if (err)
@@ -92,8 +298,8 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
   pthread_mutex_lock (&np->lock);
 
   /* Put NP in NODEHASH.  */
-  pthread_rwlock_wrlock (&nodecache_lock);
-  tmp = hurd_ihash_locp_find (&nodecache, (hurd_ihash_key_t) &np->cache_id,
+  pthread_rwlock_wrlock (&s->lock);
+  tmp = hurd_ihash_locp_find (&s->nodes, (hurd_ihash_key_t) &np->cache_id,
 			      &slot);
   if (tmp)
     {
@@ -103,11 +309,11 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
       goto gotit;
     }
 
-  err = hurd_ihash_locp_add (&nodecache, slot,
+  err = hurd_ihash_locp_add (&s->nodes, slot,
 			     (hurd_ihash_key_t) &np->cache_id, np);
   assert_perror (err);
   diskfs_nref_light (np);
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&s->lock);
 
   /* Get the contents of NP off disk.  */
   err = diskfs_user_read_node (np, ctx);
@@ -120,32 +326,78 @@ diskfs_cached_lookup_context (ino_t inum, struct node **npp,
     }
 
  gotit:
-  diskfs_nref (np);
-  pthread_rwlock_unlock (&nodecache_lock);
+  ref_cached (s, np);
+  pthread_rwlock_unlock (&s->lock);
   pthread_mutex_lock (&np->lock);
   *npp = np;
   return 0;
 }
 
+/* Return node INUM with a new hard reference, but unlocked, if it is
+   in the node cache.  Return NULL otherwise.  */
+struct node *
+_diskfs_cached_ref (ino_t inum)
+{
+  struct nodecache_shard *s = shard_of (inum);
+  struct node *np;
+
+  pthread_rwlock_rdlock (&s->lock);
+  np = hurd_ihash_find (&s->nodes, (hurd_ihash_key_t) &inum);
+  if (np)
+    {
+      __atomic_add_fetch (&s->hits, 1, __ATOMIC_RELAXED);
+      ref_cached (s, np);
+    }
+  pthread_rwlock_unlock (&s->lock);
+
+  return np;
+}
+
 /* Lookup node INUM (which must have a reference already) and return it
    without allocating any new references. */
 struct node *
 diskfs_cached_ifind (ino_t inum)
 {
+  struct nodecache_shard *s = shard_of (inum);
   struct node *np;
 
-  pthread_rwlock_rdlock (&nodecache_lock);
-  np = hurd_ihash_find (&nodecache, (hurd_ihash_key_t) &inum);
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_rdlock (&s->lock);
+  np = hurd_ihash_find (&s->nodes, (hurd_ihash_key_t) &inum);
+  pthread_rwlock_unlock (&s->lock);
 
   assert (np);
   return np;
 }
 
+/* Node NP, which has links, has just lost its last hard reference.
+   Remember it as the most recently used unused node in the node cache.
+   NP must be locked.  */
+void
+_diskfs_node_cache_unused (struct node *np)
+{
+  struct nodecache_shard *s;
+
+  /* Nodes are put into and taken out of the cache only while someone
+     holds a hard reference, or by shrink_shard if nobody but the cache
+     holds any reference at all, so SLOT cannot become NULL under our
+     feet.  Nodes of users that don't use the cache never have a
+     SLOT.  */
+  if (np->slot == NULL)
+    return;
+
+  s = shard_of (np->cache_id);
+  pthread_spin_lock (&s->lru_lock);
+  if (! lru_linked (s, np))
+    lru_push (s, np);
+  pthread_spin_unlock (&s->lru_lock);
+}
+
 void __attribute__ ((weak))
 diskfs_try_dropping_softrefs (struct node *np)
 {
-  pthread_rwlock_wrlock (&nodecache_lock);
+  struct nodecache_shard *s = shard_of (np->cache_id);
+
+  pthread_rwlock_wrlock (&s->lock);
   if (np->slot != NULL)
     {
       /* Check if someone reacquired a reference through the
@@ -157,15 +409,19 @@ diskfs_try_dropping_softrefs (struct node *np)
 	{
 	  /* A reference was reacquired through a hash table lookup.
 	     It's fine, we didn't touch anything yet. */
-	  pthread_rwlock_unlock (&nodecache_lock);
+	  pthread_rwlock_unlock (&s->lock);
 	  return;
 	}
 
-      hurd_ihash_locp_remove (&nodecache, np->slot);
+      hurd_ihash_locp_remove (&s->nodes, np->slot);
       np->slot = NULL;
+      pthread_spin_lock (&s->lru_lock);
+      if (lru_linked (s, np))
+	lru_unlink (s, np);
+      pthread_spin_unlock (&s->lru_lock);
       diskfs_nrele_light (np);
     }
-  pthread_rwlock_unlock (&nodecache_lock);
+  pthread_rwlock_unlock (&s->lock);
 
   diskfs_user_try_dropping_softrefs (np);
 }
@@ -177,39 +433,49 @@ error_t __attribute__ ((weak))
 diskfs_node_iterate (error_t (*fun)(struct node *))
 {
   error_t err = 0;
-  size_t num_nodes;
+  size_t num_nodes = 0;
   struct node *node, **node_list, **p;
+  int i;
 
-  pthread_rwlock_rdlock (&nodecache_lock);
+  /* Lock all shards, always in the same order, so that we see a
+     consistent picture of the cache.  */
+  for (i = 0; i < NODECACHE_SHARDS; i++)
+    {
+      pthread_rwlock_rdlock (&nodecache[i].lock);
+      num_nodes += nodecache[i].nodes.nr_items;
+    }
 
-  /* We must copy everything from the hash table into another data structure
-     to avoid running into any problems with the hash-table being modified
-     during processing (normally we delegate access to hash-table with
-     nodecache_lock, but we can't hold this while locking the
-     individual node locks).  */
+  /* We must copy everything from the hash tables into another data
+     structure to avoid running into any problems with the hash-tables
+     being modified during processing (normally we delegate access to
+     hash-table with the shard locks, but we can't hold these while
+     locking the individual node locks).  */
   /* XXX: Can we?  */
-  num_nodes = nodecache.nr_items;
 
   /* TODO This method doesn't scale beyond a few dozen nodes and should be
      replaced.  */
   node_list = malloc (num_nodes * sizeof (struct node *));
   if (node_list == NULL)
     {
-      pthread_rwlock_unlock (&nodecache_lock);
+      for (i = 0; i < NODECACHE_SHARDS; i++)
+	pthread_rwlock_unlock (&nodecache[i].lock);
       return ENOMEM;
     }
 
   p = node_list;
-  HURD_IHASH_ITERATE (&nodecache, i)
+  for (i = 0; i < NODECACHE_SHARDS; i++)
     {
-      *p++ = node = i;
+      HURD_IHASH_ITERATE (&nodecache[i].nodes, v)
+	{
+	  *p++ = node = v;
 
-      /* We acquire a hard reference for node, but without using
-	 diskfs_nref.  We do this so that diskfs_new_hardrefs will not
-	 get called.  */
-      refcounts_ref (&node->refcounts, NULL);
+	  /* We acquire a hard reference for node, but without using
+	     diskfs_nref.  We do this so that diskfs_new_hardrefs will not
+	     get called.  */
+	  refcounts_ref (&node->refcounts, NULL);
+	}
+      pthread_rwlock_unlock (&nodecache[i].lock);
     }
-  pthread_rwlock_unlock (&nodecache_lock);
 
   p = node_list;
   while (num_nodes-- > 0)
@@ -228,6 +494,43 @@ diskfs_node_iterate (error_t (*fun)(struct node *))
   return err;
 }
 
+/* Change diskfs_node_cache_size to SIZE, dropping unused nodes from the
+   cache right away if it now holds too many.  */
+void
+diskfs_set_node_cache_size (size_t size)
+{
+  int i;
+
+  diskfs_node_cache_size = size;
+  for (i = 0; i < NODECACHE_SHARDS; i++)
+    shrink_shard (&nodecache[i]);
+}
+
+/* Fill in *STATS with statistics about the node cache.  */
+void
+diskfs_node_cache_stats (struct diskfs_node_cache_stats *stats)
+{
+  int i;
+
+  memset (stats, 0, sizeof *stats);
+  stats->size = diskfs_node_cache_size;
+  for (i = 0; i < NODECACHE_SHARDS; i++)
+    {
+      struct nodecache_shard *s = &nodecache[i];
+
+      pthread_rwlock_rdlock (&s->lock);
+      stats->entries += s->nodes.nr_items;
+      stats->evictions += s->evictions;
+      pthread_spin_lock (&s->lru_lock);
+      stats->unused += s->lru_count;
+      pthread_spin_unlock (&s->lru_lock);
+      pthread_rwlock_unlock (&s->lock);
+
+      stats->hits += __atomic_load_n (&s->hits, __ATOMIC_RELAXED);
+      stats->misses += __atomic_load_n (&s->misses, __ATOMIC_RELAXED);
+    }
+}
+
 /* The user must define this function if she wants to use the node
    cache.  Create and initialize a node.  */
 error_t __attribute__ ((weak))
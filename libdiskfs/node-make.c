@@ -22,6 +22,9 @@
 static struct node *
 init_node (struct node *np, struct disknode *dn)
 {
+  np->slot = NULL;
+  np->lru_next = np->lru_prev = NULL;
+  np->name_cache_gen = _diskfs_name_cache_new_gen ();
   np->dn = dn;
   np->dn_set_ctime = 0;
   np->dn_set_atime = 0;
@@ -51,6 +51,8 @@ diskfs_nrele (struct node *np)
 	     hold a weak reference ourselves. */
 	  diskfs_try_dropping_softrefs (np);
 	}
+      else
+	_diskfs_node_cache_unused (np);
     }
 
   /* Finally get rid of our reference.  */
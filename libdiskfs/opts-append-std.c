@@ -62,5 +62,24 @@ diskfs_append_std_options (char **argz, size_t *argz_len)
 	}
     }
 
+  if (!err && diskfs_node_cache_size != DEFAULT_NODE_CACHE_SIZE)
+    {
+      char buf[80];
+      sprintf (buf, "--node-cache-size=%zu", diskfs_node_cache_size);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && diskfs_name_cache_size != DEFAULT_NAME_CACHE_SIZE)
+    {
+      char buf[80];
+      sprintf (buf, "--name-cache-size=%zu", diskfs_name_cache_size);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && ports_max_threads != 0)
+    {
+      char buf[80];
+      sprintf (buf, "--max-threads=%u", ports_max_threads);
+      err = argz_add (argz, argz_len, buf);
+    }
+
   return err;
 }
@@ -21,6 +21,7 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <argp.h>
+#include <string.h>
 #include "priv.h"
 
 const struct argp_option diskfs_common_options[] =
@@ -55,5 +56,23 @@ const struct argp_option diskfs_common_options[] =
    "Create new nodes with gid of parent dir (default)"},
   {"grpid",    0,   0, OPTION_ALIAS | OPTION_HIDDEN},
   {"bsdgroups", 0,   0, OPTION_ALIAS | OPTION_HIDDEN},
+  {"node-cache-size", OPT_NODE_CACHE_SIZE, "ENTRIES", 0,
+   "Keep at most ENTRIES nodes in the node cache, 0 for no limit"
+   " (default " DEFAULT_NODE_CACHE_SIZE_STRING ")"},
+  {"name-cache-size", OPT_NAME_CACHE_SIZE, "ENTRIES", 0,
+   "Cache at most ENTRIES directory lookups, 0 to disable the cache"
+   " (default " DEFAULT_NAME_CACHE_SIZE_STRING ")"},
+  {"max-threads", OPT_MAX_THREADS, "N", 0,
+   "Serve at most N requests at once, `auto' for a number suited to"
+   " the processors of this machine, 0 for no limit (the default);"
+   " too low a limit can deadlock the file system"},
   {0, 0}
 };
+
+unsigned int
+_diskfs_parse_max_threads (const char *arg)
+{
+  if (strcmp (arg, "auto") == 0)
+    return ports_auto_max_threads ();
+  return strtoul (arg, NULL, 0);
+}
@@ -34,6 +34,7 @@ struct parse_hook
 {
   int readonly, sync, sync_interval, remount, nosuid, noexec, noatime,
     noinheritdirgroup;
+  long node_cache_size, name_cache_size, max_threads;
 };
 
 /* Implement the options in H, and free H.  */
@@ -82,6 +83,12 @@ set_opts (struct parse_hook *h)
     _diskfs_noatime = h->noatime;
   if (h->noinheritdirgroup != -1)
     _diskfs_no_inherit_dir_group = h->noinheritdirgroup;
+  if (h->node_cache_size != -1)
+    diskfs_set_node_cache_size (h->node_cache_size);
+  if (h->name_cache_size != -1)
+    diskfs_set_name_cache_size (h->name_cache_size);
+  if (h->max_threads != -1)
+    ports_max_threads = h->max_threads;
 
   free (h);
 
@@ -106,6 +113,15 @@ parse_opt (int opt, char *arg, struct argp_state *state)
     case OPT_ATIME: h->noatime = 0; break;
     case OPT_NO_INHERIT_DIR_GROUP: h->noinheritdirgroup = 1; break;
     case OPT_INHERIT_DIR_GROUP: h->noinheritdirgroup = 0; break;
+    case OPT_NODE_CACHE_SIZE:
+      h->node_cache_size = strtoul (arg, NULL, 0);
+      break;
+    case OPT_NAME_CACHE_SIZE:
+      h->name_cache_size = strtoul (arg, NULL, 0);
+      break;
+    case OPT_MAX_THREADS:
+      h->max_threads = _diskfs_parse_max_threads (arg);
+      break;
     case 'n': h->sync_interval = 0; h->sync = 0; break;
     case 's':
       if (arg)
@@ -130,6 +146,7 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 	  h->sync_interval = -1;
 	  h->remount = 0;
 	  h->nosuid = h->noexec = h->noatime = h->noinheritdirgroup = -1;
+	  h->node_cache_size = h->name_cache_size = h->max_threads = -1;
 
 	  /* We know that we have one child, with which we share our hook.  */
 	  state->child_inputs[0] = h;
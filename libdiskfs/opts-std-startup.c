@@ -98,6 +98,15 @@ parse_startup_opt (int opt, char *arg, struct argp_state *state)
       diskfs_synchronous = 0;
       diskfs_default_sync_interval = 0;
       break;
+    case OPT_NODE_CACHE_SIZE:
+      diskfs_node_cache_size = strtoul (arg, NULL, 0);
+      break;
+    case OPT_NAME_CACHE_SIZE:
+      diskfs_name_cache_size = strtoul (arg, NULL, 0);
+      break;
+    case OPT_MAX_THREADS:
+      ports_max_threads = _diskfs_parse_max_threads (arg);
+      break;
 
       /* Boot options */
     case OPT_DEVICE_MASTER_PORT:
@@ -61,6 +61,9 @@ extern const struct argp_option diskfs_common_options[];
 #define OPT_ATIME	602	/* --atime */
 #define OPT_NO_INHERIT_DIR_GROUP	603	/* --no-inherit-dir-group */
 #define OPT_INHERIT_DIR_GROUP		604	/* --inherit-dir-group */
+#define OPT_NODE_CACHE_SIZE		605	/* --node-cache-size */
+#define OPT_NAME_CACHE_SIZE		606	/* --name-cache-size */
+#define OPT_MAX_THREADS			607	/* --max-threads */
 
 /* Common value for diskfs_common_options and diskfs_default_sync_interval. */
 #define DEFAULT_SYNC_INTERVAL 30
@@ -68,6 +71,38 @@ extern const struct argp_option diskfs_common_options[];
 #define STRINGIFY(x) STRINGIFY_1(x)
 #define STRINGIFY_1(x) #x
 
+/* Default value for diskfs_node_cache_size.  */
+#define DEFAULT_NODE_CACHE_SIZE 16384
+#define DEFAULT_NODE_CACHE_SIZE_STRING STRINGIFY(DEFAULT_NODE_CACHE_SIZE)
+
+/* Default value for diskfs_name_cache_size.  */
+#define DEFAULT_NAME_CACHE_SIZE 32768
+#define DEFAULT_NAME_CACHE_SIZE_STRING STRINGIFY(DEFAULT_NAME_CACHE_SIZE)
+
+/* Parse the argument ARG of --max-threads.  */
+unsigned int _diskfs_parse_max_threads (const char *arg);
+
+/* Return a name cache generation number that has never been used
+   before, for a new node or a directory whose entries are purged.  */
+unsigned long _diskfs_name_cache_new_gen (void);
+
+/* Return node INUM with a new hard reference, but unlocked, if it is
+   in the node cache.  Return NULL otherwise.  */
+struct node *_diskfs_cached_ref (ino_t inum);
+
+/* Like diskfs_check_lookup_cache, but only for names other than `..',
+   and without going to disk: return the node for the first LEN
+   characters of NAME inside DIR with a new hard reference, but
+   unlocked, if both the entry and the node are cached, and NULL
+   otherwise.  DIR need not be locked.  */
+struct node *_diskfs_check_lookup_cache_fast (struct node *dir,
+					      const char *name, size_t len);
+
+/* Node NP, which has links, has just lost its last hard reference.
+   Remember it as the most recently used unused node in the node cache.
+   NP must be locked.  */
+void _diskfs_node_cache_unused (struct node *np);
+
 /* Diskfs thinks the disk is dirty if this is set. */
 extern int _diskfs_diskdirty;
 
@@ -35,6 +35,13 @@
 
 #define SLAB_PAGES 4
 
+/* The number of objects a magazine holds.  */
+#define MAGAZINE_SIZE 32
+
+/* The number of slots in the table each thread uses to find its
+   caches.  */
+#define CACHE_TABLE_SIZE 16
+
 
 /* Number of pages the slab allocator has allocated.  */
 static int __hurd_slab_nr_pages;
@@ -67,6 +74,57 @@ struct hurd_slab
   union hurd_bufctl *free_list;
 };
 
+/* A magazine is a stack of free objects.  */
+struct hurd_slab_magazine
+{
+  struct hurd_slab_magazine *next;
+  int rounds;
+  void *objs[MAGAZINE_SIZE];
+};
+
+
+/* The cache a thread keeps for a slab space.  It is only used by its
+   thread, but hurd_slab_reclaim and hurd_slab_destroy may take its
+   magazines away, so it has a lock of its own.  The lock of the cache
+   is taken before the lock of the space.  */
+struct hurd_slab_thread_cache
+{
+  /* The space this cache is for, or NULL if the space has been
+     destroyed.  */
+  hurd_slab_space_t space;
+
+  pthread_spinlock_t lock;
+
+  /* Objects are taken from and put into LOADED.  When it is empty (on
+     allocation) or full (on deallocation), it is exchanged with
+     PREVIOUS, and if that does not help, with a magazine from the
+     depot.  Either may be NULL.  */
+  struct hurd_slab_magazine *loaded;
+  struct hurd_slab_magazine *previous;
+
+  /* Link in the list of caches of SPACE.  */
+  struct hurd_slab_thread_cache *space_next;
+
+  /* Link in the list of caches of the thread.  */
+  struct hurd_slab_thread_cache *thread_next;
+};
+
+/* Protects the lists of caches of each space and the list of spaces
+   that have caches.  Taken before the lock of a cache and the lock of
+   a space.  */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hurd_slab_space *spaces;
+
+/* Used to flush the caches of a thread when it exits.  */
+static pthread_key_t thread_caches_key;
+static pthread_once_t thread_caches_once = PTHREAD_ONCE_INIT;
+
+/* The caches of the current thread.  TABLE is indexed by a hash of
+   the space, and is only a hint.  */
+static __thread struct hurd_slab_thread_cache *thread_caches;
+static __thread struct hurd_slab_thread_cache *table[CACHE_TABLE_SIZE];
+
+
 /* Allocate a buffer in *PTR of size SIZE which must be a power of 2
    and self aligned (i.e. aligned on a SIZE byte boundary) for slab
    space SPACE.  Return 0 on success, an error code on failure.  */
@@ -384,6 +442,8 @@ hurd_slab_create (size_t size, size_t alignment,
 }
 
 
+static void drain (hurd_slab_space_t space, bool detach);
+
 /* Destroy all objects and the slab space SPACE.  Returns EBUSY if
    there are still allocated objects in the slab.  */
 error_t
@@ -392,8 +452,11 @@ hurd_slab_destroy (hurd_slab_space_t space)
   error_t err;
 
   /* The caller wants to destroy the slab.  It can not be destroyed if
-     there are any outstanding memory allocations.  */
-  pthread_mutex_lock (&space->lock);
+     there are any outstanding memory allocations.  Objects in the
+     per-thread caches are not outstanding, so get them back first.  */
+  pthread_mutex_lock (&registry_lock);
+  drain (space, true);
+  pthread_mutex_unlock (&registry_lock);
   err = reap (space);
   if (err)
     {
@@ -429,15 +492,13 @@ hurd_slab_free (hurd_slab_space_t space)
 }
 
 
-/* Allocate a new object from the slab space SPACE.  */
-error_t
-hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
+/* Allocate a new object from the slabs of SPACE, which is locked.  */
+static error_t
+alloc_locked (hurd_slab_space_t space, void **buffer)
 {
   error_t err;
   union hurd_bufctl *bufctl;
 
-  pthread_mutex_lock (&space->lock);
-
   /* If there is no slabs with free buffer, the cache has to be
      expanded with another slab.  If the slab space has not yet been
      initialized this is always true.  */
@@ -445,10 +506,7 @@ hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
     {
       err = grow (space);
       if (err)
-	{
-	  pthread_mutex_unlock (&space->lock);
-	  return err;
-	}
+	return err;
     }
 
   /* Remove buffer from the free list and update the reference
@@ -477,7 +535,6 @@ hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
       space->first_free = new_first;
     }
   *buffer = ((void *) bufctl) - (space->size - sizeof *bufctl);
-  pthread_mutex_unlock (&space->lock);
   return 0;
 }
 
@@ -492,17 +549,13 @@ put_on_slab_list (struct hurd_slab *slab, union hurd_bufctl *bufctl)
 }
 
 
-/* Deallocate the object BUFFER from the slab space SPACE.  */
-void
-hurd_slab_dealloc (hurd_slab_space_t space, void *buffer)
+/* Return the object BUFFER to the slabs of SPACE, which is locked.  */
+static void
+dealloc_locked (hurd_slab_space_t space, void *buffer)
 {
   struct hurd_slab *slab;
   union hurd_bufctl *bufctl;
 
-  assert (space->initialized);
-
-  pthread_mutex_lock (&space->lock);
-
   bufctl = (buffer + (space->size - sizeof *bufctl));
   put_on_slab_list (slab = bufctl->slab, bufctl);
 
@@ -513,6 +566,411 @@ hurd_slab_dealloc (hurd_slab_space_t space, void *buffer)
   if (!space->first_free 
       || slab->refcount < space->first_free->refcount)
     space->first_free = slab;
+}
+
+
+/* Per-thread caches.  */
+
+/* Put the magazine MAG, if any, in the depot of SPACE, which is
+   locked.  */
+static void
+depot_put (hurd_slab_space_t space, struct hurd_slab_magazine *mag)
+{
+  if (! mag)
+    return;
+  if (mag->rounds > 0)
+    {
+      mag->next = space->full_magazines;
+      space->full_magazines = mag;
+    }
+  else
+    {
+      mag->next = space->empty_magazines;
+      space->empty_magazines = mag;
+    }
+}
+
+/* Return an empty magazine from the depot of SPACE, which is locked,
+   or a new one.  Return NULL if out of memory.  */
+static struct hurd_slab_magazine *
+magazine_get (hurd_slab_space_t space)
+{
+  struct hurd_slab_magazine *mag = space->empty_magazines;
+
+  if (mag)
+    space->empty_magazines = mag->next;
+  else
+    {
+      mag = malloc (sizeof *mag);
+      if (mag)
+	mag->rounds = 0;
+    }
+  return mag;
+}
+
+/* Return the objects in the list of magazines MAGS to the slabs of
+   SPACE, which is locked, and free the magazines.  */
+static void
+free_magazines (hurd_slab_space_t space, struct hurd_slab_magazine *mags)
+{
+  struct hurd_slab_magazine *mag;
+
+  while ((mag = mags))
+    {
+      mags = mag->next;
+      while (mag->rounds > 0)
+	dealloc_locked (space, mag->objs[--mag->rounds]);
+      free (mag);
+    }
+}
+
+/* Take the magazines of all the caches of SPACE, and return their
+   objects, along with those in the depot, to the slabs.  If DETACH,
+   also dissociate the caches from SPACE.  REGISTRY_LOCK must be held.
+   Return with the lock of SPACE held.  */
+static void
+drain (hurd_slab_space_t space, bool detach)
+{
+  struct hurd_slab_thread_cache *tc;
+  struct hurd_slab_magazine *mags = NULL;
+
+  for (tc = space->thread_caches; tc; tc = tc->space_next)
+    {
+      pthread_spin_lock (&tc->lock);
+      if (tc->loaded)
+	{
+	  tc->loaded->next = mags;
+	  mags = tc->loaded;
+	  tc->loaded = NULL;
+	}
+      if (tc->previous)
+	{
+	  tc->previous->next = mags;
+	  mags = tc->previous;
+	  tc->previous = NULL;
+	}
+      if (detach)
+	__atomic_store_n (&tc->space, NULL, __ATOMIC_RELAXED);
+      pthread_spin_unlock (&tc->lock);
+    }
+
+  if (detach && space->registered)
+    {
+      struct hurd_slab_space **sp;
+
+      space->thread_caches = NULL;
+      for (sp = &spaces; *sp != space; sp = &(*sp)->next_space)
+	;
+      *sp = space->next_space;
+      space->registered = false;
+    }
+
+  pthread_mutex_lock (&space->lock);
+  free_magazines (space, mags);
+  free_magazines (space, space->full_magazines);
+  free_magazines (space, space->empty_magazines);
+  space->full_magazines = space->empty_magazines = NULL;
+}
+
+/* Give the magazines of the exiting thread's caches CACHES back to
+   their spaces, and free the caches.  */
+static void
+flush_thread_caches (void *caches)
+{
+  struct hurd_slab_thread_cache *tc, *next;
+
+  pthread_mutex_lock (&registry_lock);
+  for (tc = caches; tc; tc = next)
+    {
+      hurd_slab_space_t space = tc->space;
+
+      next = tc->thread_next;
+      if (space)
+	{
+	  struct hurd_slab_thread_cache **p;
+
+	  for (p = &space->thread_caches; *p != tc; p = &(*p)->space_next)
+	    ;
+	  *p = tc->space_next;
+
+	  pthread_mutex_lock (&space->lock);
+	  depot_put (space, tc->loaded);
+	  depot_put (space, tc->previous);
+	  pthread_mutex_unlock (&space->lock);
+	}
+      pthread_spin_destroy (&tc->lock);
+      free (tc);
+    }
+  pthread_mutex_unlock (&registry_lock);
+}
+
+static bool thread_caches_ok;
+
+static void
+thread_caches_init (void)
+{
+  thread_caches_ok = pthread_key_create (&thread_caches_key,
+					 flush_thread_caches) == 0;
+}
+
+/* Create a cache for SPACE for the current thread.  Return NULL if
+   that is not possible.  */
+static struct hurd_slab_thread_cache *
+new_thread_cache (hurd_slab_space_t space)
+{
+  struct hurd_slab_thread_cache *tc;
+
+  pthread_once (&thread_caches_once, thread_caches_init);
+  if (! thread_caches_ok)
+    return NULL;
+
+  /* Reuse a cache whose space has been destroyed.  */
+  for (tc = thread_caches; tc; tc = tc->thread_next)
+    if (__atomic_load_n (&tc->space, __ATOMIC_RELAXED) == NULL)
+      break;
+
+  if (! tc)
+    {
+      tc = calloc (1, sizeof *tc);
+      if (! tc)
+	return NULL;
+      pthread_spin_init (&tc->lock, PTHREAD_PROCESS_PRIVATE);
+      tc->thread_next = thread_caches;
+      if (pthread_setspecific (thread_caches_key, tc))
+	{
+	  pthread_spin_destroy (&tc->lock);
+	  free (tc);
+	  return NULL;
+	}
+      thread_caches = tc;
+    }
+
+  pthread_mutex_lock (&registry_lock);
+  __atomic_store_n (&tc->space, space, __ATOMIC_RELAXED);
+  tc->space_next = space->thread_caches;
+  space->thread_caches = tc;
+  if (! space->registered)
+    {
+      space->next_space = spaces;
+      spaces = space;
+      space->registered = true;
+    }
+  pthread_mutex_unlock (&registry_lock);
+
+  return tc;
+}
+
+/* Return the cache of the current thread for SPACE, or NULL if it
+   has none and cannot get one.  */
+static inline struct hurd_slab_thread_cache *
+get_thread_cache (hurd_slab_space_t space)
+{
+  struct hurd_slab_thread_cache **slot
+    = &table[((uintptr_t) space >> 6) % CACHE_TABLE_SIZE];
+  struct hurd_slab_thread_cache *tc = *slot;
+
+  if (tc && __atomic_load_n (&tc->space, __ATOMIC_RELAXED) == space)
+    return tc;
+
+  for (tc = thread_caches; tc; tc = tc->thread_next)
+    if (__atomic_load_n (&tc->space, __ATOMIC_RELAXED) == space)
+      break;
+  if (! tc)
+    tc = new_thread_cache (space);
+  if (tc)
+    *slot = tc;
+  return tc;
+}
+
+/* The cache TC of SPACE is out of objects.  Exchange its magazines
+   for a full one from the depot, or else fill one from the slabs.
+   Return one of the objects in *BUFFER.  */
+static error_t
+alloc_refill (hurd_slab_space_t space, struct hurd_slab_thread_cache *tc,
+	      void **buffer)
+{
+  struct hurd_slab_magazine *mag;
+  error_t err;
+
+  pthread_mutex_lock (&space->lock);
+
+  mag = space->full_magazines;
+  if (mag)
+    {
+      space->full_magazines = mag->next;
+      depot_put (space, tc->previous);
+      tc->previous = tc->loaded;
+      tc->loaded = mag;
+      *buffer = mag->objs[--mag->rounds];
+      pthread_mutex_unlock (&space->lock);
+      return 0;
+    }
+
+  err = alloc_locked (space, buffer);
+  if (! err)
+    {
+      /* Take some more objects while we hold the lock.  Only fill the
+	 magazine half way, so that there is room for deallocations
+	 too.  */
+      if (! tc->loaded)
+	tc->loaded = magazine_get (space);
+      mag = tc->loaded;
+      if (mag)
+	while (mag->rounds < MAGAZINE_SIZE / 2
+	       && ! alloc_locked (space, &mag->objs[mag->rounds]))
+	  mag->rounds++;
+    }
 
   pthread_mutex_unlock (&space->lock);
+  return err;
+}
+
+/* The cache TC of SPACE has no room left.  Exchange its magazines for
+   an empty one from the depot, and put BUFFER in it.  */
+static void
+dealloc_refill (hurd_slab_space_t space, struct hurd_slab_thread_cache *tc,
+		void *buffer)
+{
+  struct hurd_slab_magazine *mag;
+
+  pthread_mutex_lock (&space->lock);
+
+  mag = magazine_get (space);
+  if (mag)
+    {
+      depot_put (space, tc->previous);
+      tc->previous = tc->loaded;
+      tc->loaded = mag;
+      mag->objs[mag->rounds++] = buffer;
+    }
+  else
+    dealloc_locked (space, buffer);
+
+  pthread_mutex_unlock (&space->lock);
+}
+
+
+/* Allocate a new object from the slab space SPACE.  */
+error_t
+hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
+{
+  struct hurd_slab_thread_cache *tc = get_thread_cache (space);
+  struct hurd_slab_magazine *mag;
+  error_t err = 0;
+
+  if (! tc)
+    {
+      pthread_mutex_lock (&space->lock);
+      err = alloc_locked (space, buffer);
+      pthread_mutex_unlock (&space->lock);
+      return err;
+    }
+
+  pthread_spin_lock (&tc->lock);
+
+  mag = tc->loaded;
+  if (! mag || mag->rounds == 0)
+    {
+      if (tc->previous && tc->previous->rounds > 0)
+	{
+	  tc->loaded = tc->previous;
+	  tc->previous = mag;
+	}
+      else
+	{
+	  err = alloc_refill (space, tc, buffer);
+	  pthread_spin_unlock (&tc->lock);
+	  return err;
+	}
+    }
+
+  mag = tc->loaded;
+  *buffer = mag->objs[--mag->rounds];
+
+  pthread_spin_unlock (&tc->lock);
+  return 0;
+}
+
+
+/* Deallocate the object BUFFER from the slab space SPACE.  */
+void
+hurd_slab_dealloc (hurd_slab_space_t space, void *buffer)
+{
+  struct hurd_slab_thread_cache *tc;
+  struct hurd_slab_magazine *mag;
+
+  assert (space->initialized);
+
+  tc = get_thread_cache (space);
+  if (! tc)
+    {
+      pthread_mutex_lock (&space->lock);
+      dealloc_locked (space, buffer);
+      pthread_mutex_unlock (&space->lock);
+      return;
+    }
+
+  pthread_spin_lock (&tc->lock);
+
+  mag = tc->loaded;
+  if (! mag || mag->rounds == MAGAZINE_SIZE)
+    {
+      if (tc->previous && tc->previous->rounds < MAGAZINE_SIZE)
+	{
+	  tc->loaded = tc->previous;
+	  tc->previous = mag;
+	}
+      else
+	{
+	  dealloc_refill (space, tc, buffer);
+	  pthread_spin_unlock (&tc->lock);
+	  return;
+	}
+    }
+
+  mag = tc->loaded;
+  mag->objs[mag->rounds++] = buffer;
+
+  pthread_spin_unlock (&tc->lock);
+}
+
+
+/* Return the objects in the per-thread caches of SPACE to its slabs,
+   and release the slabs that are completely free.  */
+error_t
+hurd_slab_reclaim (hurd_slab_space_t space)
+{
+  error_t err;
+
+  pthread_mutex_lock (&registry_lock);
+  drain (space, false);
+  pthread_mutex_unlock (&registry_lock);
+
+  err = reap (space);
+  pthread_mutex_unlock (&space->lock);
+  return err;
+}
+
+
+/* Call hurd_slab_reclaim for every slab space in use.  */
+error_t
+hurd_slab_reclaim_all (void)
+{
+  struct hurd_slab_space *space;
+  error_t err = 0;
+
+  pthread_mutex_lock (&registry_lock);
+  for (space = spaces; space; space = space->next_space)
+    {
+      error_t e;
+
+      drain (space, false);
+      e = reap (space);
+      pthread_mutex_unlock (&space->lock);
+      if (e && ! err)
+	err = e;
+    }
+  pthread_mutex_unlock (&registry_lock);
+
+  return err;
 }
@@ -111,6 +111,19 @@ struct hurd_slab_space
   /* The size of one object.  Should include possible alignment as
      well as the size of the bufctl structure.  */
   size_t size;
+
+  /* The depot: magazines of free objects that are not loaded in a
+     per-thread cache.  Those in FULL_MAGAZINES hold at least one
+     object, those in EMPTY_MAGAZINES none.  Protected by LOCK.  */
+  struct hurd_slab_magazine *full_magazines;
+  struct hurd_slab_magazine *empty_magazines;
+
+  /* The per-thread caches for this space, and the link in the list of
+     all spaces that have some.  Protected by a global lock in
+     slab.c.  */
+  struct hurd_slab_thread_cache *thread_caches;
+  struct hurd_slab_space *next_space;
+  bool registered;
 };
 
 
@@ -177,6 +190,16 @@ error_t hurd_slab_alloc (hurd_slab_space_t space, void **buffer);
 
 /* Deallocate the object BUFFER from the slab space SPACE.  */
 void hurd_slab_dealloc (hurd_slab_space_t space, void *buffer);
+
+/* Each thread keeps a few free objects of each slab space it uses in
+   a cache of its own, so that most allocations and deallocations need
+   not take the lock of the space.  Return the objects held in these
+   caches to the slab space SPACE, and release the memory of the slabs
+   that are now completely free.  Call this when memory is scarce.  */
+error_t hurd_slab_reclaim (hurd_slab_space_t space);
+
+/* Call hurd_slab_reclaim for every slab space in use.  */
+error_t hurd_slab_reclaim_all (void);
 
 /* Create a more strongly typed slab interface a la a C++ template.
 
@@ -0,0 +1,690 @@
+/* cihash.c - Integer-keyed hash table for concurrent use.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* The table is laid out like the one of struct hurd_ihash: open
+   addressing with linear probing, where removed elements leave a
+   _HURD_IHASH_DELETED mark behind.  A location that has been used
+   never becomes empty again until the whole table is replaced, so a
+   lookup that runs concurrently with changes to other keys always
+   gets past them to the key it is looking for.
+
+   The writers of a location store its key before they publish its
+   value, and a lookup reads the value before the key.  A lookup can
+   still pair a value with a key that was stored later, if the location
+   is reused in between.  That can only give a wrong answer if the key
+   it is looking for was added or removed in the meantime, and every
+   such change bumps the sequence number of the stripe of the key.  A
+   lookup retries if the sequence number changed under it.
+
+   Reorganizing the table builds a new one with all the stripe locks
+   held, and publishes it.  Lookups may still be reading the old one,
+   so it is only freed once every thread that was in a lookup at that
+   time has left it.  For that, a thread that looks something up
+   announces the epoch it saw on entry in a per-thread record, and a
+   table retired in epoch E can go once no record shows an epoch
+   before E.  */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "cihash.h"
+
+/* Return the hash of the key K.  */
+static inline hurd_ihash_key_t
+hash (hurd_cihash_t ht, hurd_ihash_key_t k)
+{
+  return ht->fct_hash ? ht->fct_hash ((const void *) k) : k;
+}
+
+/* Returns true if the key A is equal to B.  */
+static inline int
+compare (hurd_cihash_t ht, hurd_ihash_key_t a, hurd_ihash_key_t b)
+{
+  return
+    ht->fct_cmp ? (a && ht->fct_cmp ((const void *) a, (const void *) b))
+		: a == b;
+}
+
+/* Return the stripe of the key with the hash H.  Consecutive keys
+   land in different stripes, but the bits used for that are mixed so
+   that they do not follow the index in the table.  */
+static inline struct _hurd_cihash_stripe *
+stripe (hurd_cihash_t ht, hurd_ihash_key_t h)
+{
+  uint32_t x = (uint32_t) (h ^ (h >> 16)) * 0x9e3779b1U;
+  return &ht->stripes[x >> 27 & (_HURD_CIHASH_STRIPES - 1)];
+}
+
+/* Return the load factor of N elements in a table of SIZE locations,
+   see hurd_ihash_get_load.  */
+static inline unsigned int
+load (size_t n, size_t size)
+{
+  int d = __builtin_ctzl (size) - 7;
+  return d >= 0 ? n >> d : n << -d;
+}
+
+/* Write a location pointer for VALUE, which is at ITEM.  The store
+   releases the writes to ITEM, so that whoever finds it through the
+   location pointer sees ITEM filled in.  */
+static inline void
+set_locp (hurd_cihash_t ht, hurd_ihash_value_t value,
+	  struct _hurd_ihash_item *item)
+{
+  if (ht->locp_offset != HURD_IHASH_NO_LOCP)
+    __atomic_store_n ((hurd_ihash_locp_t *) (((char *) value)
+					     + ht->locp_offset),
+		      &item->value, __ATOMIC_RELEASE);
+}
+
+/* Return the location of VALUE, as written by set_locp.  */
+static inline struct _hurd_ihash_item *
+get_locp (hurd_cihash_t ht, hurd_ihash_value_t value)
+{
+  return (struct _hurd_ihash_item *)
+    __atomic_load_n ((hurd_ihash_locp_t *) (((char *) value)
+					    + ht->locp_offset),
+		     __ATOMIC_ACQUIRE);
+}
+
+
+/* Sequence numbers.  Must be called with the lock of S held.  */
+
+static inline void
+write_begin (struct _hurd_cihash_stripe *s)
+{
+  __atomic_store_n (&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static inline void
+write_end (struct _hurd_cihash_stripe *s)
+{
+  __atomic_store_n (&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/* Epochs.  */
+
+/* A thread that is looking something up.  */
+struct reader
+{
+  /* The epoch the lookup started in, or 0 outside of lookups.  */
+  unsigned long epoch;
+
+  struct reader *next;
+} __attribute__ ((aligned (64)));
+
+/* The current epoch.  */
+static unsigned long epoch = 1;
+
+/* The records of all threads that have made lookups, protected by
+   readers_lock.  */
+static pthread_mutex_t readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct reader *readers;
+
+static pthread_once_t readers_once = PTHREAD_ONCE_INIT;
+static pthread_key_t reader_key;
+static __thread struct reader *self;
+
+/* Drop the record of an exiting thread.  */
+static void
+reader_destroy (void *arg)
+{
+  struct reader *r = arg, **rp;
+
+  pthread_mutex_lock (&readers_lock);
+  for (rp = &readers; *rp != r; rp = &(*rp)->next)
+    ;
+  *rp = r->next;
+  pthread_mutex_unlock (&readers_lock);
+  free (r);
+  self = NULL;
+}
+
+static void
+readers_init (void)
+{
+  int err = pthread_key_create (&reader_key, reader_destroy);
+  assert (! err);
+}
+
+/* Return the record of the calling thread, or NULL if it could not be
+   allocated.  */
+static struct reader *
+reader_self (void)
+{
+  struct reader *r = self;
+
+  if (r)
+    return r;
+
+  pthread_once (&readers_once, readers_init);
+  if (posix_memalign ((void **) &r, sizeof *r, sizeof *r))
+    return NULL;
+  r->epoch = 0;
+  pthread_mutex_lock (&readers_lock);
+  r->next = readers;
+  readers = r;
+  pthread_mutex_unlock (&readers_lock);
+  pthread_setspecific (reader_key, r);
+  return self = r;
+}
+
+/* Enter a lookup.  Returns 1 if this is the outermost one, which must
+   be left with reader_leave.  */
+static inline int
+reader_enter (struct reader *r)
+{
+  if (r->epoch)
+    /* A hash or compare function looking something up.  */
+    return 0;
+
+  __atomic_store_n (&r->epoch, __atomic_load_n (&epoch, __ATOMIC_RELAXED),
+		    __ATOMIC_RELAXED);
+  /* The announcement must be visible before we look at the table, see
+     reclaim.  */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  return 1;
+}
+
+static inline void
+reader_leave (struct reader *r)
+{
+  __atomic_store_n (&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Free the retired tables of HT that no lookup can be looking at.
+   Must be called with all the locks of HT held.  */
+static void
+reclaim (hurd_cihash_t ht)
+{
+  struct _hurd_cihash_table *t, **tp;
+  unsigned long oldest = ~0UL;
+  struct reader *r;
+
+  if (! ht->retired)
+    return;
+
+  /* Pairs with the fence in reader_enter: either a lookup announced
+     itself before we look here, or it sees the current table.  */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock (&readers_lock);
+  for (r = readers; r; r = r->next)
+    {
+      unsigned long e = __atomic_load_n (&r->epoch, __ATOMIC_ACQUIRE);
+      if (e && e < oldest)
+	oldest = e;
+    }
+  pthread_mutex_unlock (&readers_lock);
+
+  tp = &ht->retired;
+  while ((t = *tp))
+    if (t->epoch <= oldest)
+      {
+	*tp = t->retired;
+	free (t);
+      }
+    else
+      tp = &t->retired;
+}
+
+
+/* Construction and destruction of hash tables.  */
+
+void
+hurd_cihash_init (hurd_cihash_t ht, intptr_t locp_offs)
+{
+  int i;
+
+  ht->table = NULL;
+  ht->retired = NULL;
+  ht->nr_items = 0;
+  ht->nr_used = 0;
+  ht->locp_offset = locp_offs;
+  ht->max_load = HURD_IHASH_MAX_LOAD_DEFAULT;
+  ht->cleanup = 0;
+  ht->fct_hash = NULL;
+  ht->fct_cmp = NULL;
+  for (i = 0; i < _HURD_CIHASH_STRIPES; i++)
+    {
+      pthread_mutex_init (&ht->stripes[i].lock, NULL);
+      ht->stripes[i].seq = 0;
+    }
+}
+
+void
+hurd_cihash_destroy (hurd_cihash_t ht)
+{
+  struct _hurd_cihash_table *t;
+  size_t i;
+
+  if (ht->table)
+    {
+      if (ht->cleanup)
+	for (i = 0; i < ht->table->size; i++)
+	  if (hurd_ihash_value_valid (ht->table->items[i].value))
+	    (*ht->cleanup) (ht->table->items[i].value, ht->cleanup_data);
+      free (ht->table);
+    }
+
+  /* Nobody may look at HT anymore.  */
+  while ((t = ht->retired))
+    {
+      ht->retired = t->retired;
+      free (t);
+    }
+}
+
+void
+hurd_cihash_set_cleanup (hurd_cihash_t ht, hurd_ihash_cleanup_t cleanup,
+			 void *cleanup_data)
+{
+  ht->cleanup = cleanup;
+  ht->cleanup_data = cleanup_data;
+}
+
+void
+hurd_cihash_set_gki (hurd_cihash_t ht,
+		     hurd_ihash_fct_hash_t fct_hash,
+		     hurd_ihash_fct_cmp_t fct_cmp)
+{
+  assert (ht->table == NULL || ! "called after insertion");
+  ht->fct_hash = fct_hash;
+  ht->fct_cmp = fct_cmp;
+}
+
+void
+hurd_cihash_set_max_load (hurd_cihash_t ht, unsigned int max_load)
+{
+  ht->max_load = max_load;
+}
+
+void
+hurd_cihash_lock (hurd_cihash_t ht)
+{
+  int i;
+
+  for (i = 0; i < _HURD_CIHASH_STRIPES; i++)
+    pthread_mutex_lock (&ht->stripes[i].lock);
+}
+
+void
+hurd_cihash_unlock (hurd_cihash_t ht)
+{
+  int i;
+
+  for (i = _HURD_CIHASH_STRIPES - 1; i >= 0; i--)
+    pthread_mutex_unlock (&ht->stripes[i].lock);
+}
+
+
+/* Replace the table SEEN of HT with a new one that has room for more
+   elements, and no removed ones.  If the table is no longer SEEN,
+   somebody else did this already.  */
+static error_t
+reorganize (hurd_cihash_t ht, struct _hurd_cihash_table *seen)
+{
+  struct _hurd_cihash_table *old, *new;
+  size_t size, mask, i, idx;
+
+  hurd_cihash_lock (ht);
+
+  old = ht->table;
+  if (old != seen)
+    {
+      hurd_cihash_unlock (ht);
+      return 0;
+    }
+
+  /* Only enlarge the table if the elements, rather than the removed
+     ones, fill it.  */
+  size = old ? old->size : HURD_IHASH_MIN_SIZE;
+  if (old && load (ht->nr_items, size) > ht->max_load / 2)
+    size <<= 1;
+
+  new = calloc (1, sizeof *new + size * sizeof new->items[0]);
+  if (new == NULL)
+    {
+      hurd_cihash_unlock (ht);
+      return ENOMEM;
+    }
+  new->size = size;
+  mask = size - 1;
+
+  /* Nobody changes OLD anymore, and no location in it is reserved.
+     The new table is not published yet, so plain stores will do.  */
+  if (old)
+    for (i = 0; i < old->size; i++)
+      {
+	struct _hurd_ihash_item *item = &old->items[i];
+	if (! hurd_ihash_value_valid (item->value))
+	  continue;
+
+	for (idx = hash (ht, item->key) & mask;
+	     new->items[idx].value != _HURD_IHASH_EMPTY;
+	     idx = (idx + 1) & mask)
+	  ;
+	new->items[idx].key = item->key;
+	new->items[idx].value = item->value;
+	set_locp (ht, item->value, &new->items[idx]);
+      }
+
+  ht->nr_used = ht->nr_items;
+  __atomic_store_n (&ht->table, new, __ATOMIC_RELEASE);
+
+  if (old)
+    {
+      /* Lookups that started from now on see NEW.  */
+      old->epoch = __atomic_add_fetch (&epoch, 1, __ATOMIC_SEQ_CST);
+      old->retired = ht->retired;
+      ht->retired = old;
+    }
+  reclaim (ht);
+
+  hurd_cihash_unlock (ht);
+  return 0;
+}
+
+
+/* Helper function for hurd_cihash_add, called with the lock of the
+   stripe S of KEY held.  Return 1 if the item was added, and 0 if the
+   table TABLE needs to be reorganized first.  Unless FORCE is set,
+   this is the case if the load factor would exceed the maximum.  */
+static int
+add_one (hurd_cihash_t ht, struct _hurd_cihash_table *table,
+	 struct _hurd_cihash_stripe *s, hurd_ihash_key_t h,
+	 hurd_ihash_key_t key, hurd_ihash_value_t value, int force)
+{
+  size_t mask = table->size - 1;
+  size_t idx = h & mask;
+  size_t first_deleted = table->size;
+  struct _hurd_ihash_item *item;
+  hurd_ihash_value_t v;
+  size_t n;
+
+  /* Look for KEY, and remember where it could go.  Only we add and
+     remove KEY, so if it is not there, it will not show up behind our
+     back.  */
+  for (n = 0; n < table->size; n++, idx = (idx + 1) & mask)
+    {
+      item = &table->items[idx];
+      v = __atomic_load_n (&item->value, __ATOMIC_ACQUIRE);
+      if (v == _HURD_IHASH_EMPTY)
+	break;
+      if (v == _HURD_IHASH_DELETED)
+	{
+	  if (first_deleted == table->size)
+	    first_deleted = idx;
+	  continue;
+	}
+      if (v == _HURD_CIHASH_RESERVED
+	  || ! compare (ht, __atomic_load_n (&item->key, __ATOMIC_RELAXED),
+			key))
+	continue;
+
+      /* Replace the value of KEY.  Lookups see either one.  */
+      if (ht->cleanup)
+	(*ht->cleanup) (v, ht->cleanup_data);
+      set_locp (ht, value, item);
+      __atomic_store_n (&item->value, value, __ATOMIC_RELEASE);
+      return 1;
+    }
+
+  if (first_deleted < table->size)
+    idx = first_deleted;
+  else if (n == table->size)
+    /* The table is full.  */
+    return 0;
+
+  /* Claim a location.  Writers of other keys compete for the same
+     ones, so if we lose, look further.  */
+  for (n = 0; n < table->size; n++, idx = (idx + 1) & mask)
+    {
+      item = &table->items[idx];
+      v = __atomic_load_n (&item->value, __ATOMIC_RELAXED);
+      if (v == _HURD_IHASH_EMPTY)
+	{
+	  if (! force
+	      && load (__atomic_load_n (&ht->nr_used, __ATOMIC_RELAXED) + 1,
+		       table->size) > ht->max_load)
+	    return 0;
+	}
+      else if (v != _HURD_IHASH_DELETED)
+	continue;
+
+      if (__atomic_compare_exchange_n (&item->value, &v,
+				       _HURD_CIHASH_RESERVED, 0,
+				       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	break;
+    }
+  if (n == table->size)
+    return 0;
+
+  if (v == _HURD_IHASH_EMPTY)
+    __atomic_add_fetch (&ht->nr_used, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&ht->nr_items, 1, __ATOMIC_RELAXED);
+
+  write_begin (s);
+  __atomic_store_n (&item->key, key, __ATOMIC_RELAXED);
+  set_locp (ht, value, item);
+  __atomic_store_n (&item->value, value, __ATOMIC_RELEASE);
+  write_end (s);
+
+  return 1;
+}
+
+error_t
+hurd_cihash_add (hurd_cihash_t ht, hurd_ihash_key_t key,
+		 hurd_ihash_value_t item)
+{
+  hurd_ihash_key_t h = hash (ht, key);
+  struct _hurd_cihash_stripe *s = stripe (ht, h);
+  struct _hurd_cihash_table *table;
+  int force = 0;	/* go over the load factor on allocation errors */
+  error_t err;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&s->lock);
+      /* The table only changes with all locks held.  */
+      table = ht->table;
+      if (table && add_one (ht, table, s, h, key, item, force))
+	{
+	  pthread_mutex_unlock (&s->lock);
+	  return 0;
+	}
+      pthread_mutex_unlock (&s->lock);
+
+      err = reorganize (ht, table);
+      if (err)
+	{
+	  /* We prefer performance degradation over failure, but if
+	     the table is full, there is nothing we can do.  */
+	  if (force || table == NULL)
+	    return err;
+	  force = 1;
+	}
+    }
+}
+
+
+/* Look up KEY with the hash H in the current table of HT.  */
+static inline hurd_ihash_value_t
+find_one (hurd_cihash_t ht, hurd_ihash_key_t h, hurd_ihash_key_t key)
+{
+  struct _hurd_cihash_table *table;
+  size_t mask, idx, n;
+
+  table = __atomic_load_n (&ht->table, __ATOMIC_ACQUIRE);
+  if (table == NULL)
+    return NULL;
+
+  mask = table->size - 1;
+  idx = h & mask;
+  for (n = 0; n < table->size; n++, idx = (idx + 1) & mask)
+    {
+      struct _hurd_ihash_item *item = &table->items[idx];
+      hurd_ihash_value_t v = __atomic_load_n (&item->value,
+					      __ATOMIC_ACQUIRE);
+      if (v == _HURD_IHASH_EMPTY)
+	break;
+      if (v != _HURD_IHASH_DELETED && v != _HURD_CIHASH_RESERVED
+	  && compare (ht, __atomic_load_n (&item->key, __ATOMIC_RELAXED),
+		      key))
+	return v;
+    }
+  return NULL;
+}
+
+hurd_ihash_value_t
+hurd_cihash_find (hurd_cihash_t ht, hurd_ihash_key_t key)
+{
+  hurd_ihash_key_t h = hash (ht, key);
+  struct _hurd_cihash_stripe *s = stripe (ht, h);
+  struct reader *r = reader_self ();
+  hurd_ihash_value_t value;
+  unsigned int seq;
+  int outer;
+
+  if (r == NULL)
+    {
+      /* Without a record we cannot keep the table from being freed
+	 under us.  */
+      pthread_mutex_lock (&s->lock);
+      value = find_one (ht, h, key);
+      pthread_mutex_unlock (&s->lock);
+      return value;
+    }
+
+  outer = reader_enter (r);
+  do
+    {
+      while ((seq = __atomic_load_n (&s->seq, __ATOMIC_ACQUIRE)) & 1)
+	;
+      value = find_one (ht, h, key);
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    }
+  while (__atomic_load_n (&s->seq, __ATOMIC_RELAXED) != seq);
+  if (outer)
+    reader_leave (r);
+
+  return value;
+}
+
+
+/* Remove the element at ITEM from the hash table HT.  Must be called
+   with the lock of the stripe S of its key held.  */
+static void
+remove_one (hurd_cihash_t ht, struct _hurd_cihash_stripe *s,
+	    struct _hurd_ihash_item *item)
+{
+  hurd_ihash_value_t value = __atomic_load_n (&item->value,
+					      __ATOMIC_RELAXED);
+
+  write_begin (s);
+  __atomic_store_n (&item->value, _HURD_IHASH_DELETED, __ATOMIC_RELAXED);
+  write_end (s);
+  __atomic_sub_fetch (&ht->nr_items, 1, __ATOMIC_RELAXED);
+
+  if (ht->cleanup)
+    (*ht->cleanup) (value, ht->cleanup_data);
+}
+
+int
+hurd_cihash_remove (hurd_cihash_t ht, hurd_ihash_key_t key)
+{
+  hurd_ihash_key_t h = hash (ht, key);
+  struct _hurd_cihash_stripe *s = stripe (ht, h);
+  struct _hurd_cihash_table *table;
+  size_t mask, idx, n;
+  int removed = 0;
+
+  pthread_mutex_lock (&s->lock);
+  table = ht->table;
+  if (table)
+    {
+      mask = table->size - 1;
+      idx = h & mask;
+      for (n = 0; n < table->size; n++, idx = (idx + 1) & mask)
+	{
+	  struct _hurd_ihash_item *item = &table->items[idx];
+	  hurd_ihash_value_t v = __atomic_load_n (&item->value,
+						  __ATOMIC_RELAXED);
+	  if (v == _HURD_IHASH_EMPTY)
+	    break;
+	  if (v != _HURD_IHASH_DELETED && v != _HURD_CIHASH_RESERVED
+	      && compare (ht, __atomic_load_n (&item->key, __ATOMIC_RELAXED),
+			  key))
+	    {
+	      remove_one (ht, s, item);
+	      removed = 1;
+	      break;
+	    }
+	}
+    }
+  pthread_mutex_unlock (&s->lock);
+
+  return removed;
+}
+
+void
+hurd_cihash_locp_remove (hurd_cihash_t ht, hurd_ihash_value_t value)
+{
+  struct reader *r = reader_self ();
+  struct _hurd_ihash_item *item;
+  struct _hurd_cihash_stripe *s;
+  int outer;
+
+  assert (ht->locp_offset != HURD_IHASH_NO_LOCP);
+
+  if (r == NULL)
+    {
+      hurd_cihash_lock (ht);
+      item = get_locp (ht, value);
+      remove_one (ht, stripe (ht, hash (ht, item->key)), item);
+      hurd_cihash_unlock (ht);
+      return;
+    }
+
+  /* Find the lock of the key.  The table the location pointer points
+     into may be replaced at any moment, but it is not freed while we
+     are in a lookup.  Nobody else removes VALUE, so its key stays
+     put.  */
+  outer = reader_enter (r);
+  item = get_locp (ht, value);
+  s = stripe (ht, hash (ht, __atomic_load_n (&item->key, __ATOMIC_RELAXED)));
+  pthread_mutex_lock (&s->lock);
+  if (outer)
+    reader_leave (r);
+
+  /* Now the table stays, but it may have changed before we got the
+     lock.  */
+  item = get_locp (ht, value);
+  remove_one (ht, s, item);
+  pthread_mutex_unlock (&s->lock);
+}
@@ -0,0 +1,192 @@
+/* cihash.h - Integer keyed hash table for concurrent use.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#ifndef _HURD_CIHASH_H
+#define _HURD_CIHASH_H	1
+
+#include <pthread.h>
+#include <hurd/ihash.h>
+
+
+/* A variant of struct hurd_ihash that does its own locking, for
+   tables that are looked up by many threads at once.
+
+   Lookups take no lock at all.  Additions and removals take one of
+   _HURD_CIHASH_STRIPES locks, chosen by the hash of the key, so that
+   changes to different keys can happen in parallel.  Reorganizing the
+   table takes all of them.  The old table is freed once no lookup
+   that may have seen it is still in progress.
+
+   Lookups run concurrently with changes, so a value returned by
+   hurd_cihash_find may already have been removed from the table by
+   the time the caller looks at it.  The caller must make sure that
+   the values in the table are not freed while a lookup may still
+   return them.
+
+   The keys, the values that are reserved, the cleanup function, the
+   generalized key interface and location pointers are as for struct
+   hurd_ihash.  The value (hurd_ihash_value_t) -2 is reserved as
+   well.  */
+
+/* The number of locks of a table.  Must be a power of two.  */
+#define _HURD_CIHASH_STRIPES	32
+
+/* A location that is being claimed by an addition.  */
+#define _HURD_CIHASH_RESERVED	((hurd_ihash_value_t) -2)
+
+struct _hurd_cihash_stripe
+{
+  pthread_mutex_t lock;
+
+  /* Odd while a key of this stripe is being changed.  */
+  unsigned int seq;
+} __attribute__ ((aligned (64)));
+
+struct _hurd_cihash_table
+{
+  /* The length of the array ITEMS, a power of two.  */
+  size_t size;
+
+  /* Once this table has been replaced, the next table that is waiting
+     to be freed, and the epoch in which it was replaced.  */
+  struct _hurd_cihash_table *retired;
+  unsigned long epoch;
+
+  struct _hurd_ihash_item items[0];
+};
+
+struct hurd_cihash
+{
+  /* The current table, or NULL if nothing has been added yet.  */
+  struct _hurd_cihash_table *table;
+
+  /* Tables that have been replaced, but that lookups may still be
+     looking at.  */
+  struct _hurd_cihash_table *retired;
+
+  /* The number of hashed elements.  */
+  size_t nr_items;
+
+  /* The number of locations that are not empty, that is, of hashed
+     elements plus those that have been removed since the table was
+     last reorganized.  */
+  size_t nr_used;
+
+  /* As in struct hurd_ihash.  */
+  intptr_t locp_offset;
+  unsigned int max_load;
+  hurd_ihash_cleanup_t cleanup;
+  void *cleanup_data;
+  hurd_ihash_fct_hash_t fct_hash;
+  hurd_ihash_fct_cmp_t fct_cmp;
+
+  struct _hurd_cihash_stripe stripes[_HURD_CIHASH_STRIPES];
+};
+typedef struct hurd_cihash *hurd_cihash_t;
+
+/* The static initializer for a struct hurd_cihash.  */
+#define HURD_CIHASH_INITIALIZER(locp_offs)				\
+  { .table = 0, .retired = 0, .nr_items = 0, .nr_used = 0,		\
+    .locp_offset = (locp_offs),						\
+    .max_load = HURD_IHASH_MAX_LOAD_DEFAULT,				\
+    .cleanup = (hurd_ihash_cleanup_t) 0,				\
+    .stripes = { [0 ... _HURD_CIHASH_STRIPES - 1] =			\
+		 { .lock = PTHREAD_MUTEX_INITIALIZER, .seq = 0 } } }
+
+/* Initialize the hash table at address HT.  LOCP_OFFS is as for
+   hurd_ihash_init.  */
+void hurd_cihash_init (hurd_cihash_t ht, intptr_t locp_offs);
+
+/* Destroy the hash table at address HT.  This first removes all
+   elements which are still in the hash table, and calling the cleanup
+   function for them (if any).  */
+void hurd_cihash_destroy (hurd_cihash_t ht);
+
+/* Set the cleanup function for the hash table HT to CLEANUP.  The
+   second argument to CLEANUP will be CLEANUP_DATA on every
+   invocation.  The cleanup function is called with the lock of the
+   key held.  */
+void hurd_cihash_set_cleanup (hurd_cihash_t ht, hurd_ihash_cleanup_t cleanup,
+			      void *cleanup_data);
+
+/* Use the generalized key interface.  Must be called before any item
+   is inserted into the table.  FCT_CMP may be called on keys that are
+   being removed concurrently.  */
+void hurd_cihash_set_gki (hurd_cihash_t ht,
+			  hurd_ihash_fct_hash_t fct_hash,
+			  hurd_ihash_fct_cmp_t fct_cmp);
+
+/* Set the maximum load factor in binary percent to MAX_LOAD, see
+   hurd_ihash_set_max_load.  Locations of removed elements count
+   towards the load until the table is reorganized.  */
+void hurd_cihash_set_max_load (hurd_cihash_t ht, unsigned int max_load);
+
+/* Add ITEM to the hash table HT under the key KEY.  If there already
+   is an item under this key, call the cleanup function (if any) for
+   it before overriding the value.  If a memory allocation error
+   occurs, ENOMEM is returned, otherwise 0.  */
+error_t hurd_cihash_add (hurd_cihash_t ht, hurd_ihash_key_t key,
+			 hurd_ihash_value_t item);
+
+/* Find and return the item in the hash table HT with key KEY, or NULL
+   if it doesn't exist.  This takes no lock.  */
+hurd_ihash_value_t hurd_cihash_find (hurd_cihash_t ht, hurd_ihash_key_t key);
+
+/* Remove the entry with the key KEY from the hash table HT.  If such
+   an entry was found and removed, 1 is returned, otherwise 0.  */
+int hurd_cihash_remove (hurd_cihash_t ht, hurd_ihash_key_t key);
+
+/* Remove VALUE, which must be in the hash table HT, using the
+   location pointer stored in it.  HT must have been initialized with
+   a LOCP_OFFS.  Unlike hurd_ihash_locp_remove, this takes the value
+   rather than the location pointer, which changes when the table is
+   reorganized and could thus be out of date by the time it is used.
+   This call is faster than hurd_cihash_remove.  */
+void hurd_cihash_locp_remove (hurd_cihash_t ht, hurd_ihash_value_t value);
+
+/* Return the number of elements in HT.  */
+static inline size_t
+hurd_cihash_nr_items (hurd_cihash_t ht)
+{
+  return __atomic_load_n (&ht->nr_items, __ATOMIC_RELAXED);
+}
+
+/* Take all the locks of HT, so that it does not change.  Lookups can
+   still proceed.  */
+void hurd_cihash_lock (hurd_cihash_t ht);
+
+/* Release the locks taken by hurd_cihash_lock.  */
+void hurd_cihash_unlock (hurd_cihash_t ht);
+
+/* Iterate over all elements in the hash table HT, like
+   HURD_IHASH_ITERATE.  HT must be locked with hurd_cihash_lock.  */
+#define HURD_CIHASH_ITERATE(ht, val)					\
+  for (hurd_ihash_value_t val,						\
+	 *_hurd_cihash_valuep = (ht)->table				\
+	   ? &(ht)->table->items[0].value : 0;				\
+       _hurd_cihash_valuep						\
+	 && (size_t) ((_hurd_ihash_item_t) _hurd_cihash_valuep		\
+		      - &(ht)->table->items[0])				\
+	    < (ht)->table->size						\
+	 && (val = *_hurd_cihash_valuep, 1);				\
+       _hurd_cihash_valuep = (hurd_ihash_value_t *)			\
+	 (((_hurd_ihash_item_t) _hurd_cihash_valuep) + 1))		\
+    if (hurd_ihash_value_valid (val) && val != _HURD_CIHASH_RESERVED)
+
+#endif	/* _HURD_CIHASH_H */
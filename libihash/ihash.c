@@ -1,5 +1,5 @@
 /* ihash.c - Integer-keyed hash table functions.
-   Copyright (C) 1993-1997, 2001, 2003, 2004, 2006, 2014, 2015
+   Copyright (C) 1993-1997, 2001, 2003, 2004, 2006, 2014, 2015, 2026
      Free Software Foundation, Inc.
    Written by Michael I. Bushnell.
    Revised by Miles Bader <miles@gnu.org>.
@@ -28,15 +28,152 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include "ihash.h"
 
-/* This function is used to hash the key.  */
-static inline hurd_ihash_key_t
+/* The layout of the table follows the "Swiss table" design.  The
+   array of items is followed by one control byte per item, which
+   tells whether the item is empty, deleted, or in use, and in the
+   latter case holds seven bits of the hash of its key.  The table is
+   divided into groups of GROUP_SIZE items, and the control bytes of a
+   whole group are compared with the one we look for at once, so that
+   most lookups look at one key only.
+
+   A key is probed for in the group given by the upper bits of its
+   hash, and then in the groups following it at increasing distances,
+   until it is found, or a group with an empty item is reached.  So a
+   deleted item only has to be marked as such if its group is full,
+   as probes never stopped in that group.  Otherwise it becomes empty
+   again.  */
+
+#define GROUP_SIZE	16
+
+#define CTRL_EMPTY	((uint8_t) 0x80)
+#define CTRL_DELETED	((uint8_t) 0xfe)
+/* Items in use have the H2 of their key, which has the high bit
+   clear.  */
+
+/* Return the control bytes of the hash table HT.  */
+static inline uint8_t *
+ctrl (hurd_ihash_t ht)
+{
+  return (uint8_t *) &ht->items[ht->size];
+}
+
+/* The upper and lower bits of the hash H: the group to start probing
+   in, and the bits kept in the control byte.  */
+#define H1(h)	((h) >> 7)
+#define H2(h)	((uint8_t) ((h) & 0x7f))
+
+/* The groups are compared using SSE2 if we have it, and otherwise
+   eight bytes at a time in general registers.  Either way, the result
+   is a mask with one bit per item of the group.  */
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/* Return the items in the group at CTRL with the control byte C.  */
+static inline unsigned int
+group_match (const uint8_t *ctrl, uint8_t c)
+{
+  __m128i g = _mm_loadu_si128 ((const __m128i *) ctrl);
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (g, _mm_set1_epi8 (c)));
+}
+
+/* Return the items in the group at CTRL that are empty.  */
+static inline unsigned int
+group_match_empty (const uint8_t *ctrl)
+{
+  return group_match (ctrl, CTRL_EMPTY);
+}
+
+/* Return the items in the group at CTRL that are empty or deleted.  */
+static inline unsigned int
+group_match_free (const uint8_t *ctrl)
+{
+  return _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) ctrl));
+}
+
+#else
+
+#define LSBS	0x0101010101010101ULL
+#define MSBS	0x8080808080808080ULL
+
+/* Load eight control bytes, the first one in the lowest byte.  */
+static inline uint64_t
+load8 (const uint8_t *ctrl)
+{
+  uint64_t w;
+  memcpy (&w, ctrl, sizeof w);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64 (w);
+#endif
+  return w;
+}
+
+/* Gather the high bits of the bytes of W into the lowest byte.  */
+static inline unsigned int
+compress8 (uint64_t w)
+{
+  return ((w >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+/* This may also report an item right after a matching one.  The
+   keys are compared anyway.  */
+static inline unsigned int
+match8 (uint64_t w, uint8_t c)
+{
+  w ^= LSBS * c;
+  return compress8 ((w - LSBS) & ~w & MSBS);
+}
+
+static inline unsigned int
+group_match (const uint8_t *ctrl, uint8_t c)
+{
+  return match8 (load8 (ctrl), c) | match8 (load8 (ctrl + 8), c) << 8;
+}
+
+/* CTRL_EMPTY is the only value with the high bit set and bit 1
+   clear.  */
+static inline unsigned int
+group_match_empty (const uint8_t *ctrl)
+{
+  uint64_t lo = load8 (ctrl), hi = load8 (ctrl + 8);
+  return (compress8 (lo & ~(lo << 6) & MSBS)
+	  | compress8 (hi & ~(hi << 6) & MSBS) << 8);
+}
+
+static inline unsigned int
+group_match_free (const uint8_t *ctrl)
+{
+  return (compress8 (load8 (ctrl) & MSBS)
+	  | compress8 (load8 (ctrl + 8) & MSBS) << 8);
+}
+#endif
+
+/* Return the hash of the key K.  Integer keys are often consecutive,
+   and the groups are found with the upper bits, so the bits of the
+   key are mixed first.  */
+static inline size_t
 hash (hurd_ihash_t ht, hurd_ihash_key_t k)
 {
-  return ht->fct_hash ? ht->fct_hash ((const void *) k) : k;
+  size_t h = ht->fct_hash ? ht->fct_hash ((const void *) k) : k;
+
+#if SIZE_MAX > 0xffffffff
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+#else
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+#endif
+  return h;
 }
 
 /* This function is used to compare the key.  Returns true if A is
@@ -48,63 +185,86 @@ compare (hurd_ihash_t ht, hurd_ihash_key_t a, hurd_ihash_key_t b)
     ht->fct_cmp ? (a && ht->fct_cmp ((const void *) a, (const void *) b))
 		: a == b;
 }
-
-/* Return 1 if the slot with the index IDX in the hash table HT is
-   empty, and 0 otherwise.  */
-static inline int
-index_empty (hurd_ihash_t ht, unsigned int idx)
-{
-  return ! hurd_ihash_value_valid (ht->items[idx].value);
-}
 
-
-/* Return 1 if the index IDX in the hash table HT is occupied by the
-   element with the key KEY.  */
-static inline int
-index_valid (hurd_ihash_t ht, unsigned int idx, hurd_ihash_key_t key)
+/* Iterate over the groups the key with the hash H is probed for in,
+   setting GROUP to the index of the first item of each.  Every group
+   is visited once.  */
+#define FOR_EACH_GROUP(ht, h, group)					\
+  for (size_t _mask = (ht)->size / GROUP_SIZE - 1,			\
+	      _g = H1 (h) & _mask, _i = 0;				\
+       _i <= _mask && ((group) = _g * GROUP_SIZE, 1);			\
+       _g = (_g + ++_i) & _mask)
+
+/* Given a hash table HT, and a key KEY with the hash H, find the index
+   in the table of that key.  Returns -1 if it is not there.  */
+static inline ssize_t
+find_index (hurd_ihash_t ht, hurd_ihash_key_t key, size_t h)
 {
-  return !index_empty (ht, idx) && compare (ht, ht->items[idx].key, key);
-}
+  uint8_t *c = ctrl (ht);
+  size_t group;
 
+  FOR_EACH_GROUP (ht, h, group)
+    {
+      unsigned int match = group_match (&c[group], H2 (h));
 
-/* Given a hash table HT, and a key KEY, find the index in the table
-   of that key.  You must subsequently check with index_valid() if the
-   returned index is valid.  */
-static inline int
-find_index (hurd_ihash_t ht, hurd_ihash_key_t key)
-{
-  unsigned int idx;
-  unsigned int up_idx;
-  unsigned int first_deleted = 0;
-  int first_deleted_set = 0;
-  unsigned int mask = ht->size - 1;
+      while (match)
+	{
+	  size_t idx = group + __builtin_ctz (match);
+	  if (compare (ht, ht->items[idx].key, key))
+	    return idx;
+	  match &= match - 1;
+	}
 
-  idx = hash (ht, key) & mask;
+      if (group_match_empty (&c[group]))
+	break;
+    }
 
-  if (ht->items[idx].value == _HURD_IHASH_EMPTY
-      || compare (ht, ht->items[idx].key, key))
-    return idx;
+  return -1;
+}
 
-  up_idx = idx;
+/* Return the index of the first empty or deleted item where the key
+   with the hash H could go, or -1 if the table is full.  */
+static inline ssize_t
+find_free (hurd_ihash_t ht, size_t h)
+{
+  uint8_t *c = ctrl (ht);
+  size_t group;
 
-  do
+  FOR_EACH_GROUP (ht, h, group)
     {
-      up_idx = (up_idx + 1) & mask;
-      if (ht->items[up_idx].value == _HURD_IHASH_EMPTY)
-        return first_deleted_set ? first_deleted : up_idx;
-      if (compare (ht, ht->items[up_idx].key, key))
-	return up_idx;
-      if (! first_deleted_set
-          && ht->items[up_idx].value == _HURD_IHASH_DELETED)
-        first_deleted = up_idx, first_deleted_set = 1;
+      unsigned int match = group_match_free (&c[group]);
+      if (match)
+	return group + __builtin_ctz (match);
     }
-  while (up_idx != idx);
 
-  /* If we end up here, the item could not be found.  Return the index
-     of the first deleted item, as this is the position where we can
-     insert an item with the given key once we established that it is
-     not in the table.  */
-  return first_deleted;
+  return -1;
+}
+
+/* Return the load factor of N items in HT, see
+   hurd_ihash_get_load.  */
+static inline unsigned int
+load (hurd_ihash_t ht, size_t n)
+{
+  int d = __builtin_ctzl (ht->size) - 7;
+  return d >= 0 ? n >> d : n << -d;
+}
+
+/* Store KEY and VALUE at the free index IDX.  H is the hash of
+   KEY.  */
+static inline void
+fill_index (hurd_ihash_t ht, size_t idx, size_t h,
+	    hurd_ihash_key_t key, hurd_ihash_value_t value)
+{
+  if (ctrl (ht)[idx] == CTRL_DELETED)
+    ht->nr_deleted--;
+  ctrl (ht)[idx] = H2 (h);
+  ht->items[idx].value = value;
+  ht->items[idx].key = key;
+  ht->nr_items++;
+
+  if (ht->locp_offset != HURD_IHASH_NO_LOCP)
+    *((hurd_ihash_locp_t *) (((char *) value) + ht->locp_offset))
+      = &ht->items[idx].value;
 }
 
 
@@ -115,14 +275,28 @@ static inline void
 locp_remove (hurd_ihash_t ht, hurd_ihash_locp_t locp)
 {
   struct _hurd_ihash_item *item = (struct _hurd_ihash_item *) locp;
+  size_t idx = item - ht->items;
+  uint8_t *c = ctrl (ht);
+
   if (ht->cleanup)
     (*ht->cleanup) (item->value, ht->cleanup_data);
-  item->value = _HURD_IHASH_DELETED;
+
+  if (group_match_empty (&c[idx & ~(GROUP_SIZE - 1)]))
+    {
+      c[idx] = CTRL_EMPTY;
+      item->value = _HURD_IHASH_EMPTY;
+    }
+  else
+    {
+      c[idx] = CTRL_DELETED;
+      item->value = _HURD_IHASH_DELETED;
+      ht->nr_deleted++;
+    }
   item->key = 0;
   ht->nr_items--;
 }
 
-
+
 /* Construction and destruction of hash tables.  */
 
 /* Initialize the hash table at address HT.  */
@@ -130,6 +304,7 @@ void
 hurd_ihash_init (hurd_ihash_t ht, intptr_t locp_offs)
 {
   ht->nr_items = 0;
+  ht->nr_deleted = 0;
   ht->size = 0;
   ht->locp_offset = locp_offs;
   ht->max_load = HURD_IHASH_MAX_LOAD_DEFAULT;
@@ -232,36 +407,45 @@ hurd_ihash_set_max_load (hurd_ihash_t ht, unsigned int max_load)
 
 
 /* Helper function for hurd_ihash_add.  Return 1 if the item was
-   added, and 0 if it could not be added because no empty slot was
-   found.  The arguments are identical to hurd_ihash_add.
-
-   We are using open address hashing.  As the hash function we use the
-   division method with linear probe.  */
+   added, and 0 if the table has to be reorganized first.  Unless
+   FORCE is set, that is the case when adding the item would take
+   the table over its maximum load factor.  Deleted items count
+   towards the load, as they make probes longer, too.  The other
+   arguments are identical to hurd_ihash_add.  */
 static inline int
-add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
+add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value,
+	 int force)
 {
-  unsigned int idx;
+  size_t h = hash (ht, key);
+  ssize_t idx;
 
-  idx = find_index (ht, key);
+  idx = find_index (ht, key, h);
 
-  /* Remove the old entry for this key if necessary.  */
-  if (index_valid (ht, idx, key))
-    locp_remove (ht, &ht->items[idx].value);
-
-  if (index_empty (ht, idx))
+  /* Replace the old entry for this key if necessary.  */
+  if (idx >= 0)
     {
-      ht->nr_items++;
-      ht->items[idx].value = value;
-      ht->items[idx].key = key;
+      struct _hurd_ihash_item *item = &ht->items[idx];
 
+      if (ht->cleanup)
+	(*ht->cleanup) (item->value, ht->cleanup_data);
+      item->value = value;
       if (ht->locp_offset != HURD_IHASH_NO_LOCP)
 	*((hurd_ihash_locp_t *) (((char *) value) + ht->locp_offset))
-	  = &ht->items[idx].value;
-
+	  = &item->value;
       return 1;
     }
 
-  return 0;
+  idx = find_free (ht, h);
+  if (idx < 0)
+    return 0;
+
+  if (! force
+      && ctrl (ht)[idx] == CTRL_EMPTY
+      && load (ht, ht->nr_items + ht->nr_deleted + 1) > ht->max_load)
+    return 0;
+
+  fill_index (ht, idx, h, key, value);
+  return 1;
 }
 
 
@@ -282,93 +466,75 @@ hurd_ihash_locp_add (hurd_ihash_t ht, hurd_ihash_locp_t locp,
                      hurd_ihash_key_t key, hurd_ihash_value_t value)
 {
   struct _hurd_ihash_item *item = (struct _hurd_ihash_item *) locp;
+  size_t idx;
 
   /* In case of complications, fall back to hurd_ihash_add.  */
-  if (ht->size == 0
-      || item == NULL
-      || item->value == _HURD_IHASH_DELETED
-      || ! compare (ht, item->key, key)
-      || hurd_ihash_get_load (ht) > ht->max_load)
+  if (ht->size == 0 || item == NULL)
     return hurd_ihash_add (ht, key, value);
 
-  if (item->value == _HURD_IHASH_EMPTY)
-    {
-      item->key = key;
-      ht->nr_items += 1;
-    }
-  else
+  idx = item - ht->items;
+
+  if (hurd_ihash_value_valid (item->value))
     {
       assert (compare (ht, item->key, key));
       if (ht->cleanup)
-        (*ht->cleanup) (locp, ht->cleanup_data);
-    }
+        (*ht->cleanup) (item->value, ht->cleanup_data);
+      item->value = value;
 
-  item->value = value;
+      if (ht->locp_offset != HURD_IHASH_NO_LOCP)
+	*((hurd_ihash_locp_t *) (((char *) value) + ht->locp_offset))
+	  = locp;
+      return 0;
+    }
 
-  if (ht->locp_offset != HURD_IHASH_NO_LOCP)
-    *((hurd_ihash_locp_t *) (((char *) value) + ht->locp_offset))
-      = locp;
+  /* LOCP is where hurd_ihash_locp_find would have put KEY.  */
+  if (ctrl (ht)[idx] == CTRL_EMPTY
+      && load (ht, ht->nr_items + ht->nr_deleted + 1) > ht->max_load)
+    return hurd_ihash_add (ht, key, value);
 
+  fill_index (ht, idx, hash (ht, key), key, value);
   return 0;
 }
 
 
-/* Add ITEM to the hash table HT under the key KEY.  If there already
-   is an item under this key, call the cleanup function (if any) for
-   it before overriding the value.  If a memory allocation error
-   occurs, ENOMEM is returned, otherwise 0.  */
-error_t
-hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
+/* Replace the items of HT with a new array without deleted items.
+   It is larger unless getting rid of those leaves a quarter of the
+   maximum load free.  If a memory allocation error occurs, ENOMEM is
+   returned, otherwise 0.  */
+static error_t
+reorganize (hurd_ihash_t ht)
 {
   struct hurd_ihash old_ht = *ht;
-  int was_added;
-  int fatal = 0;	/* bail out on allocation errors */
-  unsigned int i;
-
-  if (ht->size)
-    {
-      /* Only fill the hash table up to its maximum load factor.  */
-      if (hurd_ihash_get_load (ht) <= ht->max_load)
-      add_one:
-	if (add_one (ht, key, item))
-	  return 0;
-    }
+  size_t i;
 
-  /* The hash table is too small, and we have to increase it.  */
-  ht->nr_items = 0;
   if (ht->size == 0)
-      ht->size = HURD_IHASH_MIN_SIZE;
-  else
-      ht->size <<= 1;
-
-  /* calloc() will initialize all values to _HURD_IHASH_EMPTY implicitly.  */
-  ht->items = calloc (ht->size, sizeof (struct _hurd_ihash_item));
+    ht->size = HURD_IHASH_MIN_SIZE;
+  else if (load (ht, ht->nr_items) > ht->max_load * 3 / 4)
+    ht->size <<= 1;
 
+  /* calloc() will initialize all values to _HURD_IHASH_EMPTY
+     implicitly.  The control bytes follow the items.  */
+  ht->items = calloc (ht->size, sizeof (struct _hurd_ihash_item) + 1);
   if (ht->items == NULL)
     {
       *ht = old_ht;
-      if (fatal || ht->size == 0)
-        return ENOMEM;
-
-      /* We prefer performance degradation over failure.  Therefore,
-	 we add the item even though we are above the load factor.  If
-	 the table is full, this will fail.  We set the fatal flag to
-	 avoid looping.	 */
-      fatal = 1;
-      goto add_one;
+      return ENOMEM;
     }
+  memset (ctrl (ht), CTRL_EMPTY, ht->size);
+  ht->nr_items = 0;
+  ht->nr_deleted = 0;
 
   /* We have to rehash the old entries.  */
   for (i = 0; i < old_ht.size; i++)
-    if (!index_empty (&old_ht, i))
+    if (hurd_ihash_value_valid (old_ht.items[i].value))
       {
-	was_added = add_one (ht, old_ht.items[i].key, old_ht.items[i].value);
-	assert (was_added);
-      }
+	hurd_ihash_key_t key = old_ht.items[i].key;
+	size_t h = hash (ht, key);
+	ssize_t idx = find_free (ht, h);
 
-  /* Finally add the new element!  */
-  was_added = add_one (ht, key, item);
-  assert (was_added);
+	assert (idx >= 0);
+	fill_index (ht, idx, h, key, old_ht.items[i].value);
+      }
 
   if (old_ht.size > 0)
     free (old_ht.items);
@@ -377,6 +543,39 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
 }
 
 
+/* Add ITEM to the hash table HT under the key KEY.  If there already
+   is an item under this key, call the cleanup function (if any) for
+   it before overriding the value.  If a memory allocation error
+   occurs, ENOMEM is returned, otherwise 0.  */
+error_t
+hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
+{
+  error_t err;
+
+  if (ht->size && add_one (ht, key, item, 0))
+    return 0;
+
+  /* The hash table is too small, or has too many deleted items.  */
+  err = reorganize (ht);
+  if (err)
+    {
+      /* We prefer performance degradation over failure.  Therefore,
+	 we add the item even though we are above the load factor.  If
+	 the table is full, this will fail.  */
+      if (ht->size && add_one (ht, key, item, 1))
+	return 0;
+      return err;
+    }
+
+  /* Finally add the new element!  The load factor may still be too
+     high for very small ones.  */
+  if (! add_one (ht, key, item, 1))
+    assert (! "no room after reorganizing");
+
+  return 0;
+}
+
+
 /* Find and return the item in the hash table HT with key KEY, or NULL
    if it doesn't exist.  */
 hurd_ihash_value_t
@@ -386,8 +585,8 @@ hurd_ihash_find (hurd_ihash_t ht, hurd_ihash_key_t key)
     return NULL;
   else
     {
-      int idx = find_index (ht, key);
-      return index_valid (ht, idx, key) ? ht->items[idx].value : NULL;
+      ssize_t idx = find_index (ht, key, hash (ht, key));
+      return idx >= 0 ? ht->items[idx].value : NULL;
     }
 }
 
@@ -409,14 +608,23 @@ hurd_ihash_locp_find (hurd_ihash_t ht,
 		      hurd_ihash_key_t key,
 		      hurd_ihash_locp_t *slot)
 {
-  int idx;
+  size_t h;
+  ssize_t idx;
 
   if (ht->size == 0)
     return NULL;
 
-  idx = find_index (ht, key);
-  *slot = &ht->items[idx].value;
-  return index_valid (ht, idx, key) ? ht->items[idx].value : NULL;
+  h = hash (ht, key);
+  idx = find_index (ht, key, h);
+  if (idx >= 0)
+    {
+      *slot = &ht->items[idx].value;
+      return ht->items[idx].value;
+    }
+
+  idx = find_free (ht, h);
+  *slot = idx >= 0 ? &ht->items[idx].value : NULL;
+  return NULL;
 }
 
 
@@ -427,9 +635,9 @@ hurd_ihash_remove (hurd_ihash_t ht, hurd_ihash_key_t key)
 {
   if (ht->size != 0)
     {
-      int idx = find_index (ht, key);
-      
-      if (index_valid (ht, idx, key))
+      ssize_t idx = find_index (ht, key, hash (ht, key));
+
+      if (idx >= 0)
 	{
 	  locp_remove (ht, &ht->items[idx].value);
 	  return 1;
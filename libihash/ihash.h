@@ -1,5 +1,6 @@
 /* ihash.h - Integer keyed hash table interface.
-   Copyright (C) 1995, 2003, 2004, 2014, 2015 Free Software Foundation, Inc.
+   Copyright (C) 1995, 2003, 2004, 2014, 2015, 2026
+     Free Software Foundation, Inc.
    Written by Miles Bader <miles@gnu.org>.
    Revised by Marcus Brinkmann <marcus@gnu.org>.
 
@@ -92,7 +93,8 @@ struct hurd_ihash
   /* The number of hashed elements.  */
   size_t nr_items;
 
-  /* An array of (key, value) pairs.  */
+  /* An array of (key, value) pairs.  It is followed by one control
+     byte for each pair, which is private to the implementation.  */
   _hurd_ihash_item_t items;
 
   /* The length of the array ITEMS.  */
@@ -113,6 +115,10 @@ struct hurd_ihash
   /* User-supplied functions for the generalized key interface.  */
   hurd_ihash_fct_hash_t fct_hash;
   hurd_ihash_fct_cmp_t fct_cmp;
+
+  /* The number of locations that still have to be marked as deleted
+     so that searches continue through them.  */
+  size_t nr_deleted;
 };
 typedef struct hurd_ihash *hurd_ihash_t;
 
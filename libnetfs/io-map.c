@@ -0,0 +1,73 @@
+/*
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+#include <fcntl.h>
+
+#include "netfs.h"
+#include "io_S.h"
+
+/* Implement io_map as described in <hurd/io.defs>. */
+error_t
+netfs_S_io_map (struct protid *user,
+		mach_port_t *rdobj, mach_msg_type_name_t *rdobjtype,
+		mach_port_t *wrobj, mach_msg_type_name_t *wrobjtype)
+{
+  int flags;
+  struct node *np;
+
+  if (!user)
+    return EOPNOTSUPP;
+
+  *wrobj = *rdobj = MACH_PORT_NULL;
+
+  np = user->po->np;
+  flags = user->po->openstat & (O_READ | O_WRITE);
+
+  pthread_mutex_lock (&np->lock);
+  switch (flags)
+    {
+    case O_READ | O_WRITE:
+      *wrobj = *rdobj = netfs_get_filemap (np, user->user,
+					   VM_PROT_READ | VM_PROT_WRITE);
+      if (*wrobj == MACH_PORT_NULL)
+	goto error;
+      mach_port_mod_refs (mach_task_self (), *rdobj, MACH_PORT_RIGHT_SEND, 1);
+      break;
+    case O_READ:
+      *rdobj = netfs_get_filemap (np, user->user, VM_PROT_READ);
+      if (*rdobj == MACH_PORT_NULL)
+	goto error;
+      break;
+    case O_WRITE:
+      *wrobj = netfs_get_filemap (np, user->user, VM_PROT_WRITE);
+      if (*wrobj == MACH_PORT_NULL)
+	goto error;
+      break;
+    }
+  pthread_mutex_unlock (&np->lock);
+
+  *rdobjtype = MACH_MSG_TYPE_MOVE_SEND;
+  *wrobjtype = MACH_MSG_TYPE_MOVE_SEND;
+
+  return 0;
+
+error:
+  pthread_mutex_unlock (&np->lock);
+  return errno;
+}
@@ -1,5 +1,5 @@
 /* 
-   Copyright (C) 1995 Free Software Foundation, Inc.
+   Copyright (C) 1995, 2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -22,14 +22,6 @@
 #include "netfs.h"
 #include "io_S.h"
 
-error_t
-netfs_S_io_map (struct protid *user, 
-		mach_port_t *rdobj, mach_msg_type_name_t *rdobjtype,
-		mach_port_t *wrobj, mach_msg_type_name_t *wrobjtype)
-{
-  return EOPNOTSUPP;
-}
-
 error_t
 netfs_S_io_map_cntl (struct protid *user,
 		     mach_port_t *obj,
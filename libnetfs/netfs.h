@@ -1,6 +1,6 @@
 /*
 
-   Copyright (C) 1994,95,96,97,99,2000,02,13 Free Software Foundation, Inc.
+   Copyright (C) 1994,95,96,97,99,2000,02,13,26 Free Software Foundation, Inc.
 
    This program is free software; you can redistribute it and/or
    modify it under the terms of the GNU General Public License as
@@ -323,6 +323,14 @@ error_t netfs_file_get_storage_info (struct iouser *cred,
    default function always returns EOPNOTSUPP. */
 error_t netfs_get_source (struct protid *cred,
                           char *source, size_t source_len);
+
+/* The user may define this function.  Return a memory object proxy
+   port (send right) for the contents of NP (which is locked) for user
+   CRED, to be mapped with protection PROT.  On error, set errno and
+   return MACH_PORT_NULL.  The default function sets errno to
+   EOPNOTSUPP, so that io_map is not supported.  */
+mach_port_t netfs_get_filemap (struct node *np, struct iouser *cred,
+			       vm_prot_t prot);
 
 /* Option parsing */
 
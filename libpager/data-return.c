@@ -21,6 +21,23 @@
 #include <string.h>
 #include <assert.h>
 
+/* Default implementation of pager_write_pages; users that can do
+   better override it.  */
+void __attribute__ ((weak))
+pager_write_pages (struct user_pager_info *upi,
+		   vm_offset_t offset,
+		   vm_address_t buf,
+		   vm_size_t length,
+		   error_t *errors)
+{
+  vm_size_t i;
+
+  for (i = 0; i < length / vm_page_size; i++)
+    errors[i] = pager_write_page (upi,
+				  offset + (vm_page_size * i),
+				  buf + (vm_page_size * i));
+}
+
 /* Worker function used by _pager_S_memory_object_data_return
    and _pager_S_memory_object_data_initialize.  All args are
    as for _pager_S_memory_object_data_return; the additional
@@ -158,14 +175,28 @@ _pager_do_write_request (struct pager *p,
   /* Let someone else in. */
   pthread_mutex_unlock (&p->interlock);
 
-  /* This is inefficient; we should send all the pages to the device at once
-     but until the pager library interface is changed, this will have to do. */
+  /* Hand each run of pages that have to be written to the user in one
+     go, so that it can combine them into larger i/o operations.  */
+  for (i = 0; i < npages; )
+    {
+      int run;
 
-  for (i = 0; i < npages; i++)
-    if (!(omitdata & (1 << i)))
-      pagerrs[i] = pager_write_page (p->upi,
-				     offset + (vm_page_size * i),
-				     data + (vm_page_size * i));
+      if (omitdata & (1 << i))
+	{
+	  i++;
+	  continue;
+	}
+
+      for (run = 1; i + run < npages && !(omitdata & (1 << (i + run))); run++)
+	;
+
+      pager_write_pages (p->upi,
+			 offset + (vm_page_size * i),
+			 data + (vm_page_size * i),
+			 vm_page_size * run,
+			 &pagerrs[i]);
+      i += run;
+    }
 
   /* Acquire the right to meddle with the pagemap */
   pthread_mutex_lock (&p->interlock);
@@ -20,6 +20,7 @@
 #include <mach/mig_errors.h>
 #include <pthread.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include "priv.h"
 #include "memory_object_S.h"
@@ -30,8 +31,11 @@
   Worker pool for the server functions.
 
   A single thread receives messages from the port bucket and puts them
-  into a queue.  A fixed number of consumers actually execute the
-  server functions and send the reply.
+  into a queue.  A pool of consumers actually execute the server
+  functions and send the reply.  The pool starts with a single worker
+  and grows on demand: whenever a request is queued while every
+  worker is busy, another worker is started, up to the limit given to
+  pager_start_workers_max.
 
   The requests to an object O have to be processed in the order they
   were received.  To this end, each worker has a local queue and a
@@ -41,7 +45,14 @@
 
   At least one worker thread is necessary.
 */
-#define WORKER_COUNT 1
+
+/* The number of workers started per available processor if the user
+   does not specify a limit.  Paging is mostly bound by i/o, so we
+   allow more workers than there are processors.  */
+#define WORKERS_PER_CPU 2
+
+/* Never start more than this many workers.  */
+#define WORKER_COUNT_MAX 64
 
 /* An request contains the message received from the port set.  */
 struct request
@@ -64,6 +75,8 @@ struct worker
   struct pager_requests *requests;	/* our pagers request queue */
   struct queue queue;	/* other workers may delegate requests to us */
   unsigned long tag;	/* tag of the object we are working on */
+  unsigned long long handled;	/* number of requests processed */
+  struct timeval busy;	/* time spent in server functions */
 };
 
 /* This is the queue for incoming requests.  A single thread receives
@@ -82,9 +95,45 @@ struct pager_requests
   pthread_cond_t wakeup;
   pthread_cond_t inhibit_wakeup;
   pthread_mutex_t lock;
-  struct worker workers[WORKER_COUNT];
+
+  /* Statistics, protected by LOCK.  */
+  unsigned int queue_length;	/* requests in queue_in and queue_out */
+  unsigned int queue_peak;	/* maximum of QUEUE_LENGTH */
+  unsigned long long delegated;	/* requests handed to a busy worker */
+
+  int nworkers;			/* workers started so far */
+  int max_workers;		/* do not start more workers than this */
+  struct worker workers[WORKER_COUNT_MAX];
 };
 
+static void *worker_func (void *arg);
+
+/* Start another worker thread for REQUESTS.  REQUESTS->lock must be
+   held.  */
+static error_t
+start_worker (struct pager_requests *requests)
+{
+  error_t err;
+  pthread_t t;
+  struct worker *w;
+
+  assert (requests->nworkers < requests->max_workers);
+  w = &requests->workers[requests->nworkers];
+  w->requests = requests;
+  w->tag = 0;
+  w->handled = 0;
+  timerclear (&w->busy);
+  queue_init (&w->queue);
+
+  err = pthread_create (&t, NULL, &worker_func, w);
+  if (err)
+    return err;
+  pthread_detach (t);
+
+  requests->nworkers += 1;
+  return 0;
+}
+
 /* Demultiplex a single message directed at a pager port; INP is the
    message received; fill OUTP with the reply.  */
 static int
@@ -116,10 +165,20 @@ pager_demuxer (struct pager_requests *requests,
   pthread_mutex_lock (&requests->lock);
 
   queue_enqueue (requests->queue_in, &r->item);
+  requests->queue_length += 1;
+  if (requests->queue_length > requests->queue_peak)
+    requests->queue_peak = requests->queue_length;
 
   /* Awake worker, but only if not inhibited.  */
-  if (requests->asleep > 0 && requests->queue_in == requests->queue_out)
-      pthread_cond_signal (&requests->wakeup);
+  if (requests->queue_in == requests->queue_out)
+    {
+      if (requests->asleep > 0)
+	pthread_cond_signal (&requests->wakeup);
+      else if (requests->nworkers < requests->max_workers)
+	/* All workers are busy, try to add one.  If that fails, the
+	   request will be picked up by one of the existing workers.  */
+	start_worker (requests);
+    }
 
   pthread_mutex_unlock (&requests->lock);
 
@@ -175,6 +234,7 @@ worker_func (void *arg)
     {
       int i;
       mach_msg_return_t mr;
+      struct timeval start, end, elapsed;
 
       /* Free previous message.  */
       free (r);
@@ -196,19 +256,22 @@ worker_func (void *arg)
       while ((r = queue_dequeue (requests->queue_out)) == NULL)
 	{
 	  requests->asleep += 1;
-	  if (requests->asleep == WORKER_COUNT)
+	  if (requests->asleep == requests->nworkers)
 	    pthread_cond_broadcast (&requests->inhibit_wakeup);
 	  pthread_cond_wait (&requests->wakeup, &requests->lock);
 	  requests->asleep -= 1;
 	}
 
-      for (i = 0; i < WORKER_COUNT; i++)
+      requests->queue_length -= 1;
+
+      for (i = 0; i < requests->nworkers; i++)
 	if (requests->workers[i].tag
 	    == (unsigned long) request_inp (r)->msgh_local_port)
 	  {
 	    /* Some other thread is working on that object.  Delegate
 	       the request to that worker.  */
 	    queue_enqueue (&requests->workers[i].queue, &r->item);
+	    requests->delegated += 1;
 	    goto get_request_locked;
 	  }
 
@@ -221,7 +284,15 @@ worker_func (void *arg)
       mig_reply_setup (request_inp (r), (mach_msg_header_t *) &reply_msg);
 
       /* Call the server routine.  */
+      gettimeofday (&start, NULL);
       (*r->routine) (request_inp (r), (mach_msg_header_t *) &reply_msg);
+      gettimeofday (&end, NULL);
+
+      timersub (&end, &start, &elapsed);
+      pthread_mutex_lock (&requests->lock);
+      timeradd (&self->busy, &elapsed, &self->busy);
+      self->handled += 1;
+      pthread_mutex_unlock (&requests->lock);
 
       /* What follows is basically the second part of
 	 mach_msg_server_timeout.  */
@@ -305,18 +376,62 @@ service_paging_requests (void *arg)
   return NULL;
 }
 
+/* Return the default maximum number of workers, derived from the
+   number of available processors.  */
+static int
+default_max_workers (void)
+{
+  error_t err;
+  struct host_basic_info hbi;
+  mach_msg_type_number_t count = HOST_BASIC_INFO_COUNT;
+  mach_port_t host = mach_host_self ();
+  int n = 1;
+
+  err = host_info (host, HOST_BASIC_INFO, (host_info_t) &hbi, &count);
+  if (! err && hbi.avail_cpus > 0)
+    n = hbi.avail_cpus;
+  mach_port_deallocate (mach_task_self (), host);
+
+  return n * WORKERS_PER_CPU;
+}
+
+/* Return the number of workers to use if the user asked for
+   MAX_WORKERS, which must not be negative.  */
+static int
+effective_max_workers (int max_workers)
+{
+  if (max_workers == 0)
+    max_workers = default_max_workers ();
+  return max_workers > WORKER_COUNT_MAX ? WORKER_COUNT_MAX : max_workers;
+}
+
 /* Start the worker threads libpager uses to service requests.  */
 error_t
 pager_start_workers (struct port_bucket *pager_bucket,
 		     struct pager_requests **out_requests)
+{
+  return pager_start_workers_max (pager_bucket, 0, out_requests);
+}
+
+/* Start the worker threads libpager uses to service requests, using
+   at most MAX_WORKERS threads.  */
+error_t
+pager_start_workers_max (struct port_bucket *pager_bucket,
+			 int max_workers,
+			 struct pager_requests **out_requests)
 {
   error_t err;
-  int i;
   pthread_t t;
   struct pager_requests *requests;
 
   assert (out_requests != NULL);
 
+  if (max_workers < 0)
+    {
+      err = EINVAL;
+      goto done;
+    }
+
   requests = malloc (sizeof *requests);
   if (requests == NULL)
     {
@@ -326,6 +441,11 @@ pager_start_workers (struct port_bucket *pager_bucket,
 
   requests->bucket = pager_bucket;
   requests->asleep = 0;
+  requests->queue_length = 0;
+  requests->queue_peak = 0;
+  requests->delegated = 0;
+  requests->nworkers = 0;
+  requests->max_workers = effective_max_workers (max_workers);
 
   requests->queue_in = malloc (sizeof *requests->queue_in);
   if (requests->queue_in == NULL)
@@ -341,24 +461,21 @@ pager_start_workers (struct port_bucket *pager_bucket,
   pthread_cond_init (&requests->inhibit_wakeup, NULL);
   pthread_mutex_init (&requests->lock, NULL);
 
+  /* Start the first worker before the receiving thread, so that
+     REQUESTS->nworkers is never zero once requests arrive.  Additional
+     workers are started on demand by pager_demuxer.  */
+  pthread_mutex_lock (&requests->lock);
+  err = start_worker (requests);
+  pthread_mutex_unlock (&requests->lock);
+  if (err)
+    goto done;
+
   /* Make a thread to service paging requests.  */
   err = pthread_create (&t, NULL, service_paging_requests, requests);
   if (err)
     goto done;
   pthread_detach (t);
 
-  for (i = 0; i < WORKER_COUNT; i++)
-    {
-      requests->workers[i].requests = requests;
-      requests->workers[i].tag = 0;
-      queue_init (&requests->workers[i].queue);
-
-      err = pthread_create (&t, NULL, &worker_func, &requests->workers[i]);
-      if (err)
-	goto done;
-      pthread_detach (t);
-    }
-
 done:
   if (err)
     *out_requests = NULL;
@@ -368,6 +485,80 @@ done:
   return err;
 }
 
+/* Change the maximum number of workers of REQUESTS to MAX_WORKERS.  */
+error_t
+pager_set_max_workers (struct pager_requests *requests, int max_workers)
+{
+  if (max_workers < 0)
+    return EINVAL;
+  max_workers = effective_max_workers (max_workers);
+
+  /* Workers are never stopped, so if there are more than MAX_WORKERS
+     already, this merely prevents new ones from being started.  */
+  pthread_mutex_lock (&requests->lock);
+  requests->max_workers = max_workers;
+  pthread_mutex_unlock (&requests->lock);
+
+  return 0;
+}
+
+/* Return the maximum number of workers of REQUESTS.  */
+int
+pager_get_max_workers (struct pager_requests *requests)
+{
+  int max_workers;
+
+  pthread_mutex_lock (&requests->lock);
+  max_workers = requests->max_workers;
+  pthread_mutex_unlock (&requests->lock);
+
+  return max_workers;
+}
+
+/* Fill in STATS with the current statistics of REQUESTS.  */
+void
+pager_get_requests_stats (struct pager_requests *requests,
+			  struct pager_requests_stats *stats)
+{
+  int i;
+
+  pthread_mutex_lock (&requests->lock);
+  stats->workers = requests->nworkers;
+  stats->max_workers = requests->max_workers;
+  stats->idle_workers = requests->asleep;
+  stats->queue_length = requests->queue_length;
+  stats->queue_peak = requests->queue_peak;
+  stats->delegated = requests->delegated;
+  stats->handled = 0;
+  timerclear (&stats->busy);
+  for (i = 0; i < requests->nworkers; i++)
+    {
+      stats->handled += requests->workers[i].handled;
+      timeradd (&stats->busy, &requests->workers[i].busy, &stats->busy);
+    }
+  pthread_mutex_unlock (&requests->lock);
+}
+
+/* Fill in STATS with the statistics of worker WORKER of REQUESTS.  */
+error_t
+pager_get_worker_stats (struct pager_requests *requests, int worker,
+			struct pager_worker_stats *stats)
+{
+  error_t err = 0;
+
+  pthread_mutex_lock (&requests->lock);
+  if (worker < 0 || worker >= requests->nworkers)
+    err = EINVAL;
+  else
+    {
+      stats->handled = requests->workers[worker].handled;
+      stats->busy = requests->workers[worker].busy;
+    }
+  pthread_mutex_unlock (&requests->lock);
+
+  return err;
+}
+
 error_t
 pager_inhibit_workers (struct pager_requests *requests)
 {
@@ -395,7 +586,8 @@ pager_inhibit_workers (struct pager_requests *requests)
      Check that the queue is empty, since it's possible that a request
      came in, was queued and a worker was signalled but the lock was
      acquired here before the worker woke up.  */
-  while (requests->asleep < WORKER_COUNT || !queue_empty(requests->queue_out))
+  while (requests->asleep < requests->nworkers
+	 || !queue_empty(requests->queue_out))
     pthread_cond_wait (&requests->inhibit_wakeup, &requests->lock);
 
 done_locked:
@@ -410,7 +602,7 @@ pager_resume_workers (struct pager_requests *requests)
 
   /* Check the workers are inhibited.  */
   assert (requests->queue_out != requests->queue_in);
-  assert (requests->asleep == WORKER_COUNT);
+  assert (requests->asleep == requests->nworkers);
   assert (queue_empty(requests->queue_out));
 
   /* The queue has been drained and will no longer be used.  */
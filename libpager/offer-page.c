@@ -19,6 +19,7 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
 
+#include <assert.h>
 #include "priv.h"
 
 void
@@ -30,7 +31,7 @@ pager_offer_page (struct pager *p,
 {
   pthread_mutex_lock (&p->interlock);
 
-  if (_pager_pagemap_resize (p, offset + vm_page_size))
+  if (! _pager_pagemap_resize (p, offset + vm_page_size))
     {
       short *pm_entry = &p->pagemap[offset / vm_page_size];
 
@@ -49,3 +50,62 @@ pager_offer_page (struct pager *p,
 
   pthread_mutex_unlock (&p->interlock);
 }
+
+void
+pager_offer_pages (struct pager *p,
+		   int precious,
+		   int writelock,
+		   vm_offset_t offset,
+		   vm_address_t buf,
+		   vm_size_t length)
+{
+  vm_size_t npages = length / vm_page_size;
+  vm_size_t i, run = 0;
+
+  assert (offset % vm_page_size == 0);
+  assert (length % vm_page_size == 0);
+
+  /* Supply the RUN pages preceding page I in one go.  */
+  void supply_run (void)
+    {
+      if (run > 0)
+	memory_object_data_supply (p->memobjcntl,
+				   offset + (i - run) * vm_page_size,
+				   buf + (i - run) * vm_page_size,
+				   run * vm_page_size, 1,
+				   writelock ? VM_PROT_WRITE : VM_PROT_NONE,
+				   precious, MACH_PORT_NULL);
+      run = 0;
+    }
+
+  pthread_mutex_lock (&p->interlock);
+
+  if (p->pager_state != NORMAL
+      || _pager_pagemap_resize (p, offset + length))
+    npages = 0;
+
+  for (i = 0; i < npages; i++)
+    {
+      short *pm_entry = &p->pagemap[offset / vm_page_size + i];
+
+      if (*pm_entry & (PM_INCORE | PM_PAGINGOUT | PM_INVALID))
+	{
+	  /* The kernel might have a more recent copy of this page, or
+	     the disk contents are not to be trusted.  Skip it.  */
+	  supply_run ();
+	  munmap ((void *) (buf + i * vm_page_size), vm_page_size);
+	}
+      else
+	{
+	  *pm_entry |= PM_INCORE;
+	  run++;
+	}
+    }
+  supply_run ();
+
+  pthread_mutex_unlock (&p->interlock);
+
+  if (i < length / vm_page_size)
+    /* We bailed out early; release the rest.  */
+    munmap ((void *) (buf + i * vm_page_size), length - i * vm_page_size);
+}
@@ -20,6 +20,7 @@
 #define _HURD_PAGER_
 
 #include <hurd/ports.h>
+#include <sys/time.h>
 
 /* This declaration exists to place struct user_pager_info in the proper
    scope.  */
@@ -34,6 +35,63 @@ error_t
 pager_start_workers (struct port_bucket *pager_bucket,
 		     struct pager_requests **requests);
 
+/* Like pager_start_workers, but start at most MAX_WORKERS worker
+   threads.  Workers are started on demand, when a request arrives
+   while all existing workers are busy.  Requests to the same memory
+   object are always processed in the order they were received, no
+   matter how many workers there are.  If MAX_WORKERS is zero, a
+   default based on the number of available processors is used; this
+   is what pager_start_workers does.  */
+error_t
+pager_start_workers_max (struct port_bucket *pager_bucket,
+			 int max_workers,
+			 struct pager_requests **requests);
+
+/* Change the maximum number of worker threads of the worker pool
+   REQUESTS to MAX_WORKERS, or to the default if MAX_WORKERS is zero.
+   Running workers are not stopped if the limit is lowered.  */
+error_t
+pager_set_max_workers (struct pager_requests *requests, int max_workers);
+
+/* Return the maximum number of worker threads of the worker pool
+   REQUESTS.  */
+int
+pager_get_max_workers (struct pager_requests *requests);
+
+/* Statistics about a worker pool, see pager_get_requests_stats.  */
+struct pager_requests_stats
+{
+  int workers;			/* workers currently running */
+  int max_workers;		/* maximum number of workers */
+  int idle_workers;		/* workers waiting for requests */
+  unsigned int queue_length;	/* requests waiting for a worker */
+  unsigned int queue_peak;	/* maximum of QUEUE_LENGTH so far */
+  unsigned long long delegated;	/* requests passed to the worker already
+				   busy with the same object */
+  unsigned long long handled;	/* requests processed by all workers */
+  struct timeval busy;		/* total time spent processing requests */
+};
+
+/* Statistics about a single worker, see pager_get_worker_stats.  */
+struct pager_worker_stats
+{
+  unsigned long long handled;	/* requests processed by this worker */
+  struct timeval busy;		/* time spent processing requests */
+};
+
+/* Fill in STATS with the current statistics of the worker pool
+   REQUESTS.  */
+void
+pager_get_requests_stats (struct pager_requests *requests,
+			  struct pager_requests_stats *stats);
+
+/* Fill in STATS with the statistics of worker number WORKER (counting
+   from zero) of the worker pool REQUESTS.  Return EINVAL if there is
+   no such worker.  */
+error_t
+pager_get_worker_stats (struct pager_requests *requests, int worker,
+			struct pager_worker_stats *stats);
+
 /* Inhibit the worker threads libpager uses to service requests,
    blocking until all requests sent before this function is called have
    finished.
@@ -131,6 +189,22 @@ pager_offer_page (struct pager *pager,
 		  vm_offset_t page,
 		  vm_address_t buf);  
 
+/* Offer the LENGTH bytes of data at BUF, which correspond to the pages
+   starting at OFFSET, to the kernel, for instance after reading ahead.
+   OFFSET and LENGTH must be page aligned.  Unlike pager_offer_page,
+   this never blocks: pages the kernel might already have, pages being
+   paged out and pages with errors are silently skipped.  BUF is
+   consumed in all cases.  This is intended to be called from
+   pager_read_page, where per-object ordering guarantees that no page
+   of PAGER is written back concurrently.  */
+void
+pager_offer_pages (struct pager *pager,
+		   int precious,
+		   int writelock,
+		   vm_offset_t offset,
+		   vm_address_t buf,
+		   vm_size_t length);
+
 /* Change the attributes of the memory object underlying pager PAGER.
    Arguments MAY_CACHE and COPY_STRATEGY are as for
    memory_object_change_attributes.  Wait for the kernel to report
@@ -191,6 +265,19 @@ pager_write_page (struct user_pager_info *pager,
 		  vm_offset_t page,
 		  vm_address_t buf);
 
+/* The user may define this function.  For pager PAGER, synchronously
+   write LENGTH bytes (a multiple of the page size) from BUF to offset
+   OFFSET, storing the result for each page in ERRORS.  Like
+   pager_write_page, this must not free BUF.  This allows the user to
+   combine the pages of one data return into larger i/o operations;
+   the default implementation calls pager_write_page for each page.  */
+void
+pager_write_pages (struct user_pager_info *pager,
+		   vm_offset_t offset,
+		   vm_address_t buf,
+		   vm_size_t length,
+		   error_t *errors);
+
 /* The user must define this function.  A page should be made writable. */
 error_t
 pager_unlock_page (struct user_pager_info *pager,
@@ -1,6 +1,6 @@
 /* The SOCK_DGRAM pipe class
 
-   Copyright (C) 1995 Free Software Foundation, Inc.
+   Copyright (C) 1995, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -52,8 +52,10 @@ dgram_read (struct packet *packet, int *dequeue, unsigned *flags,
     }
 }
 
+static struct packet_pool dgram_pool = PACKET_POOL_INITIALIZER;
+
 struct pipe_class _dgram_pipe_class =
 {
-  SOCK_DGRAM, PIPE_CLASS_CONNECTIONLESS, dgram_read, dgram_write
+  SOCK_DGRAM, PIPE_CLASS_CONNECTIONLESS, dgram_read, dgram_write, &dgram_pool
 };
 struct pipe_class *dgram_pipe_class = &_dgram_pipe_class;
@@ -1,6 +1,6 @@
 /* Generic one-way pipes
 
-   Copyright (C) 1995, 1998 Free Software Foundation, Inc.
+   Copyright (C) 1995, 1998, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -68,7 +68,7 @@ pipe_create (struct pipe_class *class, struct pipe **pipe)
   new->pending_selects = NULL;
   pthread_mutex_init (&new->lock, NULL);
 
-  pq_create (&new->queue);
+  pq_create (&new->queue, class->pool);
 
   if (! pipe_is_connless (new))
     new->flags |= PIPE_BROKEN;
@@ -1,6 +1,6 @@
 /* Generic one-way pipes
 
-   Copyright (C) 1995, 1996 Free Software Foundation, Inc.
+   Copyright (C) 1995, 1996, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -52,6 +52,10 @@ struct pipe_class
   /* Write DATA &c into the packet queue PQ.  */
   error_t (*write)(struct pq *pq, void *source,
 		   char *data, size_t data_len, size_t *amount);
+
+  /* Where the packet queues of pipes of this class get their packets and
+     buffers from, or NULL.  */
+  struct packet_pool *pool;
 };
 
 /* pipe_class flags  */
@@ -124,6 +128,8 @@ extern size_t pipe_readable (struct pipe *pipe, int data_only);
 
 extern int pipe_is_readable (struct pipe *pipe, int data_only);
 
+extern int pipe_next_message (struct pipe *pipe, size_t *len);
+
 extern error_t pipe_wait_readable (struct pipe *pipe, int noblock, int data_only);
 
 extern error_t pipe_select_readable (struct pipe *pipe, struct timespec *tsp,
@@ -167,6 +173,22 @@ pipe_is_readable (struct pipe *pipe, int data_only)
   return (packet != NULL);
 }
 
+/* Returns true if there's a data packet to be read in PIPE, and the number
+   of bytes in it in LEN.  Any `control' packets in front of it, which are
+   returned with it, are skipped.  */
+PIPE_EI int
+pipe_next_message (struct pipe *pipe, size_t *len)
+{
+  struct pq *pq = pipe->queue;
+  struct packet *packet = pq_head (pq, PACKET_TYPE_ANY, NULL);
+  while (packet && packet->type == PACKET_TYPE_CONTROL)
+    packet = packet->next;
+  if (! packet)
+    return 0;
+  *len = packet_readable (packet);
+  return 1;
+}
+
 /* Waits for PIPE to be readable, or an error to occur.  If NOBLOCK is true,
    this operation will return EWOULDBLOCK instead of blocking when no data is
    immediately available.  If DATA_ONLY is true, then `control' packets are
@@ -1,6 +1,6 @@
 /* Packet queues
 
-   Copyright (C) 1995, 1996, 1998, 1999, 2002, 2006
+   Copyright (C) 1995, 1996, 1998, 1999, 2002, 2006, 2026
      Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
@@ -28,41 +28,202 @@
 
 /* ---------------------------------------------------------------- */
 
-/* Create a new packet queue, returning it in PQ.  The only possible error is
-   ENOMEM.  */
-error_t
-pq_create (struct pq **pq)
+/* The number of free packets a queue keeps for itself.  */
+#define PQ_FREE_MAX		16
+
+/* The number of packets, and of bytes of buffers of each size class, that a
+   pool holds on to.  */
+#define POOL_PACKETS_MAX	1024
+#define POOL_CLASS_BYTES	(256 * 1024)
+
+/* Returns the size class of a pooled buffer of LEN bytes, or -1 if such
+   buffers aren't pooled.  */
+static int
+size_class (size_t len)
 {
-  *pq = malloc (sizeof (struct pq));
+  int class = 0;
+  size_t size = PACKET_SIZE_SMALL;
 
-  if (! *pq)
-    return ENOMEM;
+  while (size < len)
+    {
+      size <<= 1;
+      class++;
+    }
 
-  (*pq)->head = (*pq)->tail = 0;
-  (*pq)->free = 0;
+  return (size == len && class < PACKET_POOL_CLASSES) ? class : -1;
+}
 
-  return 0;
+/* Returns a buffer of LEN bytes for a packet using POOL, which may be NULL,
+   or NULL if there's no memory.  It is vm_allocated if LEN is at least
+   PACKET_SIZE_LARGE, and malloced otherwise.  */
+static char *
+buffer_get (struct packet_pool *pool, size_t len)
+{
+  char *buf;
+
+  if (pool)
+    {
+      int class = size_class (len);
+
+      pthread_mutex_lock (&pool->lock);
+      if (class >= 0 && pool->buffers[class])
+	{
+	  buf = pool->buffers[class];
+	  pool->buffers[class] = *(void **)buf;
+	  pool->nr_buffers[class]--;
+	  pool->stats.free_buffers--;
+	  pool->stats.free_bytes -= len;
+	  pool->stats.buffers_reused++;
+	  pthread_mutex_unlock (&pool->lock);
+	  return buf;
+	}
+      pool->stats.buffers_allocated++;
+      pthread_mutex_unlock (&pool->lock);
+    }
+
+  if (len >= PACKET_SIZE_LARGE)
+    {
+      buf = mmap (0, len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      return (buf == (char *) -1) ? NULL : buf;
+    }
+  else
+    return malloc (len);
 }
 
-/* Free every packet (and its contents) in the linked list rooted at HEAD.  */
+/* Gets rid of BUF, a packet buffer of LEN bytes belonging to a packet using
+   POOL, which may be NULL.  VM_ALLOCED is true if BUF was vm_allocated.  */
 static void
-free_packets (struct packet *head)
+buffer_put (struct packet_pool *pool, char *buf, size_t len, int vm_alloced)
 {
-  if (head)
+  if (len == 0)
+    return;
+
+  if (pool && ! vm_alloced)
     {
-      struct packet *next = head->next;
-      if (head->ports)
-	free (head->ports);
-      if (head->buf_len > 0)
+      int class = size_class (len);
+
+      if (class >= 0)
 	{
-	  if (head->buf_vm_alloced)
-	    munmap (head->buf, head->buf_len);
-	  else
-	    free (head->buf);
+	  pthread_mutex_lock (&pool->lock);
+	  if ((pool->nr_buffers[class] + 1) * len <= POOL_CLASS_BYTES)
+	    {
+	      *(void **)buf = pool->buffers[class];
+	      pool->buffers[class] = buf;
+	      pool->nr_buffers[class]++;
+	      pool->stats.free_buffers++;
+	      pool->stats.free_bytes += len;
+	      pthread_mutex_unlock (&pool->lock);
+	      return;
+	    }
+	  pool->stats.buffers_freed++;
+	  pthread_mutex_unlock (&pool->lock);
+	}
+    }
+
+  if (vm_alloced)
+    vm_deallocate (mach_task_self (), (vm_address_t)buf, len);
+  else
+    free (buf);
+}
+
+/* Returns a new packet, without a buffer, for a queue using POOL, which may
+   be NULL, or NULL if there's no memory.  */
+static struct packet *
+packet_get (struct packet_pool *pool)
+{
+  struct packet *packet;
+
+  if (pool)
+    {
+      pthread_mutex_lock (&pool->lock);
+      packet = pool->packets;
+      if (packet)
+	{
+	  pool->packets = packet->next;
+	  pool->stats.free_packets--;
+	  pool->stats.packets_reused++;
 	}
-      free (head);
-      free_packets (next);
+      else
+	pool->stats.packets_allocated++;
+      pthread_mutex_unlock (&pool->lock);
+
+      if (packet)
+	return packet;
     }
+
+  packet = malloc (sizeof (struct packet));
+  if (!packet)
+    return 0;
+  packet->buf = 0;
+  packet->buf_len = 0;
+  packet->ports = 0;
+  packet->ports_alloced = 0;
+  packet->buf_vm_alloced = 0;
+  packet->pool = pool;
+
+  return packet;
+}
+
+/* Gets rid of PACKET, which isn't in any queue, and its buffer, by giving
+   them back to its pool, or by freeing them if the pool is full.  */
+static void
+packet_put (struct packet *packet)
+{
+  struct packet_pool *pool = packet->pool;
+
+  buffer_put (pool, packet->buf, packet->buf_len, packet->buf_vm_alloced);
+  packet->buf = 0;
+  packet->buf_len = 0;
+  packet->buf_vm_alloced = 0;
+
+  if (pool)
+    {
+      pthread_mutex_lock (&pool->lock);
+      if (pool->stats.free_packets < POOL_PACKETS_MAX)
+	{
+	  packet->next = pool->packets;
+	  pool->packets = packet;
+	  pool->stats.free_packets++;
+	  pthread_mutex_unlock (&pool->lock);
+	  return;
+	}
+      pool->stats.packets_freed++;
+      pthread_mutex_unlock (&pool->lock);
+    }
+
+  free (packet->ports);
+  free (packet);
+}
+
+/* Fill in STATS with the current statistics of POOL.  */
+void
+packet_pool_get_stats (struct packet_pool *pool,
+		       struct packet_pool_stats *stats)
+{
+  pthread_mutex_lock (&pool->lock);
+  *stats = pool->stats;
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Create a new packet queue, returning it in PQ.  Its packets and their
+   buffers are taken from POOL, if it isn't NULL.  The only possible error is
+   ENOMEM.  */
+error_t
+pq_create (struct pq **pq, struct packet_pool *pool)
+{
+  *pq = malloc (sizeof (struct pq));
+
+  if (! *pq)
+    return ENOMEM;
+
+  (*pq)->head = (*pq)->tail = 0;
+  (*pq)->free = 0;
+  (*pq)->num_free = 0;
+  (*pq)->pool = pool;
+
+  return 0;
 }
 
 /* Frees PQ and any resources it holds, including deallocating any ports in
@@ -71,10 +232,15 @@ void
 pq_free (struct pq *pq)
 {
   pq_drain (pq);
-  free_packets (pq->free);
+  while (pq->free)
+    {
+      struct packet *packet = pq->free;
+      pq->free = packet->next;
+      packet_put (packet);
+    }
   free (pq);
 }
-
+
 /* ---------------------------------------------------------------- */
 
 /* Remove the first packet (if any) in PQ, deallocating any resources it
@@ -95,13 +261,21 @@ pq_dequeue (struct pq *pq)
     pipe_dealloc_addr (packet->source);
 
   pq->head = packet->next;
-  packet->next = pq->free;
-  pq->free = packet;
   if (pq->head)
     pq->head->prev = 0;
   else
     pq->tail = 0;
 
+  if (pq->num_free < PQ_FREE_MAX)
+    {
+      packet->next = pq->free;
+      pq->free = packet;
+      pq->num_free++;
+    }
+  else
+    /* Let other queues have it.  */
+    packet_put (packet);
+
   return 1;
 }
 
@@ -112,7 +286,7 @@ pq_drain (struct pq *pq)
   while (pq_dequeue (pq))
     ;
 }
-
+
 /* Pushes a new packet of type TYPE and source SOURCE onto the tail of the
    queue, and returns it, or 0 if there was an allocation error. */
 struct packet *
@@ -120,19 +294,17 @@ pq_queue (struct pq *pq, unsigned type, void *source)
 {
   struct packet *packet = pq->free;
 
-  if (!packet)
+  if (packet)
     {
-      packet = malloc (sizeof (struct packet));
+      pq->free = packet->next;
+      pq->num_free--;
+    }
+  else
+    {
+      packet = packet_get (pq->pool);
       if (!packet)
 	return 0;
-      packet->buf = 0;
-      packet->buf_len = 0;
-      packet->ports = 0;
-      packet->ports_alloced = 0;
-      packet->buf_vm_alloced = 0;
     }
-  else
-    pq->free = packet->next;
 
   packet->num_ports = 0;
   packet->buf_start = packet->buf_end = packet->buf;
@@ -161,6 +333,14 @@ packet_new_size (struct packet *packet, size_t extra)
   if (packet->buf_vm_alloced || new_len >= PACKET_SIZE_LARGE)
     /* Round NEW_LEN up to a page boundary (OLD_LEN should already be).  */
     return round_page (new_len);
+  else if (new_len <= PACKET_SIZE_POOLED)
+    /* Round NEW_LEN up to a size class, so that the buffer can be pooled.  */
+    {
+      size_t len = PACKET_SIZE_SMALL;
+      while (len < new_len)
+	len <<= 1;
+      return len;
+    }
   else
     /* Otherwise, just round up to a multiple of 512 bytes.  */
     return (new_len + 511) & ~511;
@@ -228,16 +408,8 @@ packet_realloc (struct packet *packet, size_t new_len)
   int vm_alloc = (new_len >= PACKET_SIZE_LARGE);
 
   /* Make a new buffer.  */
-  if (vm_alloc)
-    {
-      new_buf = mmap (0, new_len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-      err = (new_buf == (char *) -1) ? errno : 0;
-    }
-  else
-    {
-      new_buf = malloc (new_len);
-      err = (new_buf ? 0 : ENOMEM);
-    }
+  new_buf = buffer_get (packet->pool, new_len);
+  err = (new_buf ? 0 : ENOMEM);
 
   if (! err)
     {
@@ -255,13 +427,7 @@ packet_realloc (struct packet *packet, size_t new_len)
 	memcpy (new_buf, start, end - start);
 
       /* And get rid of the old buffer.  */
-      if (old_len > 0)
-	{
-	  if (packet->buf_vm_alloced)
-	    vm_deallocate (mach_task_self (), (vm_address_t)old_buf, old_len);
-	  else
-	    free (old_buf);
-	}
+      buffer_put (packet->pool, old_buf, old_len, packet->buf_vm_alloced);
 
       packet->buf = new_buf;
       packet->buf_len = new_len;
@@ -329,14 +495,69 @@ packet_read_ports (struct packet *packet,
   return 0;
 }
 
+/* Make the DATA_LEN bytes at DATA, which must be page-aligned, the contents
+   of PACKET, which must be empty.  The whole pages of DATA are shared
+   copy-on-write with a new vm_alloced buffer, instead of being copied; only
+   the bytes on a last partial page are copied, so that what follows the
+   data on that page is not passed on to the reader.  If an error occurs,
+   PACKET is not modified and the error is returned.  */
+static error_t
+packet_copy_pages (struct packet *packet, char *data, size_t data_len)
+{
+  error_t err;
+  size_t pages_len = trunc_page (data_len);
+  size_t new_len = round_page (data_len);
+  vm_address_t new_buf = 0;
+
+  err = vm_allocate (mach_task_self (), &new_buf, new_len, 1);
+  if (err)
+    return err;
+
+  err = vm_copy (mach_task_self (), (vm_address_t)data, pages_len, new_buf);
+  if (err)
+    {
+      vm_deallocate (mach_task_self (), new_buf, new_len);
+      return err;
+    }
+
+  if (data_len > pages_len)
+    memcpy ((char *)new_buf + pages_len, data + pages_len,
+	    data_len - pages_len);
+
+  /* Get rid of the old buffer.  */
+  buffer_put (packet->pool, packet->buf, packet->buf_len,
+	      packet->buf_vm_alloced);
+
+  packet->buf = (char *)new_buf;
+  packet->buf_len = new_len;
+  packet->buf_vm_alloced = 1;
+  packet->buf_start = packet->buf;
+  packet->buf_end = packet->buf + data_len;
+
+  return 0;
+}
+
 /* Append the bytes in DATA, of length DATA_LEN, to what's already in PACKET,
    and return the amount appended in AMOUNT if that's not the null pointer.  */
 error_t
 packet_write (struct packet *packet,
 	      char *data, size_t data_len, size_t *amount)
 {
-  error_t err = packet_ensure (packet, data_len);
+  error_t err;
+
+  if (data_len >= PACKET_SIZE_LARGE && packet_readable (packet) == 0
+      && trunc_page ((vm_address_t)data) == (vm_address_t)data
+      && packet_copy_pages (packet, data, data_len) == 0)
+    /* Large transfers usually arrive out-of-line, in pages of their own.
+       Their pages are now in PACKET without having been touched, and
+       packet_read will hand them to the reader the same way.  */
+    {
+      if (amount != NULL)
+	*amount = data_len;
+      return 0;
+    }
 
+  err = packet_ensure (packet, data_len);
   if (err)
     return err;
 
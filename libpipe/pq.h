@@ -1,6 +1,6 @@
 /* Packet queues
 
-   Copyright (C) 1995, 1996, 2006 Free Software Foundation, Inc.
+   Copyright (C) 1995, 1996, 2006, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -25,6 +25,7 @@
 #include <stddef.h>		/* for size_t */
 #include <string.h>
 #include <mach/mach.h>
+#include <pthread.h>
 #include <features.h>
 
 #ifdef PQ_DEFINE_EI
@@ -55,6 +56,9 @@ struct packet
   mach_port_t *ports;
   size_t num_ports, ports_alloced;
 
+  /* Where BUF is taken from and given back to, or NULL.  */
+  struct packet_pool *pool;
+
   /* Next and previous packets within the packet queue we're part of.  If
      PREV is null, we're at the head of the queue, and if NEXT is null, we're
      at the tail.  */
@@ -87,7 +91,9 @@ packet_readable (struct packet *packet)
 #endif /* Use extern inlines.  */
 
 /* Append the bytes in DATA, of length DATA_LEN, to what's already in PACKET,
-   and return the amount appended in AMOUNT if that's not the null pointer.  */
+   and return the amount appended in AMOUNT if that's not the null pointer.
+   If PACKET is empty and DATA is a large page-aligned buffer, its pages are
+   copied copy-on-write rather than byte by byte.  */
 error_t packet_write (struct packet *packet,
 		      char *data, size_t data_len, size_t *amount);
 
@@ -129,6 +135,59 @@ packet_read_source (struct packet *packet, void **source)
    copying around data.  */
 #define PACKET_SIZE_LARGE	8192
 
+/* Packet buffers up to PACKET_SIZE_POOLED bytes are malloced in a number of
+   size classes, each twice the size of the one before, starting with
+   PACKET_SIZE_SMALL, so that they can be passed from one packet to another.
+   Larger buffers are not pooled, as packet_read may return their pages to
+   the reader whole, including whatever a previous user left on them.  */
+#define PACKET_SIZE_SMALL	512
+#define PACKET_POOL_CLASSES	4
+#define PACKET_SIZE_POOLED	(PACKET_SIZE_SMALL << (PACKET_POOL_CLASSES - 1))
+
+/* Statistics of a packet pool, see packet_pool_get_stats.  */
+struct packet_pool_stats
+{
+  /* Packets allocated, taken from the pool, and freed because the pool
+     was full.  */
+  unsigned long packets_allocated;
+  unsigned long packets_reused;
+  unsigned long packets_freed;
+
+  /* The same for packet buffers.  */
+  unsigned long buffers_allocated;
+  unsigned long buffers_reused;
+  unsigned long buffers_freed;
+
+  /* What's currently in the pool.  */
+  size_t free_packets;
+  size_t free_buffers;
+  size_t free_bytes;
+};
+
+/* A pool of unused packets and packet buffers, shared by many packet
+   queues.  Each queue keeps a few packets for itself; those it has no use
+   for, and those left when it's freed, go to the pool.  Buffers are kept
+   by size class.  */
+struct packet_pool
+{
+  pthread_mutex_t lock;
+
+  /* Free packets, without buffers, linked through their NEXT field.  */
+  struct packet *packets;
+
+  /* Free buffers of each size class, linked through their first word.  */
+  void *buffers[PACKET_POOL_CLASSES];
+  size_t nr_buffers[PACKET_POOL_CLASSES];
+
+  struct packet_pool_stats stats;
+};
+
+#define PACKET_POOL_INITIALIZER { .lock = PTHREAD_MUTEX_INITIALIZER }
+
+/* Fill in STATS with the current statistics of POOL.  */
+void packet_pool_get_stats (struct packet_pool *pool,
+			    struct packet_pool_stats *stats);
+
 /* Returns a legal size to which PACKET can be set allowing enough room for
    EXTRA bytes more than what's already in it, and perhaps more.  */
 size_t packet_new_size (struct packet *packet, size_t extra);
@@ -226,6 +285,8 @@ struct pq
 {
   struct packet *head, *tail;	/* Packet queue */
   struct packet *free;		/* Free packets */
+  size_t num_free;		/* Length of FREE */
+  struct packet_pool *pool;	/* Where to get packets and buffers from */
 };
 
 /* Pushes a new packet of type TYPE and source SOURCE, and returns it, or
@@ -295,9 +356,10 @@ pq_next (struct pq *pq, unsigned type, void *source)
 /* Dequeues all packets in PQ.  */
 void pq_drain (struct pq *pq);
 
-/* Create a new packet queue, returning it in PQ.  The only possible error is
+/* Create a new packet queue, returning it in PQ.  Its packets and their
+   buffers are taken from POOL, if it isn't NULL.  The only possible error is
    ENOMEM.  */
-error_t pq_create (struct pq **pq);
+error_t pq_create (struct pq **pq, struct packet_pool *pool);
 
 /* Frees PQ and any resources it holds, including deallocating any ports in
    packets left in the queue.  */
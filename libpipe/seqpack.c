@@ -1,6 +1,6 @@
 /* The SOCK_SEQPACKET pipe class
 
-   Copyright (C) 1995 Free Software Foundation, Inc.
+   Copyright (C) 1995, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -57,8 +57,10 @@ seqpack_read (struct packet *packet, int *dequeue, unsigned *flags,
   return err;
 }
 
+static struct packet_pool seqpack_pool = PACKET_POOL_INITIALIZER;
+
 struct pipe_class _seqpack_pipe_class =
 {
-  SOCK_SEQPACKET, 0, seqpack_read, seqpack_write
+  SOCK_SEQPACKET, 0, seqpack_read, seqpack_write, &seqpack_pool
 };
 struct pipe_class *seqpack_pipe_class = &_seqpack_pipe_class;
@@ -1,6 +1,6 @@
 /* The SOCK_STREAM pipe class
 
-   Copyright (C) 1995 Free Software Foundation, Inc.
+   Copyright (C) 1995, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -39,9 +39,11 @@ stream_write (struct pq *pq, void *source,
 
   if (packet_readable (packet) > 0
       && data_len > PACKET_SIZE_LARGE
-      && (! page_aligned (data - packet->buf_end)
+      && (page_aligned ((vm_offset_t)data)
+	  || ! page_aligned (data - packet->buf_end)
 	  || ! packet_ensure_efficiently (packet, data_len)))
-    /* Put a large page-aligned transfer in its own packet, if it's
+    /* Put a large transfer in its own packet if it's page-aligned, so that
+       packet_write can take its pages instead of copying them, if it's
        page-aligned `differently' than the end of the current packet, or if
        the current packet can't be extended in place.  */
     packet = pq_queue (pq, PACKET_TYPE_DATA, source);
@@ -70,8 +72,10 @@ stream_read (struct packet *packet, int *dequeue, unsigned *flags,
   return err;
 }
 
+static struct packet_pool stream_pool = PACKET_POOL_INITIALIZER;
+
 struct pipe_class _stream_pipe_class =
 {
-  SOCK_STREAM, 0, stream_read, stream_write
+  SOCK_STREAM, 0, stream_read, stream_write, &stream_pool
 };
 struct pipe_class *stream_pipe_class = &_stream_pipe_class;
@@ -28,8 +28,32 @@ ports_begin_rpc (void *portstruct, mach_msg_id_t msg_id, struct rpc_info *info)
   int *block_flags = 0;
 
   struct port_info *pi = portstruct;
-  
-  pthread_mutex_lock (&_ports_lock);
+
+  info->thread = hurd_thread_self ();
+  info->notifies = 0;
+
+  /* As long as nobody is inhibiting RPCs, there is nothing to wait for,
+     and the RPC can be recorded without taking _ports_lock.  If an
+     inhibitor shows up while we do that, back off and do it the slow
+     way.  See rpcs.c.  */
+  if (__atomic_load_n (&_ports_inhibitors, __ATOMIC_SEQ_CST) == 0)
+    {
+      /* If our receive right is gone, then abandon the RPC. */
+      if (__atomic_load_n (&pi->port_right, __ATOMIC_RELAXED)
+	  == MACH_PORT_NULL)
+	return EOPNOTSUPP;
+
+      _ports_add_rpc (pi, info);
+      if (__atomic_load_n (&_ports_inhibitors, __ATOMIC_SEQ_CST) == 0)
+	return 0;
+
+      pthread_mutex_lock (&_ports_lock);
+      _ports_remove_rpc (pi, info);
+      /* Someone may be waiting for us to finish.  */
+      pthread_cond_broadcast (&_ports_block);
+    }
+  else
+    pthread_mutex_lock (&_ports_lock);
   
   do
     {
@@ -90,17 +114,7 @@ ports_begin_rpc (void *portstruct, mach_msg_id_t msg_id, struct rpc_info *info)
   while (block_flags);
   
   /* Record that that an RPC is in progress */
-  info->thread = hurd_thread_self ();
-  info->next = pi->current_rpcs;
-  info->notifies = 0;
-  if (pi->current_rpcs)
-    pi->current_rpcs->prevp = &info->next;
-  info->prevp = &pi->current_rpcs;
-  pi->current_rpcs = info;
-
-  pi->class->rpcs++;
-  pi->bucket->rpcs++;
-  _ports_total_rpcs++;
+  _ports_add_rpc (pi, info);
 
   pthread_mutex_unlock (&_ports_lock);
 
@@ -23,9 +23,10 @@
 
 
 /* Internal entrypoint for both ports_bucket_iterate and ports_class_iterate.
-   If CLASS is non-null, call FUN only for ports in that class.  */
+   If BUCKET is null, look at all ports.  If CLASS is non-null, call FUN
+   only for ports in that class.  */
 error_t
-_ports_bucket_class_iterate (struct hurd_ihash *ht,
+_ports_bucket_class_iterate (struct port_bucket *bucket,
 			     struct port_class *class,
 			     error_t (*fun)(void *))
 {
@@ -35,35 +36,60 @@ _ports_bucket_class_iterate (struct hurd_ihash *ht,
   size_t i, n, nr_items;
   error_t err;
 
-  pthread_rwlock_rdlock (&_ports_htable_lock);
-
-  if (ht->nr_items == 0)
-    {
-      pthread_rwlock_unlock (&_ports_htable_lock);
-      return 0;
-    }
+  /* Without a bucket, all the shards of _PORTS_HTABLE are locked, in
+     order, so that we see a consistent snapshot.  */
+  if (bucket)
+    pthread_rwlock_rdlock (&_ports_htable_lock);
+  else
+    for (i = 0; i < _PORTS_HTABLE_SHARDS; i++)
+      pthread_rwlock_rdlock (&_ports_htable[i].lock);
+
+  if (bucket)
+    nr_items = bucket->htable.nr_items;
+  else
+    for (nr_items = 0, i = 0; i < _PORTS_HTABLE_SHARDS; i++)
+      nr_items += _ports_htable[i].htable.nr_items;
+
+  p = NULL;
+  err = 0;
+  n = 0;
+  if (nr_items == 0)
+    goto unlock;
 
-  nr_items = ht->nr_items;
   p = malloc (nr_items * sizeof *p);
   if (p == NULL)
     {
-      pthread_rwlock_unlock (&_ports_htable_lock);
-      return ENOMEM;
+      err = ENOMEM;
+      goto unlock;
     }
 
-  n = 0;
-  HURD_IHASH_ITERATE (ht, arg)
+  for (i = 0; i < (bucket ? 1 : _PORTS_HTABLE_SHARDS); i++)
     {
-      struct port_info *const pi = arg;
+      struct hurd_ihash *ht
+	= bucket ? &bucket->htable : &_ports_htable[i].htable;
 
-      if (class == 0 || pi->class == class)
+      HURD_IHASH_ITERATE (ht, arg)
 	{
-	  refcounts_ref (&pi->refcounts, NULL);
-	  p[n] = pi;
-	  n++;
+	  struct port_info *const pi = arg;
+
+	  if (class == 0 || pi->class == class)
+	    {
+	      refcounts_ref (&pi->refcounts, NULL);
+	      p[n] = pi;
+	      n++;
+	    }
 	}
     }
-  pthread_rwlock_unlock (&_ports_htable_lock);
+
+ unlock:
+  if (bucket)
+    pthread_rwlock_unlock (&_ports_htable_lock);
+  else
+    for (i = _PORTS_HTABLE_SHARDS; i-- > 0; )
+      pthread_rwlock_unlock (&_ports_htable[i].lock);
+
+  if (p == NULL)
+    return err;
 
   if (n != 0 && n != nr_items)
     {
@@ -73,7 +99,6 @@ _ports_bucket_class_iterate (struct hurd_ihash *ht,
         p = new;
     }
 
-  err = 0;
   for (i = 0; i < n; i++)
     {
       if (!err)
@@ -89,5 +114,5 @@ error_t
 ports_bucket_iterate (struct port_bucket *bucket,
 		      error_t (*fun)(void *))
 {
-  return _ports_bucket_class_iterate (&bucket->htable, NULL, fun);
+  return _ports_bucket_class_iterate (bucket, NULL, fun);
 }
@@ -23,5 +23,5 @@ error_t
 ports_class_iterate (struct port_class *class,
 		     error_t (*fun)(void *))
 {
-  return _ports_bucket_class_iterate (&_ports_htable, class, fun);
+  return _ports_bucket_class_iterate (NULL, class, fun);
 }
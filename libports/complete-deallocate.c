@@ -29,9 +29,12 @@ _ports_complete_deallocate (struct port_info *pi)
 
   if (MACH_PORT_VALID (pi->port_right))
     {
+      struct _ports_htable_shard *shard
+	= _ports_htable_shard (pi->port_right);
       struct references result;
 
       pthread_rwlock_wrlock (&_ports_htable_lock);
+      pthread_rwlock_wrlock (&shard->lock);
       refcounts_references (&pi->refcounts, &result);
       if (result.hard > 0 || result.weak > 0)
         {
@@ -39,12 +42,14 @@ _ports_complete_deallocate (struct port_info *pi)
              It's fine, we didn't touch anything yet. */
           /* XXX: This really shouldn't happen.  */
           assert (! "reacquired reference w/o send rights");
+          pthread_rwlock_unlock (&shard->lock);
           pthread_rwlock_unlock (&_ports_htable_lock);
           return;
         }
 
-      hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
+      hurd_ihash_locp_remove (&shard->htable, pi->ports_htable_entry);
       hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
+      pthread_rwlock_unlock (&shard->lock);
       pthread_rwlock_unlock (&_ports_htable_lock);
 
       mach_port_mod_refs (mach_task_self (), pi->port_right,
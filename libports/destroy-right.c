@@ -62,10 +62,7 @@ ports_destroy_right (void *portstruct)
     {
       mach_port_clear_protected_payload (mach_task_self (), port_right);
 
-      pthread_rwlock_wrlock (&_ports_htable_lock);
-      hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
-      hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_remove (pi, port_right);
     }
   pthread_mutex_unlock (&_ports_lock);
 
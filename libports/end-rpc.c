@@ -25,23 +25,26 @@ ports_end_rpc (void *port, struct rpc_info *info)
 {
   struct port_info *pi = port;
 
-  pthread_mutex_lock (&_ports_lock);
-
   if (info->notifies)
-    _ports_remove_notified_rpc (info);
-
-  *info->prevp = info->next;
-  if (info->next)
-    info->next->prevp = info->prevp;
-  pi->class->rpcs--;
-  _ports_total_rpcs--;
-  pi->bucket->rpcs--;
-
-  if ((pi->flags & PORT_INHIBIT_WAIT)
-      || (pi->bucket->flags & PORT_BUCKET_INHIBIT_WAIT)
-      || (pi->class->flags & PORT_CLASS_INHIBIT_WAIT)
-      || (_ports_flags & _PORTS_INHIBIT_WAIT))
-    pthread_cond_broadcast (&_ports_block);
+    {
+      pthread_mutex_lock (&_ports_lock);
+      _ports_remove_notified_rpc (info);
+      pthread_mutex_unlock (&_ports_lock);
+    }
+
+  _ports_remove_rpc (pi, info);
+
+  /* Only an inhibitor can be waiting for us.  See rpcs.c.  */
+  if (__atomic_load_n (&_ports_inhibitors, __ATOMIC_SEQ_CST) != 0)
+    {
+      pthread_mutex_lock (&_ports_lock);
+      if ((pi->flags & PORT_INHIBIT_WAIT)
+	  || (pi->bucket->flags & PORT_BUCKET_INHIBIT_WAIT)
+	  || (pi->class->flags & PORT_CLASS_INHIBIT_WAIT)
+	  || (_ports_flags & _PORTS_INHIBIT_WAIT))
+	pthread_cond_broadcast (&_ports_block);
+      pthread_mutex_unlock (&_ports_lock);
+    }
 
   /* This removes the current thread's rpc (which should be INFO) from the
      ports interrupted list.  */
@@ -50,6 +53,4 @@ ports_end_rpc (void *port, struct rpc_info *info)
   /* Clear the cancellation flag for this thread since the current 
      RPC is now finished anwhow. */
   hurd_check_cancel ();
-
-  pthread_mutex_unlock (&_ports_lock);
 }
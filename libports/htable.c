@@ -0,0 +1,60 @@
+/* Maintaining the port hash tables
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "ports.h"
+#include <hurd/ihash.h>
+
+/* Add PI to _PORTS_HTABLE and to the hash table of its bucket, under
+   the name PORT.  */
+error_t
+_ports_htable_add (struct port_info *pi, mach_port_t port)
+{
+  struct _ports_htable_shard *shard = _ports_htable_shard (port);
+  error_t err;
+
+  pthread_rwlock_wrlock (&_ports_htable_lock);
+  pthread_rwlock_wrlock (&shard->lock);
+  err = hurd_ihash_add (&shard->htable, port, pi);
+  if (! err)
+    {
+      err = hurd_ihash_add (&pi->bucket->htable, port, pi);
+      if (err)
+	hurd_ihash_locp_remove (&shard->htable, pi->ports_htable_entry);
+    }
+  pthread_rwlock_unlock (&shard->lock);
+  pthread_rwlock_unlock (&_ports_htable_lock);
+
+  return err;
+}
+
+/* Remove PI, whose name is PORT, from _PORTS_HTABLE and from the hash
+   table of its bucket.  */
+void
+_ports_htable_remove (struct port_info *pi, mach_port_t port)
+{
+  struct _ports_htable_shard *shard = _ports_htable_shard (port);
+
+  pthread_rwlock_wrlock (&_ports_htable_lock);
+  pthread_rwlock_wrlock (&shard->lock);
+  hurd_ihash_locp_remove (&shard->htable, pi->ports_htable_entry);
+  hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
+  pthread_rwlock_unlock (&shard->lock);
+  pthread_rwlock_unlock (&_ports_htable_lock);
+}
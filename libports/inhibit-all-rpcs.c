@@ -34,28 +34,36 @@ ports_inhibit_all_rpcs ()
   else
     {
       int this_one = 0;
+      int i;
 
-      pthread_rwlock_rdlock (&_ports_htable_lock);
-      HURD_IHASH_ITERATE (&_ports_htable, portstruct)
-	{
-	  struct rpc_info *rpc;
-	  struct port_info *pi = portstruct;
+      __atomic_add_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
+      _ports_flags |= _PORTS_INHIBIT_WAIT;
 
-	  for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
+      for (i = 0; i < _PORTS_HTABLE_SHARDS; i++)
+	{
+	  pthread_rwlock_rdlock (&_ports_htable[i].lock);
+	  HURD_IHASH_ITERATE (&_ports_htable[i].htable, portstruct)
 	    {
-	      /* Avoid cancelling the calling thread if it's currently
-		 handling a RPC.  */
-	      if (rpc->thread == hurd_thread_self ())
-		this_one = 1;
-	      else
-		hurd_thread_cancel (rpc->thread);
+	      struct rpc_info *rpc;
+	      struct port_info *pi = portstruct;
+
+	      pthread_mutex_lock (_ports_rpc_lock (pi));
+	      for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
+		{
+		  /* Avoid cancelling the calling thread if it's currently
+		     handling a RPC.  */
+		  if (rpc->thread == hurd_thread_self ())
+		    this_one = 1;
+		  else
+		    hurd_thread_cancel (rpc->thread);
+		}
+	      pthread_mutex_unlock (_ports_rpc_lock (pi));
 	    }
+	  pthread_rwlock_unlock (&_ports_htable[i].lock);
 	}
-      pthread_rwlock_unlock (&_ports_htable_lock);
 
-      while (_ports_total_rpcs > this_one)
+      while (__atomic_load_n (&_ports_total_rpcs, __ATOMIC_SEQ_CST) > this_one)
 	{
-	  _ports_flags |= _PORTS_INHIBIT_WAIT;
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
@@ -67,6 +75,8 @@ ports_inhibit_all_rpcs ()
       _ports_flags &= ~_PORTS_INHIBIT_WAIT;
       if (! err)
 	_ports_flags |= _PORTS_INHIBITED;
+      else
+	__atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
     }
 
   pthread_mutex_unlock (&_ports_lock);
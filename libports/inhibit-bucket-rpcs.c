@@ -35,12 +35,16 @@ ports_inhibit_bucket_rpcs (struct port_bucket *bucket)
     {
       int this_one = 0;
 
+      __atomic_add_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
+      bucket->flags |= PORT_BUCKET_INHIBIT_WAIT;
+
       pthread_rwlock_rdlock (&_ports_htable_lock);
       HURD_IHASH_ITERATE (&bucket->htable, portstruct)
 	{
 	  struct rpc_info *rpc;
 	  struct port_info *pi = portstruct;
 
+	  pthread_mutex_lock (_ports_rpc_lock (pi));
 	  for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
 	    {
 	      /* Avoid cancelling the calling thread.  */
@@ -49,12 +53,12 @@ ports_inhibit_bucket_rpcs (struct port_bucket *bucket)
 	      else
 		hurd_thread_cancel (rpc->thread);
 	    }
+	  pthread_mutex_unlock (_ports_rpc_lock (pi));
 	}
       pthread_rwlock_unlock (&_ports_htable_lock);
 
-      while (bucket->rpcs > this_one)
+      while (__atomic_load_n (&bucket->rpcs, __ATOMIC_SEQ_CST) > this_one)
 	{
-	  bucket->flags |= PORT_BUCKET_INHIBIT_WAIT;
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
@@ -66,6 +70,8 @@ ports_inhibit_bucket_rpcs (struct port_bucket *bucket)
       bucket->flags &= ~PORT_BUCKET_INHIBIT_WAIT;
       if (! err)
 	bucket->flags |= PORT_BUCKET_INHIBITED;
+      else
+	__atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
     }
 
   pthread_mutex_unlock (&_ports_lock);
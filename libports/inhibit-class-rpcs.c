@@ -20,6 +20,7 @@
 
 #include "ports.h"
 #include <hurd.h>
+#include <hurd/ihash.h>
 
 error_t
 ports_inhibit_class_rpcs (struct port_class *class)
@@ -33,29 +34,37 @@ ports_inhibit_class_rpcs (struct port_class *class)
   else
     {
       int this_one = 0;
+      int i;
 
-      pthread_rwlock_rdlock (&_ports_htable_lock);
-      HURD_IHASH_ITERATE (&_ports_htable, portstruct)
-	{
-	  struct rpc_info *rpc;
-	  struct port_info *pi = portstruct;
-	  if (pi->class != class)
-	    continue;
+      __atomic_add_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
+      class->flags |= PORT_CLASS_INHIBIT_WAIT;
 
-	  for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
+      for (i = 0; i < _PORTS_HTABLE_SHARDS; i++)
+	{
+	  pthread_rwlock_rdlock (&_ports_htable[i].lock);
+	  HURD_IHASH_ITERATE (&_ports_htable[i].htable, portstruct)
 	    {
-	      /* Avoid cancelling the calling thread.  */
-	      if (rpc->thread == hurd_thread_self ())
-		this_one = 1;
-	      else
-		hurd_thread_cancel (rpc->thread);
+	      struct rpc_info *rpc;
+	      struct port_info *pi = portstruct;
+	      if (pi->class != class)
+		continue;
+
+	      pthread_mutex_lock (_ports_rpc_lock (pi));
+	      for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
+		{
+		  /* Avoid cancelling the calling thread.  */
+		  if (rpc->thread == hurd_thread_self ())
+		    this_one = 1;
+		  else
+		    hurd_thread_cancel (rpc->thread);
+		}
+	      pthread_mutex_unlock (_ports_rpc_lock (pi));
 	    }
+	  pthread_rwlock_unlock (&_ports_htable[i].lock);
 	}
-      pthread_rwlock_unlock (&_ports_htable_lock);
 
-      while (class->rpcs > this_one)
+      while (__atomic_load_n (&class->rpcs, __ATOMIC_SEQ_CST) > this_one)
 	{
-	  class->flags |= PORT_CLASS_INHIBIT_WAIT;
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
@@ -67,6 +76,8 @@ ports_inhibit_class_rpcs (struct port_class *class)
       class->flags &= ~PORT_CLASS_INHIBIT_WAIT;
       if (! err)
 	class->flags |= PORT_CLASS_INHIBITED;
+      else
+	__atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
     }
 
   pthread_mutex_unlock (&_ports_lock);
@@ -33,9 +33,15 @@ ports_inhibit_port_rpcs (void *portstruct)
     err = EBUSY;
   else
     {
+      pthread_mutex_t *lock = _ports_rpc_lock (pi);
       struct rpc_info *rpc;
       struct rpc_info *this_rpc = 0;
-  
+      int busy;
+
+      __atomic_add_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
+      pi->flags |= PORT_INHIBIT_WAIT;
+
+      pthread_mutex_lock (lock);
       for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
 	{
 	  /* Avoid cancelling the calling thread.  */
@@ -44,12 +50,19 @@ ports_inhibit_port_rpcs (void *portstruct)
 	  else
 	    hurd_thread_cancel (rpc->thread);
 	}
+      pthread_mutex_unlock (lock);
 
-      while (pi->current_rpcs
-	     /* If this thread's RPC is the only one left, it doesn't count. */
-	     && !(pi->current_rpcs == this_rpc && ! this_rpc->next))
+      for (;;)
 	{
-	  pi->flags |= PORT_INHIBIT_WAIT;
+	  pthread_mutex_lock (lock);
+	  busy = (pi->current_rpcs
+		  /* If this thread's RPC is the only one left, it doesn't
+		     count. */
+		  && !(pi->current_rpcs == this_rpc && ! this_rpc->next));
+	  pthread_mutex_unlock (lock);
+	  if (! busy)
+	    break;
+
 	  if (pthread_hurd_cond_wait_np (&_ports_block, &_ports_lock))
 	    /* We got cancelled.  */
 	    {
@@ -61,6 +74,8 @@ ports_inhibit_port_rpcs (void *portstruct)
       pi->flags &= ~PORT_INHIBIT_WAIT;
       if (! err)
 	pi->flags |= PORT_INHIBITED;
+      else
+	__atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
     }
 
   pthread_mutex_unlock (&_ports_lock);
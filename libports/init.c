@@ -24,9 +24,22 @@
 pthread_mutex_t _ports_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t _ports_block = PTHREAD_COND_INITIALIZER;
 
-struct hurd_ihash _ports_htable =
-  HURD_IHASH_INITIALIZER (offsetof (struct port_info, ports_htable_entry));
+struct _ports_htable_shard _ports_htable[_PORTS_HTABLE_SHARDS] =
+{
+  [0 ... _PORTS_HTABLE_SHARDS - 1] =
+  {
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+    .htable = HURD_IHASH_INITIALIZER (offsetof (struct port_info,
+						ports_htable_entry)),
+  }
+};
 pthread_rwlock_t _ports_htable_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 int _ports_total_rpcs;
 int _ports_flags;
+int _ports_inhibitors;
+
+pthread_mutex_t _ports_rpc_locks[_PORTS_RPC_LOCKS] =
+{
+  [0 ... _PORTS_RPC_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
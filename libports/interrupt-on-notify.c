@@ -170,11 +170,11 @@ ports_interrupt_self_on_notification (void *object,
   struct port_info *pi = object;
   thread_t thread = hurd_thread_self ();
 
-  pthread_mutex_lock (&_ports_lock);
+  pthread_mutex_lock (_ports_rpc_lock (pi));
   for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
     if (rpc->thread == thread)
       break;
-  pthread_mutex_unlock (&_ports_lock);
+  pthread_mutex_unlock (_ports_rpc_lock (pi));
 
   assert (rpc);
 
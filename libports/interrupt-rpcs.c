@@ -25,15 +25,16 @@ void
 ports_interrupt_rpcs (void *portstruct)
 {
   struct port_info *pi = portstruct;
+  pthread_mutex_t *lock = _ports_rpc_lock (pi);
   struct rpc_info *rpc;
 
-  pthread_mutex_lock (&_ports_lock);
-  
+  pthread_mutex_lock (lock);
+
   for (rpc = pi->current_rpcs; rpc; rpc = rpc->next)
     {
       hurd_thread_cancel (rpc->thread);
       _ports_record_interruption (rpc);
     }
 
-  pthread_mutex_unlock (&_ports_lock);
+  pthread_mutex_unlock (lock);
 }
@@ -26,11 +26,12 @@ ports_lookup_port (struct port_bucket *bucket,
 		   mach_port_t port,
 		   struct port_class *class)
 {
+  struct _ports_htable_shard *shard = _ports_htable_shard (port);
   struct port_info *pi;
 
-  pthread_rwlock_rdlock (&_ports_htable_lock);
+  pthread_rwlock_rdlock (&shard->lock);
 
-  pi = hurd_ihash_find (&_ports_htable, port);
+  pi = hurd_ihash_find (&shard->htable, port);
   if (pi
       && ((class && pi->class != class)
           || (bucket && pi->bucket != bucket)))
@@ -39,7 +40,7 @@ ports_lookup_port (struct port_bucket *bucket,
   if (pi)
     refcounts_unsafe_ref (&pi->refcounts, NULL);
 
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  pthread_rwlock_unlock (&shard->lock);
 
   return pi;
 }
@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 1995, 1996, 1997 Free Software Foundation, Inc.
+   Copyright (C) 1995, 1996, 1997, 2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell.
 
    This file is part of the GNU Hurd.
@@ -21,7 +21,11 @@
 #include "ports.h"
 #include <assert.h>
 #include <error.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <mach/message.h>
 #include <mach/thread_info.h>
 #include <mach/thread_switch.h>
@@ -30,6 +34,61 @@
 
 #define THREAD_PRI 2
 
+/* Server threads spend most of their time waiting for the disk, the
+   network or other servers, so ports_auto_max_threads allows for many
+   of them per processor.  */
+#define THREADS_PER_CPU 32
+
+unsigned int ports_max_threads;
+
+static struct ports_thread_stats stats;
+
+unsigned int
+ports_auto_max_threads (void)
+{
+  long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (ncpus < 1)
+    ncpus = 1;
+  return ncpus * THREADS_PER_CPU;
+}
+
+void
+ports_thread_stats (struct ports_thread_stats *s)
+{
+  s->threads = __atomic_load_n (&stats.threads, __ATOMIC_RELAXED);
+  s->peak = __atomic_load_n (&stats.peak, __ATOMIC_RELAXED);
+  s->created = __atomic_load_n (&stats.created, __ATOMIC_RELAXED);
+  s->reaped = __atomic_load_n (&stats.reaped, __ATOMIC_RELAXED);
+  s->saturated = __atomic_load_n (&stats.saturated, __ATOMIC_RELAXED);
+}
+
+/* Account for a new thread in STATS.  */
+static void
+stats_thread_added (void)
+{
+  unsigned int n = __atomic_add_fetch (&stats.threads, 1, __ATOMIC_RELAXED);
+  unsigned int peak = __atomic_load_n (&stats.peak, __ATOMIC_RELAXED);
+
+  while (n > peak
+	 && ! __atomic_compare_exchange_n (&stats.peak, &peak, n, 1,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* Return true if the RPC MSG_ID on PI is one that may unblock the RPCs
+   in progress, and so must not wait for one of them to be done.  */
+static int
+unblocking_rpc (struct port_info *pi, mach_msg_id_t msg_id)
+{
+  struct ports_msg_id_range *range;
+
+  for (range = pi->class->uninhibitable_rpcs; range; range = range->next)
+    if (msg_id >= range->start && msg_id < range->end)
+      return 1;
+  return 0;
+}
+
 /* XXX To reduce starvation, the priority of new threads is initially
    depressed. This helps already existing threads complete their job and be
    recycled to handle new messages. The duration of this depression is made
@@ -107,6 +166,24 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
   unsigned int totalthreads = 1;
   unsigned int nreqthreads = 1;
 
+  /* A request that came in while ports_max_threads requests were being
+     served.  PI holds a reference.  */
+  struct held_request
+  {
+    struct held_request *next;
+    struct port_info *pi;
+    mach_msg_header_t msg;	/* Followed by the rest of the message.  */
+  };
+
+  /* The number of requests being served other than unblocking ones,
+     which ports_max_threads bounds, and the requests held until one of
+     them is done, oldest first.  Receiving threads never wait for a
+     slot, so that one of them is always free to serve the RPCs that may
+     unblock the others, like interrupt_operation.  */
+  unsigned int nbusythreads = 0;
+  struct held_request *held = NULL, **held_tail = &held;
+  pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
   pthread_attr_t attr;
 
   auto void * thread_function (void *);
@@ -114,14 +191,38 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
   pthread_attr_init (&attr);
   pthread_attr_setstacksize (&attr, STACK_SIZE);
 
-  int
-  internal_demuxer (mach_msg_header_t *inp,
-		    mach_msg_header_t *outheadp)
+  void
+  spawn_thread (void)
+    {
+      pthread_t pthread_id;
+      error_t err;
+
+      __atomic_add_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+      stats_thread_added ();
+
+      err = pthread_create (&pthread_id, &attr, thread_function, NULL);
+      if (!err)
+	{
+	  pthread_detach (pthread_id);
+	  __atomic_add_fetch (&stats.created, 1, __ATOMIC_RELAXED);
+	}
+      else
+	{
+	  __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  __atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+	  __atomic_sub_fetch (&stats.threads, 1, __ATOMIC_RELAXED);
+	  /* There is not much we can do at this point.  The code
+	     and design of the Hurd servers just don't handle
+	     thread creation failure.  */
+	  errno = err;
+	  perror ("pthread_create");
+	}
+    }
+
+  void
+  fill_reply (mach_msg_header_t *inp, mig_reply_header_t *outp)
     {
-      int status;
-      struct port_info *pi;
-      struct rpc_info link;
-      register mig_reply_header_t *outp = (mig_reply_header_t *) outheadp;
       static const mach_msg_type_t RetCodeType = {
 		/* msgt_name = */		MACH_MSG_TYPE_INTEGER_32,
 		/* msgt_size = */		32,
@@ -132,30 +233,6 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 		/* msgt_unused = */		0
 	};
 
-      if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
-	/* No thread would be listening for requests, spawn one. */
-	{
-	  pthread_t pthread_id;
-	  error_t err;
-
-	  __atomic_add_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	  __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
-
-	  err = pthread_create (&pthread_id, &attr, thread_function, NULL);
-	  if (!err)
-	    pthread_detach (pthread_id);
-	  else
-	    {
-	      __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	      __atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
-	      /* There is not much we can do at this point.  The code
-		 and design of the Hurd servers just don't handle
-		 thread creation failure.  */
-	      errno = err;
-	      perror ("pthread_create");
-	    }
-	}
-      
       /* Fill in default response. */
       outp->Head.msgh_bits 
 	= MACH_MSGH_BITS(MACH_MSGH_BITS_REMOTE(inp->msgh_bits), 0);
@@ -166,27 +243,15 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
       outp->Head.msgh_id = inp->msgh_id + 100;
       outp->RetCodeType = RetCodeType;
       outp->RetCode = MIG_BAD_ID;
+    }
 
-      if (MACH_MSGH_BITS_LOCAL (inp->msgh_bits) ==
-	  MACH_MSG_TYPE_PROTECTED_PAYLOAD)
-	pi = ports_lookup_payload (bucket, inp->msgh_protected_payload, NULL);
-      else
-	{
-	  pi = ports_lookup_port (bucket, inp->msgh_local_port, 0);
-	  if (pi)
-	    {
-	      /* Store the objects address as the payload and set the
-		 message type accordingly.  This prevents us from
-		 having to do another hash table lookup in the intran
-		 functions if protected payloads are not supported by
-		 the kernel.  */
-	      inp->msgh_bits =
-		MACH_MSGH_BITS_OTHER (inp->msgh_bits)
-		| MACH_MSGH_BITS (MACH_MSGH_BITS_REMOTE (inp->msgh_bits),
-				  MACH_MSG_TYPE_PROTECTED_PAYLOAD);
-	      inp->msgh_protected_payload = (unsigned long) pi;
-	    }
-	}
+  /* Serve INP on PI, consuming the reference to PI.  */
+  int
+  serve_request (mach_msg_header_t *inp, mig_reply_header_t *outp,
+		 struct port_info *pi)
+    {
+      int status;
+      struct rpc_info link;
 
       if (pi)
 	{
@@ -204,7 +269,7 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	      if (inp->msgh_seqno < cancel_threshold)
 		hurd_thread_cancel (link.thread);
 
-	      status = demuxer (inp, outheadp);
+	      status = demuxer (inp, &outp->Head);
 	      ports_end_rpc (pi, &link);
 	    }
 	  ports_port_deref (pi);
@@ -215,6 +280,173 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	  status = 1;
 	}
 
+      return status;
+    }
+
+  /* Send the reply OUTP to INP, or destroy them, as mach_msg_server
+     does after the demuxer returns.  */
+  void
+  send_reply (mach_msg_header_t *inp, mig_reply_header_t *outp)
+    {
+      error_t err;
+
+      switch (outp->RetCode)
+	{
+	case KERN_SUCCESS:
+	  break;
+	case MIG_NO_REPLY:
+	  outp->Head.msgh_remote_port = MACH_PORT_NULL;
+	  break;
+	default:
+	  /* Release what INP carries, but keep its reply port for the
+	     error.  */
+	  inp->msgh_remote_port = MACH_PORT_NULL;
+	  mach_msg_destroy (inp);
+	  break;
+	}
+
+      if (outp->Head.msgh_remote_port == MACH_PORT_NULL)
+	{
+	  if (outp->Head.msgh_bits & MACH_MSGH_BITS_COMPLEX)
+	    mach_msg_destroy (&outp->Head);
+	  return;
+	}
+
+      err = mach_msg (&outp->Head, MACH_SEND_MSG, outp->Head.msgh_size, 0,
+		      MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+      if (err == MACH_SEND_INVALID_DEST)
+	mach_msg_destroy (&outp->Head);
+    }
+
+  /* Serve the requests held while this thread served INP, whose reply
+     is OUTP, and then give up its slot.  */
+  void
+  serve_held (mach_msg_header_t *inp, mig_reply_header_t *outp)
+    {
+      struct held_request *h;
+      mig_reply_header_t *reply = NULL;
+
+      pthread_mutex_lock (&slot_lock);
+      while ((h = held) != NULL)
+	{
+	  held = h->next;
+	  if (! held)
+	    held_tail = &held;
+	  pthread_mutex_unlock (&slot_lock);
+
+	  if (! reply)
+	    {
+	      /* Don't keep the client of INP waiting until the held
+		 requests are done: reply now, and leave nothing for
+		 mach_msg_server to send or destroy.  */
+	      send_reply (inp, outp);
+	      outp->Head.msgh_bits &= ~MACH_MSGH_BITS_COMPLEX;
+	      outp->Head.msgh_remote_port = MACH_PORT_NULL;
+	      outp->RetCode = MIG_NO_REPLY;
+
+	      /* The size mach_msg_server uses by default.  */
+	      reply = alloca (2 * vm_page_size);
+	    }
+
+	  fill_reply (&h->msg, reply);
+	  serve_request (&h->msg, reply, h->pi);
+	  send_reply (&h->msg, reply);
+	  free (h);
+
+	  pthread_mutex_lock (&slot_lock);
+	}
+      nbusythreads--;
+      pthread_mutex_unlock (&slot_lock);
+    }
+
+  int
+  internal_demuxer (mach_msg_header_t *inp,
+		    mach_msg_header_t *outheadp)
+    {
+      int status;
+      struct port_info *pi;
+      int last_receiver;
+      int bounded = 0;
+      register mig_reply_header_t *outp = (mig_reply_header_t *) outheadp;
+
+      last_receiver =
+	__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0;
+
+      fill_reply (inp, outp);
+
+      if (MACH_MSGH_BITS_LOCAL (inp->msgh_bits) ==
+	  MACH_MSG_TYPE_PROTECTED_PAYLOAD)
+	pi = ports_lookup_payload (bucket, inp->msgh_protected_payload, NULL);
+      else
+	{
+	  pi = ports_lookup_port (bucket, inp->msgh_local_port, 0);
+	  if (pi)
+	    {
+	      /* Store the objects address as the payload and set the
+		 message type accordingly.  This prevents us from
+		 having to do another hash table lookup in the intran
+		 functions if protected payloads are not supported by
+		 the kernel.  */
+	      inp->msgh_bits =
+		MACH_MSGH_BITS_OTHER (inp->msgh_bits)
+		| MACH_MSGH_BITS (MACH_MSGH_BITS_REMOTE (inp->msgh_bits),
+				  MACH_MSG_TYPE_PROTECTED_PAYLOAD);
+	      inp->msgh_protected_payload = (unsigned long) pi;
+	    }
+	}
+
+      if (pi && __atomic_load_n (&ports_max_threads, __ATOMIC_RELAXED)
+	  && ! unblocking_rpc (pi, inp->msgh_id))
+	/* Take one of the ports_max_threads slots for ordinary requests,
+	   or hold on to the request until a thread gives up its slot.  */
+	{
+	  unsigned int max;
+
+	  pthread_mutex_lock (&slot_lock);
+	  max = __atomic_load_n (&ports_max_threads, __ATOMIC_RELAXED);
+	  if (max && nbusythreads >= max)
+	    {
+	      struct held_request *h;
+
+	      h = malloc (offsetof (struct held_request, msg)
+			  + inp->msgh_size);
+	      if (h)
+		{
+		  h->next = NULL;
+		  h->pi = pi;
+		  memcpy (&h->msg, inp, inp->msgh_size);
+		  *held_tail = h;
+		  held_tail = &h->next;
+		  outp->RetCode = MIG_NO_REPLY;
+		}
+	      else
+		{
+		  ports_port_deref (pi);
+		  outp->RetCode = ENOMEM;
+		}
+	      pthread_mutex_unlock (&slot_lock);
+	      __atomic_add_fetch (&stats.saturated, 1, __ATOMIC_RELAXED);
+
+	      /* This thread goes right back to receiving messages.  */
+	      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+	      return 1;
+	    }
+	  nbusythreads++;
+	  pthread_mutex_unlock (&slot_lock);
+	  bounded = 1;
+	}
+
+      if (last_receiver)
+	/* No thread would be listening for requests, spawn one.  This
+	   only adds threads beyond ports_max_threads for the unblocking
+	   RPCs, which don't last.  */
+	spawn_thread ();
+
+      status = serve_request (inp, outp, pi);
+
+      if (bounded)
+	serve_held (inp, outp);
+
       __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
 
       return status;
@@ -244,7 +476,12 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
       if (master)
 	timeout = global_timeout;
       else
-	timeout = thread_timeout;
+	{
+	  timeout = thread_timeout;
+	  if (timeout == 0
+	      && __atomic_load_n (&ports_max_threads, __ATOMIC_RELAXED))
+	    timeout = PORTS_BOUNDED_THREAD_TIMEOUT;
+	}
 
       _ports_thread_online (&bucket->threadpool, &thread);
 
@@ -271,7 +508,9 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	      goto startover;
 	    }
 	  __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  __atomic_add_fetch (&stats.reaped, 1, __ATOMIC_RELAXED);
 	}
+      __atomic_sub_fetch (&stats.threads, 1, __ATOMIC_RELAXED);
       _ports_thread_offline (&bucket->threadpool, &thread);
       return NULL;
     }
@@ -282,5 +521,6 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
      master thread from going away.  */
   global_timeout = 0;
 
+  stats_thread_added ();
   thread_function ((void *) 1);
 }
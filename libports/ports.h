@@ -1,5 +1,5 @@
 /* Ports library for server construction
-   Copyright (C) 1993,94,95,96,97,99,2000 Free Software Foundation, Inc.
+   Copyright (C) 1993,94,95,96,97,99,2000,2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell.
 
    This file is part of the GNU Hurd.
@@ -335,8 +335,9 @@ error_t ports_bucket_iterate (struct port_bucket *bucket,
 error_t ports_class_iterate (struct port_class *class,
 			     error_t (*fun)(void *port));
 
-/* Internal entrypoint for above two.  */
-error_t _ports_bucket_class_iterate (struct hurd_ihash *ht,
+/* Internal entrypoint for above two.  If BUCKET is null, iterate over
+   all ports.  */
+error_t _ports_bucket_class_iterate (struct port_bucket *bucket,
 				     struct port_class *class,
 				     error_t (*fun)(void *port));
 
@@ -373,13 +374,51 @@ void ports_manage_port_operations_one_thread(struct port_bucket *bucket,
    LOCAL_TIMEOUT is non-zero, then individual threads will die off if
    they handle no incoming messages for LOCAL_TIMEOUT milliseconds.
    HOOK (if not null) will be called in each new thread immediately
-   after it is created. */
+   after it is created.  See ports_max_threads for a way to bound the
+   number of threads. */
 void ports_manage_port_operations_multithread (struct port_bucket *bucket,
 					       ports_demuxer_type demuxer,
 					       int thread_timeout,
 					       int global_timeout,
 					       void (*hook)(void));
 
+/* If nonzero, ports_manage_port_operations_multithread never serves more
+   than this many requests at once for a bucket.  Requests that arrive
+   while all of them are busy are held in memory, and served in order as
+   the others are done; the thread that received them goes back to
+   waiting for messages.  Idle threads die off after
+   PORTS_BOUNDED_THREAD_TIMEOUT milliseconds if LOCAL_TIMEOUT is zero.
+   The default, zero, means no limit.  This may be changed at any time.
+
+   The RPCs in the uninhibitable_rpcs of a port's class, such as
+   interrupt_operation, don't count and are served at once.  Beware that
+   a server still deadlocks if all the requests it serves wait for some
+   other request to it, say readers of a pipe waiting for a writer, or a
+   server waiting for its own pager: set the limit well above the number
+   of such requests that may pile up, if at all.  */
+extern unsigned int ports_max_threads;
+
+#define PORTS_BOUNDED_THREAD_TIMEOUT (1000 * 30)
+
+/* Return a value for ports_max_threads suitable for the number of
+   processors of this machine.  */
+unsigned int ports_auto_max_threads (void);
+
+/* Statistics about the threads of ports_manage_port_operations_multithread,
+   see ports_thread_stats.  */
+struct ports_thread_stats
+{
+  unsigned int threads;		/* Threads there are now.  */
+  unsigned int peak;		/* Most threads there ever were.  */
+  unsigned long created;	/* Threads created.  */
+  unsigned long reaped;		/* Threads that died off being idle.  */
+  unsigned long saturated;	/* Requests held because of
+				   ports_max_threads.  */
+};
+
+/* Fill in STATS, summing over all buckets.  */
+void ports_thread_stats (struct ports_thread_stats *stats);
+
 /* Interrupt any pending RPC on PORT.  Wait for all pending RPC's to
    finish, and then block any new RPC's starting on that port. */
 error_t ports_inhibit_port_rpcs (void *port);
@@ -463,19 +502,76 @@ extern pthread_mutex_t _ports_lock;
 extern pthread_cond_t _ports_block;
 
 /* A global hash table mapping port names to port_info objects.  This
-   table is used for port lookups and to iterate over classes.
+   table is used for port lookups and to iterate over classes.  It is
+   split into _PORTS_HTABLE_SHARDS shards by port name, each with its
+   own lock, so that lookups of different ports do not contend for a
+   single lock.
 
    A port in this hash table carries an implicit light reference.
    When the reference counts reach zero, we call
    _ports_complete_deallocate.  There we reacquire our lock
    momentarily to check whether someone else reacquired a reference
    through the hash table.  */
-extern struct hurd_ihash _ports_htable;
-/* Access to all hash tables is protected by this lock.  */
+struct _ports_htable_shard
+{
+  pthread_rwlock_t lock;
+  struct hurd_ihash htable;
+} __attribute__ ((aligned (64)));
+
+#define _PORTS_HTABLE_SHARD_BITS	4
+#define _PORTS_HTABLE_SHARDS		(1 << _PORTS_HTABLE_SHARD_BITS)
+extern struct _ports_htable_shard _ports_htable[_PORTS_HTABLE_SHARDS];
+
+/* Return the shard of _PORTS_HTABLE that PORT belongs in.  */
+static inline struct _ports_htable_shard *
+_ports_htable_shard (mach_port_t port)
+{
+  return &_ports_htable[((unsigned int) port * 0x9e3779b1U)
+			>> (32 - _PORTS_HTABLE_SHARD_BITS)];
+}
+
+/* Access to the per-bucket hash tables is protected by this lock.  If
+   a shard lock is needed as well, this one must be taken first.  */
 extern pthread_rwlock_t _ports_htable_lock;
 
+/* Add PI to _PORTS_HTABLE and to the hash table of its bucket, under
+   the name PORT.  */
+error_t _ports_htable_add (struct port_info *pi, mach_port_t port);
+
+/* Remove PI, whose name is PORT, from _PORTS_HTABLE and from the hash
+   table of its bucket.  */
+void _ports_htable_remove (struct port_info *pi, mach_port_t port);
+
+/* The number of RPCs in progress; and likewise in the RPCS members of
+   buckets and classes.  These are updated with atomic operations, and
+   only read under _ports_lock.  */
 extern int _ports_total_rpcs;
 extern int _ports_flags;
+
+/* The number of inhibitions of RPCs, on any port, bucket, class or on
+   all ports, either in effect or waiting for RPCs to finish.  While it
+   is zero, RPCs can begin and end without taking _ports_lock.
+   Changed only under _ports_lock.  */
+extern int _ports_inhibitors;
+
+/* The CURRENT_RPCS list of a port is protected by one of these locks,
+   chosen by the address of the port.  _ports_lock and the hash table
+   locks may be held when taking one of them.  */
+#define _PORTS_RPC_LOCKS	32
+extern pthread_mutex_t _ports_rpc_locks[_PORTS_RPC_LOCKS];
+
+static inline pthread_mutex_t *
+_ports_rpc_lock (struct port_info *pi)
+{
+  return &_ports_rpc_locks[((unsigned long) pi >> 6) % _PORTS_RPC_LOCKS];
+}
+
+/* Record that the RPC described by INFO is in progress on PI.  */
+void _ports_add_rpc (struct port_info *pi, struct rpc_info *info);
+
+/* Record that the RPC described by INFO on PI has finished.  */
+void _ports_remove_rpc (struct port_info *pi, struct rpc_info *info);
+
 #define _PORTS_INHIBITED	PORTS_INHIBITED
 #define _PORTS_BLOCKED		PORTS_BLOCKED
 #define _PORTS_INHIBIT_WAIT	PORTS_INHIBIT_WAIT
@@ -27,6 +27,7 @@ ports_resume_all_rpcs ()
   pthread_mutex_lock (&_ports_lock);
   assert (_ports_flags & _PORTS_INHIBITED);
   _ports_flags &= ~_PORTS_INHIBITED;
+  __atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
   if (_ports_flags & _PORTS_BLOCKED)
     {
       _ports_flags &= ~_PORTS_BLOCKED;
@@ -27,6 +27,7 @@ ports_resume_bucket_rpcs (struct port_bucket *bucket)
   pthread_mutex_lock (&_ports_lock);
   assert (bucket->flags & PORT_BUCKET_INHIBITED);
   bucket->flags &= ~PORT_BUCKET_INHIBITED;
+  __atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
   if (bucket->flags & PORT_BUCKET_BLOCKED)
     {
       bucket->flags &= ~PORT_BUCKET_BLOCKED;
@@ -27,6 +27,7 @@ ports_resume_class_rpcs (struct port_class *class)
   pthread_mutex_lock (&_ports_lock);
   assert (class->flags & PORT_CLASS_INHIBITED);
   class->flags &= ~PORT_CLASS_INHIBITED;
+  __atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
   if (class->flags & PORT_CLASS_BLOCKED)
     {
       class->flags &= ~PORT_CLASS_BLOCKED;
@@ -30,6 +30,7 @@ ports_resume_port_rpcs (void *portstruct)
   
   assert (pi->flags & PORT_INHIBITED);
   pi->flags &= ~PORT_INHIBITED;
+  __atomic_sub_fetch (&_ports_inhibitors, 1, __ATOMIC_SEQ_CST);
   if (pi->flags & PORT_BLOCKED)
     {
       pi->flags &= ~PORT_BLOCKED;
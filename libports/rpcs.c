@@ -0,0 +1,64 @@
+/* Keeping track of the RPCs in progress
+
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "ports.h"
+
+/* The counters are changed with sequentially consistent operations.
+   Someone inhibiting RPCs first increments _ports_inhibitors and then
+   looks at the counters and lists, while ports_begin_rpc and
+   ports_end_rpc first change them and then look at _ports_inhibitors.
+   This way, either the inhibitor sees the RPC, or the RPC sees the
+   inhibitor and takes _ports_lock.  */
+
+/* Record that the RPC described by INFO is in progress on PI.  */
+void
+_ports_add_rpc (struct port_info *pi, struct rpc_info *info)
+{
+  pthread_mutex_t *lock = _ports_rpc_lock (pi);
+
+  pthread_mutex_lock (lock);
+  info->next = pi->current_rpcs;
+  if (pi->current_rpcs)
+    pi->current_rpcs->prevp = &info->next;
+  info->prevp = &pi->current_rpcs;
+  pi->current_rpcs = info;
+  pthread_mutex_unlock (lock);
+
+  __atomic_add_fetch (&pi->class->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&pi->bucket->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&_ports_total_rpcs, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Record that the RPC described by INFO on PI has finished.  */
+void
+_ports_remove_rpc (struct port_info *pi, struct rpc_info *info)
+{
+  pthread_mutex_t *lock = _ports_rpc_lock (pi);
+
+  pthread_mutex_lock (lock);
+  *info->prevp = info->next;
+  if (info->next)
+    info->next->prevp = info->prevp;
+  pthread_mutex_unlock (lock);
+
+  __atomic_sub_fetch (&pi->class->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&pi->bucket->rpcs, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&_ports_total_rpcs, 1, __ATOMIC_SEQ_CST);
+}
@@ -41,10 +41,7 @@ ports_transfer_right (void *tostruct,
   port = frompi->port_right;
   if (port != MACH_PORT_NULL)
     {
-      pthread_rwlock_wrlock (&_ports_htable_lock);
-      hurd_ihash_locp_remove (&_ports_htable, frompi->ports_htable_entry);
-      hurd_ihash_locp_remove (&frompi->bucket->htable, frompi->hentry);
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_remove (frompi, port);
       frompi->port_right = MACH_PORT_NULL;
       if (frompi->flags & PORT_HAS_SENDRIGHTS)
 	{
@@ -57,10 +54,7 @@ ports_transfer_right (void *tostruct,
   /* Destroy the existing right in TOPI. */
   if (topi->port_right != MACH_PORT_NULL)
     {
-      pthread_rwlock_wrlock (&_ports_htable_lock);
-      hurd_ihash_locp_remove (&_ports_htable, topi->ports_htable_entry);
-      hurd_ihash_locp_remove (&topi->bucket->htable, topi->hentry);
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_remove (topi, topi->port_right);
       err = mach_port_mod_refs (mach_task_self (), topi->port_right,
 				MACH_PORT_RIGHT_RECEIVE, -1);
       assert_perror (err);
@@ -85,11 +79,7 @@ ports_transfer_right (void *tostruct,
 
   if (port)
     {
-      pthread_rwlock_wrlock (&_ports_htable_lock);
-      err = hurd_ihash_add (&_ports_htable, port, topi);
-      assert_perror (err);
-      err = hurd_ihash_add (&topi->bucket->htable, port, topi);
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      err = _ports_htable_add (topi, port);
       assert_perror (err);
       /* This is an optimization.  It may fail.  */
       mach_port_set_protected_payload (mach_task_self (), port,
@@ -1,5 +1,5 @@
 /* cache.c - Node cache management for NFS client implementation.
-   Copyright (C) 1995, 1996, 1997, 2002 Free Software Foundation, Inc.
+   Copyright (C) 1995, 1996, 1997, 2002, 2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -82,6 +82,10 @@ lookup_fhandle (struct fhandle *handle, struct node **npp)
   memcpy (nn->handle.data, handle->data, handle->size);
   nn->stat_updated = 0;
   nn->dtrans = NOT_POSSIBLE;
+  nn->fileinfo = 0;
+  nn->data_mtime.tv_sec = 0;
+  nn->data_mtime.tv_nsec = 0;
+  nn->data_writing = 0;
   nn->dead_dir = 0;
   nn->dead_name = 0;
   
@@ -157,15 +161,40 @@ netfs_node_norefs (struct node *np)
     }
 }
 
+/* Remove NP from the node cache, unless that has been done already.  */
+static void
+uncache_node (struct node *np)
+{
+  pthread_mutex_lock (&nodehash_ihash_lock);
+  if (np->nn->slot)
+    {
+      hurd_ihash_locp_remove (&nodehash, np->nn->slot);
+      np->nn->slot = 0;
+      netfs_nrele_light (np);
+    }
+  pthread_mutex_unlock (&nodehash_ihash_lock);
+}
+
 /* When dropping soft refs, we simply remove the node from the
-   node cache.  */
+   node cache.  A node whose contents are cached by a pager stays,
+   so that the cached data is used again when the file is looked up
+   again; release_cached_node drops it once the pager has gone.  */
 void
 netfs_try_dropping_softrefs (struct node *np)
 {
-  pthread_mutex_lock (&nodehash_ihash_lock);
-  hurd_ihash_locp_remove (&nodehash, np->nn->slot);
-  netfs_nrele_light (np);
-  pthread_mutex_unlock (&nodehash_ihash_lock);
+  if (! np->nn->fileinfo)
+    uncache_node (np);
+}
+
+/* A pager of NP has gone away.  If NP has no hard references and no
+   other pager left, remove it from the node cache now.  NP need not be
+   locked.  */
+void
+release_cached_node (struct node *np)
+{
+  if (refcounts_hard_references (&np->refcounts) == 0
+      && ! np->nn->fileinfo)
+    uncache_node (np);
 }
 
 /* Change the file handle used for node NP to be the handle at P.
@@ -186,7 +215,12 @@ recache_handle (int *p, struct node *np)
   
   /* Unlink it */
   pthread_mutex_lock (&nodehash_ihash_lock);
-  hurd_ihash_locp_remove (&nodehash, np->nn->slot);
+  if (np->nn->slot)
+    hurd_ihash_locp_remove (&nodehash, np->nn->slot);
+  else
+    /* It was dropped from the cache; the cache gets its light
+       reference back.  */
+    netfs_nref_light (np);
 
   /* Change the name */
   np->nn->handle.size = len;
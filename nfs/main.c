@@ -1,5 +1,5 @@
 /* 
-   Copyright (C) 1996, 1997, 2002 Free Software Foundation, Inc.
+   Copyright (C) 1996, 1997, 2002, 2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -46,11 +46,16 @@ extern char *localhost ();
 /* Default number of seconds to timeout cached file contents. */
 #define DEFAULT_CACHE_TIMEOUT 3
 
-/* Default number of seconds to timeout cache positive dir hits. */
-#define DEFAULT_NAME_CACHE_TIMEOUT 3
+/* Default number of seconds to timeout cache positive dir hits.  Hits
+   are also checked against the modification time of the directory, so
+   this can be longer than the stat timeout.  */
+#define DEFAULT_NAME_CACHE_TIMEOUT 60
 
 /* Default number of seconds to timeout cache negative dir hits. */
-#define DEFAULT_NAME_CACHE_NEG_TIMEOUT 3
+#define DEFAULT_NAME_CACHE_NEG_TIMEOUT 60
+
+/* Default maximum number of dir cache entries. */
+#define DEFAULT_NAME_CACHE_SIZE 4096
 
 /* Default maximum number of bytes to read at once. */
 #define DEFAULT_READ_SIZE     8192
@@ -58,6 +63,13 @@ extern char *localhost ();
 /* Default maximum number of bytes to write at once. */
 #define DEFAULT_WRITE_SIZE    8192
 
+/* Default maximum number of READ or WRITE RPCs in flight at once. */
+#define DEFAULT_RPC_WINDOW    4
+
+/* Largest value allowed for --rpc-window, as the window of each read or
+   write lives on its thread's stack.  */
+#define MAX_RPC_WINDOW        64
+
 
 /* Number of seconds to timeout cached stat information. */
 int stat_timeout = DEFAULT_STAT_TIMEOUT;
@@ -71,6 +83,9 @@ int name_cache_timeout = DEFAULT_NAME_CACHE_TIMEOUT;
 /* Number of seconds to timeout cached negative dir hits. */
 int name_cache_neg_timeout = DEFAULT_NAME_CACHE_NEG_TIMEOUT;
 
+/* Maximum number of dir cache entries. */
+size_t name_cache_size = DEFAULT_NAME_CACHE_SIZE;
+
 /* Number of seconds to wait for first retransmission of an RPC. */
 int initial_transmit_timeout = 1;
 
@@ -88,6 +103,12 @@ int read_size = DEFAULT_READ_SIZE;
 
 /* Maximum number of bytes to write at once. */
 int write_size = DEFAULT_WRITE_SIZE;
+
+/* Maximum number of READ or WRITE RPCs in flight at once. */
+int rpc_window = DEFAULT_RPC_WINDOW;
+
+/* True iff we talk to the NFS server over TCP. */
+int use_tcp = 0;
 
 #define OPT_SOFT	's'
 #define OPT_HARD	'h'
@@ -107,6 +128,10 @@ int write_size = DEFAULT_WRITE_SIZE;
 #define OPT_PMAP_PORT	-13
 #define OPT_NCACHE_TO	-14
 #define OPT_NCACHE_NEG_TO -15
+#define OPT_RPC_WINDOW	-16
+#define OPT_TCP		-17
+#define OPT_UDP		-18
+#define OPT_NCACHE_SIZE	-19
 
 /* Return a string corresponding to the printed rep of DEFAULT_what */
 #define ___D(what) #what
@@ -132,6 +157,10 @@ static const struct argp_option common_options[] =
   {"write-size",	    OPT_WSIZE,	   "BYTES", 0,
      "Max packet size for writes (default " _D(WRITE_SIZE)")"},
   {"wsize",0,0,OPTION_ALIAS},
+  {"rpc-window",	    OPT_RPC_WINDOW, "NUM", 0,
+     "Max number of read or write packets in flight at once for one"
+     " read or write (default " _D(RPC_WINDOW) ", at most "
+     __D(MAX_RPC_WINDOW) ")"},
 
   {0,0,0,0,"Timeouts:",3},
   {"stat-timeout",	    OPT_STAT_TO,   "SEC", 0,
@@ -144,6 +173,9 @@ static const struct argp_option common_options[] =
   {"name-cache-neg-timeout", OPT_NCACHE_NEG_TO, "SEC", 0,
      "Timeout for negative directory cache entires (default "
       _D(NAME_CACHE_NEG_TIMEOUT) ")"},
+  {"name-cache-size",	    OPT_NCACHE_SIZE, "ENTRIES", 0,
+     "Maximum number of directory cache entries (default "
+     _D(NAME_CACHE_SIZE) ")"},
   {"init-transmit-timeout", OPT_INIT_TR_TO,"SEC", 0}, 
   {"max-transmit-timeout",  OPT_MAX_TR_TO, "SEC", 0}, 
 
@@ -166,6 +198,13 @@ parse_common_opt (int key, char *arg, struct argp_state *state)
 
     case OPT_RSIZE: read_size = atoi (arg); break;
     case OPT_WSIZE: write_size = atoi (arg); break;
+    case OPT_RPC_WINDOW:
+      rpc_window = atoi (arg);
+      if (rpc_window < 1)
+	rpc_window = 1;
+      if (rpc_window > MAX_RPC_WINDOW)
+	rpc_window = MAX_RPC_WINDOW;
+      break;
 
     case OPT_STAT_TO: stat_timeout = atoi (arg); break;
     case OPT_CACHE_TO: cache_timeout = atoi (arg); break;
@@ -173,6 +212,7 @@ parse_common_opt (int key, char *arg, struct argp_state *state)
     case OPT_MAX_TR_TO: max_transmit_timeout = atoi (arg); break;
     case OPT_NCACHE_TO: name_cache_timeout = atoi (arg); break;
     case OPT_NCACHE_NEG_TO: name_cache_neg_timeout = atoi (arg); break;
+    case OPT_NCACHE_SIZE: set_name_cache_size (atoi (arg)); break;
 
     default:
       return ARGP_ERR_UNKNOWN;
@@ -197,6 +237,11 @@ static const struct argp_option startup_options[] = {
 
   {"pmap-port",             OPT_PMAP_PORT,  "SVC|PORT"},
 
+  {"tcp",		    OPT_TCP, 0, 0,
+     "Talk to the nfs server over TCP"},
+  {"udp",		    OPT_UDP, 0, 0,
+     "Talk to the nfs server over UDP (the default)"},
+
   {"hold", OPT_HOLD, 0, OPTION_HIDDEN}, /*  */
   { 0 }
 };
@@ -243,6 +288,7 @@ netfs_append_args (char **argz, size_t *argz_len)
 
   FOPT ("--read-size=%d", read_size);
   FOPT ("--write-size=%d", write_size);
+  FOPT ("--rpc-window=%d", rpc_window);
 
   FOPT ("--stat-timeout=%d", stat_timeout);
   FOPT ("--cache-timeout=%d", cache_timeout);
@@ -250,6 +296,7 @@ netfs_append_args (char **argz, size_t *argz_len)
   FOPT ("--max-transmit-timeout=%d", max_transmit_timeout);
   FOPT ("--name-cache-timeout=%d", name_cache_timeout);
   FOPT ("--name-cache-neg-timeout=%d", name_cache_neg_timeout);
+  FOPT ("--name-cache-size=%zu", name_cache_size);
 
   if (! err)
     err = netfs_append_std_options (argz, argz_len);
@@ -337,6 +384,13 @@ parse_startup_opt (int key, char *arg, struct argp_state *state)
       nfs_port = atoi (arg);
       break;
 
+    case OPT_TCP:
+      use_tcp = 1;
+      break;
+    case OPT_UDP:
+      use_tcp = 0;
+      break;
+
     case ARGP_KEY_ARG:
       if (state->arg_num == 0)
 	remote_fs = arg;
@@ -381,6 +435,7 @@ main (int argc, char **argv)
     
   task_get_bootstrap_port (mach_task_self (), &bootstrap);
   netfs_init ();
+  create_pager_bucket ();
   
   main_udp_socket = socket (PF_INET, SOCK_DGRAM, 0);
   addr.sin_family = AF_INET;
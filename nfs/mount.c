@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 1995,96,97,98,2001,02 Free Software Foundation, Inc.
+   Copyright (C) 1995,96,97,98,2001,02,2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -239,7 +239,7 @@ mount_root (char *name, char *host)
 	}
       *(p++) = htonl (NFS_PROGRAM);
       *(p++) = htonl (NFS_VERSION);
-      *(p++) = htonl (IPPROTO_UDP);
+      *(p++) = htonl (use_tcp ? IPPROTO_TCP : IPPROTO_UDP);
       *(p++) = htonl (0);
       err = conduct_rpc (&rpcbuf, &p);
       if (!err)
@@ -258,8 +258,17 @@ mount_root (char *name, char *host)
     }
 
   addr.sin_port = htons (port);
-  if (connect (main_udp_socket, (struct sockaddr *) &addr,
-	       sizeof (struct sockaddr_in)) == -1)
+  if (use_tcp)
+    {
+      err = rpc_use_tcp (&addr);
+      if (err)
+	{
+	  error (0, err, "connect");
+	  return 0;
+	}
+    }
+  else if (connect (main_udp_socket, (struct sockaddr *) &addr,
+		    sizeof (struct sockaddr_in)) == -1)
     {
       error (0, errno, "connect");
       return 0;
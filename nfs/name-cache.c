@@ -1,6 +1,6 @@
 /* Directory name lookup caching
 
-   Copyright (C) 1996, 1997 Free Software Foundation, Inc.
+   Copyright (C) 1996, 1997, 2026 Free Software Foundation, Inc.
    Written by Thomas Bushnell, n/BSG, & Miles Bader.
 
    This file is part of the GNU Hurd.
@@ -20,224 +20,336 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
 #include "nfs.h"
+#include <assert.h>
+#include <hurd/ihash.h>
 #include <string.h>
-#include <cacheq.h>
 
-
-/* Maximum number of names to cache at any given time */
-#define MAXCACHE 200
-
-/* Maximum length of file name we bother caching */
-#define CACHE_NAME_LEN 100
-
-/* Cache entry */
-struct lookup_cache
+/* The name cache is implemented using hash tables of the directory
+   fhandle and the name.  To keep lookups in different directories, or
+   of different names, from contending for a single lock, the cache is
+   split into NAME_SHARDS shards, each with its own lock and hash table,
+   as in libdiskfs.  A shard's hash table grows with the number of
+   entries in it.
+
+   Each shard holds at most its share of name_cache_size entries.  To
+   make room for a new entry, one that has not been used recently is
+   dropped, as chosen by the clock algorithm.
+
+   An entry records the modification time its directory had when it was
+   made, and it is only used while the directory still has that time;
+   any change to the directory, by us or by another client, thus
+   invalidates all of its entries, positive and negative, as soon as we
+   get fresh attributes of the directory.  Entries also expire after
+   name_cache_timeout or name_cache_neg_timeout seconds.  */
+
+/* Number of shards.  The shard is chosen by the top bits of the hash,
+   the hash tables use the bottom ones.  */
+#define NAME_SHARD_BITS	4
+#define NAME_SHARDS	(1 << NAME_SHARD_BITS)
+
+/* Initial number of buckets of a shard's hash table.  Must be a power
+   of two.  */
+#define MIN_BUCKETS	64
+
+struct name_entry
 {
-  struct cacheq_hdr hdr;
+  /* Next entry in the same hash bucket.  */
+  struct name_entry *next;
 
-  /* File handles and lengths for cache entries.  0 for NODE_CACHE_LEN
-     means a  */
-  char dir_cache_fh[NFS3_FHSIZE];
-  size_t dir_cache_len;
+  /* Neighbours on the clock.  */
+  struct name_entry *clock_next, *clock_prev;
 
-  /* Zero means a `negative' entry -- recording that there's
-     definitely no node with this name.  */
-  struct node *np;
+  unsigned long key;
 
-  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  Entries
-     with names too long to fit in this buffer aren't cached at all.  */
-  char name[CACHE_NAME_LEN];
+  /* The node NAME names in the directory with the DIR_LEN bytes of
+     fhandle DIR_FH, with a reference.  Zero means a `negative' entry --
+     recording that there's definitely no node with this name.  */
+  struct node *np;
+  char dir_fh[NFS3_FHSIZE];
+  size_t dir_len;
 
-  /* Strlen of NAME.  If this is zero, it's an unused entry. */
-  size_t name_len;
+  /* The modification time of the directory this entry was made in.  */
+  struct timespec dir_mtime;
 
-  /* Time that this cache entry was created.  */
+  /* Time that this entry was made.  */
   time_t cache_stamp;
 
-  /* XXX */
-  int stati;
+  /* Set when the entry is used, cleared when the clock passes it.  */
+  int referenced;
+
+  char name[0];
 };
 
-/* The contents of the cache in no particular order */
-static struct cacheq lookup_cache = { sizeof (struct lookup_cache) };
+struct name_shard
+{
+  pthread_rwlock_t lock;
+
+  /* The hash table.  NBUCKETS is zero or a power of two.  */
+  struct name_entry **buckets;
+  size_t nbuckets;
+  size_t count;
+
+  /* The next entry the clock considers for replacement.  New entries
+     go right behind it.  */
+  struct name_entry *hand;
 
-static pthread_spinlock_t cache_lock = PTHREAD_SPINLOCK_INITIALIZER;
+  unsigned long long hits, negative_hits, misses, evictions;
+} __attribute__ ((aligned (64)));	/* Keep shards off each other's
+					   cache lines.  */
 
-/* Buffer to hold statistics */
-static struct stats
+static struct name_shard name_cache[NAME_SHARDS] =
 {
-  long pos_hits;
-  long neg_hits;
-  long miss;
-  long fetch_errors;
-} statistics;
-
-#define PARTIAL_THRESH 100
-#define NPARTIALS (MAXCACHE / PARTIAL_THRESH)
-struct stats partial_stats [NPARTIALS];
-
-
-/* If there's an entry for NAME, of length NAME_LEN, in directory DIR in the
-   cache, return its entry, otherwise 0.  CACHE_LOCK must be held.  */
-static struct lookup_cache *
-find_cache (char *dir, size_t len, const char *name, size_t name_len)
+  [0 ... NAME_SHARDS - 1] = { .lock = PTHREAD_RWLOCK_INITIALIZER }
+};
+
+/* Hash the directory fhandle DIR of LEN bytes and the NAME_LEN bytes of
+   NAME.  */
+static inline unsigned long
+hash (const char *dir, size_t len, const char *name, size_t name_len)
 {
-  struct lookup_cache *c;
-  int i;
-
-  /* Search the list.  All unused entries are contiguous at the end of the
-     list, so we can stop searching when we see the first one.  */
-  for (i = 0, c = lookup_cache.mru; 
-       c && c->name_len; 
-       c = c->hdr.next, i++)
-    if (c->name_len == name_len
-	&& c->dir_cache_len == len
-	&& c->name[0] == name[0] 
-	&& memcmp (c->dir_cache_fh, dir, len) == 0
-	&& strcmp (c->name, name) == 0)
-      {
-	c->stati = i / PARTIAL_THRESH;
-	return c;
-      }
-  
-  return 0;
+  unsigned long h;
+  h = hurd_ihash_hash32 (dir, len, 0);
+  h = hurd_ihash_hash32 (name, name_len, h);
+  return h;
 }
-
-/* Node NP has just been found in DIR with NAME.  If NP is null, this
-   name has been confirmed as absent in the directory.  DIR is the
-   fhandle of the directory and LEN is its length.  */
-void
-enter_lookup_cache (char *dir, size_t len, struct node *np, char *name)
+
+static inline struct name_shard *
+shard_of (unsigned long key)
 {
-  struct lookup_cache *c;
-  size_t name_len = strlen (name);
-  
-  if (name_len > CACHE_NAME_LEN - 1)
-    return;
+  return &name_cache[(key >> (32 - NAME_SHARD_BITS)) & (NAME_SHARDS - 1)];
+}
 
-  pthread_spin_lock (&cache_lock);
-
-  if (lookup_cache.length == 0)
-    /* There should always be an lru_cache; this being zero means that the
-       cache hasn't been initialized yet.  Do so.  */
-    cacheq_set_length (&lookup_cache, MAXCACHE);
-
-  /* See if there's an old entry for NAME in DIR.  If not, replace the least
-     recently used entry.  */
-  c = find_cache (dir, len, name, name_len) ?: lookup_cache.lru;
-
-  /* Fill C with the new entry.  */
-  memcpy (c->dir_cache_fh, dir, len);
-  c->dir_cache_len = len;
-  if (c->np)
-    netfs_nrele (c->np);
-  c->np = np;
-  if (c->np)
-    netfs_nref (c->np);
-  strcpy (c->name, name);
-  c->name_len = name_len;
-  c->cache_stamp = mapped_time->seconds;
-
-  /* Now C becomes the MRU entry!  */
-  cacheq_make_mru (&lookup_cache, c);
-
-  pthread_spin_unlock (&cache_lock);
+/* The number of entries a single shard may hold.  */
+static inline size_t
+shard_limit (void)
+{
+  return (name_cache_size + NAME_SHARDS - 1) / NAME_SHARDS;
 }
-
-/* Purge all references in the cache to NAME within directory DIR. */
-void
-purge_lookup_cache (struct node *dp, char *name, size_t namelen)
+
+/* Find the entry for NAME, of length NAME_LEN and hashing to KEY with
+   DIR, in the directory with the LEN bytes of fhandle DIR, whether it
+   is still valid or not.  S->lock must be held.  */
+static struct name_entry *
+find_entry (struct name_shard *s, const char *dir, size_t len,
+	    const char *name, size_t name_len, unsigned long key)
 {
-  struct lookup_cache *c, *next;
-  
-  pthread_spin_lock (&cache_lock);
-  for (c = lookup_cache.mru; c; c = next)
+  struct name_entry *e;
+
+  if (s->nbuckets == 0)
+    return NULL;
+
+  for (e = s->buckets[key & (s->nbuckets - 1)]; e; e = e->next)
+    if (e->key == key
+	&& e->dir_len == len
+	&& memcmp (e->dir_fh, dir, len) == 0
+	&& memcmp (e->name, name, name_len) == 0
+	&& e->name[name_len] == '\0')
+      return e;
+
+  return NULL;
+}
+
+/* Return nonzero if entry E of directory DIR may still be used.  */
+static inline int
+entry_valid (struct name_entry *e, struct node *dir)
+{
+  int timeout = e->np ? name_cache_timeout : name_cache_neg_timeout;
+
+  return (mapped_time->seconds - e->cache_stamp < timeout
+	  && e->dir_mtime.tv_sec == dir->nn_stat.st_mtim.tv_sec
+	  && e->dir_mtime.tv_nsec == dir->nn_stat.st_mtim.tv_nsec);
+}
+
+/* Remove E from shard S, drop its reference and free it.  S->lock must
+   be held for writing.  */
+static void
+remove_entry (struct name_shard *s, struct name_entry *e)
+{
+  struct name_entry **p;
+
+  for (p = &s->buckets[e->key & (s->nbuckets - 1)]; *p != e; p = &(*p)->next)
+    assert (*p);
+  *p = e->next;
+
+  if (e->clock_next == e)
+    s->hand = NULL;
+  else
     {
-      /* Save C->hdr.next, since we may move C from this position. */
-      next = c->hdr.next;
-
-      if (c->name_len == namelen
-	  && c->dir_cache_len == dp->nn->handle.size
-	  && memcmp (c->dir_cache_fh, dp->nn->handle.data,
-	             c->dir_cache_len) == 0
-	  && strcmp (c->name, name) == 0)
-	{
-	  if (c->np)
-	    netfs_nrele (c->np);
-	  c->name_len = 0;
-	  c->np = 0;
-	  cacheq_make_lru (&lookup_cache, c); /* Use C as the next free
-						 entry. */
-	}
+      e->clock_prev->clock_next = e->clock_next;
+      e->clock_next->clock_prev = e->clock_prev;
+      if (s->hand == e)
+	s->hand = e->clock_next;
     }
-  pthread_spin_unlock (&cache_lock);
+
+  if (e->np)
+    netfs_nrele (e->np);
+  s->count--;
+  free (e);
 }
 
-/* Purge all references in the cache to node NP. */
-void
-purge_lookup_cache_node (struct node *np)
+/* Drop entries from shard S until it holds at most LIMIT of them.
+   S->lock must be held for writing.  */
+static void
+shrink_shard (struct name_shard *s, size_t limit)
 {
-  struct lookup_cache *c, *next;
-  
-  pthread_spin_lock (&cache_lock);
-  for (c = lookup_cache.mru; c; c = next)
+  while (s->count > limit)
     {
-      next = c->hdr.next;
-      
-      if (c->np == np)
+      struct name_entry *e = s->hand;
+
+      /* Give entries used since the clock last passed a second
+	 chance.  This terminates, since we clear the flags as we go.  */
+      while (e->referenced)
 	{
-	  netfs_nrele (c->np);
-	  c->name_len = 0;
-	  c->np = 0;
-	  cacheq_make_lru (&lookup_cache, c);
+	  e->referenced = 0;
+	  e = e->clock_next;
 	}
+
+      s->hand = e;
+      remove_entry (s, e);
+      s->evictions++;
     }
-  pthread_spin_unlock (&cache_lock);
 }
 
-
-
-/* Register a negative hit for an entry in the Nth stat class */
-void
-register_neg_hit (int n)
+/* Double the number of buckets of shard S, or allocate the initial
+   ones.  S->lock must be held for writing.  If memory is short, the
+   table is left alone.  */
+static void
+grow_shard (struct name_shard *s)
 {
-  int i;
+  size_t nbuckets = s->nbuckets ? s->nbuckets * 2 : MIN_BUCKETS;
+  struct name_entry **buckets, *e, *next;
+  size_t i;
+
+  buckets = calloc (nbuckets, sizeof *buckets);
+  if (buckets == NULL)
+    return;
 
-  statistics.neg_hits++;
+  for (i = 0; i < s->nbuckets; i++)
+    for (e = s->buckets[i]; e; e = next)
+      {
+	next = e->next;
+	e->next = buckets[e->key & (nbuckets - 1)];
+	buckets[e->key & (nbuckets - 1)] = e;
+      }
 
-  for (i = 0; i < n; i++)
-    partial_stats[i].miss++;
-  for (; i < NPARTIALS; i++)
-    partial_stats[i].neg_hits++;
+  free (s->buckets);
+  s->buckets = buckets;
+  s->nbuckets = nbuckets;
 }
 
-/* Register a positive hit for an entry in the Nth stat class */
+/* Node NP has just been found in DIR with NAME.  If NP is null, this
+   name has been confirmed as absent in the directory.  DIR is the
+   fhandle of the directory and LEN is its length; DIR_MTIME is the
+   modification time the directory had when NP was found.  */
 void
-register_pos_hit (int n)
+enter_lookup_cache (char *dir, size_t len, struct timespec *dir_mtime,
+		    struct node *np, char *name)
 {
-  int i;
+  size_t name_len = strlen (name);
+  unsigned long key = hash (dir, len, name, name_len);
+  struct name_shard *s = shard_of (key);
+  size_t limit = shard_limit ();
+  struct name_entry *e;
+
+  if (limit == 0)
+    return;
+
+  if (np)
+    netfs_nref (np);
+
+  pthread_rwlock_wrlock (&s->lock);
+  e = find_entry (s, dir, len, name, name_len, key);
+  if (e)
+    {
+      if (e->np)
+	netfs_nrele (e->np);
+      e->np = np;
+      e->dir_mtime = *dir_mtime;
+      e->cache_stamp = mapped_time->seconds;
+      pthread_rwlock_unlock (&s->lock);
+      return;
+    }
+
+  shrink_shard (s, limit - 1);
+  if (s->count >= s->nbuckets)
+    grow_shard (s);
 
-  statistics.pos_hits++;
+  e = malloc (sizeof *e + name_len + 1);
+  if (e == NULL || s->nbuckets == 0)
+    {
+      free (e);
+      pthread_rwlock_unlock (&s->lock);
+      if (np)
+	netfs_nrele (np);
+      return;
+    }
+
+  e->key = key;
+  e->np = np;
+  memcpy (e->dir_fh, dir, len);
+  e->dir_len = len;
+  e->dir_mtime = *dir_mtime;
+  e->cache_stamp = mapped_time->seconds;
+  e->referenced = 0;
+  memcpy (e->name, name, name_len + 1);
+
+  e->next = s->buckets[key & (s->nbuckets - 1)];
+  s->buckets[key & (s->nbuckets - 1)] = e;
+
+  if (s->hand == NULL)
+    s->hand = e->clock_next = e->clock_prev = e;
+  else
+    {
+      e->clock_next = s->hand;
+      e->clock_prev = s->hand->clock_prev;
+      e->clock_prev->clock_next = e;
+      s->hand->clock_prev = e;
+    }
+  s->count++;
 
-  for (i = 0; i < n; i++)
-    partial_stats[i].miss++;
-  for (; i < NPARTIALS; i++)
-    partial_stats[i].pos_hits++;
+  pthread_rwlock_unlock (&s->lock);
 }
-  
-/* Register a miss */
+
+/* Purge all references in the cache to NAME within directory DIR. */
 void
-register_miss ()
+purge_lookup_cache (struct node *dp, char *name, size_t namelen)
 {
-  int i;
-  
-  statistics.miss++;
-  for (i = 0; i < NPARTIALS; i++)
-    partial_stats[i].miss++;
+  unsigned long key = hash (dp->nn->handle.data, dp->nn->handle.size,
+			    name, namelen);
+  struct name_shard *s = shard_of (key);
+  struct name_entry *e;
+
+  pthread_rwlock_wrlock (&s->lock);
+  e = find_entry (s, dp->nn->handle.data, dp->nn->handle.size,
+		  name, namelen, key);
+  if (e)
+    remove_entry (s, e);
+  pthread_rwlock_unlock (&s->lock);
 }
 
+/* Purge all references in the cache to node NP.  This has to look at
+   every entry in the cache.  */
+void
+purge_lookup_cache_node (struct node *np)
+{
+  struct name_shard *s;
+  struct name_entry *e, *next;
+  size_t i;
+
+  for (s = &name_cache[0]; s < &name_cache[NAME_SHARDS]; s++)
+    {
+      pthread_rwlock_wrlock (&s->lock);
+      for (i = 0; i < s->nbuckets; i++)
+	for (e = s->buckets[i]; e; e = next)
+	  {
+	    next = e->next;
+	    if (e->np == np)
+	      remove_entry (s, e);
+	  }
+      pthread_rwlock_unlock (&s->lock);
+    }
+}
 
-
 /* Scan the cache looking for NAME inside DIR.  If we know nothing
    about the entry, then return 0.  If the entry is confirmed to not
    exist, then return -1.  Otherwise, return NP for the entry, with
@@ -247,59 +359,74 @@ register_miss ()
 struct node *
 check_lookup_cache (struct node *dir, char *name)
 {
-  struct lookup_cache *c;
-  
-  pthread_spin_lock (&cache_lock);
+  size_t name_len = strlen (name);
+  char *fh = dir->nn->handle.data;
+  size_t len = dir->nn->handle.size;
+  unsigned long key = hash (fh, len, name, name_len);
+  struct name_shard *s = shard_of (key);
+  struct name_entry *e;
+  struct node *np = 0;
+  int found = 0, stale = 0;
+
+  pthread_rwlock_rdlock (&s->lock);
+  e = find_entry (s, fh, len, name, name_len, key);
+  if (e && entry_valid (e, dir))
+    {
+      np = e->np;
+      if (np)
+	netfs_nref (np);
+      if (! e->referenced)
+	__atomic_store_n (&e->referenced, 1, __ATOMIC_RELAXED);
+      found = 1;
+    }
+  else if (e)
+    stale = 1;
+  pthread_rwlock_unlock (&s->lock);
 
-  c = find_cache (dir->nn->handle.data, dir->nn->handle.size,
-		  name, strlen (name));
-  if (c)
+  if (stale)
     {
-      int timeout = c->np
-	? name_cache_timeout 
-	: name_cache_neg_timeout;
+      /* Zap it now, so that its node is not kept any longer.  */
+      pthread_rwlock_wrlock (&s->lock);
+      e = find_entry (s, fh, len, name, name_len, key);
+      if (e && ! entry_valid (e, dir))
+	remove_entry (s, e);
+      pthread_rwlock_unlock (&s->lock);
+    }
 
-      /* Make sure the entry is still usable; if not, zap it now. */
-      if (mapped_time->seconds - c->cache_stamp >= timeout)
-	{
-	  register_neg_hit (c->stati);
-	  if (c->np)
-	    netfs_nrele (c->np);
-	  c->name_len = 0;
-	  c->np = 0;
-	  cacheq_make_lru (&lookup_cache, c);
-	  pthread_spin_unlock (&cache_lock);
-	  return 0;
-	}
+  if (! found)
+    {
+      __atomic_add_fetch (&s->misses, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
 
-      cacheq_make_mru (&lookup_cache, c); /* Record C as recently used.  */
+  pthread_mutex_unlock (&dir->lock);
 
-      if (c->np == 0)
-	/* A negative cache entry.  */
-	{
-	  register_neg_hit (c->stati);
-	  pthread_spin_unlock (&cache_lock);
-	  pthread_mutex_unlock (&dir->lock);
-	  return (struct node *)-1;
-	}
-      else 
-	{
-	  struct node *np;
-	  
-	  np = c->np;
-	  netfs_nref (np);
-	  register_pos_hit (c->stati);
-	  pthread_spin_unlock (&cache_lock);
-	  
-	  pthread_mutex_unlock (&dir->lock);
-	  pthread_mutex_lock (&np->lock);
-
-	  return np;
-	}
+  if (np == 0)
+    /* A negative cache entry.  */
+    {
+      __atomic_add_fetch (&s->negative_hits, 1, __ATOMIC_RELAXED);
+      return (struct node *) -1;
     }
-  
-  register_miss ();
-  pthread_spin_unlock (&cache_lock);
 
-  return 0;
+  __atomic_add_fetch (&s->hits, 1, __ATOMIC_RELAXED);
+  pthread_mutex_lock (&np->lock);
+  return np;
+}
+
+/* Change name_cache_size to SIZE, dropping entries from the cache right
+   away if it now holds too many.  */
+void
+set_name_cache_size (size_t size)
+{
+  struct name_shard *s;
+  size_t limit;
+
+  name_cache_size = size;
+  limit = shard_limit ();
+  for (s = &name_cache[0]; s < &name_cache[NAME_SHARDS]; s++)
+    {
+      pthread_rwlock_wrlock (&s->lock);
+      shrink_shard (s, limit);
+      pthread_rwlock_unlock (&s->lock);
+    }
 }
@@ -1,6 +1,6 @@
 /* nfs.c - XDR frobbing and lower level routines for NFS client.
 
-   Copyright (C) 1995, 1996, 1997, 1999, 2002, 2007
+   Copyright (C) 1995, 1996, 1997, 1999, 2002, 2007, 2026
      Free Software Foundation, Inc.
 
    Written by Michael I. Bushnell, p/BSG.
@@ -485,18 +485,14 @@ xdr_decode_string (int *p, char *buf)
 }
 
 
-/* Set up an RPC for procedure RPC_PROC for talking to the NFS server.
-   Allocate storage with malloc and point *BUFP at it; caller must
-   free this when done.  Initialize RPC credential information with
-   information from CRED (identifying the user making this call; -1
-   means superuser), NP (identifying the node we are operating on), and
-   SECOND_GID (specifying another GID the server might be interested
-   in).  Allocate at least LEN bytes of space for bulk data in
-   addition to the normal amount for an RPC.  */
-int *
-nfs_initialize_rpc (int rpc_proc, struct iouser *cred,
-		    size_t len, void **bufp, struct node *np,
-		    uid_t second_gid)
+/* Figure out what ids to present to the server for CRED (identifying
+   the user making a call; -1 means superuser) operating on NP, which
+   must be locked, and SECOND_GID (specifying another GID the server
+   might be interested in).  Store them in *UIDP, *GIDP and
+   *SECOND_GIDP.  */
+void
+nfs_choose_ids (struct iouser *cred, struct node *np, uid_t second_gid,
+		uid_t *uidp, gid_t *gidp, gid_t *second_gidp)
 {
   uid_t uid;
   uid_t gid;
@@ -579,6 +575,28 @@ nfs_initialize_rpc (int rpc_proc, struct iouser *cred,
   else
     uid = gid = second_gid = -1;
 
+  *uidp = uid;
+  *gidp = gid;
+  *second_gidp = second_gid;
+}
+
+/* Set up an RPC for procedure RPC_PROC for talking to the NFS server.
+   Allocate storage with malloc and point *BUFP at it; caller must
+   free this when done.  Initialize RPC credential information with
+   information from CRED (identifying the user making this call; -1
+   means superuser), NP (identifying the node we are operating on), and
+   SECOND_GID (specifying another GID the server might be interested
+   in).  Allocate at least LEN bytes of space for bulk data in
+   addition to the normal amount for an RPC.  */
+int *
+nfs_initialize_rpc (int rpc_proc, struct iouser *cred,
+		    size_t len, void **bufp, struct node *np,
+		    uid_t second_gid)
+{
+  uid_t uid;
+  gid_t gid;
+
+  nfs_choose_ids (cred, np, second_gid, &uid, &gid, &second_gid);
   return initialize_rpc (NFS_PROGRAM, NFS_VERSION, rpc_proc, len, bufp,
 			 uid, gid, second_gid);
 }
@@ -1,5 +1,5 @@
 /* Data structures and global variables for NFS client
-   Copyright (C) 1994,95,96,97,99,2001 Free Software Foundation, Inc.
+   Copyright (C) 1994,95,96,97,99,2001,2026 Free Software Foundation, Inc.
 
    This program is free software; you can redistribute it and/or
    modify it under the terms of the GNU General Public License as
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <netinet/in.h>
 #include "nfs-spec.h"
 #include <hurd/ihash.h>
 #include <hurd/netfs.h>
@@ -69,8 +70,19 @@ struct netnode
   off_t extend_len;
 #endif
 
+  /* The pager caching the contents of the file, if any; protected by
+     node2pagelock.  */
   struct user_pager_info *fileinfo;
 
+  /* The modification time of the file when its cached contents were
+     last known to be current.  If the server reports another one, the
+     cache is dropped.  */
+  struct timespec data_mtime;
+
+  /* Set while we write to the file ourselves, so that the change of
+     modification time this causes does not drop the cache.  */
+  int data_writing;
+
   /* If this node has been renamed by "deletion" then
      this is the directory and the name in that directory
      which is holding the node */
@@ -78,6 +90,28 @@ struct netnode
   char *dead_name;
 };
 
+/* The pager caching the contents of a file.  */
+struct user_pager_info
+{
+  struct node *np;
+  struct pager *p;
+
+  /* The ids to present to the server when paging; protected by
+     node2pagelock.  Once someone maps the file for writing, WRITER is
+     set and these are that user's ids, so that the pages dirtied
+     through the mapping are written back as that user; until then they
+     are those of the first user to read or map the file.  */
+  uid_t uid;
+  gid_t gid;
+  int writer;
+
+  /* Sequential read-ahead: the page expected to be faulted in next if
+     the file is read sequentially, and the number of pages to read
+     ahead after it; these are only used by pager_read_page.  */
+  vm_offset_t read_ahead_next;
+  int read_ahead_pages;
+};
+
 /* Socket file descriptor for talking to RPC servers. */
 int main_udp_socket;
 
@@ -101,6 +135,9 @@ extern int name_cache_timeout;
 /* How long to keep around negative dir cache entries */
 extern int name_cache_neg_timeout;
 
+/* How many dir cache entries to keep around at most */
+extern size_t name_cache_size;
+
 /* How long to wait for replies before re-sending RPC's. */
 extern int initial_transmit_timeout;
 extern int max_transmit_timeout;
@@ -117,6 +154,10 @@ extern int read_size;
 /* Maximum amout to write at once */
 extern int write_size;
 
+/* Maximum number of READ or WRITE RPC's to have in flight at once for
+   one read or write */
+extern int rpc_window;
+
 /* Service name for portmapper */
 extern char *pmap_service_name;
 
@@ -155,6 +196,9 @@ extern int nfs_port_override;
 /* Which NFS protocol version we are using */
 extern int protocol_version;
 
+/* Whether to talk to the NFS server over TCP rather than UDP */
+extern int use_tcp;
+
 
 /* Count how many four-byte chunks it takes to hold LEN bytes. */
 #define INTSIZE(len) (((len)+3)>>2)
@@ -174,6 +218,8 @@ int *xdr_encode_create_state (int *, mode_t, uid_t);
 int *xdr_decode_fattr (int *, struct stat *);
 int *xdr_decode_string (int *, char *);
 int *xdr_decode_fhandle (int *, struct node **);
+void nfs_choose_ids (struct iouser *, struct node *, uid_t,
+		     uid_t *, gid_t *, gid_t *);
 int *nfs_initialize_rpc (int, struct iouser *, size_t, void **,
 			 struct node *, uid_t);
 error_t nfs_error_trans (int);
@@ -185,21 +231,39 @@ extern uint16_t mounted_nfs_port; /* host order */
 
 /* ops.c */
 int *register_fresh_stat (struct node *, int *);
+error_t nfs_read_data (struct iouser *, struct node *,
+		       struct user_pager_info *, off_t, size_t *, void *);
+error_t nfs_write_data (struct iouser *, struct node *,
+			struct user_pager_info *, off_t, size_t *, void *);
 
 /* rpc.c */
 int *initialize_rpc (int, int, int, size_t, void **, uid_t, gid_t, gid_t);
 error_t conduct_rpc (void **, int **);
+error_t start_rpc (void *, int *);
+error_t finish_rpc (void **, int **);
+void abandon_rpc (void *);
+error_t rpc_use_tcp (struct sockaddr_in *);
 void *timeout_service_thread (void *);
 void *rpc_receive_thread (void *);
 
 /* cache.c */
 void lookup_fhandle (struct fhandle *, struct node **);
 int *recache_handle (int *, struct node *);
+void release_cached_node (struct node *);
+
+/* pager.c */
+extern pthread_spinlock_t node2pagelock;
+void create_pager_bucket (void);
+void invalidate_file_data (struct node *, vm_offset_t, vm_size_t, int);
+void sync_file_data (struct node *, int);
+void sync_all_file_data (int);
 
 /* name-cache.c */
-void enter_lookup_cache (char *, size_t, struct node *, char *);
+void enter_lookup_cache (char *, size_t, struct timespec *, struct node *,
+			 char *);
 void purge_lookup_cache (struct node *, char *, size_t);
 struct node *check_lookup_cache (struct node *, char *);
 void purge_lookup_cache_node (struct node *);
+void set_name_cache_size (size_t);
 
 #endif /* NFS_NFS_H */
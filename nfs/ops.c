@@ -1,5 +1,5 @@
 /* ops.c - Libnetfs callbacks for node operations in NFS client.
-   Copyright (C) 1994,95,96,97,99,2002,2011 Free Software Foundation, Inc.
+   Copyright (C) 1994,95,96,97,99,2002,2011,2026 Free Software Foundation, Inc.
 
    This program is free software; you can redistribute it and/or
    modify it under the terms of the GNU General Public License as
@@ -17,6 +17,7 @@
 
 #include "nfs.h"
 #include <hurd/netfs.h>
+#include <hurd/pager.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <fcntl.h>
@@ -74,19 +75,41 @@ register_fresh_stat (struct node *np, int *p)
   np->nn_stat.st_flags = 0;
   np->nn_translated = np->nn_stat.st_mode & S_IFMT;
 
+  /* If someone else has changed the file, our cached contents are
+     stale.  */
+  if ((np->nn_stat.st_mtim.tv_sec != np->nn->data_mtime.tv_sec
+       || np->nn_stat.st_mtim.tv_nsec != np->nn->data_mtime.tv_nsec)
+      && ! np->nn->data_writing)
+    invalidate_file_data (np, 0, 0, 1);
+  np->nn->data_mtime = np->nn_stat.st_mtim;
+
   return ret;
 }
 
+/* Like register_fresh_stat, but if NP is null, just skip the fattr
+   structure at P.  */
+static int *
+register_returned_stat (struct node *np, int *p)
+{
+  struct stat st;
+
+  if (np)
+    return register_fresh_stat (np, p);
+  else
+    return xdr_decode_fattr (p, &st);
+}
+
 /* Handle returned wcc information for various calls.  In protocol
    version 2, this is just register_fresh_stat.  In version 3, it
    checks to see if stat information is present too.  If this follows
    an operation that we expect has modified the attributes, MOD should
-   be set.  (This unpacks the post_op_attr XDR type.)  */
+   be set.  If NP is null, the information is skipped.  (This unpacks
+   the post_op_attr XDR type.)  */
 int *
 process_returned_stat (struct node *np, int *p, int mod)
 {
   if (protocol_version == 2)
-    return register_fresh_stat (np, p);
+    return register_returned_stat (np, p);
   else
     {
       int attrs_exist;
@@ -94,8 +117,8 @@ process_returned_stat (struct node *np, int *p, int mod)
       attrs_exist = ntohl (*p);
       p++;
       if (attrs_exist)
-	p = register_fresh_stat (np, p);
-      else if (mod)
+	p = register_returned_stat (np, p);
+      else if (mod && np)
 	/* We know that our values are now wrong */
 	np->nn->stat_updated = 0;
       return p;
@@ -106,13 +129,14 @@ process_returned_stat (struct node *np, int *p, int mod)
 /* Handle returned wcc information for various calls.  In protocol
    version 2, this is just register_fresh_stat.  In version 3, it does
    the wcc_data interpretation too.  If this follows an operation that
-   we expect has modified the attributes, MOD should be set.
-   (This unpacks the wcc_data XDR type.)  */
+   we expect has modified the attributes, MOD should be set.  If NP is
+   null, the information is skipped.  (This unpacks the wcc_data XDR
+   type.)  */
 int *
 process_wcc_stat (struct node *np, int *p, int mod)
 {
   if (protocol_version == 2)
-    return register_fresh_stat (np, p);
+    return register_returned_stat (np, p);
   else
     {
       int attrs_exist;
@@ -123,9 +147,9 @@ process_wcc_stat (struct node *np, int *p, int mod)
       if (attrs_exist)
 	{
 	  /* Just skip them for now */
-	  p += 2 * sizeof (int); /* size */
-	  p += 2 * sizeof (int); /* mtime */
-	  p += 2 * sizeof (int); /* atime */
+	  p += 2; /* size */
+	  p += 2; /* mtime */
+	  p += 2; /* ctime */
 	}
 
       /* Now the post_op_attr */
@@ -345,6 +369,10 @@ netfs_attempt_set_size (struct iouser *cred, struct node *np,
   void *rpcbuf;
   error_t err;
 
+  /* Write back what was changed through a mapping before the file is
+     cut, and read the rest again afterwards.  */
+  invalidate_file_data (np, 0, 0, 1);
+
   p = nfs_initialize_rpc (NFSPROC_SETATTR (protocol_version),
 			  cred, 0, &rpcbuf, np, -1);
   if (! p)
@@ -432,7 +460,9 @@ netfs_attempt_statfs (struct iouser *cred, struct node *np,
 error_t
 netfs_attempt_sync (struct iouser *cred, struct node *np, int wait)
 {
-  /* We are already completely synchronous. */
+  /* Writes are synchronous; only what was written through a mapping
+     may still have to go to the server.  */
+  sync_file_data (np, wait);
   return 0;
 }
 
@@ -441,124 +471,268 @@ netfs_attempt_sync (struct iouser *cred, struct node *np, int wait)
 error_t
 netfs_attempt_syncfs (struct iouser *cred, int wait)
 {
+  sync_all_file_data (wait);
   return 0;
 }
 
-/* Implement the netfs_attempt_read callback as described in
-   <hurd/netfs.h>.  */
+/* A READ or WRITE RPC in flight for netfs_attempt_read or
+   netfs_attempt_write, for LEN bytes at OFFSET in the file and at DATA
+   in the caller's buffer.  */
+struct chunk
+{
+  void *rpcbuf;
+  off_t offset;
+  size_t len;
+  void *data;
+};
+
+/* A ring of up to SIZE chunks, which are sent in order and whose
+   replies are processed in the same order.  SIZE is rpc_window when the
+   read or write started, which may be changed meanwhile.  */
+struct window
+{
+  struct chunk *chunks;
+  int size;
+  int first, count;
+};
+
+/* Return the slot for a new chunk at the end of WINDOW.  */
+static inline struct chunk *
+window_next (struct window *w)
+{
+  return &w->chunks[(w->first + w->count) % w->size];
+}
+
+/* Remove the oldest chunk from WINDOW and return it.  */
+static inline struct chunk *
+window_pop (struct window *w)
+{
+  struct chunk *c = &w->chunks[w->first];
+
+  w->first = (w->first + 1) % w->size;
+  w->count--;
+  return c;
+}
+
+/* Give up on all the chunks in WINDOW.  */
+static void
+window_abandon (struct window *w)
+{
+  while (w->count > 0)
+    abandon_rpc (window_pop (w)->rpcbuf);
+}
+
+/* Set up a READ or WRITE RPC for procedure RPC_PROC on NP, as
+   nfs_initialize_rpc does.  If UPI is nonzero, use the ids recorded in
+   it instead of CRED.  */
+static int *
+data_initialize_rpc (int rpc_proc, struct iouser *cred, size_t len,
+		     void **bufp, struct node *np, struct user_pager_info *upi)
+{
+  uid_t uid;
+  gid_t gid;
+
+  if (! upi)
+    return nfs_initialize_rpc (rpc_proc, cred, len, bufp, np, -1);
+
+  pthread_spin_lock (&node2pagelock);
+  uid = upi->uid;
+  gid = upi->gid;
+  pthread_spin_unlock (&node2pagelock);
+
+  return initialize_rpc (NFS_PROGRAM, NFS_VERSION, rpc_proc, len, bufp,
+			 uid, gid, -1);
+}
+
+/* Read *LEN bytes at OFFSET of NP from the server into DATA, and set
+   *LEN to the amount read.  Up to rpc_window READ RPC's are kept in
+   flight, so that large reads are not limited by the round trip time.
+   If UPI is nonzero, this is a read for the pager UPI of NP: NP is not
+   locked, the RPC's are done with the ids recorded in UPI, and the
+   attributes the server returns are ignored.  Otherwise NP is locked
+   and the RPC's are done for CRED.  */
 error_t
-netfs_attempt_read (struct iouser *cred, struct node *np,
-		    off_t offset, size_t *len, void *data)
+nfs_read_data (struct iouser *cred, struct node *np,
+	       struct user_pager_info *upi,
+	       off_t offset, size_t *len, void *data)
 {
   int *p;
-  void *rpcbuf;
   size_t trans_len;
-  error_t err;
-  size_t amt, thisamt;
+  error_t err = 0;
+  int size = rpc_window;
+  struct chunk chunks[size], *c;
+  struct window w = { chunks, size, 0, 0 };
+  off_t next_offset = offset;
+  size_t amt = *len, done = 0;
   int eof;
 
-  for (amt = *len; amt;)
+  while (amt || w.count)
     {
-      thisamt = amt;
-      if (thisamt > read_size)
-	thisamt = read_size;
-
-      p = nfs_initialize_rpc (NFSPROC_READ (protocol_version),
-			      cred, 0, &rpcbuf, np, -1);
-      if (! p)
-        return errno;
-
-      p = xdr_encode_fhandle (p, &np->nn->handle);
-      *(p++) = htonl (offset);
-      *(p++) = htonl (thisamt);
-      if (protocol_version == 2)
-	*(p++) = 0;
-
-      err = conduct_rpc (&rpcbuf, &p);
-      if (!err)
+      /* Keep the window full.  */
+      while (amt && w.count < w.size)
 	{
-	  err = nfs_error_trans (ntohl (*p));
-	  p++;
+	  c = window_next (&w);
+	  c->offset = next_offset;
+	  c->len = amt;
+	  if (c->len > read_size)
+	    c->len = read_size;
+	  c->data = data + (next_offset - offset);
+
+	  p = data_initialize_rpc (NFSPROC_READ (protocol_version),
+				   cred, 0, &c->rpcbuf, np, upi);
+	  if (! p)
+	    {
+	      err = errno;
+	      break;
+	    }
 
-	  if (!err || protocol_version == 3)
-	    p = process_returned_stat (np, p, !err);
+	  p = xdr_encode_fhandle (p, &np->nn->handle);
+	  *(p++) = htonl (c->offset);
+	  *(p++) = htonl (c->len);
+	  if (protocol_version == 2)
+	    *(p++) = 0;
 
+	  err = start_rpc (c->rpcbuf, p);
 	  if (err)
 	    {
-	      free (rpcbuf);
-	      return err;
+	      free (c->rpcbuf);
+	      break;
 	    }
 
-	  trans_len = ntohl (*p);
+	  w.count++;
+	  next_offset += c->len;
+	  amt -= c->len;
+	}
+      if (err)
+	break;
+
+      c = window_pop (&w);
+      err = finish_rpc (&c->rpcbuf, &p);
+      if (err)
+	{
+	  free (c->rpcbuf);
+	  break;
+	}
+
+      err = nfs_error_trans (ntohl (*p));
+      p++;
+
+      if (!err || protocol_version == 3)
+	p = process_returned_stat (upi ? 0 : np, p, !err);
+
+      if (err)
+	{
+	  free (c->rpcbuf);
+	  break;
+	}
+
+      trans_len = ntohl (*p);
+      p++;
+      if (trans_len > c->len)
+	trans_len = c->len;	/* ??? */
+
+      if (protocol_version == 3)
+	{
+	  eof = ntohl (*p);
 	  p++;
-	  if (trans_len > thisamt)
-	    trans_len = thisamt;	/* ??? */
+	}
+      else
+	eof = (trans_len < c->len);
 
-	  if (protocol_version == 3)
-	    {
-	      eof = ntohl (*p);
-	      p++;
-	    }
-	  else
-	    eof = (trans_len < thisamt);
+      memcpy (c->data, p, trans_len);
+      free (c->rpcbuf);
 
-	  memcpy (data, p, trans_len);
-	  free (rpcbuf);
+      done += trans_len;
 
-	  data += trans_len;
-	  offset += trans_len;
-	  amt -= trans_len;
+      if (eof)
+	{
+	  *len = done;
+	  break;
+	}
 
-	  if (eof)
-	    {
-	      *len -= amt;
-	      return 0;
-	    }
+      if (trans_len < c->len)
+	/* A short read that is not at the end of the file.  The reads
+	   after it have left a hole, so do them over from here.  */
+	{
+	  window_abandon (&w);
+	  next_offset = c->offset + trans_len;
+	  amt = *len - done;
 	}
     }
-  return 0;
+
+  window_abandon (&w);
+  return err;
 }
 
-/* Implement the netfs_attempt_write callback as described in
-   <hurd/netfs.h>.  */
+/* Write *LEN bytes from DATA to NP at OFFSET on the server, and set
+   *LEN to the amount written.  Up to rpc_window WRITE RPC's are kept
+   in flight, and UPI is as for nfs_read_data.  */
 error_t
-netfs_attempt_write (struct iouser *cred, struct node *np,
-		     off_t offset, size_t *len, void *data)
+nfs_write_data (struct iouser *cred, struct node *np,
+		struct user_pager_info *upi,
+		off_t offset, size_t *len, void *data)
 {
   int *p;
-  void *rpcbuf;
-  error_t err;
-  size_t amt, thisamt;
+  error_t err = 0;
+  int size = rpc_window;
+  struct chunk chunks[size], *c;
+  struct window w = { chunks, size, 0, 0 };
+  off_t next_offset = offset;
+  size_t amt = *len, done = 0;
   size_t count;
 
-  for (amt = *len; amt;)
+  while (amt || w.count)
     {
-      thisamt = amt;
-      if (thisamt > write_size)
-	thisamt = write_size;
+      /* Keep the window full.  */
+      while (amt && w.count < w.size)
+	{
+	  c = window_next (&w);
+	  c->offset = next_offset;
+	  c->len = amt;
+	  if (c->len > write_size)
+	    c->len = write_size;
+	  c->data = data + (next_offset - offset);
+
+	  p = data_initialize_rpc (NFSPROC_WRITE (protocol_version),
+				   cred, c->len, &c->rpcbuf, np, upi);
+	  if (! p)
+	    {
+	      err = errno;
+	      break;
+	    }
 
-      p = nfs_initialize_rpc (NFSPROC_WRITE (protocol_version),
-			      cred, thisamt, &rpcbuf, np, -1);
-      if (! p)
-        return errno;
+	  p = xdr_encode_fhandle (p, &np->nn->handle);
+	  if (protocol_version == 2)
+	    *(p++) = 0;
+	  *(p++) = htonl (c->offset);
+	  if (protocol_version == 2)
+	    *(p++) = 0;
+	  if (protocol_version == 3)
+	    *(p++) = htonl (FILE_SYNC);
+	  p = xdr_encode_data (p, c->data, c->len);
 
-      p = xdr_encode_fhandle (p, &np->nn->handle);
-      if (protocol_version == 2)
-	*(p++) = 0;
-      *(p++) = htonl (offset);
-      if (protocol_version == 2)
-	*(p++) = 0;
-      if (protocol_version == 3)
-	*(p++) = htonl (FILE_SYNC);
-      p = xdr_encode_data (p, data, thisamt);
+	  err = start_rpc (c->rpcbuf, p);
+	  if (err)
+	    {
+	      free (c->rpcbuf);
+	      break;
+	    }
 
-      err = conduct_rpc (&rpcbuf, &p);
+	  w.count++;
+	  next_offset += c->len;
+	  amt -= c->len;
+	}
+      if (err)
+	break;
+
+      c = window_pop (&w);
+      err = finish_rpc (&c->rpcbuf, &p);
       if (!err)
 	{
 	  err = nfs_error_trans (ntohl (*p));
 	  p++;
 	  if (!err || protocol_version == 3)
-	    p = process_wcc_stat (np, p, !err);
+	    p = process_wcc_stat (upi ? 0 : np, p, !err);
 	  if (!err)
 	    {
 	      if (protocol_version == 3)
@@ -568,32 +742,117 @@ netfs_attempt_write (struct iouser *cred, struct node *np,
 		  p++;		/* ignore COMMITTED */
 		  /* ignore verf for now */
 		  p += NFS3_WRITEVERFSIZE / sizeof (int);
+		  if (count > c->len)
+		    count = c->len;
 		}
 	      else
 		/* assume it wrote the whole thing */
-		count = thisamt;
+		count = c->len;
+
+	      done += count;
 
-	      amt -= count;
-	      data += count;
-	      offset += count;
+	      if (count < c->len)
+		/* A short write.  Do the writes after it over from
+		   there; those already done are just done again.  */
+		{
+		  window_abandon (&w);
+		  next_offset = c->offset + count;
+		  amt = *len - done;
+		}
 	    }
 	}
 
-      free (rpcbuf);
-
-      if (err == EINTR && amt != *len)
-	{
-	  *len -= amt;
-	  return 0;
-	}
+      free (c->rpcbuf);
 
       if (err)
-	{
-	  *len = 0;
-	  return err;
-	}
+	break;
     }
-  return 0;
+
+  window_abandon (&w);
+
+  if (err == EINTR && done)
+    {
+      *len = done;
+      return 0;
+    }
+
+  if (err)
+    *len = 0;
+  return err;
+}
+
+/* Implement the netfs_attempt_read callback as described in
+   <hurd/netfs.h>.  The contents of regular files are read through
+   their pager, so that they are cached.  */
+error_t
+netfs_attempt_read (struct iouser *cred, struct node *np,
+		    off_t offset, size_t *len, void *data)
+{
+  error_t err;
+  mach_port_t memobj;
+
+  if (! S_ISREG (np->nn_stat.st_mode))
+    return nfs_read_data (cred, np, 0, offset, len, data);
+
+  /* Check with the server at least every cache_timeout seconds whether
+     the file has changed; register_fresh_stat drops the cache if so.  */
+  if (mapped_time->seconds - np->nn->stat_updated >= cache_timeout)
+    np->nn->stat_updated = 0;
+  err = netfs_validate_stat (np, cred);
+  if (err)
+    return err;
+
+  if (offset >= np->nn_stat.st_size)
+    {
+      *len = 0;
+      return 0;
+    }
+  if (*len > np->nn_stat.st_size - offset)
+    *len = np->nn_stat.st_size - offset;
+
+  memobj = netfs_get_filemap (np, cred, VM_PROT_READ);
+  if (memobj == MACH_PORT_NULL)
+    return errno;
+
+  /* pager_memcpy inherently uses vm_offset_t, which may be smaller
+     than off_t.  */
+  if (sizeof (off_t) > sizeof (vm_offset_t)
+      && offset + *len > ((off_t) 1) << (sizeof (vm_offset_t) * 8))
+    err = EFBIG;
+  else
+    /* The pager can't go away while we hold MEMOBJ.  */
+    err = pager_memcpy (np->nn->fileinfo->p, memobj, offset, data, len,
+			VM_PROT_READ);
+
+  mach_port_deallocate (mach_task_self (), memobj);
+  return err;
+}
+
+/* Implement the netfs_attempt_write callback as described in
+   <hurd/netfs.h>.  Writes go straight to the server; the pages they
+   touch are dropped from the cache, after writing back whatever has
+   been changed in them through a mapping.  */
+error_t
+netfs_attempt_write (struct iouser *cred, struct node *np,
+		     off_t offset, size_t *len, void *data)
+{
+  error_t err;
+  vm_offset_t start = trunc_page (offset);
+  vm_size_t size = round_page (offset + *len) - start;
+
+  if (*len == 0)
+    return 0;
+
+  invalidate_file_data (np, start, size, 1);
+
+  np->nn->data_writing = 1;
+  err = nfs_write_data (cred, np, 0, offset, len, data);
+  np->nn->data_writing = 0;
+
+  /* Drop what was paged in again meanwhile through a mapping.  */
+  invalidate_file_data (np, start, size, 0);
+
+  return err;
 }
 
 /* See if NAME exists in DIR for CRED.  If so, return EEXIST.  */
@@ -644,8 +903,12 @@ netfs_attempt_lookup (struct iouser *cred, struct node *np,
   error_t err;
   char dirhandle[NFS3_FHSIZE];
   size_t dirlen;
+  struct timespec dirmtime;
 
-  /* Check the cache first. */
+  /* Check the cache first.  Its entries are only used while the
+     directory keeps its modification time, so make sure that we know
+     that time.  */
+  netfs_validate_stat (np, cred);
   *newnp = check_lookup_cache (np, name);
   if (*newnp)
     {
@@ -670,6 +933,7 @@ netfs_attempt_lookup (struct iouser *cred, struct node *np,
 
   dirlen = np->nn->handle.size;
   memcpy (dirhandle, np->nn->handle.data, dirlen);
+  dirmtime = np->nn_stat.st_mtim;
 
   pthread_mutex_unlock (&np->lock);
 
@@ -691,6 +955,7 @@ netfs_attempt_lookup (struct iouser *cred, struct node *np,
 	    pthread_mutex_unlock (&(*newnp)->lock);
 	  pthread_mutex_lock (&np->lock);
 	  p = process_returned_stat (np, p, 0); /* XXX Do we have to lock np? */
+	  dirmtime = np->nn_stat.st_mtim;
 	  pthread_mutex_unlock (&np->lock);
 	  if (*newnp)
 	    pthread_mutex_lock (&(*newnp)->lock);
@@ -699,8 +964,10 @@ netfs_attempt_lookup (struct iouser *cred, struct node *np,
   else
     *newnp = 0;
 
-  /* Notify the cache of the hit or miss. */
-  enter_lookup_cache (dirhandle, dirlen, *newnp, name);
+  /* Notify the cache of the hit or miss.  Other errors say nothing
+     about the name.  */
+  if (!err || err == ENOENT)
+    enter_lookup_cache (dirhandle, dirlen, &dirmtime, *newnp, name);
 
   free (rpcbuf);
 
@@ -1472,6 +1739,11 @@ netfs_check_open_permissions (struct iouser *cred, struct node *np,
   if (newnode || (flags & (O_READ|O_WRITE|O_EXEC)) == 0)
     return 0;
 
+  /* Close-to-open consistency: if we have the contents of the file
+     cached, make sure now that they are still current.  */
+  if (np->nn->fileinfo)
+    np->nn->stat_updated = 0;
+
   netfs_report_access (cred, np, &modes);
   if ((flags & (O_READ|O_WRITE|O_EXEC)) == (flags & modes))
     return 0;
@@ -1694,22 +1966,96 @@ netfs_report_access (struct iouser *cred,
 }
 #endif
 
-/* Fetch the complete contents of DIR into a buffer of directs.  Set
-   *BUFP to that buffer.  *BUFP must be freed by the caller when no
-   longer needed.  If an error occurs, don't touch *BUFP and return
-   the error code.  Set BUFSIZEP to the amount of data used inside
-   *BUFP and TOTALENTRIES to the total number of entries copied.  */
+/* Set once the server has refused a READDIRPLUS call; we then use
+   plain READDIR from there on.  */
+static int readdirplus_refused;
+
+/* Append an entry for the NAMLEN bytes of NAME with file number FILENO
+   to the buffer *BUFP of *ALLOCP bytes, which is filled up to *BPP,
+   growing it if necessary.  Return the new entry.  */
+static struct dirent *
+append_dirent (void **bufp, size_t *allocp, void **bpp,
+	       ino_t fileno, char *name, int namlen)
+{
+  struct dirent *entry;
+  int reclen;
+
+  /* There's a hidden +1 here for the null byte and -1 because d_name
+     has a size of one already in the sizeof.  */
+  reclen = sizeof (struct dirent) + namlen;
+  reclen = (reclen + 3) & ~3; /* make it a multiple of four */
+
+  /* Expand buffer if necessary */
+  if (*bpp + reclen > *bufp + *allocp)
+    {
+      char *newbuf;
+
+      newbuf = realloc (*bufp, *allocp *= 2);
+      assert (newbuf);
+      *bpp = newbuf + (*bpp - *bufp);
+      *bufp = newbuf;
+    }
+
+  /* Fill in new entry */
+  entry = (struct dirent *) *bpp;
+  entry->d_fileno = fileno;
+  entry->d_reclen = reclen;
+  entry->d_type = DT_UNKNOWN;
+  entry->d_namlen = namlen;
+  memcpy (entry->d_name, name, namlen);
+  entry->d_name[namlen] = '\0';
+
+  *bpp += reclen;
+  return entry;
+}
+
+/* The file ENTRY of DIR, whose fhandle is the DIRLEN bytes at
+   DIRHANDLE and whose modification time is DIRMTIME, was returned by
+   READDIRPLUS with the attributes at ATTRS and the fhandle at HANDLE;
+   enter them in our caches, so that looking the file up and statting
+   it take no further RPC's.  */
+static void
+prefetch_entry (char *dirhandle, size_t dirlen, struct timespec *dirmtime,
+		struct dirent *entry, int *attrs, int *handle)
+{
+  struct fhandle fh;
+  struct node *np;
+
+  /* libnetfs deals with these itself.  */
+  if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, ".."))
+    return;
+
+  fh.size = ntohl (*handle);
+  if (fh.size > NFS3_FHSIZE)
+    return;
+  memcpy (fh.data, handle + 1, fh.size);
+
+  lookup_fhandle (&fh, &np);
+  register_fresh_stat (np, attrs);
+  pthread_mutex_unlock (&np->lock);
+
+  enter_lookup_cache (dirhandle, dirlen, dirmtime, np, entry->d_name);
+  netfs_nrele (np);
+}
+
+/* Fetch the complete contents of DIR into a buffer of directs, using
+   READDIRPLUS if PLUS is set, and READDIR otherwise.  The arguments
+   are otherwise as for fetch_directory.  */
 static error_t
-fetch_directory (struct iouser *cred, struct node *dir,
-		 void **bufp, size_t *bufsizep, int *totalentries)
+fetch_entries (struct iouser *cred, struct node *dir, int plus,
+	       void **bufp, size_t *bufsizep, int *totalentries)
 {
   void *buf;
-  int cookie;
+  int cookie[2];
+  char verf[NFS3_COOKIEVERFSIZE];
+  char dirhandle[NFS3_FHSIZE];
+  size_t dirlen;
+  struct timespec dirmtime;
   int *p;
   void *rpcbuf;
   struct dirent *entry;
   void *bp;
-  int bufmalloced;
+  size_t bufmalloced;
   int eof;
   error_t err;
   int isnext;
@@ -1721,14 +2067,20 @@ fetch_directory (struct iouser *cred, struct node *dir,
     return ENOMEM;
 
   bp = buf;
-  cookie = 0;
+  cookie[0] = cookie[1] = 0;
+  memset (verf, 0, sizeof verf);
   eof = 0;
   *totalentries = 0;
 
+  /* Remember the directory handle for later cache use.  */
+  dirlen = dir->nn->handle.size;
+  memcpy (dirhandle, dir->nn->handle.data, dirlen);
+
   while (!eof)
     {
       /* Fetch new directory entries */
-      p = nfs_initialize_rpc (NFSPROC_READDIR (protocol_version),
+      p = nfs_initialize_rpc (plus ? NFS3PROC_READDIRPLUS
+			      : NFSPROC_READDIR (protocol_version),
 			      cred, 0, &rpcbuf, dir, -1);
       if (! p)
 	{
@@ -1737,67 +2089,95 @@ fetch_directory (struct iouser *cred, struct node *dir,
 	}
 
       p = xdr_encode_fhandle (p, &dir->nn->handle);
-      *(p++) = cookie;
-      *(p++) = ntohl (read_size);
+      if (protocol_version == 2)
+	*(p++) = cookie[0];
+      else
+	{
+	  *(p++) = cookie[0];
+	  *(p++) = cookie[1];
+	  memcpy (p, verf, NFS3_COOKIEVERFSIZE);
+	  p += NFS3_COOKIEVERFSIZE / sizeof (int);
+	}
+      *(p++) = htonl (read_size);
+      if (plus)
+	/* The maximum size of the whole reply, as opposed to that of the
+	   names and cookies alone just above.  */
+	*(p++) = htonl (read_size);
+
       err = conduct_rpc (&rpcbuf, &p);
       if (!err)
 	{
 	  err = nfs_error_trans (ntohl (*p));
 	  p++;
 	}
+      if (!err && protocol_version == 3)
+	{
+	  p = process_returned_stat (dir, p, 0);
+	  memcpy (verf, p, NFS3_COOKIEVERFSIZE);
+	  p += NFS3_COOKIEVERFSIZE / sizeof (int);
+	}
       if (err)
 	{
+	  free (rpcbuf);
 	  free (buf);
 	  return err;
 	}
 
+      /* Don't keep DIR locked while the nodes of the entries are.  */
+      dirmtime = dir->nn_stat.st_mtim;
+      if (plus)
+	pthread_mutex_unlock (&dir->lock);
+
       isnext = ntohl (*p);
       p++;
 
       /* Now copy them one at a time. */
       while (isnext)
 	{
-	  ino_t fileno;
+	  long long fileno;
 	  int namlen;
-	  int reclen;
+	  int *attrs = 0, *handle = 0;
 
-	  fileno = ntohl (*p);
-	  p++;
+	  if (protocol_version == 2)
+	    {
+	      fileno = ntohl (*p);
+	      p++;
+	    }
+	  else
+	    p = xdr_decode_64bit (p, &fileno);
 	  namlen = ntohl (*p);
 	  p++;
 
-	  /* There's a hidden +1 here for the null byte and -1 because d_name
-	     has a size of one already in the sizeof.  */
-	  reclen = sizeof (struct dirent) + namlen;
-	  reclen = (reclen + 3) & ~3; /* make it a multiple of four */
-
-	  /* Expand buffer if necessary */
-	  if (bp + reclen > buf + bufmalloced)
-	    {
-	      char *newbuf;
+	  entry = append_dirent (&buf, &bufmalloced, &bp,
+				 fileno, (char *) p, namlen);
+	  p += INTSIZE (namlen);
 
-	      newbuf = realloc (buf, bufmalloced *= 2);
-	      assert (newbuf);
-	      if (newbuf != buf)
-		bp = newbuf + (bp - buf);
-	      buf = newbuf;
-	    }
+	  ++*totalentries;
 
-	  /* Fill in new entry */
-	  entry = (struct dirent *) bp;
-	  entry->d_fileno = fileno;
-	  entry->d_reclen = reclen;
-	  entry->d_type = DT_UNKNOWN;
-	  entry->d_namlen = namlen;
-	  memcpy (entry->d_name, p, namlen);
-	  entry->d_name[namlen] = '\0';
+	  cookie[0] = *(p++);
+	  if (protocol_version == 3)
+	    cookie[1] = *(p++);
 
-	  p += INTSIZE (namlen);
-	  bp = bp + entry->d_reclen;
+	  if (plus)
+	    {
+	      /* The post_op_attr and post_op_fh3 of the entry.  */
+	      if (ntohl (*(p++)))
+		{
+		  struct stat st;
 
-	  ++*totalentries;
+		  attrs = p;
+		  p = xdr_decode_fattr (p, &st);
+		}
+	      if (ntohl (*(p++)))
+		{
+		  handle = p;
+		  p += 1 + INTSIZE (ntohl (*p));
+		}
+	      if (attrs && handle)
+		prefetch_entry (dirhandle, dirlen, &dirmtime,
+				entry, attrs, handle);
+	    }
 
-	  cookie = *(p++);
 	  isnext = ntohl (*p);
 	  p++;
 	}
@@ -1805,6 +2185,9 @@ fetch_directory (struct iouser *cred, struct node *dir,
       eof = ntohl (*p);
       p++;
       free (rpcbuf);
+
+      if (plus)
+	pthread_mutex_lock (&dir->lock);
     }
 
   /* Return it all to the user */
@@ -1813,6 +2196,34 @@ fetch_directory (struct iouser *cred, struct node *dir,
   return 0;
 }
 
+/* Fetch the complete contents of DIR into a buffer of directs.  Set
+   *BUFP to that buffer.  *BUFP must be freed by the caller when no
+   longer needed.  If an error occurs, don't touch *BUFP and return
+   the error code.  Set BUFSIZEP to the amount of data used inside
+   *BUFP and TOTALENTRIES to the total number of entries copied.
+
+   In version 3 READDIRPLUS is used, which returns the fhandle and
+   attributes of each entry as well; they are put in the caches, which
+   saves a LOOKUP and a GETATTR per entry to `ls -l'.  */
+static error_t
+fetch_directory (struct iouser *cred, struct node *dir,
+		 void **bufp, size_t *bufsizep, int *totalentries)
+{
+  error_t err;
+
+  if (protocol_version == 3 && ! readdirplus_refused)
+    {
+      err = fetch_entries (cred, dir, 1, bufp, bufsizep, totalentries);
+      if (err != EOPNOTSUPP && err != EPROCUNAVAIL && err != EBADRPC)
+	return err;
+
+      /* The server doesn't do READDIRPLUS; don't ask it again.  */
+      readdirplus_refused = 1;
+    }
+
+  return fetch_entries (cred, dir, 0, bufp, bufsizep, totalentries);
+}
+
 
 /* Implement the netfs_get_directs callback as described in
    <hurd/netfs.h>.  */
@@ -0,0 +1,395 @@
+/* pager.c - Caching of file contents for NFS client.
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* The contents of a regular file are cached in the memory object of a
+   pager, which is also what io_map hands out.  netfs_attempt_read
+   copies from it, and writes go to the server and drop the pages they
+   touch.  Whenever fresh attributes of the file show a modification
+   time other than the one the cache was filled at, the cache is
+   dropped (see register_fresh_stat); as the attributes are fetched
+   again on open and at least every cache_timeout seconds, this gives
+   close-to-open consistency.  */
+
+#include "nfs.h"
+#include <hurd/pager.h>
+#include <error.h>
+#include <string.h>
+
+/* When a file is read sequentially, the number of pages read ahead
+   starts at READ_AHEAD_MIN_PAGES and doubles with each sequential
+   fault, up to READ_AHEAD_MAX_PAGES.  */
+#define READ_AHEAD_MIN_PAGES	4
+#define READ_AHEAD_MAX_PAGES	32
+
+pthread_spinlock_t node2pagelock = PTHREAD_SPINLOCK_INITIALIZER;
+
+static struct port_bucket *pager_bucket;
+static struct pager_requests *pager_requests;
+
+/* Implement the pager_read_page callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  If the file is being
+   read sequentially, the pages after PAGE are read along with it and
+   offered to the kernel.  */
+error_t
+pager_read_page (struct user_pager_info *upi,
+		 vm_offset_t page,
+		 vm_address_t *buf,
+		 int *writelock)
+{
+  error_t err;
+  off_t size = upi->np->nn_stat.st_size;
+  vm_size_t len;
+  size_t amt;
+  void *data;
+
+  /* A fault right after the pages we last read (ahead) means the file
+     is being read sequentially; open the read-ahead window, or widen
+     it.  Anything else closes it.  */
+  if (page == upi->read_ahead_next)
+    {
+      if (upi->read_ahead_pages == 0)
+	upi->read_ahead_pages = READ_AHEAD_MIN_PAGES;
+      else if (upi->read_ahead_pages < READ_AHEAD_MAX_PAGES)
+	upi->read_ahead_pages *= 2;
+    }
+  else
+    upi->read_ahead_pages = 0;
+
+  len = (1 + upi->read_ahead_pages) * vm_page_size;
+  if (page + len > size)
+    /* Don't read ahead past the end of the file.  */
+    len = page < size ? round_page (size - page) : vm_page_size;
+  upi->read_ahead_next = page + len;
+
+  data = mmap (0, len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (data == MAP_FAILED)
+    return EIO;
+
+  /* Whatever the server does not have reads as zeros.  */
+  if (page < size)
+    {
+      amt = len;
+      err = nfs_read_data (0, upi->np, upi, page, &amt, data);
+      if (err)
+	{
+	  munmap (data, len);
+	  return EIO;
+	}
+    }
+
+  /* This is safe because no write-back for this pager can happen while
+     we are servicing one of its paging requests.  */
+  if (len > vm_page_size)
+    pager_offer_pages (upi->p, 0, 0, page + vm_page_size,
+		       (vm_address_t) data + vm_page_size, len - vm_page_size);
+
+  *buf = (vm_address_t) data;
+  *writelock = 0;
+  return 0;
+}
+
+/* Write the LENGTH bytes at BUF to the file of UPI at OFFSET, leaving
+   out what lies past the end of the file.  */
+static error_t
+write_file_pages (struct user_pager_info *upi, vm_offset_t offset,
+		  vm_address_t buf, vm_size_t length)
+{
+  error_t err;
+  off_t size = upi->np->nn_stat.st_size;
+  size_t amt;
+
+  /* Mapping a file can't extend it.  */
+  if (offset >= size)
+    return 0;
+
+  amt = length;
+  if (amt > size - offset)
+    amt = size - offset;
+
+  err = nfs_write_data (0, upi->np, upi, offset, &amt, (void *) buf);
+  if (err == ENOSPC || err == EDQUOT)
+    return err;
+  return err ? EIO : 0;
+}
+
+/* Implement the pager_write_page callback from the pager library.  See
+   <hurd/pager.h> for the interface definition.  */
+error_t
+pager_write_page (struct user_pager_info *upi,
+		  vm_offset_t page,
+		  vm_address_t buf)
+{
+  return write_file_pages (upi, page, buf, vm_page_size);
+}
+
+/* Implement the pager_write_pages callback from the pager library, so
+   that the pages of one data return are written with as many WRITE
+   RPC's in flight as rpc_window allows.  */
+void
+pager_write_pages (struct user_pager_info *upi,
+		   vm_offset_t offset,
+		   vm_address_t buf,
+		   vm_size_t length,
+		   error_t *errors)
+{
+  error_t err = write_file_pages (upi, offset, buf, length);
+  vm_size_t i;
+
+  for (i = 0; i < length / vm_page_size; i++)
+    errors[i] = err;
+}
+
+/* Implement the pager_unlock_page callback from the pager library.
+   Whether writing is permitted is up to the server.  */
+error_t
+pager_unlock_page (struct user_pager_info *upi,
+		   vm_offset_t address)
+{
+  return 0;
+}
+
+void
+pager_notify_evict (struct user_pager_info *upi,
+		    vm_offset_t page)
+{
+  assert (!"unrequested notification on eviction");
+}
+
+/* Tell how big the file is. */
+error_t
+pager_report_extent (struct user_pager_info *upi,
+		     vm_address_t *offset,
+		     vm_size_t *size)
+{
+  *offset = 0;
+  *size = upi->np->nn_stat.st_size;
+  return 0;
+}
+
+/* Implement the pager_clear_user_data callback from the pager library. */
+void
+pager_clear_user_data (struct user_pager_info *upi)
+{
+  struct node *np = upi->np;
+
+  pthread_spin_lock (&node2pagelock);
+  if (np->nn->fileinfo == upi)
+    np->nn->fileinfo = 0;
+  pthread_spin_unlock (&node2pagelock);
+
+  /* NP was kept in the node cache for the sake of our data.  */
+  release_cached_node (np);
+  netfs_nrele_light (np);
+  free (upi);
+}
+
+void
+pager_dropweak (struct user_pager_info *upi)
+{
+}
+
+/* Create the port bucket for the pagers, and start the threads that
+   serve them.  */
+void
+create_pager_bucket (void)
+{
+  error_t err;
+
+  pager_bucket = ports_create_bucket ();
+  err = pager_start_workers (pager_bucket, &pager_requests);
+  if (err)
+    error (2, err, "starting pager worker threads");
+}
+
+/* Implement the netfs_get_filemap callback as described in
+   <hurd/netfs.h>.  The pager of NP is created if need be.  If PROT
+   allows writing, it pages with the ids of CRED from now on.  */
+mach_port_t
+netfs_get_filemap (struct node *np, struct iouser *cred, vm_prot_t prot)
+{
+  struct user_pager_info *upi;
+  struct pager *p;
+  mach_port_t right;
+  uid_t uid;
+  gid_t gid, second_gid;
+  int write = prot & VM_PROT_WRITE;
+
+  if (! S_ISREG (np->nn_stat.st_mode))
+    {
+      errno = EOPNOTSUPP;
+      return MACH_PORT_NULL;
+    }
+
+  nfs_choose_ids (cred, np, -1, &uid, &gid, &second_gid);
+
+  pthread_spin_lock (&node2pagelock);
+
+  do
+    if (!np->nn->fileinfo)
+      {
+	upi = malloc (sizeof (struct user_pager_info));
+	if (! upi)
+	  {
+	    pthread_spin_unlock (&node2pagelock);
+	    errno = ENOMEM;
+	    return MACH_PORT_NULL;
+	  }
+	upi->np = np;
+	upi->uid = uid;
+	upi->gid = gid;
+	upi->writer = 0;
+	upi->read_ahead_next = 0;
+	upi->read_ahead_pages = 0;
+	netfs_nref_light (np);
+	upi->p = pager_create (upi, pager_bucket, 1,
+			       MEMORY_OBJECT_COPY_DELAY, 0);
+	if (upi->p == 0)
+	  {
+	    netfs_nrele_light (np);
+	    free (upi);
+	    pthread_spin_unlock (&node2pagelock);
+	    return MACH_PORT_NULL;
+	  }
+	np->nn->fileinfo = upi;
+	right = pager_get_port (np->nn->fileinfo->p);
+	ports_port_deref (np->nn->fileinfo->p);
+      }
+    else
+      {
+	/* Because NP->nn->fileinfo->p is not a real reference,
+	   this might be nearly deallocated.  If that's so, then
+	   the port right will be null.  In that case, clear here
+	   and loop.  The deallocation will complete separately. */
+	right = pager_get_port (np->nn->fileinfo->p);
+	if (right == MACH_PORT_NULL)
+	  np->nn->fileinfo = 0;
+      }
+  while (right == MACH_PORT_NULL);
+
+  upi = np->nn->fileinfo;
+  p = 0;
+  if (write
+      && upi->writer && (upi->uid != uid || upi->gid != gid))
+    {
+      /* The pages dirtied through the mappings of the previous writer
+	 must be written back with its ids.  */
+      p = upi->p;
+      ports_port_ref (p);
+    }
+  else if (write)
+    {
+      upi->uid = uid;
+      upi->gid = gid;
+      upi->writer = 1;
+    }
+
+  pthread_spin_unlock (&node2pagelock);
+
+  if (p)
+    {
+      pager_sync (p, 1);
+
+      pthread_spin_lock (&node2pagelock);
+      if (np->nn->fileinfo && np->nn->fileinfo->p == p)
+	{
+	  np->nn->fileinfo->uid = uid;
+	  np->nn->fileinfo->gid = gid;
+	}
+      pthread_spin_unlock (&node2pagelock);
+      ports_port_deref (p);
+    }
+
+  mach_port_insert_right (mach_task_self (), right, right,
+			  MACH_MSG_TYPE_MAKE_SEND);
+
+  return right;
+}
+
+/* Drop the LEN bytes from START of the contents of NP from the cache,
+   or all of them if LEN is zero, and wait until that is done.  If
+   WRITE_BACK is set, what was changed through a mapping is written to
+   the server first; otherwise it is lost.  */
+void
+invalidate_file_data (struct node *np, vm_offset_t start, vm_size_t len,
+		      int write_back)
+{
+  struct pager *p = 0;
+
+  pthread_spin_lock (&node2pagelock);
+  if (np->nn->fileinfo)
+    {
+      p = np->nn->fileinfo->p;
+      ports_port_ref (p);
+    }
+  pthread_spin_unlock (&node2pagelock);
+
+  if (! p)
+    return;
+
+  if (len == 0)
+    {
+      if (write_back)
+	pager_return (p, 1);
+      else
+	pager_flush (p, 1);
+    }
+  else
+    {
+      if (write_back)
+	pager_return_some (p, start, len, 1);
+      else
+	pager_flush_some (p, start, len, 1);
+    }
+
+  ports_port_deref (p);
+}
+
+/* Write what was changed through a mapping of NP to the server; wait
+   until that is done if WAIT is set.  */
+void
+sync_file_data (struct node *np, int wait)
+{
+  struct pager *p = 0;
+
+  pthread_spin_lock (&node2pagelock);
+  if (np->nn->fileinfo)
+    {
+      p = np->nn->fileinfo->p;
+      ports_port_ref (p);
+    }
+  pthread_spin_unlock (&node2pagelock);
+
+  if (p)
+    {
+      pager_sync (p, wait);
+      ports_port_deref (p);
+    }
+}
+
+/* Do sync_file_data for every file.  */
+void
+sync_all_file_data (int wait)
+{
+  error_t sync_one (void *v_p)
+    {
+      struct pager *p = v_p;
+      pager_sync (p, wait);
+      return 0;
+    }
+
+  ports_bucket_iterate (pager_bucket, sync_one);
+}
@@ -1,5 +1,5 @@
 /* rpc.c - SunRPC management for NFS client.
-   Copyright (C) 1994, 1995, 1996, 1997, 2002 Free Software Foundation
+   Copyright (C) 1994, 1995, 1996, 1997, 2002, 2026 Free Software Foundation
 
    This program is free software; you can redistribute it and/or
    modify it under the terms of the GNU General Public License as
@@ -31,6 +31,7 @@
 #undef malloc			/* Get rid of the sun block.  */
 
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include <assert.h>
 #include <errno.h>
 #include <error.h>
@@ -42,6 +43,12 @@ struct rpc_list
 {
   struct rpc_list *next, **prevp;
   void *reply;
+
+  /* The length of the message, and the state of its retransmission.  */
+  size_t len;
+  int timeout;
+  time_t lasttrans;
+  int ntransmit;
 };
 
 /* A list of all pending RPCs.  */
@@ -54,6 +61,25 @@ static pthread_cond_t rpc_wakeup = PTHREAD_COND_INITIALIZER;
 /* Lock the global data and the REPLY fields of outstanding RPC's.  */
 static pthread_mutex_t outstanding_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Set once we talk to the server over TCP rather than UDP.  */
+static int tcp_transport;
+
+/* The address of the server to connect to over TCP, and the connection
+   to it, or -1 if there is none at the moment.  These are protected by
+   TCP_LOCK, which is also held while a message is sent so that they are
+   not mixed up; TCP_CONNECTED is signalled when a connection is made.  */
+static struct sockaddr_in tcp_server;
+static int tcp_socket = -1;
+static pthread_mutex_t tcp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tcp_connected = PTHREAD_COND_INITIALIZER;
+
+/* In the record marking of RPC over TCP, the header of each fragment of
+   a record holds its length, and this bit if it is the last one.  */
+#define LAST_FRAGMENT	0x80000000
+
+/* Drop the connection rather than take in a record larger than this.  */
+#define MAX_RECORD_SIZE	(1024 * 1024)
+
 
 
 /* Generate and return a new transaction ID.  */
@@ -166,6 +192,185 @@ link_rpc (struct rpc_list **list, struct rpc_list *hdr)
   *list = hdr;
 }
 
+/* Connect to TCP_SERVER.  TCP_LOCK must be held.  */
+static error_t
+tcp_connect (void)
+{
+  error_t err;
+  int fd;
+
+  fd = socket (PF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    return errno;
+
+  /* As for the UDP socket, try for a privileged port; if we aren't
+     allowed one, let the server deny us later if it wants.  */
+  bindresvport (fd, 0);
+
+  if (connect (fd, (struct sockaddr *) &tcp_server,
+	       sizeof (struct sockaddr_in)) == -1)
+    {
+      err = errno;
+      close (fd);
+      return err;
+    }
+
+  tcp_socket = fd;
+  pthread_cond_broadcast (&tcp_connected);
+  return 0;
+}
+
+/* Send the LEN bytes at MSG as one record over the TCP connection.
+   TCP_LOCK must be held.  */
+static error_t
+tcp_send (void *msg, size_t len)
+{
+  uint32_t marker = htonl (LAST_FRAGMENT | len);
+  struct iovec iov[2] =
+    {
+      { &marker, sizeof marker },
+      { msg, len },
+    };
+  struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+  ssize_t cc;
+
+  while (mh.msg_iovlen > 0)
+    {
+      cc = sendmsg (tcp_socket, &mh, MSG_NOSIGNAL);
+      if (cc == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+
+      /* Skip what has been sent.  */
+      while (mh.msg_iovlen > 0 && cc >= mh.msg_iov->iov_len)
+	{
+	  cc -= mh.msg_iov->iov_len;
+	  mh.msg_iov++;
+	  mh.msg_iovlen--;
+	}
+      if (mh.msg_iovlen > 0)
+	{
+	  mh.msg_iov->iov_base += cc;
+	  mh.msg_iov->iov_len -= cc;
+	}
+    }
+
+  return 0;
+}
+
+/* Send the LEN bytes of the RPC message at MSG to the server.  */
+static error_t
+send_message (void *msg, size_t len)
+{
+  ssize_t cc;
+  error_t err;
+
+  if (! tcp_transport)
+    {
+      cc = write (main_udp_socket, msg, len);
+      if (cc == -1)
+	return errno;
+      assert (cc == len);
+      return 0;
+    }
+
+  pthread_mutex_lock (&tcp_lock);
+  err = 0;
+  if (tcp_socket == -1)
+    err = tcp_connect ();
+  if (! err)
+    {
+      err = tcp_send (msg, len);
+      if (err)
+	/* Have tcp_receive_thread close the connection.  */
+	shutdown (tcp_socket, SHUT_RDWR);
+    }
+  pthread_mutex_unlock (&tcp_lock);
+
+  /* If the message did not get through, it is sent again when the RPC
+     times out, on a new connection; a soft mount still gives up after
+     soft_retries tries.  */
+  return 0;
+}
+
+/* Transmit the RPC HDR, which must be linked into the list of pending
+   RPC's.  OUTSTANDING_LOCK must be held; it is released while the
+   message is sent, so that the replies to other RPC's can be taken in
+   meanwhile.  If an error is returned, HDR has been unlinked.  */
+static error_t
+transmit_rpc (struct rpc_list *hdr)
+{
+  error_t err;
+
+  /* If we've sent enough, give up.  */
+  if (mounted_soft && hdr->ntransmit == soft_retries)
+    {
+      unlink_rpc (hdr);
+      return ETIMEDOUT;
+    }
+
+  /* Issue the RPC.  */
+  hdr->lasttrans = mapped_time->seconds;
+  hdr->ntransmit++;
+  pthread_mutex_unlock (&outstanding_lock);
+  err = send_message ((void *) hdr + sizeof (struct rpc_list), hdr->len);
+  pthread_mutex_lock (&outstanding_lock);
+
+  /* A reply to an earlier transmission may have come in meanwhile.  */
+  if (err && ! hdr->reply)
+    {
+      unlink_rpc (hdr);
+      return err;
+    }
+
+  return 0;
+}
+
+/* Send the specified RPC message without waiting for the reply.  RPCBUF
+   is the initialized buffer from a previous initialize_rpc call; P, the
+   payload, points past the filled in args.  The reply must be collected
+   with finish_rpc, or given up on with abandon_rpc, unless an error is
+   returned, in which case RPCBUF has not been freed.  Several RPC's may
+   be in flight at once this way.  */
+error_t
+start_rpc (void *rpcbuf, int *p)
+{
+  struct rpc_list *hdr = rpcbuf;
+  error_t err;
+
+  hdr->len = (void *) p - rpcbuf - sizeof (struct rpc_list);
+  hdr->timeout = initial_transmit_timeout;
+  hdr->ntransmit = 0;
+
+  pthread_mutex_lock (&outstanding_lock);
+  link_rpc (&outstanding_rpcs, hdr);
+  err = transmit_rpc (hdr);
+  pthread_mutex_unlock (&outstanding_lock);
+
+  return err;
+}
+
+/* Give up on the RPC RPCBUF started with start_rpc, and free it, along
+   with its reply if one has arrived.  */
+void
+abandon_rpc (void *rpcbuf)
+{
+  struct rpc_list *hdr = rpcbuf;
+  void *reply;
+
+  pthread_mutex_lock (&outstanding_lock);
+  reply = hdr->reply;
+  if (! reply)
+    unlink_rpc (hdr);
+  pthread_mutex_unlock (&outstanding_lock);
+
+  free (reply);
+  free (hdr);
+}
+
 /* Send the specified RPC message.  *RPCBUF is the initialized buffer
    from a previous initialize_rpc call; *PP, the payload, points past
    the filledin args.  Set *PP to the address of the reply contents
@@ -174,56 +379,42 @@ link_rpc (struct rpc_list **list, struct rpc_list *hdr)
    *RPCBUF will be freed by this routine.  */
 error_t
 conduct_rpc (void **rpcbuf, int **pp)
+{
+  error_t err = start_rpc (*rpcbuf, *pp);
+
+  if (err)
+    return err;
+
+  return finish_rpc (rpcbuf, pp);
+}
+
+/* Wait for the reply to the RPC *RPCBUF started with start_rpc,
+   retransmitting it as necessary, and process it as conduct_rpc
+   does.  */
+error_t
+finish_rpc (void **rpcbuf, int **pp)
 {
   struct rpc_list *hdr = *rpcbuf;
   error_t err;
-  size_t cc, nc;
-  int timeout = initial_transmit_timeout;
-  time_t lasttrans;
-  int ntransmit = 0;
   int *p;
   int xid;
   int n;
   int cancel;
-  
-  pthread_mutex_lock (&outstanding_lock);
-
-  link_rpc (&outstanding_rpcs, hdr);
 
   xid = * (int *) (*rpcbuf + sizeof (struct rpc_list));
 
-  do
-    {
-      /* If we've sent enough, give up.  */
-      if (mounted_soft && ntransmit == soft_retries)
-	{
-	  unlink_rpc (hdr);
-	  pthread_mutex_unlock (&outstanding_lock);
-	  return ETIMEDOUT;
-	}
+  pthread_mutex_lock (&outstanding_lock);
 
-      /* Issue the RPC.  */
-      lasttrans = mapped_time->seconds;
-      ntransmit++;
-      nc = (void *) *pp - *rpcbuf - sizeof (struct rpc_list);
-      cc = write (main_udp_socket, *rpcbuf + sizeof (struct rpc_list), nc);
-      if (cc == -1)
-	{
-	  unlink_rpc (hdr);
-	  pthread_mutex_unlock (&outstanding_lock);
-	  return errno;
-	}
-      else 
-	assert (cc == nc);
-      
+  while (!hdr->reply)
+    {
       /* Wait for reply.  */
       cancel = 0;
       while (!hdr->reply
-	     && (mapped_time->seconds - lasttrans < timeout)
+	     && (mapped_time->seconds - hdr->lasttrans < hdr->timeout)
 	     && !cancel)
 	cancel = pthread_hurd_cond_wait_np (&rpc_wakeup, &outstanding_lock);
-  
-      if (cancel)
+
+      if (cancel && !hdr->reply)
 	{
 	  unlink_rpc (hdr);
 	  pthread_mutex_unlock (&outstanding_lock);
@@ -235,12 +426,18 @@ conduct_rpc (void **rpcbuf, int **pp)
          otherwise, retransmit and continue to wait.  */
       if (!hdr->reply)
 	{
-	  timeout *= 2;
-	  if (timeout > max_transmit_timeout)
-	    timeout = max_transmit_timeout;
+	  hdr->timeout *= 2;
+	  if (hdr->timeout > max_transmit_timeout)
+	    hdr->timeout = max_transmit_timeout;
+
+	  err = transmit_rpc (hdr);
+	  if (err)
+	    {
+	      pthread_mutex_unlock (&outstanding_lock);
+	      return err;
+	    }
 	}
     }
-  while (!hdr->reply);
 
   pthread_mutex_unlock (&outstanding_lock);
 
@@ -365,6 +562,37 @@ timeout_service_thread (void *arg)
   return NULL;
 }
 
+/* Hand the reply in BUF to the pending RPC it answers, and return
+   nonzero.  If no RPC is waiting for it, return zero; BUF is then still
+   the caller's.  */
+static int
+deliver_reply (void *buf)
+{
+  struct rpc_list *r;
+  int xid = *(int *)buf;
+
+  pthread_mutex_lock (&outstanding_lock);
+
+  /* Find the rpc that we just fulfilled.  */
+  for (r = outstanding_rpcs; r; r = r->next)
+    {
+      if (* (int *) &r[1] == xid)
+	{
+	  unlink_rpc (r);
+	  r->reply = buf;
+	  pthread_cond_broadcast (&rpc_wakeup);
+	  break;
+	}
+    }
+#if 0
+  if (! r)
+    fprintf (stderr, "NFS dropping reply xid %d\n", xid);
+#endif
+  pthread_mutex_unlock (&outstanding_lock);
+
+  return r != 0;
+}
+
 /* Dedicate thread to receive RPC replies, register them on the queue
    of pending wakeups, and deal appropriately.  */
 void *
@@ -386,40 +614,160 @@ rpc_receive_thread (void *arg)
           error (0, errno, "nfs read");
           continue;
         }
-      else
-        {
-          struct rpc_list *r;
-          int xid = *(int *)buf;
-
-          pthread_mutex_lock (&outstanding_lock);
-
-          /* Find the rpc that we just fulfilled.  */
-          for (r = outstanding_rpcs; r; r = r->next)
-    	    {
-    	      if (* (int *) &r[1] == xid)
-	        {
-	          unlink_rpc (r);
-	          r->reply = buf;
-	          pthread_cond_broadcast (&rpc_wakeup);
-		  break;
-	        }
-	    }
-#if 0
-	  if (! r)
-	    fprintf (stderr, "NFS dropping reply xid %d\n", xid);
-#endif
-	  pthread_mutex_unlock (&outstanding_lock);
 
-	  /* If r is not null then we had a message from a pending
-	     (i.e. known) rpc.  Thus, it was fulfilled and if we want
-	     to get another request, a new buffer is needed.  */
-	  if (r)
-	    {
-              buf = malloc (1024 + read_size);
-              assert (buf);
-	    }
-        }
+      /* If the reply was for a pending (i.e. known) rpc, then it was
+	 fulfilled and if we want to get another reply, a new buffer is
+	 needed.  */
+      if (deliver_reply (buf))
+	{
+	  buf = malloc (1024 + read_size);
+	  assert (buf);
+	}
     }
 
   return NULL;
 }
+
+/* Read LEN bytes from FD into BUF.  */
+static error_t
+read_fully (int fd, void *buf, size_t len)
+{
+  ssize_t cc;
+
+  while (len > 0)
+    {
+      cc = read (fd, buf, len);
+      if (cc == 0)
+	return ECONNRESET;
+      if (cc == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+      buf += cc;
+      len -= cc;
+    }
+
+  return 0;
+}
+
+/* Read a record, made of one or more fragments, from the TCP connection
+   FD.  Return it in *BUFP, allocated with malloc, and its length in
+   *LENP.  */
+static error_t
+read_record (int fd, void **bufp, size_t *lenp)
+{
+  void *buf = 0, *newbuf;
+  size_t len = 0, frag;
+  uint32_t marker;
+  error_t err;
+
+  do
+    {
+      err = read_fully (fd, &marker, sizeof marker);
+      if (err)
+	break;
+      marker = ntohl (marker);
+
+      frag = marker & ~LAST_FRAGMENT;
+      if (len + frag > MAX_RECORD_SIZE)
+	{
+	  err = EMSGSIZE;
+	  break;
+	}
+
+      newbuf = realloc (buf, len + frag);
+      if (! newbuf && len + frag > 0)
+	{
+	  err = ENOMEM;
+	  break;
+	}
+      buf = newbuf;
+
+      err = read_fully (fd, buf + len, frag);
+      if (err)
+	break;
+      len += frag;
+    }
+  while (! (marker & LAST_FRAGMENT));
+
+  if (err)
+    {
+      free (buf);
+      return err;
+    }
+
+  *bufp = buf;
+  *lenp = len;
+  return 0;
+}
+
+/* Dedicated thread to receive RPC replies over TCP, like
+   rpc_receive_thread.  When the connection is lost, it is closed, and
+   all pending RPC's are sent again at once; that makes a new one.  */
+static void *
+tcp_receive_thread (void *arg)
+{
+  struct rpc_list *r;
+  void *buf;
+  size_t len;
+  error_t err;
+  int fd;
+
+  (void) arg;
+
+  while (1)
+    {
+      pthread_mutex_lock (&tcp_lock);
+      while (tcp_socket == -1)
+	pthread_cond_wait (&tcp_connected, &tcp_lock);
+      fd = tcp_socket;
+      pthread_mutex_unlock (&tcp_lock);
+
+      while (! (err = read_record (fd, &buf, &len)))
+	if (len < sizeof (int) || ! deliver_reply (buf))
+	  free (buf);
+
+      if (err != ECONNRESET)
+	error (0, err, "nfs read");
+
+      pthread_mutex_lock (&tcp_lock);
+      close (fd);
+      tcp_socket = -1;
+      pthread_mutex_unlock (&tcp_lock);
+
+      pthread_mutex_lock (&outstanding_lock);
+      for (r = outstanding_rpcs; r; r = r->next)
+	r->lasttrans = 0;
+      pthread_cond_broadcast (&rpc_wakeup);
+      pthread_mutex_unlock (&outstanding_lock);
+    }
+
+  return NULL;
+}
+
+/* Talk to the server at ADDR over TCP from now on, with the record
+   marking of RFC 5531, instead of over main_udp_socket.  The connection
+   is made again whenever it is lost.  */
+error_t
+rpc_use_tcp (struct sockaddr_in *addr)
+{
+  pthread_t thread;
+  error_t err;
+
+  pthread_mutex_lock (&tcp_lock);
+  tcp_server = *addr;
+  err = tcp_connect ();
+  pthread_mutex_unlock (&tcp_lock);
+  if (err)
+    return err;
+
+  err = pthread_create (&thread, NULL, tcp_receive_thread, NULL);
+  if (err)
+    return err;
+  pthread_detach (thread);
+
+  tcp_transport = 1;
+  return 0;
+}
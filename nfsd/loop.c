@@ -1,5 +1,5 @@
 /* loop.c - Main server loop for nfs server.
-   Copyright (C) 1996,98,2002,2006 Free Software Foundation, Inc.
+   Copyright (C) 1996,98,2002,2006,2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -20,6 +20,9 @@
 
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 #include "nfsd.h"
 
@@ -35,190 +38,497 @@
 #include <rpc/rpc_msg.h>
 #undef malloc
 
-void *
-server_loop (void *arg)
+/* The bit of a record marker that flags the last fragment of a record
+   (RFC 5531, section 11).  */
+#define LAST_FRAGMENT 0x80000000
+
+/* The largest call we accept over TCP.  Calls are never much larger
+   than the largest write.  */
+#define MAXRECORDSIZE (MAXTRANSFER + 1024)
+
+/* Process the RPC call of LEN bytes at BUF, which came from SENDER.
+   Return the reply to send back, which the caller must release with
+   release_cached_reply once it has been sent, or null if the message
+   is to be ignored.  */
+static struct cached_reply *
+process_call (void *buf, size_t len, struct sockaddr_in *sender)
 {
-  int fd = (int) arg;
-  char buf[MAXIOSIZE];
   int xid;
-  int *p, *r;
+  int *p = buf, *r;
   char *rbuf;
   struct cached_reply *cr;
   int program;
-  struct sockaddr_in sender;
   int version;
   int procedure;
   struct proctable *table = 0;
-  struct procedure *proc;
+  struct procedure *proc = 0;
   struct idspec *cred;
   struct cache_handle *c, fakec;
   error_t err;
-  socklen_t addrlen;
-  int cc;
 
   memset (&fakec, 0, sizeof (struct cache_handle));
 
+  if (len < 2 * sizeof (int))
+    return 0;
+  xid = *(p++);
+
+  /* Ignore things that aren't proper RPCs.  */
+  if (ntohl (*p) != CALL)
+    return 0;
+  p++;
+
+  cr = check_cached_replies (xid, sender);
+  if (cr->data)
+    /* This transacation has already completed.  */
+    return cr;
+
+  r = (int *) (rbuf = malloc (MAXIOSIZE));
+
+  if (ntohl (*p) != RPC_MSG_VERSION)
+    {
+      /* Reject RPC.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_DENIED);
+      *(r++) = htonl (RPC_MISMATCH);
+      *(r++) = htonl (RPC_MSG_VERSION);
+      *(r++) = htonl (RPC_MSG_VERSION);
+      goto send_reply;
+    }
+  p++;
+
+  program = ntohl (*p);
+  p++;
+  switch (program)
+    {
+    case MOUNTPROG:
+      version = MOUNTVERS;
+      table = &mounttable;
+      break;
+
+    case NFS_PROGRAM:
+      version = NFS_VERSION;
+      table = &nfs2table;
+      break;
+
+    case PMAPPROG:
+      version = PMAPVERS;
+      table = &pmaptable;
+      break;
+
+    default:
+      /* Program unavailable.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_ACCEPTED);
+      *(r++) = htonl (AUTH_NULL);
+      *(r++) = htonl (0);
+      *(r++) = htonl (PROG_UNAVAIL);
+      goto send_reply;
+    }
+
+  if (ntohl (*p) != version)
+    {
+      /* Program mismatch.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_ACCEPTED);
+      *(r++) = htonl (AUTH_NULL);
+      *(r++) = htonl (0);
+      *(r++) = htonl (PROG_MISMATCH);
+      *(r++) = htonl (version);
+      *(r++) = htonl (version);
+      goto send_reply;
+    }
+  p++;
+
+  procedure = htonl (*p);
+  p++;
+  if (procedure < table->min
+      || procedure > table->max
+      || table->procs[procedure - table->min].func == 0)
+    {
+      /* Procedure unavailable.  */
+      *(r++) = xid;
+      *(r++) = htonl (REPLY);
+      *(r++) = htonl (MSG_ACCEPTED);
+      *(r++) = htonl (AUTH_NULL);
+      *(r++) = htonl (0);
+      *(r++) = htonl (PROC_UNAVAIL);
+      *(r++) = htonl (table->min);
+      *(r++) = htonl (table->max);
+      goto send_reply;
+    }
+  proc = &table->procs[procedure - table->min];
+
+  p = process_cred (p, &cred);
+
+  if (proc->need_handle)
+    p = lookup_cache_handle (p, &c, cred);
+  else
+    {
+      fakec.ids = cred;
+      c = &fakec;
+    }
+
+  if (proc->alloc_reply)
+    {
+      size_t amt;
+      amt = (*proc->alloc_reply) (p, version) + 256;
+      if (amt > MAXIOSIZE)
+	{
+	  free (rbuf);
+	  r = (int *) (rbuf = malloc (amt));
+	}
+    }
+
+  /* Fill in beginning of reply.  */
+  *(r++) = xid;
+  *(r++) = htonl (REPLY);
+  *(r++) = htonl (MSG_ACCEPTED);
+  *(r++) = htonl (AUTH_NULL);
+  *(r++) = htonl (0);
+  *(r++) = htonl (SUCCESS);
+  if (!proc->process_error)
+    /* The function does its own error processing, and we ignore
+       its return value.  */
+    (void) (*proc->func) (c, p, &r, version);
+  else
+    {
+      if (c)
+	{
+	  /* Assume success for now and patch it later if necessary.  */
+	  int *errloc = r;
+	  *(r++) = htonl (0);
+	  /* Call processing function, its output after error code.  */
+	  err = (*proc->func) (c, p, &r, version);
+	  if (err)
+	    {
+	      r = errloc;	/* Back up, patch error code, discard rest.  */
+	      *(r++) = htonl (nfs_error_trans (err, version));
+	    }
+	}
+      else
+	*(r++) = htonl (nfs_error_trans (ESTALE, version));
+    }
+
+  cred_rele (cred);
+  if (c && c != &fakec)
+    cache_handle_rele (c);
+
+ send_reply:
+  cr->data = rbuf;
+  cr->len = (char *)r - rbuf;
+  return cr;
+}
+
+/* Serve the calls that come in on the UDP socket ARG.  */
+void *
+server_loop (void *arg)
+{
+  int fd = (int) arg;
+  char buf[MAXIOSIZE];
+  struct cached_reply *cr;
+  struct sockaddr_in sender;
+  socklen_t addrlen;
+  int cc;
+
   for (;;)
     {
-      p = (int *) buf;
-      proc = 0;
       addrlen = sizeof (struct sockaddr_in);
       cc = recvfrom (fd, buf, MAXIOSIZE, 0, &sender, &addrlen);
       if (cc == -1)
 	continue;		/* Ignore errors.  */
-      xid = *(p++);
 
-      /* Ignore things that aren't proper RPCs.  */
-      if (ntohl (*p) != CALL)
+      cr = process_call (buf, cc, &sender);
+      if (! cr)
 	continue;
-      p++;
 
-      cr = check_cached_replies (xid, &sender);
-      if (cr->data)
-	/* This transacation has already completed.  */
-	goto repost_reply;
+      sendto (fd, cr->data, cr->len, 0,
+	      (struct sockaddr *) &sender, addrlen);
+      release_cached_reply (cr);
+    }
+}
 
-      r = (int *) (rbuf = malloc (MAXIOSIZE));
+/* A TCP connection from a client.  It is served by several threads
+   at once: each of them reads a whole call under READ_LOCK, processes
+   it, and writes the whole reply under WRITE_LOCK.  The last of them
+   to give up on the connection closes it.  */
+struct connection
+{
+  int fd;
+  struct sockaddr_in peer;
+  pthread_mutex_t read_lock;
+  pthread_mutex_t write_lock;
+  int threads;
+  /* The number of calls read and not answered yet.  */
+  int busy;
+};
 
-      if (ntohl (*p) != RPC_MSG_VERSION)
+/* The number of TCP connections being served, on all the ports.  No
+   more than MAXCONNECTIONS are accepted at once.  */
+static int connections;
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connections_wakeup = PTHREAD_COND_INITIALIZER;
+
+/* Close CONN, which nobody serves any more, and let another connection
+   be accepted in its place.  */
+static void
+release_connection (struct connection *conn)
+{
+  close (conn->fd);
+  free (conn);
+
+  pthread_mutex_lock (&connections_lock);
+  connections--;
+  pthread_cond_signal (&connections_wakeup);
+  pthread_mutex_unlock (&connections_lock);
+}
+
+/* Read LEN bytes from CONN into BUF.  Give up with ETIMEDOUT if the
+   client sends nothing for CONN_IDLE_TIMEOUT seconds, unless IDLE is
+   set and some calls on CONN are still being served: the client may
+   then just be waiting for their replies.  */
+static error_t
+read_fully (struct connection *conn, void *buf, size_t len, int idle)
+{
+  struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+  ssize_t cc;
+  int n;
+
+  while (len > 0)
+    {
+      n = poll (&pfd, 1, CONN_IDLE_TIMEOUT * 1000);
+      if (n == -1)
 	{
-	  /* Reject RPC.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_DENIED);
-	  *(r++) = htonl (RPC_MISMATCH);
-	  *(r++) = htonl (RPC_MSG_VERSION);
-	  *(r++) = htonl (RPC_MSG_VERSION);
-	  goto send_reply;
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+      if (n == 0)
+	{
+	  if (idle && __atomic_load_n (&conn->busy, __ATOMIC_ACQUIRE) > 0)
+	    continue;
+	  return ETIMEDOUT;
 	}
-      p++;
 
-      program = ntohl (*p);
-      p++;
-      switch (program)
+      cc = read (conn->fd, buf, len);
+      if (cc == 0)
+	return ECONNRESET;
+      if (cc == -1)
 	{
-	case MOUNTPROG:
-	  version = MOUNTVERS;
-	  table = &mounttable;
-	  break;
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+      buf += cc;
+      len -= cc;
+    }
 
-	case NFS_PROGRAM:
-	  version = NFS_VERSION;
-	  table = &nfs2table;
-	  break;
+  return 0;
+}
+
+/* Read a record, made of one or more fragments as described in RFC
+   5531, from CONN.  Return it in *BUFP, allocated with malloc, and its
+   length in *LENP.  The buffer always holds MAXRECORDSIZE bytes, those
+   past the record zeroed: like the UDP buffer, it leaves the decoders,
+   which don't check for the end of the call, in bounds however short
+   the call is.  */
+static error_t
+read_record (struct connection *conn, void **bufp, size_t *lenp)
+{
+  void *buf = 0;
+  size_t len = 0, frag;
+  uint32_t marker;
+  error_t err;
+
+  do
+    {
+      /* The client may leave the connection idle between calls, but
+	 not in the middle of one.  */
+      err = read_fully (conn, &marker, sizeof marker, ! buf);
+      if (err)
+	break;
+      marker = ntohl (marker);
 
-	case PMAPPROG:
-	  version = PMAPVERS;
-	  table = &pmaptable;
+      frag = marker & ~LAST_FRAGMENT;
+      if (frag > MAXRECORDSIZE - len)
+	{
+	  err = EMSGSIZE;
 	  break;
+	}
 
-	default:
-	  /* Program unavailable.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_ACCEPTED);
-	  *(r++) = htonl (AUTH_NULL);
-	  *(r++) = htonl (0);
-	  *(r++) = htonl (PROG_UNAVAIL);
-	  goto send_reply;
+      if (! buf)
+	{
+	  buf = malloc (MAXRECORDSIZE);
+	  if (! buf)
+	    {
+	      err = ENOMEM;
+	      break;
+	    }
 	}
 
-      if (ntohl (*p) != version)
+      err = read_fully (conn, buf + len, frag, 0);
+      if (err)
+	break;
+      len += frag;
+    }
+  while (! (marker & LAST_FRAGMENT));
+
+  if (err)
+    {
+      free (buf);
+      return err;
+    }
+
+  memset (buf + len, 0, MAXRECORDSIZE - len);
+  *bufp = buf;
+  *lenp = len;
+  return 0;
+}
+
+/* Send the LEN bytes at BUF as one record over the TCP connection
+   FD.  */
+static error_t
+write_record (int fd, void *buf, size_t len)
+{
+  uint32_t marker = htonl (LAST_FRAGMENT | len);
+  struct iovec iov[2] =
+    {
+      { &marker, sizeof marker },
+      { buf, len },
+    };
+  struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+  ssize_t cc;
+
+  while (mh.msg_iovlen > 0)
+    {
+      cc = sendmsg (fd, &mh, MSG_NOSIGNAL);
+      if (cc == -1)
 	{
-	  /* Program mismatch.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_ACCEPTED);
-	  *(r++) = htonl (AUTH_NULL);
-	  *(r++) = htonl (0);
-	  *(r++) = htonl (PROG_MISMATCH);
-	  *(r++) = htonl (version);
-	  *(r++) = htonl (version);
-	  goto send_reply;
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
 	}
-      p++;
 
-      procedure = htonl (*p);
-      p++;
-      if (procedure < table->min
-	  || procedure > table->max
-	  || table->procs[procedure - table->min].func == 0)
+      /* Skip what has been sent.  */
+      while (mh.msg_iovlen > 0 && cc >= mh.msg_iov->iov_len)
 	{
-	  /* Procedure unavailable.  */
-	  *(r++) = xid;
-	  *(r++) = htonl (REPLY);
-	  *(r++) = htonl (MSG_ACCEPTED);
-	  *(r++) = htonl (AUTH_NULL);
-	  *(r++) = htonl (0);
-	  *(r++) = htonl (PROC_UNAVAIL);
-	  *(r++) = htonl (table->min);
-	  *(r++) = htonl (table->max);
-	  goto send_reply;
+	  cc -= mh.msg_iov->iov_len;
+	  mh.msg_iov++;
+	  mh.msg_iovlen--;
 	}
-      proc = &table->procs[procedure - table->min];
+      if (mh.msg_iovlen > 0)
+	{
+	  mh.msg_iov->iov_base += cc;
+	  mh.msg_iov->iov_len -= cc;
+	}
+    }
 
-      p = process_cred (p, &cred);
+  return 0;
+}
 
-      if (proc->need_handle)
-	p = lookup_cache_handle (p, &c, cred);
-      else
+/* Serve the calls that come in on the struct connection ARG.  */
+static void *
+connection_loop (void *arg)
+{
+  struct connection *conn = arg;
+  struct cached_reply *cr;
+  void *buf;
+  size_t len;
+  error_t err;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&conn->read_lock);
+      err = read_record (conn, &buf, &len);
+      if (! err)
+	__atomic_add_fetch (&conn->busy, 1, __ATOMIC_ACQ_REL);
+      pthread_mutex_unlock (&conn->read_lock);
+      if (err)
+	break;
+
+      cr = process_call (buf, len, &conn->peer);
+      free (buf);
+      if (cr)
 	{
-	  fakec.ids = cred;
-	  c = &fakec;
+	  pthread_mutex_lock (&conn->write_lock);
+	  err = write_record (conn->fd, cr->data, cr->len);
+	  pthread_mutex_unlock (&conn->write_lock);
+	  release_cached_reply (cr);
 	}
+      __atomic_sub_fetch (&conn->busy, 1, __ATOMIC_ACQ_REL);
+      if (err)
+	break;
+    }
+
+  /* Make the other threads give up as well.  */
+  shutdown (conn->fd, SHUT_RDWR);
+
+  if (__atomic_sub_fetch (&conn->threads, 1, __ATOMIC_ACQ_REL) == 0)
+    release_connection (conn);
+  return NULL;
+}
+
+/* Accept connections on the listening TCP socket ARG, and start
+   tcp_threads threads to serve each of them.  Once MAXCONNECTIONS are
+   being served, wait for one of them to be closed first.  */
+void *
+tcp_accept_loop (void *arg)
+{
+  int fd = (int) arg;
+  struct connection *conn;
+  socklen_t addrlen;
+  pthread_t thread;
+  int s, i, n;
 
-      if (proc->alloc_reply)
+  for (;;)
+    {
+      pthread_mutex_lock (&connections_lock);
+      while (connections >= MAXCONNECTIONS)
+	pthread_cond_wait (&connections_wakeup, &connections_lock);
+      connections++;
+      pthread_mutex_unlock (&connections_lock);
+
+      conn = malloc (sizeof (struct connection));
+      if (! conn)
 	{
-	  size_t amt;
-	  amt = (*proc->alloc_reply) (p, version) + 256;
-	  if (amt > MAXIOSIZE)
-	    {
-	      free (rbuf);
-	      r = (int *) (rbuf = malloc (amt));
-	    }
+	  sleep (1);
+	  s = -1;
 	}
-
-      /* Fill in beginning of reply.  */
-      *(r++) = xid;
-      *(r++) = htonl (REPLY);
-      *(r++) = htonl (MSG_ACCEPTED);
-      *(r++) = htonl (AUTH_NULL);
-      *(r++) = htonl (0);
-      *(r++) = htonl (SUCCESS);
-      if (!proc->process_error)
-	/* The function does its own error processing, and we ignore
-	   its return value.  */
-	(void) (*proc->func) (c, p, &r, version);
       else
 	{
-	  if (c)
-	    {
-	      /* Assume success for now and patch it later if necessary.  */
-	      int *errloc = r;
-	      *(r++) = htonl (0);
-	      /* Call processing function, its output after error code.  */
-	      err = (*proc->func) (c, p, &r, version);
-	      if (err)
-		{
-		  r = errloc;	/* Back up, patch error code, discard rest.  */
-		  *(r++) = htonl (nfs_error_trans (err, version));
-		}
-	    }
-	  else
-	    *(r++) = htonl (nfs_error_trans (ESTALE, version));
+	  addrlen = sizeof (struct sockaddr_in);
+	  s = accept (fd, (struct sockaddr *) &conn->peer, &addrlen);
+	}
+      if (s == -1)
+	{
+	  /* Ignore errors.  */
+	  free (conn);
+	  pthread_mutex_lock (&connections_lock);
+	  connections--;
+	  pthread_cond_signal (&connections_wakeup);
+	  pthread_mutex_unlock (&connections_lock);
+	  continue;
 	}
 
-      cred_rele (cred);
-      if (c && c != &fakec)
-	cache_handle_rele (c);
-
-    send_reply:
-      cr->data = rbuf;
-      cr->len = (char *)r - rbuf;
+      conn->fd = s;
+      pthread_mutex_init (&conn->read_lock, NULL);
+      pthread_mutex_init (&conn->write_lock, NULL);
+      conn->threads = tcp_threads;
+      conn->busy = 0;
 
-    repost_reply:
-      sendto (fd, cr->data, cr->len, 0,
-	      (struct sockaddr *) &sender, addrlen);
-      release_cached_reply (cr);
+      /* The threads that fail to start are given up on by the
+	 connection at once.  */
+      for (i = n = 0; i < tcp_threads; i++)
+	if (pthread_create (&thread, NULL, connection_loop, conn) == 0)
+	  {
+	    pthread_detach (thread);
+	    n++;
+	  }
+      if (n < tcp_threads
+	  && __atomic_sub_fetch (&conn->threads, tcp_threads - n,
+				 __ATOMIC_ACQ_REL) == 0)
+	release_connection (conn);
     }
 }
@@ -1,5 +1,5 @@
 /* Main NFS server program
-   Copyright (C) 1996, 2002 Free Software Foundation, Inc.
+   Copyright (C) 1996, 2002, 2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -28,18 +28,20 @@
 #include <error.h>
 
 int main_udp_socket, pmap_udp_socket;
+int main_tcp_socket = -1, pmap_tcp_socket = -1;
+int tcp_threads;
 struct sockaddr_in main_address, pmap_address;
 static char index_file[] = LOCALSTATEDIR "/state/misc/nfsd.index";
 char *index_file_name = index_file;
 
-/* Launch a server loop thread */
+/* Launch a thread running LOOP on SOCKET */
 static void
-create_server_thread (int socket)
+create_server_thread (void *(*loop) (void *), int socket)
 {
   pthread_t thread;
   int fail;
 
-  fail = pthread_create (&thread, NULL, server_loop, (void *) socket);
+  fail = pthread_create (&thread, NULL, loop, (void *) socket);
   if (fail)
     error (1, fail, "Creating main server thread");
 
@@ -48,6 +50,32 @@ create_server_thread (int socket)
     error (1, fail, "Detaching main server thread");
 }
 
+/* Return a TCP socket listening on ADDRESS, or -1 if that fails; NFS
+   is then served over UDP only.  */
+static int
+create_tcp_socket (struct sockaddr_in *address)
+{
+  int fd, one = 1;
+
+  fd = socket (PF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    {
+      error (0, errno, "Creating TCP socket");
+      return -1;
+    }
+
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  if (bind (fd, (struct sockaddr *) address, sizeof (struct sockaddr_in))
+      || listen (fd, SOMAXCONN))
+    {
+      error (0, errno, "Listening on TCP port %d", ntohs (address->sin_port));
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -88,12 +116,22 @@ main (int argc, char **argv)
   if (fail)
     error (1, errno, "Binding PMAP socket");
 
+  main_tcp_socket = create_tcp_socket (&main_address);
+  pmap_tcp_socket = create_tcp_socket (&pmap_address);
+
   init_filesystems ();
 
-  create_server_thread (pmap_udp_socket);
+  /* Each TCP connection gets as many threads as the UDP socket.  */
+  tcp_threads = nthreads;
+
+  create_server_thread (server_loop, pmap_udp_socket);
+  if (pmap_tcp_socket != -1)
+    create_server_thread (tcp_accept_loop, pmap_tcp_socket);
+  if (main_tcp_socket != -1)
+    create_server_thread (tcp_accept_loop, main_tcp_socket);
 
   while (nthreads--)
-    create_server_thread (main_udp_socket);
+    create_server_thread (server_loop, main_udp_socket);
 
   for (;;)
     {
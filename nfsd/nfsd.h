@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 1996,98,2002 Free Software Foundation, Inc.
+   Copyright (C) 1996,98,2002,2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -31,8 +31,15 @@
 #define ID_KEEP_TIMEOUT 3600	/* one hour */
 #define FH_KEEP_TIMEOUT 600	/* ten minutes */
 #define REPLY_KEEP_TIMEOUT 120	/* two minutes */
+#define CONN_IDLE_TIMEOUT 300	/* five minutes */
+#define MAXCONNECTIONS 64	/* TCP connections served at once */
 #define MAXIOSIZE 10240
 
+/* The largest read or write we serve, and the most we advertise as the
+   transfer size.  Over UDP, calls and replies must also fit in
+   MAXIOSIZE, which leaves clients 8K.  */
+#define MAXTRANSFER 65536
+
 struct idspec
 {
   struct idspec *next, **prevp;
@@ -93,6 +100,12 @@ volatile struct mapped_time_value *mapped_time;
 extern int main_udp_socket, pmap_udp_socket;
 extern struct sockaddr_in main_address, pmap_address;
 
+/* The same for TCP; these are -1 if we couldn't listen on them.  */
+extern int main_tcp_socket, pmap_tcp_socket;
+
+/* The number of threads that serve each TCP connection.  */
+extern int tcp_threads;
+
 /* Name of the file on disk containing the filesystem index table */
 extern char *index_file_name;
 
@@ -115,6 +128,7 @@ void scan_replies (void);
 
 /* loop.c */
 void * server_loop (void *);
+void * tcp_accept_loop (void *);
 
 /* ops.c */
 extern struct proctable nfs2table, mounttable, pmaptable;
@@ -1,6 +1,6 @@
 /* ops.c NFS daemon protocol operations.
 
-   Copyright (C) 1996, 2001, 2002, 2007 Free Software Foundation, Inc.
+   Copyright (C) 1996, 2001, 2002, 2007, 2026 Free Software Foundation, Inc.
 
    Written by Michael I. Bushnell, p/BSG.
 
@@ -225,8 +225,11 @@ op_readlink (struct cache_handle *c,
 static size_t
 count_read_buffersize (int *p, int version)
 {
+  size_t count;
+
   p++;			/* Skip OFFSET.  */
-  return ntohl (*p);	/* Return COUNT.  */
+  count = ntohl (*p);
+  return count < MAXTRANSFER ? count : MAXTRANSFER;
 }
 
 static error_t
@@ -246,6 +249,8 @@ op_read (struct cache_handle *c,
   p++;
   count = ntohl (*p);
   p++;
+  if (count > MAXTRANSFER)
+    count = MAXTRANSFER;
 
   err = io_read (c->port, &bp, &buflen, offset, count);
   if (err)
@@ -685,7 +690,9 @@ op_getport (struct cache_handle *c,
   prot = ntohl (*p);
   p++;
 
-  if (prot != IPPROTO_UDP)
+  if (prot != IPPROTO_UDP
+      && (prot != IPPROTO_TCP
+	  || main_tcp_socket == -1 || pmap_tcp_socket == -1))
     *(*reply)++ = htonl (0);
   else if ((prog == MOUNTPROG && vers == MOUNTVERS)
 	   || (prog == NFS_PROGRAM && vers == NFS_VERSION))
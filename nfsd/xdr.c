@@ -1,6 +1,6 @@
 /* xdr.c - XDR packing and unpacking in nfsd.
 
-   Copyright (C) 1996, 2002, 2007 Free Software Foundation, Inc.
+   Copyright (C) 1996, 2002, 2007, 2026 Free Software Foundation, Inc.
 
    Written by Michael I. Bushnell, p/BSG.
 
@@ -132,7 +132,7 @@ encode_data (int *p, char *data, size_t len)
 int *
 encode_statfs (int *p, struct statfs *st)
 {
-  *(p++) = st->f_bsize;
+  *(p++) = st->f_bsize < MAXTRANSFER ? st->f_bsize : MAXTRANSFER;
   *(p++) = st->f_bsize;
   *(p++) = st->f_blocks;
   *(p++) = st->f_bfree;
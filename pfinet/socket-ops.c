@@ -1,5 +1,5 @@
 /* Interface functions for the socket.defs interface.
-   Copyright (C) 1995,96,97,99,2000,02,07 Free Software Foundation, Inc.
+   Copyright (C) 1995,96,97,99,2000,02,07,2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -542,3 +542,34 @@ S_socket_recv (struct sock_user *user,
 
   return err;
 }
+
+error_t
+S_socket_send_batch (struct sock_user *user, int flags,
+		     mach_port_t *addrs, mach_msg_type_number_t naddrs,
+		     char *data, mach_msg_type_number_t datalen,
+		     int *datalens, mach_msg_type_number_t nmsgs,
+		     mach_port_t *ports, mach_msg_type_number_t nports,
+		     int *portcounts, mach_msg_type_number_t nportcounts,
+		     char *control, mach_msg_type_number_t controllen,
+		     int *controllens, mach_msg_type_number_t ncontrollens,
+		     int *sent)
+{
+  return EOPNOTSUPP;
+}
+
+error_t
+S_socket_recv_batch (struct sock_user *user, int flags, int count,
+		     vm_size_t amount,
+		     mach_port_t **addrs, mach_msg_type_name_t *addrstype,
+		     mach_msg_type_number_t *naddrs,
+		     char **data, mach_msg_type_number_t *datalen,
+		     int **datalens, mach_msg_type_number_t *ndatalens,
+		     mach_port_t **ports, mach_msg_type_name_t *portstype,
+		     mach_msg_type_number_t *nports,
+		     int **portcounts, mach_msg_type_number_t *nportcounts,
+		     char **control, mach_msg_type_number_t *controllen,
+		     int **controllens, mach_msg_type_number_t *ncontrollens,
+		     int **outflags, mach_msg_type_number_t *noutflags)
+{
+  return EOPNOTSUPP;
+}
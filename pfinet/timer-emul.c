@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 1995,96,2000,02 Free Software Foundation, Inc.
+   Copyright (C) 1995,96,2000,02,2026 Free Software Foundation, Inc.
    Written by Michael I. Bushnell, p/BSG.
 
    This file is part of the GNU Hurd.
@@ -27,13 +27,18 @@
 #include <error.h>
 #include <string.h>
 #include "pfinet.h"
+#include "timer-wheel.h"
 
 long long root_jiffies;
 volatile struct mapped_time_value *mapped_time;
 
-static struct timer_list *timers;
 static thread_t timer_thread = 0;
 
+/* If WAKEUP_SET, the timer thread is going to wake up at jiffy WAKEUP
+   at the latest, otherwise it waits for add_timer to wake it up.  */
+static int wakeup_set;
+static unsigned long wakeup;
+
 static void *
 timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 {
@@ -49,12 +54,13 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
     {
       int jiff = jiffies;
 
-      if (!timers)
+      wakeup_set = timer_wheel_next (&wakeup);
+      if (!wakeup_set)
 	wait = -1;
-      else if (timers->expires <= jiff)
+      else if (time_before_eq (wakeup, jiff))
 	wait = 0;
       else
-	wait = ((timers->expires - jiff) * 1000) / HZ;
+	wait = ((wakeup - jiff) * 1000) / HZ;
 
       pthread_mutex_unlock (&global_lock);
 
@@ -64,21 +70,7 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 
       pthread_mutex_lock (&global_lock);
 
-      while (timers->expires <= jiffies)
-	{
-	  struct timer_list *tp;
-
-	  tp = timers;
-
-	  timers = timers->next;
-	  if (timers)
-	    timers->prev = &timers;
-
-	  tp->next = 0;
-	  tp->prev = 0;
-
-	  (*tp->function) (tp->data);
-	}
+      timer_wheel_run (jiffies);
     }
 
   return NULL;
@@ -88,33 +80,20 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 void
 add_timer (struct timer_list *timer)
 {
-  struct timer_list **tp;
-
-  for (tp = &timers; *tp; tp = &(*tp)->next)
-    if ((*tp)->expires > timer->expires)
-      {
-	timer->next = *tp;
-	timer->next->prev = &timer->next;
-	timer->prev = tp;
-	*tp = timer;
-	break;
-      }
-  if (!*tp)
-    {
-      timer->next = 0;
-      timer->prev = tp;
-      *tp = timer;
-    }
+  timer_wheel_add (timer);
 
-  if (timers == timer)
+  if (!wakeup_set || time_before (timer->expires, wakeup))
     {
-      /* We have change the first one, so tweak the timer thread
-	 to push things up. */
+      /* The timer thread would wake up too late for this one, so tweak
+	 it to push things up. */
       while (timer_thread == 0)
 	swtch_pri (0);
 
       if (timer_thread != mach_thread_self ())
 	{
+	  wakeup_set = 1;
+	  wakeup = timer->expires;
+
 	  thread_suspend (timer_thread);
 	  thread_abort (timer_thread);
 	  thread_resume (timer_thread);
@@ -125,24 +104,15 @@ add_timer (struct timer_list *timer)
 int
 del_timer (struct timer_list *timer)
 {
-  if (timer->prev)
-    {
-      *timer->prev = timer->next;
-      if (timer->next)
-	timer->next->prev = timer->prev;
-
-      timer->next = 0;
-      timer->prev = 0;
-      return 1;
-    }
-  else
-    return 0;
+  return timer_wheel_del (timer);
 }
 
 void
 mod_timer (struct timer_list *timer, unsigned long expires)
 {
-  /* Should optimize this.  */
+  if (timer->prev && timer->expires == expires)
+    return;
+
   del_timer (timer);
   timer->expires = expires;
   add_timer (timer);
@@ -0,0 +1,194 @@
+/* A hierarchical timing wheel for struct timer_list
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+#include "timer-wheel.h"
+
+#define TVR_BITS	8
+#define TVN_BITS	6
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_MASK	(TVN_SIZE - 1)
+
+/* The list of wheel N (counting from the second wheel as 0) that a timer
+   expiring at T belongs in.  */
+#define INDEX(t, n)	(((t) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+/* The lowest wheel, one list per jiffy.  */
+static struct timer_list *tv1[TVR_SIZE];
+
+/* The higher wheels.  */
+static struct timer_list *tvn[4][TVN_SIZE];
+
+/* The next jiffy whose list of the lowest wheel has to be run.  */
+static unsigned long timer_jiffies;
+
+/* The number of pending timers.  */
+static unsigned long nr_timers;
+
+/* Put TIMER at the head of the list *HEAD.  */
+static inline void
+list_add (struct timer_list **head, struct timer_list *timer)
+{
+  timer->next = *head;
+  if (timer->next)
+    timer->next->prev = &timer->next;
+  timer->prev = head;
+  *head = timer;
+}
+
+/* Put TIMER in the list it belongs in, given timer_jiffies.  */
+static void
+internal_add (struct timer_list *timer)
+{
+  unsigned long expires = timer->expires;
+  unsigned long idx = expires - timer_jiffies;
+  struct timer_list **head;
+
+  if ((long) idx < 0)
+    /* Already expired; run it with the next jiffy.  */
+    head = &tv1[timer_jiffies & TVR_MASK];
+  else if (idx < TVR_SIZE)
+    head = &tv1[expires & TVR_MASK];
+  else if (idx < 1UL << (TVR_BITS + TVN_BITS))
+    head = &tvn[0][INDEX (expires, 0)];
+  else if (idx < 1UL << (TVR_BITS + 2 * TVN_BITS))
+    head = &tvn[1][INDEX (expires, 1)];
+  else if (idx < 1UL << (TVR_BITS + 3 * TVN_BITS))
+    head = &tvn[2][INDEX (expires, 2)];
+  else
+    {
+      /* The highest wheel covers 2^32 jiffies.  A timer further away
+	 than that goes around it again when it is cascaded.  */
+      if (idx > 0xffffffffUL)
+	expires = timer_jiffies + 0xffffffffUL;
+      head = &tvn[3][INDEX (expires, 3)];
+    }
+
+  list_add (head, timer);
+}
+
+/* Spread the timers of list INDEX of the higher wheel N over the wheels
+   below it.  Return INDEX, so that the caller knows whether the next
+   wheel up has to be cascaded as well.  */
+static int
+cascade (int n, int index)
+{
+  struct timer_list *timer, *list = tvn[n][index];
+
+  tvn[n][index] = 0;
+  while ((timer = list))
+    {
+      list = timer->next;
+      internal_add (timer);
+    }
+
+  return index;
+}
+
+void
+timer_wheel_add (struct timer_list *timer)
+{
+  internal_add (timer);
+  nr_timers++;
+}
+
+int
+timer_wheel_del (struct timer_list *timer)
+{
+  if (timer->prev)
+    {
+      *timer->prev = timer->next;
+      if (timer->next)
+	timer->next->prev = timer->prev;
+
+      timer->next = 0;
+      timer->prev = 0;
+      nr_timers--;
+      return 1;
+    }
+  else
+    return 0;
+}
+
+void
+timer_wheel_run (unsigned long now)
+{
+  while ((long) (now - timer_jiffies) >= 0)
+    {
+      struct timer_list *work, *timer;
+      int index = timer_jiffies & TVR_MASK;
+
+      if (nr_timers == 0)
+	{
+	  /* All the lists are empty, so there is nothing to step
+	     through.  */
+	  timer_jiffies = now + 1;
+	  break;
+	}
+
+      if (index == 0
+	  && ! cascade (0, INDEX (timer_jiffies, 0))
+	  && ! cascade (1, INDEX (timer_jiffies, 1))
+	  && ! cascade (2, INDEX (timer_jiffies, 2)))
+	cascade (3, INDEX (timer_jiffies, 3));
+
+      /* Timers that the functions add for this jiffy or earlier go into
+	 the next jiffy's list.  */
+      timer_jiffies++;
+
+      /* Move the list aside, so that it is left alone by the timers
+	 that are added while the functions run.  */
+      work = tv1[index];
+      if (! work)
+	continue;
+      tv1[index] = 0;
+      work->prev = &work;
+
+      while ((timer = work))
+	{
+	  timer_wheel_del (timer);
+	  (*timer->function) (timer->data);
+	}
+    }
+}
+
+int
+timer_wheel_next (unsigned long *when)
+{
+  unsigned long t;
+
+  if (nr_timers == 0)
+    return 0;
+
+  /* The first list of the lowest wheel that is not empty, up to the
+     point where it wraps around.  Nothing in the higher wheels can
+     expire before then, and there the next one is cascaded.  */
+  t = timer_jiffies;
+  if (t & TVR_MASK)
+    for (; ! tv1[t & TVR_MASK]; t++)
+      if (((t + 1) & TVR_MASK) == 0)
+	{
+	  t++;
+	  break;
+	}
+
+  *when = t;
+  return 1;
+}
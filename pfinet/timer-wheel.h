@@ -0,0 +1,53 @@
+/* A hierarchical timing wheel for struct timer_list
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <linux/timer.h>
+
+/* The timers are kept in five wheels of lists, as in Linux.  The first
+   wheel has a list for each of the next 256 jiffies, each list of the
+   next wheel covers all of the first wheel, and so on.  Adding and
+   removing a timer takes constant time.  Once every 256 jiffies, the
+   timers of one list of a higher wheel are spread over the wheel below
+   it, so that each timer is moved at most four times before it runs.
+
+   The caller does the locking; timer-emul.c uses global_lock.  */
+
+/* Add TIMER, which must not be pending, to expire at TIMER->expires.  A
+   timer that has already expired is run by the next call to
+   timer_wheel_run.  */
+void timer_wheel_add (struct timer_list *timer);
+
+/* Remove TIMER.  Return 1 if it was pending and 0 otherwise.  */
+int timer_wheel_del (struct timer_list *timer);
+
+/* Call the function of every timer that expires at or before NOW, one
+   jiffy after the other.  The functions may add and remove timers,
+   including their own.  */
+void timer_wheel_run (unsigned long now);
+
+/* If any timer is pending, return 1 and set *WHEN to the jiffy at which
+   timer_wheel_run must be called next.  That may be earlier than the
+   first expiry, as the lists of the higher wheels are not sorted.
+   Otherwise return 0.  */
+int timer_wheel_next (unsigned long *when);
+
+#endif
@@ -1,6 +1,6 @@
 /* Listen queue functions
 
-   Copyright (C) 1995,96,2001,2012 Free Software Foundation, Inc.
+   Copyright (C) 1995,96,2001,2012,2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.org>
 
@@ -166,13 +166,18 @@ connq_listen (struct connq *cq, struct timespec *tsp, struct sock **sock)
       return 0;
     }
 
-  cq->num_listeners++;
-
   if (cq->count == 0)
     /* The request queue is empty.  */
     {
       assert (! cq->head);
 
+      /* Only count ourselves as a listener while waiting:
+	 connq_connect_complete consumes this count when it hands us a
+	 request, so counting a listener that takes a request that is
+	 already queued would let a connector in beyond the queue
+	 limit for good.  */
+      cq->num_listeners++;
+
       if (cq->num_connectors > 0)
 	/* Someone is waiting for an acceptor.  Signal that we can
 	   service their request.  */
@@ -314,12 +319,18 @@ connq_set_length (struct connq *cq, int max)
   omax = cq->max;
   cq->max = max;
 
-  if (max > omax && cq->count >= omax && cq->count < max
-      && cq->num_connectors >= cq->num_listeners)
-    /* This is an increase in the number of connection slots which has
-       made some slots available and there are waiting threads.  Wake
-       them up.  */
-    pthread_cond_broadcast (&cq->listeners);
+  if (max > omax && cq->num_connectors > 0)
+    /* This is an increase in the number of connection slots, which
+       connectors blocked in connq_connect may now be able to use.  Wake
+       one up for each new slot; they check for themselves whether they
+       can go ahead.  */
+    {
+      unsigned slots = max - omax;
+      if (slots > cq->num_connectors)
+	slots = cq->num_connectors;
+      for (; slots > 0; slots--)
+	pthread_cond_signal (&cq->connectors);
+    }
 
   pthread_mutex_unlock (&cq->lock);
 
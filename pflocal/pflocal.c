@@ -1,6 +1,6 @@
 /* A server for local sockets, of type PF_LOCAL
 
-   Copyright (C) 1995, 1997, 1998 Free Software Foundation, Inc.
+   Copyright (C) 1995, 1997, 1998, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -19,14 +19,20 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <error.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <hurd/hurd_types.h>
 #include <hurd/trivfs.h>
+#include <hurd/pipe.h>
 
 #include "sock.h"
+#include "libtrivfs/trivfs_io_S.h"
 
 /* Where to put the file-system ports. */
 static struct port_bucket *pf_port_bucket;
@@ -34,10 +40,10 @@ static struct port_bucket *pf_port_bucket;
 /* Trivfs hooks */
 int trivfs_fstype = FSTYPE_MISC;
 int trivfs_fsid = 0;
-int trivfs_support_read = 0;
+int trivfs_support_read = 1;
 int trivfs_support_write = 0;
 int trivfs_support_exec = 0;
-int trivfs_allow_open = 0;
+int trivfs_allow_open = O_READ;
 
 /* ---------------------------------------------------------------- */
 #include "socket_S.h"
@@ -125,3 +131,176 @@ trivfs_goaway (struct trivfs_control *fsys, int flags)
 
   return err;
 }
+
+/* ---------------------------------------------------------------- */
+
+/* Reading our node returns statistics about the packet pools of the socket
+   types, as they were when it was opened for reading.  */
+struct stats
+{
+  char *contents;
+  size_t contents_len;
+  off_t offs;
+};
+
+static void
+print_pool_stats (FILE *f, const char *name, struct pipe_class *class)
+{
+  struct packet_pool_stats stats;
+
+  packet_pool_get_stats (class->pool, &stats);
+  fprintf (f, "%s packets: %lu allocated, %lu reused, %lu freed, %zu pooled\n",
+	   name, stats.packets_allocated, stats.packets_reused,
+	   stats.packets_freed, stats.free_packets);
+  fprintf (f, "%s buffers: %lu allocated, %lu reused, %lu freed, "
+	   "%zu pooled (%zu bytes)\n",
+	   name, stats.buffers_allocated, stats.buffers_reused,
+	   stats.buffers_freed, stats.free_buffers, stats.free_bytes);
+}
+
+static error_t
+open_hook (struct trivfs_peropen *peropen)
+{
+  struct stats *op;
+  FILE *f;
+
+  if (! (peropen->openmodes & O_READ))
+    /* Looked up to create sockets; nothing to do.  */
+    return 0;
+
+  op = malloc (sizeof (struct stats));
+  if (op == NULL)
+    return ENOMEM;
+
+  f = open_memstream (&op->contents, &op->contents_len);
+  if (f == NULL)
+    {
+      free (op);
+      return ENOMEM;
+    }
+  print_pool_stats (f, "stream", stream_pipe_class);
+  print_pool_stats (f, "dgram", dgram_pipe_class);
+  print_pool_stats (f, "seqpacket", seqpack_pipe_class);
+  if (fclose (f) != 0)
+    {
+      free (op);
+      return ENOMEM;
+    }
+
+  op->offs = 0;
+  peropen->hook = op;
+  return 0;
+}
+
+static void
+close_hook (struct trivfs_peropen *peropen)
+{
+  struct stats *op = peropen->hook;
+
+  if (op)
+    {
+      free (op->contents);
+      free (op);
+    }
+}
+
+error_t (*trivfs_peropen_create_hook)(struct trivfs_peropen *) = open_hook;
+void (*trivfs_peropen_destroy_hook) (struct trivfs_peropen *) = close_hook;
+
+/* Read data from an IO object.  If offset is -1, read from the object
+   maintained file pointer.  If the object is not seekable, offset is
+   ignored.  The amount desired to be read is in AMOUNT.  */
+error_t
+trivfs_S_io_read (struct trivfs_protid *cred,
+		  mach_port_t reply, mach_msg_type_name_t reply_type,
+		  char **data, mach_msg_type_number_t *data_len,
+		  loff_t offs, mach_msg_type_number_t amount)
+{
+  struct stats *op;
+
+  if (! cred)
+    return EOPNOTSUPP;
+  else if (! (cred->po->openmodes & O_READ))
+    return EBADF;
+
+  op = cred->po->hook;
+  if (offs == -1)
+    offs = op->offs;
+  else if (offs < 0)
+    return EINVAL;
+
+  if (offs > op->contents_len)
+    offs = op->contents_len;
+  if (offs + amount > op->contents_len)
+    amount = op->contents_len - offs;
+
+  if (amount > 0)
+    {
+      if (*data_len < amount)
+	{
+	  *data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+	  if (*data == MAP_FAILED)
+	    return ENOMEM;
+	}
+      memcpy (*data, op->contents + offs, amount);
+      op->offs = offs + amount;
+    }
+
+  *data_len = amount;
+  return 0;
+}
+
+/* Tell how much data can be read from the object without blocking for
+   a "long time".  */
+error_t
+trivfs_S_io_readable (struct trivfs_protid *cred,
+		      mach_port_t reply, mach_msg_type_name_t reply_type,
+		      mach_msg_type_number_t *amount)
+{
+  struct stats *op;
+
+  if (! cred)
+    return EOPNOTSUPP;
+  else if (! (cred->po->openmodes & O_READ))
+    return EBADF;
+
+  op = cred->po->hook;
+  *amount = op->offs < op->contents_len ? op->contents_len - op->offs : 0;
+  return 0;
+}
+
+/* Change current read/write offset */
+error_t
+trivfs_S_io_seek (struct trivfs_protid *cred,
+		  mach_port_t reply, mach_msg_type_name_t reply_type,
+		  off_t offs, int whence, off_t *new_offs)
+{
+  struct stats *op;
+
+  if (! cred)
+    return EOPNOTSUPP;
+
+  op = cred->po->hook;
+  if (! op)
+    return ESPIPE;
+
+  switch (whence)
+    {
+    case SEEK_CUR:
+      offs += op->offs;
+      break;
+    case SEEK_END:
+      offs += op->contents_len;
+      break;
+    case SEEK_SET:
+      break;
+    default:
+      return EINVAL;
+    }
+
+  if (offs < 0)
+    return EINVAL;
+
+  *new_offs = op->offs = offs;
+  return 0;
+}
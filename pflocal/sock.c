@@ -1,6 +1,6 @@
 /* Sock functions
 
-   Copyright (C) 1995,96,2000,01,02, 2005 Free Software Foundation, Inc.
+   Copyright (C) 1995,96,2000,01,02, 2005, 2026 Free Software Foundation, Inc.
    Written by Miles Bader <miles@gnu.org>
 
    This program is free software; you can redistribute it and/or
@@ -114,6 +114,7 @@ sock_create (struct pipe_class *pipe_class, mode_t mode, struct sock **sock)
   pipe_add_reader (new->read_pipe);
 
   new->refs = 0;
+  new->users = 0;
   new->flags = 0;
   new->write_pipe = NULL;
   new->mode = mode;
@@ -122,6 +123,7 @@ sock_create (struct pipe_class *pipe_class, mode_t mode, struct sock **sock)
   new->connect_queue = NULL;
   new->pipe_class = pipe_class;
   new->addr = NULL;
+  new->addr_next = NULL;
   memset (&new->change_time, 0, sizeof (new->change_time));
   pthread_mutex_init (&new->lock, NULL);
 
@@ -178,7 +180,22 @@ static void
 sock_user_clean (void *vuser)
 {
   struct sock_user *user = vuser;
-  sock_deref (user->sock);
+  struct sock *sock = user->sock;
+  int unbind;
+
+  pthread_mutex_lock (&sock->lock);
+  unbind = --sock->users == 0 && sock->addr;
+  pthread_mutex_unlock (&sock->lock);
+
+  if (unbind)
+    /* Nobody can accept or receive on SOCK any more, so don't let its
+       address hand it out to connectors and senders, which may still
+       hold a reference on it for a while, or forever if it shares the
+       address with other sockets.  Someone else may have unbound it
+       meanwhile, which is fine.  */
+    sock_bind (sock, NULL);
+
+  sock_deref (sock);
 }
 
 /* Return a new user port on SOCK in PORT.  */
@@ -197,6 +214,7 @@ sock_create_port (struct sock *sock, mach_port_t *port)
 
   pthread_mutex_lock (&sock->lock);
   sock->refs++;
+  sock->users++;
   pthread_mutex_unlock (&sock->lock);
 
   user->sock = sock;
@@ -213,13 +231,21 @@ sock_create_port (struct sock *sock, mach_port_t *port)
 struct addr
 {
   struct port_info pi;
+  /* The sockets bound to this address, chained through their ADDR_NEXT
+     field.  There is only ever more than one if SHARED is set.  */
   struct sock *sock;
+  /* The socket addr_get_sock returns next, or NULL to start over at
+     SOCK.  */
+  struct sock *next_sock;
+  /* True if SOCK had PFLOCAL_SOCK_REUSEPORT set when it was bound, so that
+     other such sockets may be bound too.  */
+  int shared;
   pthread_mutex_t lock;
 };
 
 struct port_class *addr_port_class;
 
-/* Get rid of ADDR's socket's reference to it, in preparation for ADDR going
+/* Get rid of ADDR's sockets' references to it, in preparation for ADDR going
    away.  */
 static void
 addr_unbind (void *vaddr)
@@ -228,16 +254,17 @@ addr_unbind (void *vaddr)
   struct addr *addr = vaddr;
 
   pthread_mutex_lock (&addr->lock);
-  sock = addr->sock;
-  if (sock)
+  while ((sock = addr->sock))
     {
       pthread_mutex_lock (&sock->lock);
       sock->addr = NULL;
-      addr->sock = NULL;
+      addr->sock = sock->addr_next;
+      sock->addr_next = NULL;
       ports_port_deref_weak (addr);
       pthread_mutex_unlock (&sock->lock);
       sock_deref (sock);
     }
+  addr->next_sock = NULL;
   pthread_mutex_unlock (&addr->lock);
 }
 
@@ -264,12 +291,29 @@ addr_create (struct addr **addr)
     {
       ensure_sock_server ();
       (*addr)->sock = NULL;
+      (*addr)->next_sock = NULL;
+      (*addr)->shared = 0;
       pthread_mutex_init (&(*addr)->lock, NULL);
     }
 
   return err;
 }
-
+
+/* Remove SOCK from the sockets bound to ADDR.  Both must be locked.  */
+static void
+addr_remove_sock (struct addr *addr, struct sock *sock)
+{
+  struct sock **prevp;
+
+  for (prevp = &addr->sock; *prevp != sock; prevp = &(*prevp)->addr_next)
+    assert (*prevp);
+  *prevp = sock->addr_next;
+
+  if (addr->next_sock == sock)
+    addr->next_sock = sock->addr_next;
+  sock->addr_next = NULL;
+}
+
 /* Bind SOCK to ADDR.  */
 error_t
 sock_bind (struct sock *sock, struct addr *addr)
@@ -277,43 +321,65 @@ sock_bind (struct sock *sock, struct addr *addr)
   error_t err = 0;
   struct addr *old_addr;
 
-  if (addr)
-    pthread_mutex_lock (&addr->lock);
-  pthread_mutex_lock (&sock->lock);
-
-  old_addr = sock->addr;
-  if (addr && old_addr)
-    err = EINVAL;		/* SOCK already bound.  */
-  else if (!addr && !old_addr)
-    err = EINVAL;		/* SOCK already bound.  */
-  else if (addr && addr->sock)
-    err = EADDRINUSE;		/* Something else already bound ADDR.  */
-  else if (addr)
-    addr->sock = sock;		/* First binding for SOCK.  */
-  else
-    old_addr->sock = NULL;	/* Unbinding SOCK.  */
-
-  if (! err)
+  if (! addr)
+    /* Unbinding SOCK.  ADDR has to be locked before SOCK, so find out what
+       it is first, and keep it from going away until it is locked.  */
     {
-      sock->addr = addr;
+      pthread_mutex_lock (&sock->lock);
+      addr = sock->addr;
       if (addr)
+	ports_port_ref_weak (addr);
+      pthread_mutex_unlock (&sock->lock);
+
+      if (! addr)
+	return EINVAL;		/* SOCK not bound.  */
+
+      pthread_mutex_lock (&addr->lock);
+      pthread_mutex_lock (&sock->lock);
+
+      if (sock->addr == addr)
 	{
-	  sock->refs++;
-	  ports_port_ref_weak (addr);
-	}
-      if (old_addr)
-	{
+	  addr_remove_sock (addr, sock);
+	  sock->addr = NULL;
 	  /* Note that we don't have to worry about SOCK's ref count going to
 	     zero because whoever's calling us should be holding a ref.  */
 	  sock->refs--;
-	  ports_port_deref_weak (old_addr);
+	  ports_port_deref_weak (addr);
 	  assert (sock->refs > 0);	/* But make sure... */
 	}
+      else
+	err = EINVAL;		/* Someone else unbound SOCK meanwhile.  */
+
+      pthread_mutex_unlock (&sock->lock);
+      pthread_mutex_unlock (&addr->lock);
+      ports_port_deref_weak (addr);
+
+      return err;
+    }
+
+  pthread_mutex_lock (&addr->lock);
+  pthread_mutex_lock (&sock->lock);
+
+  old_addr = sock->addr;
+  if (old_addr)
+    err = EINVAL;		/* SOCK already bound.  */
+  else if (addr->sock
+	   && !(addr->shared && (sock->flags & PFLOCAL_SOCK_REUSEPORT)
+		&& addr->sock->pipe_class == sock->pipe_class))
+    err = EADDRINUSE;		/* Something else already bound ADDR.  */
+  else
+    {
+      if (! addr->sock)
+	addr->shared = !!(sock->flags & PFLOCAL_SOCK_REUSEPORT);
+      sock->addr_next = addr->sock;
+      addr->sock = sock;
+      sock->addr = addr;
+      sock->refs++;
+      ports_port_ref_weak (addr);
     }
 
   pthread_mutex_unlock (&sock->lock);
-  if (addr)
-    pthread_mutex_unlock (&addr->lock);
+  pthread_mutex_unlock (&addr->lock);
 
   return err;
 }
@@ -331,6 +397,7 @@ ensure_addr (struct sock *sock, struct addr **addr)
       if (!err)
 	{
 	  sock->addr->sock = sock;
+	  sock->addr->shared = 0;
 	  sock->refs++;
 	  ports_port_ref_weak (sock->addr);
 	}
@@ -344,15 +411,46 @@ ensure_addr (struct sock *sock, struct addr **addr)
   return err;
 }
 
-/* Returns the socket bound to ADDR in SOCK, or EADDRNOTAVAIL.  The returned
-   sock will have one reference added to it.  */
+/* Returns true if connections to SOCK, which shares its address with other
+   sockets, may be made.  */
+static int
+sock_can_serve (struct sock *sock)
+{
+  int ok;
+
+  pthread_mutex_lock (&sock->lock);
+  ok = sock->users > 0
+    && (sock->listen_queue
+	|| (sock->pipe_class->flags & PIPE_CLASS_CONNECTIONLESS));
+  pthread_mutex_unlock (&sock->lock);
+
+  return ok;
+}
+
+/* Returns the socket bound to ADDR in SOCK, or EADDRNOTAVAIL.  If several
+   sockets share ADDR, they are returned in turn, so that connections and
+   datagrams are spread over all of them; connection-oriented sockets that
+   aren't listening are passed over unless none is.  The returned sock will
+   have one reference added to it.  */
 error_t
 addr_get_sock (struct addr *addr, struct sock **sock)
 {
+  struct sock *first;
+
   pthread_mutex_lock (&addr->lock);
-  *sock = addr->sock;
+  first = *sock = addr->next_sock ?: addr->sock;
+  if (first && addr->sock->addr_next)
+    while (! sock_can_serve (*sock))
+      {
+	*sock = (*sock)->addr_next ?: addr->sock;
+	if (*sock == first)
+	  break;
+      }
   if (*sock)
-    (*sock)->refs++;
+    {
+      addr->next_sock = (*sock)->addr_next;
+      (*sock)->refs++;
+    }
   pthread_mutex_unlock (&addr->lock);
   return *sock ? 0 : EADDRNOTAVAIL;
 }
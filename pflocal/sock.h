@@ -1,6 +1,6 @@
 /* Internal sockets
 
-   Copyright (C) 1995,96,99,2000,01 Free Software Foundation, Inc.
+   Copyright (C) 1995,96,99,2000,01,2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.org>
 
@@ -44,6 +44,9 @@ struct sock
   int refs;
   pthread_mutex_t lock;
 
+  /* The number of user ports on this socket; they each hold a ref too.  */
+  unsigned users;
+
   /* What kind of socket this is.  */
   struct pipe_class *pipe_class;
 
@@ -71,6 +74,10 @@ struct sock
      one could tell anyway).  */
   struct addr *addr;
 
+  /* The next socket bound to ADDR, if several sockets with
+     PFLOCAL_SOCK_REUSEPORT set share it.  Protected by ADDR's lock.  */
+  struct sock *addr_next;
+
   /* If this sock has been connected to another sock, then WRITE_ADDR is the
      addr of that sock.  We *do* hold a reference to this addr.  */
   struct addr *write_addr;
@@ -89,6 +96,7 @@ struct sock
 #define PFLOCAL_SOCK_NONBLOCK		0x2 /* Don't block on I/O.  */
 #define PFLOCAL_SOCK_SHUTDOWN_READ	0x4 /* The read-half has been shutdown.  */
 #define PFLOCAL_SOCK_SHUTDOWN_WRITE	0x8 /* The write-half has been shutdown.  */
+#define PFLOCAL_SOCK_REUSEPORT		0x10 /* May share its address, SO_REUSEPORT.  */
 
 /* Returns the pipe that SOCK is reading from in PIPE, locked and with an
    additional reference, or an error saying why it's not possible.  NULL may
@@ -172,8 +180,9 @@ void sock_shutdown (struct sock *sock, unsigned flags);
 /* Return a new address, not connected to any socket yet, ADDR.  */
 error_t addr_create (struct addr **addr);
 
-/* Returns the socket bound to ADDR in SOCK, or EADDRNOTAVAIL.  The returned
-   sock will have one reference added to it.  */
+/* Returns the socket bound to ADDR in SOCK, or EADDRNOTAVAIL.  If several
+   sockets share ADDR, they are returned in turn.  The returned sock will
+   have one reference added to it.  */
 error_t addr_get_sock (struct addr *addr, struct sock **sock);
 
 /* Prepare for socket creation.  */
@@ -1,6 +1,6 @@
 /* Socket-specific operations
 
-   Copyright (C) 1995, 2008, 2010, 2012 Free Software Foundation, Inc.
+   Copyright (C) 1995, 2008, 2010, 2012, 2026 Free Software Foundation, Inc.
 
    Written by Miles Bader <miles@gnu.ai.mit.edu>
 
@@ -18,6 +18,8 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 
 #include <hurd/pipe.h>
@@ -273,27 +275,20 @@ S_socket_peername (struct sock_user *user,
   *addr_port_type = MACH_MSG_TYPE_MAKE_SEND;
 }
 
-/* Send data over a socket, possibly including Mach ports.  */
-error_t
-S_socket_send (struct sock_user *user, struct addr *dest_addr, int flags,
-	       char *data, size_t data_len,
-	       mach_port_t *ports, size_t num_ports,
-	       char *control, size_t control_len,
-	       size_t *amount)
+/* Send DATA, CONTROL and PORTS from SOCK to the socket at DEST_ADDR, or to
+   SOCK's peer if DEST_ADDR is NULL, and return the amount of data sent in
+   AMOUNT.  If an error is returned, the rights in PORTS are deallocated.  */
+static error_t
+send_msg (struct sock *sock, struct addr *dest_addr,
+	  char *data, size_t data_len,
+	  mach_port_t *ports, size_t num_ports,
+	  char *control, size_t control_len,
+	  size_t *amount)
 {
   error_t err = 0;
   struct pipe *pipe;
-  struct sock *sock, *dest_sock;
-  struct addr *source_addr;
-
-  if (!user)
-    return EOPNOTSUPP;
-
-  sock = user->sock;
-
-  if (flags & MSG_OOB)
-    /* BSD local sockets don't support OOB data.  */
-    return EOPNOTSUPP;
+  struct sock *dest_sock = 0;
+  struct addr *source_addr = NULL;
 
   if (dest_addr)
     {
@@ -302,21 +297,17 @@ S_socket_send (struct sock_user *user, struct addr *dest_addr, int flags,
 	/* The server went away.  */
 	err = ECONNREFUSED;
       if (err)
-	return err;
-      if (sock->pipe_class != dest_sock->pipe_class)
+	dest_sock = 0;
+      else if (sock->pipe_class != dest_sock->pipe_class)
 	/* Sending to a different type of socket!  */
 	err = EINVAL;		/* ? XXX */
     }
-  else
-    dest_sock = 0;
 
   /* We could provide a source address for all writes, but we
      only do so for connectionless sockets because that's the
      only place it's required, and it's more efficient not to.  */
   if (!err && sock->pipe_class->flags & PIPE_CLASS_CONNECTIONLESS)
     err = sock_get_addr (sock, &source_addr);
-  else
-    source_addr = NULL;
 
   if (!err)
     {
@@ -343,22 +334,136 @@ S_socket_send (struct sock_user *user, struct addr *dest_addr, int flags,
 	    pipe_release_writer (pipe);
 	}
 
-      if (err)
-	/* The send failed, so free any resources it would have consumed
-	   (mig gets rid of memory, but we have to do everything else). */
-	{
-	  if (source_addr)
-	    ports_port_deref (source_addr);
-	  while (num_ports-- > 0)
-	    mach_port_deallocate (mach_task_self (), *ports++);
-	}
+      if (err && source_addr)
+	ports_port_deref (source_addr);
     }
 
+  if (err)
+    /* The send failed, so free any resources it would have consumed
+       (mig gets rid of memory, but we have to do everything else). */
+    while (num_ports-- > 0)
+      mach_port_deallocate (mach_task_self (), *ports++);
+
   if (dest_sock)
     sock_deref (dest_sock);
 
   return err;
 }
+
+/* Send data over a socket, possibly including Mach ports.  */
+error_t
+S_socket_send (struct sock_user *user, struct addr *dest_addr, int flags,
+	       char *data, size_t data_len,
+	       mach_port_t *ports, size_t num_ports,
+	       char *control, size_t control_len,
+	       size_t *amount)
+{
+  if (!user)
+    return EOPNOTSUPP;
+
+  if (flags & MSG_OOB)
+    /* BSD local sockets don't support OOB data.  */
+    return EOPNOTSUPP;
+
+  return send_msg (user->sock, dest_addr, data, data_len,
+		   ports, num_ports, control, control_len, amount);
+}
+
+/* Returns true if none of the NUM lengths in LENS is negative, and they
+   add up to TOTAL.  */
+static int
+lens_add_up (int *lens, size_t num, size_t total)
+{
+  size_t left = total;
+  while (num-- > 0)
+    if (*lens < 0 || (size_t) *lens > left)
+      return 0;
+    else
+      left -= *lens++;
+  return left == 0;
+}
+
+/* Send several messages over a socket in one go.  */
+error_t
+S_socket_send_batch (struct sock_user *user, int flags,
+		     mach_port_t *addrs, mach_msg_type_number_t num_addrs,
+		     char *data, mach_msg_type_number_t data_len,
+		     int *data_lens, mach_msg_type_number_t num_msgs,
+		     mach_port_t *ports, mach_msg_type_number_t num_ports,
+		     int *port_counts, mach_msg_type_number_t num_port_counts,
+		     char *control, mach_msg_type_number_t control_len,
+		     int *control_lens, mach_msg_type_number_t num_control_lens,
+		     int *sent)
+{
+  error_t err = 0;
+  size_t i, j, n = 0;
+
+  if (!user)
+    err = EOPNOTSUPP;
+  else if (flags & MSG_OOB)
+    /* BSD local sockets don't support OOB data.  */
+    err = EOPNOTSUPP;
+  else if ((num_addrs != 0 && num_addrs != num_msgs)
+	   || (num_port_counts != 0 && num_port_counts != num_msgs)
+	   || (num_control_lens != 0 && num_control_lens != num_msgs)
+	   || ! lens_add_up (data_lens, num_msgs, data_len)
+	   || ! lens_add_up (port_counts, num_port_counts, num_ports)
+	   || ! lens_add_up (control_lens, num_control_lens, control_len))
+    err = EINVAL;
+
+  for (i = 0; !err && i < num_msgs; i++)
+    {
+      struct addr *dest_addr = NULL;
+      size_t msg_ports = num_port_counts ? port_counts[i] : 0;
+      size_t msg_control = num_control_lens ? control_lens[i] : 0;
+      size_t amount = 0;
+
+      if (num_addrs && addrs[i] != MACH_PORT_NULL)
+	{
+	  dest_addr = ports_lookup_port (0, addrs[i], addr_port_class);
+	  if (! dest_addr)
+	    err = ECONNREFUSED;
+	}
+
+      if (!err)
+	err = send_msg (user->sock, dest_addr, data, data_lens[i],
+			ports, msg_ports, control, msg_control, &amount);
+      else
+	for (j = 0; j < msg_ports; j++)
+	  mach_port_deallocate (mach_task_self (), ports[j]);
+
+      if (dest_addr)
+	ports_port_deref (dest_addr);
+
+      data += data_lens[i];
+      ports += msg_ports;
+      num_ports -= msg_ports;
+      control += msg_control;
+
+      if (err)
+	break;
+      n++;
+      if (amount < (size_t) data_lens[i])
+	/* The rest didn't fit.  */
+	break;
+    }
+
+  if (n > 0)
+    /* Report the messages that went.  */
+    err = 0;
+  if (!err)
+    *sent = n;
+
+  /* Get rid of the rights of the messages that weren't sent, and of the
+     addresses, which we get as a side effect of the rpc.  */
+  while (num_ports-- > 0)
+    mach_port_deallocate (mach_task_self (), *ports++);
+  for (i = 0; i < num_addrs; i++)
+    if (addrs[i] != MACH_PORT_NULL)
+      mach_port_deallocate (mach_task_self (), addrs[i]);
+
+  return err;
+}
 
 /* Receive data from a socket, possibly including Mach ports.  */
 error_t
@@ -424,6 +529,222 @@ S_socket_recv (struct sock_user *user,
   return err;
 }
 
+/* An array returned by S_socket_recv_batch, in vm_allocated memory.  */
+struct out_array
+{
+  char *buf;
+  size_t used, alloced;
+};
+
+/* Append LEN bytes at FROM to ARRAY, making it bigger if need be.  */
+static error_t
+out_append (struct out_array *array, const void *from, size_t len)
+{
+  if (array->used + len > array->alloced)
+    {
+      size_t new_alloced = round_page (2 * (array->used + len));
+      char *new_buf = mmap (0, new_alloced, PROT_READ|PROT_WRITE,
+			    MAP_ANON, 0, 0);
+      if (new_buf == MAP_FAILED)
+	return ENOMEM;
+      if (array->alloced > 0)
+	{
+	  memcpy (new_buf, array->buf, array->used);
+	  munmap (array->buf, array->alloced);
+	}
+      array->buf = new_buf;
+      array->alloced = new_alloced;
+    }
+  memcpy (array->buf + array->used, from, len);
+  array->used += len;
+  return 0;
+}
+
+/* Return ARRAY, of elements of SIZE bytes, in *BUF and *NUM.  */
+static void
+out_return (struct out_array *array, void *buf, mach_msg_type_number_t *num,
+	    size_t size)
+{
+  size_t keep = round_page (array->used);
+
+  if (array->alloced > keep)
+    /* The reply only takes along the pages in use.  */
+    munmap (array->buf + keep, array->alloced - keep);
+  if (array->used > 0)
+    *(char **) buf = array->buf;
+  *num = array->used / size;
+}
+
+/* Deallocate DATA_LEN bytes at DATA, which pipe_recv returned in new
+   memory instead of the buffer it was passed.  */
+static void
+dealloc_recvd (void *data, size_t data_len)
+{
+  vm_address_t start = trunc_page ((vm_address_t) data);
+  vm_address_t end = round_page ((vm_address_t) data + data_len);
+  if (end > start)
+    vm_deallocate (mach_task_self (), start, end - start);
+}
+
+/* Receive several messages from a socket in one go.  */
+error_t
+S_socket_recv_batch (struct sock_user *user, int in_flags, int count,
+		     vm_size_t amount,
+		     mach_port_t **addrs, mach_msg_type_name_t *addrs_type,
+		     mach_msg_type_number_t *num_addrs,
+		     char **data, mach_msg_type_number_t *data_len,
+		     int **data_lens, mach_msg_type_number_t *num_data_lens,
+		     mach_port_t **ports, mach_msg_type_name_t *ports_type,
+		     mach_msg_type_number_t *num_ports,
+		     int **port_counts, mach_msg_type_number_t *num_port_counts,
+		     char **control, mach_msg_type_number_t *control_len,
+		     int **control_lens,
+		     mach_msg_type_number_t *num_control_lens,
+		     int **out_flags, mach_msg_type_number_t *num_out_flags)
+{
+  enum { ADDRS, DATA, DATA_LENS, PORTS, PORT_COUNTS, CONTROL, CONTROL_LENS,
+	 OUT_FLAGS, NUM_ARRAYS };
+  struct out_array out[NUM_ARRAYS];
+  error_t err;
+  unsigned flags;
+  struct pipe *pipe;
+  int i, n = 0;
+  size_t j;
+
+  if (!user)
+    return EOPNOTSUPP;
+
+  if (in_flags & MSG_OOB)
+    /* BSD local sockets don't support OOB data.  */
+    return EINVAL;		/* XXX */
+
+  if (count <= 0)
+    return EINVAL;
+
+  /* Fill in the pipe FLAGS from any corresponding ones in IN_FLAGS.  */
+  flags = in_flags & MSG_PEEK;
+  if (flags & MSG_PEEK)
+    /* Peeking again would only return the same message.  */
+    count = 1;
+
+  memset (out, 0, sizeof out);
+
+  err = sock_acquire_read_pipe (user->sock, &pipe);
+  if (err == EPIPE)
+    /* EOF, which is no messages.  */
+    err = 0;
+  else if (!err)
+    {
+      err = pipe_wait_readable (pipe,
+				user->sock->flags & PFLOCAL_SOCK_NONBLOCK, 0);
+
+      /* Only the first message is waited for; take the others that are
+	 already there, as long as their data fits.  */
+      while (!err && n < count)
+	{
+	  char data_buf[2048], *msg_data = data_buf;
+	  char control_buf[256], *msg_control = control_buf;
+	  mach_port_t ports_buf[16], *msg_ports = ports_buf;
+	  size_t msg_data_len = sizeof data_buf;
+	  size_t msg_control_len = sizeof control_buf;
+	  size_t msg_num_ports = sizeof ports_buf / sizeof ports_buf[0];
+	  size_t next_len, used[NUM_ARRAYS];
+	  unsigned msg_flags = flags;
+	  void *source = NULL;
+	  mach_port_t addr = MACH_PORT_NULL;
+	  int len, zero = 0;
+
+	  if (! pipe_next_message (pipe, &next_len)
+	      || (n > 0 && next_len > amount - out[DATA].used))
+	    break;
+
+	  err = pipe_recv (pipe, 1, &msg_flags, &source,
+			   &msg_data, &msg_data_len, amount - out[DATA].used,
+			   &msg_control, &msg_control_len,
+			   &msg_ports, &msg_num_ports);
+	  if (err)
+	    break;
+
+	  if (source)
+	    {
+	      addr = ports_get_right (source);
+	      ports_port_deref (source); /* since get_right has one too.  */
+	    }
+
+	  for (i = 0; i < NUM_ARRAYS; i++)
+	    used[i] = out[i].used;
+	  err = out_append (&out[ADDRS], &addr, sizeof addr);
+	  len = msg_data_len;
+	  if (!err)
+	    err = out_append (&out[DATA], msg_data, msg_data_len);
+	  if (!err)
+	    err = out_append (&out[DATA_LENS], &len, sizeof len);
+	  len = msg_num_ports;
+	  if (!err)
+	    err = out_append (&out[PORTS], msg_ports,
+			      msg_num_ports * sizeof (mach_port_t));
+	  if (!err)
+	    err = out_append (&out[PORT_COUNTS], &len, sizeof len);
+	  len = msg_control_len;
+	  if (!err)
+	    err = out_append (&out[CONTROL], msg_control, msg_control_len);
+	  if (!err)
+	    err = out_append (&out[CONTROL_LENS], &len, sizeof len);
+	  if (!err)
+	    err = out_append (&out[OUT_FLAGS], &zero, sizeof zero);
+
+	  if (err)
+	    /* The message is lost.  */
+	    {
+	      for (i = 0; i < NUM_ARRAYS; i++)
+		out[i].used = used[i];
+	      for (j = 0; j < msg_num_ports; j++)
+		if (msg_ports[j] != MACH_PORT_NULL)
+		  mach_port_deallocate (mach_task_self (), msg_ports[j]);
+	    }
+	  else
+	    n++;
+
+	  if (msg_data != data_buf)
+	    dealloc_recvd (msg_data, msg_data_len);
+	  if (msg_control != control_buf)
+	    dealloc_recvd (msg_control, msg_control_len);
+	  if (msg_ports != ports_buf)
+	    dealloc_recvd (msg_ports, msg_num_ports * sizeof (mach_port_t));
+	}
+
+      pipe_release_reader (pipe);
+    }
+
+  if (n > 0)
+    /* Report the messages we got.  */
+    err = 0;
+
+  if (err)
+    for (i = 0; i < NUM_ARRAYS; i++)
+      {
+	if (out[i].alloced > 0)
+	  munmap (out[i].buf, out[i].alloced);
+      }
+  else
+    {
+      *addrs_type = MACH_MSG_TYPE_MAKE_SEND;
+      *ports_type = MACH_MSG_TYPE_MOVE_SEND;
+      out_return (&out[ADDRS], addrs, num_addrs, sizeof (mach_port_t));
+      out_return (&out[DATA], data, data_len, 1);
+      out_return (&out[DATA_LENS], data_lens, num_data_lens, sizeof (int));
+      out_return (&out[PORTS], ports, num_ports, sizeof (mach_port_t));
+      out_return (&out[PORT_COUNTS], port_counts, num_port_counts,
+		  sizeof (int));
+      out_return (&out[CONTROL], control, control_len, 1);
+      out_return (&out[CONTROL_LENS], control_lens, num_control_lens,
+		  sizeof (int));
+      out_return (&out[OUT_FLAGS], out_flags, num_out_flags, sizeof (int));
+    }
+
+  return err;
+}
+
 error_t
 S_socket_getopt (struct sock_user *user,
 		 int level, int opt,
@@ -449,6 +770,15 @@ S_socket_getopt (struct sock_user *user,
 	  *(int *)*value = user->sock->pipe_class->sock_type;
 	  *value_len = sizeof (int);
 	  break;
+	case SO_REUSEPORT:
+	  if (*value_len < sizeof (int))
+	    {
+	      ret = EINVAL;
+	      break;
+	    }
+	  *(int *)*value = !!(user->sock->flags & PFLOCAL_SOCK_REUSEPORT);
+	  *value_len = sizeof (int);
+	  break;
 	case SO_ERROR:
 	  /* We do not have asynchronous operations (such as connect), so no
 	     error to report.  */
@@ -494,6 +824,28 @@ S_socket_setopt (struct sock_user *user,
   pthread_mutex_lock (&user->sock->lock);
   switch (level)
     {
+    case SOL_SOCKET:
+      switch (opt)
+	{
+	case SO_REUSEPORT:
+	  /* Let several sockets bind the same address, which then hands
+	     out connections and datagrams to each of them in turn.  This
+	     only affects later binds, as with other systems.  */
+	  if (value_len < sizeof (int))
+	    {
+	      ret = EINVAL;
+	      break;
+	    }
+	  if (*(int *)value)
+	    user->sock->flags |= PFLOCAL_SOCK_REUSEPORT;
+	  else
+	    user->sock->flags &= ~PFLOCAL_SOCK_REUSEPORT;
+	  break;
+	default:
+	  ret = ENOPROTOOPT;
+	  break;
+	}
+      break;
     default:
       ret = ENOPROTOOPT;
       break;